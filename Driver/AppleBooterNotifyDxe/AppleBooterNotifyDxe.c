@@ -34,19 +34,368 @@
 #include <Guid/AppleOSLoaded.h>
 
 #include <Protocol/AppleBooterHandle.h>
+#include <Protocol/AppleBooterLifecycle.h>
 #include <Protocol/LoadedImage.h>
 
-#include <Library/BaseMemoryLib.h>
+#include <Library/BaseLib.h>
 #include <Library/DebugLib.h>
+#include <Library/DevicePathLib.h>
 #include <Library/EfiBootServicesLib.h>
-#include <Library/MemoryAllocationLib.h>
-#include <Library/MiscDevicePathLib.h>
 #include <Library/PcdLib.h>
+#include <Library/ServiceHookLib.h>
 #include <Library/UefiBootServicesTableLib.h>
 #include <Library/UefiLib.h>
 
+///
+/// The maximum number of file names identifying the Apple booter.
+///
+#define APPLE_BOOTER_NAMES_MAXIMUM  8
+
+// APPLE_BOOTER_NAME
+typedef struct {
+  CONST CHAR16 *Name;
+  UINTN        Length;
+  UINT32       Hash;
+} APPLE_BOOTER_NAME;
+
+// APPLE_BOOTER_CALLBACK_FROM_LINK
+#define APPLE_BOOTER_CALLBACK_FROM_LINK(Entry)  \
+  BASE_CR ((Entry), APPLE_BOOTER_CALLBACK, Link)
+
 STATIC EFI_IMAGE_START mStartImage = NULL;
 
+// mCallbacks
+/// The registered lifecycle clients, in ascending order.
+STATIC LIST_ENTRY mCallbacks = INITIALIZE_LIST_HEAD_VARIABLE (mCallbacks);
+
+// mBooterNames
+/// The file names of PcdAppleBooterFileNames.
+STATIC APPLE_BOOTER_NAME mBooterNames[APPLE_BOOTER_NAMES_MAXIMUM];
+
+// mNumberOfBooterNames
+STATIC UINTN mNumberOfBooterNames = 0;
+
+// InternalHashName
+/** Returns the case-insensitive FNV-1a hash of a file name.
+
+  @param[in] Name    The file name to hash.  It may be unaligned.
+  @param[in] Length  The number of characters in Name.
+**/
+STATIC
+UINT32
+InternalHashName (
+  IN CONST CHAR16  *Name,
+  IN UINTN         Length
+  )
+{
+  UINT32 Hash;
+  UINTN  Index;
+  CHAR16 Character;
+
+  Hash = 0x811C9DC5U;
+
+  for (Index = 0; Index < Length; ++Index) {
+    Character = (CHAR16)ReadUnaligned16 ((CONST UINT16 *)&Name[Index]);
+    Hash     ^= CharToUpper (Character);
+    Hash     *= 0x01000193U;
+  }
+
+  return Hash;
+}
+
+// InternalNamesEqual
+/** Compares two file names case-insensitively.
+
+  @param[in] Name       The file name to compare.  It may be unaligned.
+  @param[in] Reference  The file name to compare against.
+  @param[in] Length     The number of characters to compare.
+**/
+STATIC
+BOOLEAN
+InternalNamesEqual (
+  IN CONST CHAR16  *Name,
+  IN CONST CHAR16  *Reference,
+  IN UINTN         Length
+  )
+{
+  UINTN Index;
+
+  for (Index = 0; Index < Length; ++Index) {
+    if (CharToUpper ((CHAR16)ReadUnaligned16 ((CONST UINT16 *)&Name[Index]))
+     != CharToUpper (Reference[Index])) {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+// InternalInitializeBooterNames
+/** Hashes the file names of PcdAppleBooterFileNames.
+**/
+STATIC
+VOID
+InternalInitializeBooterNames (
+  VOID
+  )
+{
+  CONST CHAR16 *Name;
+  UINTN        Length;
+
+  mNumberOfBooterNames = 0;
+
+  for (
+    Name = (CONST CHAR16 *)FixedPcdGetPtr (PcdAppleBooterFileNames);
+    *Name != L'\0';
+    Name += Length
+    ) {
+    if (*Name == L';') {
+      Length = 1;
+      continue;
+    }
+
+    for (
+      Length = 0;
+      (Name[Length] != L'\0') && (Name[Length] != L';');
+      ++Length
+      );
+
+    if (mNumberOfBooterNames == ARRAY_SIZE (mBooterNames)) {
+      DEBUG ((DEBUG_WARN, "AppleBooterNotify: Too many booter names\n"));
+      break;
+    }
+
+    mBooterNames[mNumberOfBooterNames].Name   = Name;
+    mBooterNames[mNumberOfBooterNames].Length = Length;
+    mBooterNames[mNumberOfBooterNames].Hash   = InternalHashName (Name, Length);
+
+    ++mNumberOfBooterNames;
+  }
+}
+
+// InternalGetFileName
+/** Locates the name of the file a file path points to.  The last File Path
+    Media node is parsed in place.
+
+  @param[in]  FilePath  The file path to parse.
+  @param[out] Name      Returns the file name.  It may be unaligned.
+  @param[out] Length    Returns the number of characters in Name.
+
+  @retval TRUE   The file name has been returned.
+  @retval FALSE  FilePath does not contain a file name.
+**/
+STATIC
+BOOLEAN
+InternalGetFileName (
+  IN  CONST EFI_DEVICE_PATH_PROTOCOL  *FilePath,
+  OUT CONST CHAR16                    **Name,
+  OUT UINTN                           *Length
+  )
+{
+  CONST FILEPATH_DEVICE_PATH *FilePathNode;
+  CONST CHAR16               *PathName;
+  UINTN                      Index;
+
+  FilePathNode = NULL;
+
+  while (!IsDevicePathEnd (FilePath)) {
+    if ((DevicePathType (FilePath) == MEDIA_DEVICE_PATH)
+     && (DevicePathSubType (FilePath) == MEDIA_FILEPATH_DP)
+     && (DevicePathNodeLength (FilePath) > SIZE_OF_FILEPATH_DEVICE_PATH)) {
+      FilePathNode = (CONST FILEPATH_DEVICE_PATH *)FilePath;
+    }
+
+    FilePath = NextDevicePathNode (FilePath);
+  }
+
+  if (FilePathNode == NULL) {
+    return FALSE;
+  }
+
+  PathName = FilePathNode->PathName;
+  Index    = ((DevicePathNodeLength (FilePathNode)
+                - SIZE_OF_FILEPATH_DEVICE_PATH) / sizeof (*PathName));
+
+  //
+  // Skip the terminator and any padding.
+  //
+  while ((Index > 0)
+      && (ReadUnaligned16 ((CONST UINT16 *)&PathName[Index - 1]) == L'\0')) {
+    --Index;
+  }
+
+  *Length = 0;
+
+  while ((Index > 0)
+      && (ReadUnaligned16 ((CONST UINT16 *)&PathName[Index - 1]) != L'\\')) {
+    --Index;
+    ++(*Length);
+  }
+
+  *Name = &PathName[Index];
+
+  return (BOOLEAN)(*Length > 0);
+}
+
+// InternalIsAppleBooter
+/** Returns whether a file path points to the Apple booter.
+
+  @param[in] FilePath  The file path of the image to start.
+**/
+STATIC
+BOOLEAN
+InternalIsAppleBooter (
+  IN CONST EFI_DEVICE_PATH_PROTOCOL  *FilePath
+  )
+{
+  CONST CHAR16 *Name;
+  UINTN        Length;
+  UINT32       Hash;
+  UINTN        Index;
+
+  if ((FilePath == NULL) || !InternalGetFileName (FilePath, &Name, &Length)) {
+    return FALSE;
+  }
+
+  Hash = InternalHashName (Name, Length);
+
+  for (Index = 0; Index < mNumberOfBooterNames; ++Index) {
+    if ((mBooterNames[Index].Hash == Hash)
+     && (mBooterNames[Index].Length == Length)
+     && InternalNamesEqual (Name, mBooterNames[Index].Name, Length)) {
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+// InternalRegisterCallback
+/** Adds a client to the booter lifecycle.
+
+  @param[in] This      The protocol instance.
+  @param[in] Callback  The callbacks to add.
+
+  @retval EFI_SUCCESS  The callbacks have been added.
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+InternalRegisterCallback (
+  IN APPLE_BOOTER_LIFECYCLE_PROTOCOL  *This,
+  IN APPLE_BOOTER_CALLBACK            *Callback
+  )
+{
+  LIST_ENTRY *Link;
+
+  ASSERT (Callback != NULL);
+
+  for (
+    Link = GetFirstNode (&mCallbacks);
+    !IsNull (&mCallbacks, Link);
+    Link = GetNextNode (&mCallbacks, Link)
+    ) {
+    if (APPLE_BOOTER_CALLBACK_FROM_LINK (Link)->Order > Callback->Order) {
+      break;
+    }
+  }
+
+  //
+  // Insert the client in front of the first one with a greater order.
+  //
+  InsertTailList (Link, &Callback->Link);
+
+  return EFI_SUCCESS;
+}
+
+// InternalUnregisterCallback
+/** Removes a client from the booter lifecycle.
+
+  @param[in] This      The protocol instance.
+  @param[in] Callback  The callbacks to remove.
+
+  @retval EFI_SUCCESS  The callbacks have been removed.
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+InternalUnregisterCallback (
+  IN APPLE_BOOTER_LIFECYCLE_PROTOCOL  *This,
+  IN APPLE_BOOTER_CALLBACK            *Callback
+  )
+{
+  ASSERT (Callback != NULL);
+
+  RemoveEntryList (&Callback->Link);
+
+  return EFI_SUCCESS;
+}
+
+// mAppleBooterLifecycle
+STATIC APPLE_BOOTER_LIFECYCLE_PROTOCOL mAppleBooterLifecycle = {
+  APPLE_BOOTER_LIFECYCLE_PROTOCOL_REVISION,
+  InternalRegisterCallback,
+  InternalUnregisterCallback
+};
+
+// InternalCallStartCallbacks
+/** Calls the start callbacks in ascending order.
+
+  @param[in] BooterHandle  The image handle of the booter.
+**/
+STATIC
+VOID
+InternalCallStartCallbacks (
+  IN EFI_HANDLE  BooterHandle
+  )
+{
+  LIST_ENTRY            *Link;
+  APPLE_BOOTER_CALLBACK *Callback;
+
+  Link = GetFirstNode (&mCallbacks);
+
+  while (!IsNull (&mCallbacks, Link)) {
+    Callback = APPLE_BOOTER_CALLBACK_FROM_LINK (Link);
+
+    //
+    // A client may unregister itself from its callback.
+    //
+    Link = GetNextNode (&mCallbacks, Link);
+
+    if (Callback->Start != NULL) {
+      Callback->Start (BooterHandle, Callback->Context);
+    }
+  }
+}
+
+// InternalCallExitCallbacks
+/** Calls the exit callbacks in descending order.
+
+  @param[in] BooterHandle  The image handle of the booter.
+  @param[in] ExitStatus    The status StartImage() has returned.
+**/
+STATIC
+VOID
+InternalCallExitCallbacks (
+  IN EFI_HANDLE  BooterHandle,
+  IN EFI_STATUS  ExitStatus
+  )
+{
+  LIST_ENTRY            *Link;
+  APPLE_BOOTER_CALLBACK *Callback;
+
+  Link = GetPreviousNode (&mCallbacks, &mCallbacks);
+
+  while (!IsNull (&mCallbacks, Link)) {
+    Callback = APPLE_BOOTER_CALLBACK_FROM_LINK (Link);
+    Link     = GetPreviousNode (&mCallbacks, Link);
+
+    if (Callback->Exit != NULL) {
+      Callback->Exit (BooterHandle, ExitStatus, Callback->Context);
+    }
+  }
+}
+
 /**
   Transfers control to a loaded image's entry point.
 
@@ -76,71 +425,72 @@ InternalStartImage (
   EFI_STATUS                Status;
 
   EFI_LOADED_IMAGE_PROTOCOL *LoadedImage;
-  CHAR16                    *FilePath;
-  UINTN                     FilePathSize;
-  UINTN                     Index;
-  UINTN                     Result;
   BOOLEAN                   AppleOs;
 
   ASSERT (mStartImage != NULL);
 
-  Status = EfiHandleProtocol (
+  AppleOs = FALSE;
+  Status  = EfiHandleProtocol (
+              ImageHandle,
+              &gEfiLoadedImageProtocolGuid,
+              (VOID **)&LoadedImage
+              );
+
+  if (!EFI_ERROR (Status)) {
+    AppleOs = InternalIsAppleBooter (LoadedImage->FilePath);
+  }
+
+  if (AppleOs) {
+    InternalCallStartCallbacks (ImageHandle);
+
+    if (PcdGetBool (PcdSignalAppleBooterHandle)) {
+      EfiInstallMultipleProtocolInterfaces (
+        &gImageHandle,
+        &gAppleBooterHandleProtocolGuid,
+        (VOID *)ImageHandle,
+        NULL
+        );
+
+      EfiUninstallMultipleProtocolInterfaces (
+        gImageHandle,
+        &gAppleBooterHandleProtocolGuid,
+        (VOID *)ImageHandle,
+        NULL
+        );
+    }
+
+    if (PcdGetBool (PcdSignalAppleOSLoadedEvent)) {
+      EfiNamedEventSignal (&gAppleOSLoadedNamedEventGuid);
+    }
+  }
+
+  //
+  // Images are always started, the firmware validates ImageHandle.
+  //
+  Status = mStartImage (
              ImageHandle,
-             &gEfiLoadedImageProtocolGuid,
-             (VOID **)&LoadedImage
+             ExitDataSize,
+             ExitData
              );
 
-  if (!EFI_ERROR (Status)) {
-    FilePath = MiscFileDevicePathToText (LoadedImage->FilePath, &FilePathSize);
-
-    if (FilePath != NULL) {
-      FilePathSize -= sizeof (APPLE_BOOTER_FILE_NAME);
-      Index         = (FilePathSize / sizeof (FilePath[0]));
-      Result        = CompareMem (
-                        (VOID *)&FilePath[Index],
-                        (VOID *)APPLE_BOOTER_FILE_NAME,
-                        sizeof (APPLE_BOOTER_FILE_NAME)
-                        );
-
-      FreePool ((VOID *)FilePath);
-
-      AppleOs = (BOOLEAN)(Result == 0);
-
-      if (AppleOs) {
-        EfiInstallMultipleProtocolInterfaces (
-          &gImageHandle,
-          &gAppleBooterHandleProtocolGuid,
-          (VOID *)ImageHandle,
-          NULL
-          );
-
-        EfiUninstallMultipleProtocolInterfaces (
-          gImageHandle,
-          &gAppleBooterHandleProtocolGuid,
-          (VOID *)ImageHandle,
-          NULL
-          );
-
-        if (PcdGetBool (PcdSignalAppleOSLoadedEvent)) {
-          EfiNamedEventSignal (&gAppleOSLoadedNamedEventGuid);
-        }
-      }
-      
-      Status = mStartImage (
-                 ImageHandle,
-                 ExitDataSize,
-                 ExitData
-                 );
-
-      if (AppleOs) {
-        EfiNamedEventSignal (&gAppleBooterExitNamedEventGuid);
-      }
+  if (AppleOs) {
+    InternalCallExitCallbacks (ImageHandle, Status);
+
+    if (PcdGetBool (PcdSignalAppleBooterHandle)) {
+      EfiNamedEventSignal (&gAppleBooterExitNamedEventGuid);
     }
   }
 
   return Status;
 }
 
+// mStartImageHook
+STATIC SERVICE_HOOK mStartImageHook = SERVICE_HOOK_BOOT (
+                                        StartImage,
+                                        InternalStartImage,
+                                        &mStartImage
+                                        );
+
 EFI_STATUS
 EFIAPI
 AppleBooterNotifyMain (
@@ -148,22 +498,36 @@ AppleBooterNotifyMain (
   IN EFI_SYSTEM_TABLE  *SystemTable
   )
 {
-  EFI_TPL OldTpl;
+  EFI_STATUS Status;
 
   DEBUG_CODE (
     ASSERT (mStartImage == NULL);
     );
 
-  OldTpl = EfiRaiseTPL (TPL_HIGH_LEVEL);
+  InternalInitializeBooterNames ();
 
-  mStartImage     = gBS->StartImage;
-  gBS->StartImage = InternalStartImage;
+  Status = ServiceHookInstallList (&mStartImageHook, 1);
 
-  UPDATE_EFI_TABLE_HEADER_CRC32 (gBS->Hdr);
+  ASSERT_EFI_ERROR (Status);
 
-  EfiRestoreTPL (OldTpl);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
 
-  return EFI_SUCCESS;
+  Status = EfiInstallMultipleProtocolInterfaces (
+             &ImageHandle,
+             &gAppleBooterLifecycleProtocolGuid,
+             (VOID *)&mAppleBooterLifecycle,
+             NULL
+             );
+
+  ASSERT_EFI_ERROR (Status);
+
+  if (EFI_ERROR (Status)) {
+    ServiceHookUninstallList (&mStartImageHook, 1);
+  }
+
+  return Status;
 }
 
 EFI_STATUS
@@ -172,24 +536,37 @@ AppleBooterNotifyUnload (
   IN EFI_HANDLE  ImageHandle
   )
 {
-  EFI_TPL OldTpl;
+  EFI_STATUS Status;
 
   DEBUG_CODE (
     ASSERT (mStartImage != NULL);
     );
 
-  OldTpl = EfiRaiseTPL (TPL_HIGH_LEVEL);
+  //
+  // The lifecycle clients call back into this image until they are unloaded.
+  //
+  if (!IsListEmpty (&mCallbacks)) {
+    return EFI_ACCESS_DENIED;
+  }
 
-  gBS->StartImage = InternalStartImage;
-  mStartImage     = gBS->StartImage;
+  Status = EfiUninstallMultipleProtocolInterfaces (
+             ImageHandle,
+             &gAppleBooterLifecycleProtocolGuid,
+             (VOID *)&mAppleBooterLifecycle,
+             NULL
+             );
 
-  UPDATE_EFI_TABLE_HEADER_CRC32 (gBS->Hdr);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
 
-  EfiRestoreTPL (OldTpl);
+  Status = ServiceHookUninstallList (&mStartImageHook, 1);
 
-  DEBUG_CODE (
-    mStartImage = NULL;
-    );
+  if (!EFI_ERROR (Status)) {
+    DEBUG_CODE (
+      mStartImage = NULL;
+      );
+  }
 
-  return EFI_SUCCESS;
+  return Status;
 }
@@ -17,147 +17,594 @@
 #include <Uefi.h>
 
 #include <Protocol/AppleBootPolicy.h>
+#include <Protocol/BlockIo.h>
+#include <Protocol/ImageLoadPipeline.h>
 #include <Protocol/SimpleFileSystem.h>
 
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
 #include <Library/DebugLib.h>
 #include <Library/DevicePathLib.h>
 #include <Library/EfiBootServicesLib.h>
-#include <Library/MiscRuntimeLib.h>
 #include <Library/MemoryAllocationLib.h>
+#include <Library/PcdLib.h>
 #include <Library/UefiBootServicesTableLib.h>
 #include <Library/UefiLib.h>
 
-// mLoadImage
-STATIC EFI_IMAGE_LOAD mLoadImage = NULL;
-
-// InternalLoadImage
-/** Loads an EFI image into memory. Supports Apple bless.
-
-  @param[in]   BootPolicy         If TRUE, indicates that the request
-                                  originates from the boot manager, and that
-                                  the boot manager is attempting to load
-                                  FilePath as a boot selection. Ignored if
-                                  SourceBuffer is not NULL.
-  @param[in]   ParentImageHandle  The caller's image handle.
-  @param[in]   DevicePath         The DeviceHandle specific file path from
-                                  which the image is loaded.
-  @param[in]   SourceBuffer       If not NULL, a pointer to the memory location
-                                  containing a copy of the image to be loaded.
-  @param[in]   SourceSize         The size in bytes of SourceBuffer. Ignored if
-                                  SourceBuffer is NULL.
-  @param[out]  ImageHandle        The pointer to the returned image handle that
-                                  is created when the  image is successfully
-                                  loaded.
-
-  @retval EFI_SUCCESS             Image was loaded into memory correctly.
-  @retval EFI_NOT_FOUND           Both SourceBuffer and DevicePath are NULL.
-  @retval EFI_INVALID_PARAMETER   One or more parameters are invalid.
-  @retval EFI_UNSUPPORTED         The image type is not supported.
-  @retval EFI_OUT_OF_RESOURCES    Image was not loaded due to insufficient
-                                  resources.
-  @retval EFI_LOAD_ERROR          Image was not loaded because the image format
-                                  was corrupt or not understood.
-  @retval EFI_DEVICE_ERROR        Image was not loaded because the device
-                                  returned a read error.
-  @retval EFI_ACCESS_DENIED       Image was not loaded because the platform
-                                  policy prohibits the image from being loaded.
-                                  NULL is returned in *ImageHandle.
-  @retval EFI_SECURITY_VIOLATION  Image was loaded and an ImageHandle was
-                                  created with a valid
-                                  EFI_LOADED_IMAGE_PROTOCOL. However, the
-                                  current platform policy specifies that the
-                                  image should not be started.
+// BLESS_CACHE_ENTRY
+typedef struct {
+  LIST_ENTRY               Link;
+  /// The Simple File System handle of the volume.
+  EFI_HANDLE               Device;
+  /// The device path of the volume, to detect a reused handle.
+  EFI_DEVICE_PATH_PROTOCOL *DevicePath;
+  /// The media the boot file has been resolved on.
+  UINT32                   MediaId;
+  /// The result of GetBootFile().
+  EFI_STATUS               Status;
+  /// The device path of the boot file or NULL.
+  EFI_DEVICE_PATH_PROTOCOL *BootFile;
+} BLESS_CACHE_ENTRY;
+
+// BLESS_CACHE_ENTRY_FROM_LINK
+#define BLESS_CACHE_ENTRY_FROM_LINK(Entry)  \
+  BASE_CR ((Entry), BLESS_CACHE_ENTRY, Link)
+
+// mImageLoadPipeline
+STATIC IMAGE_LOAD_PIPELINE_PROTOCOL *mImageLoadPipeline = NULL;
+
+// mImageLoadPipelineEvent
+STATIC EFI_EVENT mImageLoadPipelineEvent = NULL;
+
+// mImageLoadPipelineRegistration
+STATIC VOID *mImageLoadPipelineRegistration = NULL;
+
+// mReadyToBootEvent
+STATIC EFI_EVENT mReadyToBootEvent = NULL;
+
+// mFileSystemEvent
+STATIC EFI_EVENT mFileSystemEvent = NULL;
+
+// mFileSystemRegistration
+STATIC VOID *mFileSystemRegistration = NULL;
+
+// mBootPolicyEvent
+STATIC EFI_EVENT mBootPolicyEvent = NULL;
+
+// mBootPolicyRegistration
+STATIC VOID *mBootPolicyRegistration = NULL;
+
+// mBlessCache
+/// The boot files resolved per volume.
+STATIC LIST_ENTRY mBlessCache = INITIALIZE_LIST_HEAD_VARIABLE (mBlessCache);
+
+// InternalFreeCacheEntry
+STATIC
+VOID
+InternalFreeCacheEntry (
+  IN BLESS_CACHE_ENTRY  *Entry
+  )
+{
+  RemoveEntryList (&Entry->Link);
+
+  if (Entry->BootFile != NULL) {
+    FreePool ((VOID *)Entry->BootFile);
+  }
+
+  FreePool ((VOID *)Entry->DevicePath);
+  FreePool ((VOID *)Entry);
+}
+
+// InternalFindCacheEntry
+/** Returns the cache entry of a volume.  Entries of handles that are no
+    longer the volume they have been created for are dropped.
+
+  @param[in] Device      The Simple File System handle of the volume.
+  @param[in] DevicePath  The device path of Device.
+
+  @return  The cache entry of Device or NULL.
+**/
+STATIC
+BLESS_CACHE_ENTRY *
+InternalFindCacheEntry (
+  IN EFI_HANDLE                Device,
+  IN EFI_DEVICE_PATH_PROTOCOL  *DevicePath
+  )
+{
+  LIST_ENTRY        *Link;
+  BLESS_CACHE_ENTRY *Entry;
+  UINTN             Size;
+
+  for (
+    Link = GetFirstNode (&mBlessCache);
+    !IsNull (&mBlessCache, Link);
+    Link = GetNextNode (&mBlessCache, Link)
+    ) {
+    Entry = BLESS_CACHE_ENTRY_FROM_LINK (Link);
+
+    if (Entry->Device == Device) {
+      Size = GetDevicePathSize (DevicePath);
+
+      if ((Size == GetDevicePathSize (Entry->DevicePath))
+       && (CompareMem (DevicePath, Entry->DevicePath, Size) == 0)) {
+        return Entry;
+      }
+
+      InternalFreeCacheEntry (Entry);
+      break;
+    }
+  }
+
+  return NULL;
+}
+
+// InternalGetMediaId
+/** Returns the identity of the media a volume resides on.  Volumes without
+    Block I/O cannot change their media and are identified as 0.
+
+  @param[in]  Device   The Simple File System handle of the volume.
+  @param[out] MediaId  Returns the identity of the media.
+
+  @retval TRUE   MediaId has been returned.
+  @retval FALSE  No media is present.
+**/
+STATIC
+BOOLEAN
+InternalGetMediaId (
+  IN  EFI_HANDLE  Device,
+  OUT UINT32      *MediaId
+  )
+{
+  EFI_STATUS            Status;
+  EFI_BLOCK_IO_PROTOCOL *BlockIo;
+
+  *MediaId = 0;
+
+  Status = EfiHandleProtocol (
+             Device,
+             &gEfiBlockIoProtocolGuid,
+             (VOID **)&BlockIo
+             );
+
+  if (!EFI_ERROR (Status)) {
+    if (!BlockIo->Media->MediaPresent) {
+      return FALSE;
+    }
+
+    *MediaId = BlockIo->Media->MediaId;
+  }
+
+  return TRUE;
+}
+
+// InternalGetBootFile
+/** Returns the blessed boot file of a volume.  The result is cached until
+    the media of the volume changes or the handle is no longer the volume.
+
+  @param[in]  Device    The Simple File System handle of the volume.
+  @param[out] BootFile  Returns the device path of the boot file.  It is
+                        owned by the cache.
+
+  @retval EFI_SUCCESS      The boot file has been returned.
+  @retval EFI_NO_MEDIA     No media is present.
+  @retval EFI_UNSUPPORTED  Device is no volume.
+  @retval other            The boot file could not be resolved.
+**/
+STATIC
+EFI_STATUS
+InternalGetBootFile (
+  IN  EFI_HANDLE                Device,
+  OUT EFI_DEVICE_PATH_PROTOCOL  **BootFile
+  )
+{
+  EFI_STATUS                      Status;
+  EFI_SIMPLE_FILE_SYSTEM_PROTOCOL *FileSystem;
+  EFI_DEVICE_PATH_PROTOCOL        *DevicePath;
+  UINT32                          MediaId;
+  BOOLEAN                         MediaPresent;
+  BLESS_CACHE_ENTRY               *Entry;
+  APPLE_BOOT_POLICY_PROTOCOL      *AppleBootPolicy;
+  FILEPATH_DEVICE_PATH            *FilePath;
+
+  //
+  // The cache is keyed on the handle, which may have been reused for another
+  // volume since.
+  //
+  Status = EfiHandleProtocol (
+             Device,
+             &gEfiSimpleFileSystemProtocolGuid,
+             (VOID **)&FileSystem
+             );
+
+  if (!EFI_ERROR (Status)) {
+    Status = EfiHandleProtocol (
+               Device,
+               &gEfiDevicePathProtocolGuid,
+               (VOID **)&DevicePath
+               );
+  }
+
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  MediaPresent = InternalGetMediaId (Device, &MediaId);
+  Entry        = InternalFindCacheEntry (Device, DevicePath);
+
+  if (Entry != NULL) {
+    if (MediaPresent && (Entry->MediaId == MediaId)) {
+      *BootFile = Entry->BootFile;
+      return Entry->Status;
+    }
+
+    InternalFreeCacheEntry (Entry);
+  }
+
+  if (!MediaPresent) {
+    return EFI_NO_MEDIA;
+  }
+
+  Status = EfiLocateProtocol (
+             &gAppleBootPolicyProtocolGuid,
+             NULL,
+             (VOID **)&AppleBootPolicy
+             );
+
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  FilePath = NULL;
+  Status   = AppleBootPolicy->GetBootFile (Device, &FilePath);
+
+  if (EFI_ERROR (Status)) {
+    FilePath = NULL;
+  }
+
+  Entry = AllocatePool (sizeof (*Entry));
+
+  if (Entry != NULL) {
+    Entry->DevicePath = DuplicateDevicePath (DevicePath);
+
+    if (Entry->DevicePath == NULL) {
+      FreePool ((VOID *)Entry);
+
+      Entry = NULL;
+    }
+  }
+
+  if (Entry == NULL) {
+    if (FilePath != NULL) {
+      FreePool ((VOID *)FilePath);
+    }
+
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Entry->Device   = Device;
+  Entry->MediaId  = MediaId;
+  Entry->Status   = Status;
+  Entry->BootFile = (EFI_DEVICE_PATH_PROTOCOL *)FilePath;
+
+  InsertTailList (&mBlessCache, &Entry->Link);
+
+  *BootFile = Entry->BootFile;
+
+  return Status;
+}
+
+// InternalResolveBootFile
+/** Resolves the blessed boot file of a volume for boot selections.
+
+  @param[in]  BootPolicy    Whether the boot manager loads a boot selection.
+  @param[in]  DevicePath    The device path of the boot selection.
+  @param[out] ResolvedPath  Returns the device path of the blessed boot file.
+
+  @retval EFI_SUCCESS      The boot file has been resolved.
+  @retval EFI_UNSUPPORTED  The request is no boot selection.
+  @retval other            The boot file could not be resolved.
 **/
 STATIC
 EFI_STATUS
 EFIAPI
-InternalLoadImage (
+InternalResolveBootFile (
   IN  BOOLEAN                   BootPolicy,
-  IN  EFI_HANDLE                ParentImageHandle,
   IN  EFI_DEVICE_PATH_PROTOCOL  *DevicePath,
-  IN  VOID                      *SourceBuffer, OPTIONAL
-  IN  UINTN                     SourceSize,
-  OUT EFI_HANDLE                *ImageHandle
+  OUT EFI_DEVICE_PATH_PROTOCOL  **ResolvedPath
   )
 {
-  EFI_DEVICE_PATH_PROTOCOL   *RemainingDevicePath;
-  EFI_STATUS                 Status;
-  EFI_HANDLE                 Device;
-  EFI_DEV_PATH_PTR           DevicePathPtr;
-  APPLE_BOOT_POLICY_PROTOCOL *AppleBootPolicy;
+  EFI_STATUS               Status;
+  EFI_HANDLE               Device;
+  EFI_DEVICE_PATH_PROTOCOL *RemainingDevicePath;
 
-  ASSERT (ParentImageHandle != NULL);
   ASSERT (DevicePath != NULL);
-  ASSERT ((((SourceSize != 0) ? 1 : 0)
-    ^ ((SourceBuffer == NULL) ? 1 : 0)) != 0);
+  ASSERT (ResolvedPath != NULL);
 
-  ASSERT (ImageHandle != NULL);
-  ASSERT (!EfiAtRuntime ());
-  ASSERT (EfiGetCurrentTpl () < TPL_CALLBACK);
-  ASSERT (mLoadImage != NULL);
+  if (!BootPolicy) {
+    return EFI_UNSUPPORTED;
+  }
 
-  if (BootPolicy && (SourceBuffer == NULL) && (DevicePath != NULL)) {
-    Status = EfiLocateProtocol (
-               &gAppleBootPolicyProtocolGuid,
-               NULL,
-               (VOID **)&AppleBootPolicy
+  RemainingDevicePath = DevicePath;
+  Status              = EfiLocateDevicePath (
+                          &gEfiSimpleFileSystemProtocolGuid,
+                          &RemainingDevicePath,
+                          &Device
+                          );
+
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  //
+  // Only volumes are resolved, i.e. paths ending in a Hard Drive node.
+  //
+  while (!IsDevicePathEnd (RemainingDevicePath)) {
+    if ((DevicePathType (RemainingDevicePath) == MEDIA_DEVICE_PATH)
+     && (DevicePathSubType (RemainingDevicePath) == MEDIA_HARDDRIVE_DP)) {
+      if (IsDevicePathEnd (NextDevicePathNode (RemainingDevicePath))) {
+        return InternalGetBootFile (Device, ResolvedPath);
+      }
+
+      break;
+    }
+
+    RemainingDevicePath = NextDevicePathNode (RemainingDevicePath);
+  }
+
+  return EFI_NOT_FOUND;
+}
+
+// InternalFileSystemNotify
+/** Resolves the boot files of the volumes installed since the last call.
+
+  @param[in] Event    The event that has been signaled.
+  @param[in] Context  Unused.
+**/
+STATIC
+VOID
+EFIAPI
+InternalFileSystemNotify (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  EFI_STATUS               Status;
+  EFI_HANDLE               Device;
+  UINTN                    BufferSize;
+  EFI_DEVICE_PATH_PROTOCOL *DevicePath;
+  BLESS_CACHE_ENTRY        *Entry;
+  EFI_DEVICE_PATH_PROTOCOL *BootFile;
+
+  while (TRUE) {
+    BufferSize = sizeof (Device);
+    Status     = EfiLocateHandle (
+                   ByRegisterNotify,
+                   NULL,
+                   mFileSystemRegistration,
+                   &BufferSize,
+                   &Device
+                   );
+
+    if (EFI_ERROR (Status)) {
+      break;
+    }
+
+    //
+    // A reinstalled file system may expose a different boot file.
+    //
+    Status = EfiHandleProtocol (
+               Device,
+               &gEfiDevicePathProtocolGuid,
+               (VOID **)&DevicePath
                );
 
     if (!EFI_ERROR (Status)) {
-      RemainingDevicePath = DevicePath;
-      Status              = EfiLocateDevicePath (
-                              &gEfiSimpleFileSystemProtocolGuid,
-                              &RemainingDevicePath,
-                              &Device
-                              );
-
-      if (!EFI_ERROR (Status)) {
-        RemainingDevicePath   = DuplicateDevicePath (RemainingDevicePath);
-        DevicePathPtr.DevPath = RemainingDevicePath;
-
-        Status = EFI_NOT_FOUND;
-
-        while (!IsDevicePathEnd ((CONST VOID *)DevicePathPtr.DevPath)) {
-          if ((DevicePathType ((CONST VOID *)DevicePathPtr.DevPath) == MEDIA_DEVICE_PATH)
-           && (DevicePathSubType ((CONST VOID *)DevicePathPtr.DevPath) == MEDIA_HARDDRIVE_DP)) {
-            DevicePathPtr.DevPath = NextDevicePathNode (
-                                      (CONST VOID *)DevicePathPtr.DevPath
-                                      );
-
-            if (IsDevicePathEnd ((CONST VOID *)DevicePathPtr.DevPath)) {
-              Status = AppleBootPolicy->GetBootFile (
-                                          Device,
-                                          &DevicePathPtr.FilePath
-                                          );
-
-              if (!EFI_ERROR (Status)) {
-                DevicePath = DevicePathPtr.DevPath;
-              }
-            }
-
-            break;
-          }
-
-          DevicePathPtr.DevPath = NextDevicePathNode (
-                                    (CONST VOID *)DevicePathPtr.DevPath
-                                    );
-        }
-
-        if (EFI_ERROR (Status)) {
-          FreePool ((VOID *)RemainingDevicePath);
-        }
+      Entry = InternalFindCacheEntry (Device, DevicePath);
+
+      if (Entry != NULL) {
+        InternalFreeCacheEntry (Entry);
       }
     }
+
+    InternalGetBootFile (Device, &BootFile);
   }
+}
 
-  return mLoadImage (
-           BootPolicy,
-           ParentImageHandle,
-           DevicePath,
-           SourceBuffer,
-           SourceSize,
-           ImageHandle
-           );
+// InternalScanVolumes
+/** Resolves the boot files of all volumes present.
+**/
+STATIC
+VOID
+InternalScanVolumes (
+  VOID
+  )
+{
+  EFI_STATUS               Status;
+  UINTN                    NumberOfHandles;
+  EFI_HANDLE               *Handles;
+  UINTN                    Index;
+  EFI_DEVICE_PATH_PROTOCOL *BootFile;
+
+  //
+  // Boot Services, and thus the file system drivers, may only be called on
+  // the BSP, hence the volumes are scanned serially.
+  //
+  Status = EfiLocateHandleBuffer (
+             ByProtocol,
+             &gEfiSimpleFileSystemProtocolGuid,
+             NULL,
+             &NumberOfHandles,
+             &Handles
+             );
+
+  if (!EFI_ERROR (Status)) {
+    for (Index = 0; Index < NumberOfHandles; ++Index) {
+      InternalGetBootFile (Handles[Index], &BootFile);
+    }
+
+    FreePool ((VOID *)Handles);
+  }
+}
+
+// InternalBootPolicyNotify
+/** Scans the volumes again once the Apple Boot Policy is installed, as no
+    boot file can be resolved before.
+
+  @param[in] Event    The event that has been signaled.
+  @param[in] Context  Unused.
+**/
+STATIC
+VOID
+EFIAPI
+InternalBootPolicyNotify (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  InternalScanVolumes ();
+}
+
+// InternalPreScanVolumes
+/** Resolves the boot files of all volumes present and of the ones installed
+    later on, so that boot pickers find the cache filled.
+
+  @retval EFI_SUCCESS  The volumes have been scanned.
+  @retval other        Installed volumes or the installation of the Apple
+                       Boot Policy cannot be tracked.
+**/
+STATIC
+EFI_STATUS
+InternalPreScanVolumes (
+  VOID
+  )
+{
+  EFI_STATUS Status;
+
+  Status = EfiCreateEvent (
+             EVT_NOTIFY_SIGNAL,
+             TPL_CALLBACK,
+             InternalFileSystemNotify,
+             NULL,
+             &mFileSystemEvent
+             );
+
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  Status = EfiRegisterProtocolNotify (
+             &gEfiSimpleFileSystemProtocolGuid,
+             mFileSystemEvent,
+             &mFileSystemRegistration
+             );
+
+  if (EFI_ERROR (Status)) {
+    EfiCloseEvent (mFileSystemEvent);
+
+    mFileSystemEvent = NULL;
+
+    return Status;
+  }
+
+  Status = EfiCreateEvent (
+             EVT_NOTIFY_SIGNAL,
+             TPL_CALLBACK,
+             InternalBootPolicyNotify,
+             NULL,
+             &mBootPolicyEvent
+             );
+
+  if (!EFI_ERROR (Status)) {
+    Status = EfiRegisterProtocolNotify (
+               &gAppleBootPolicyProtocolGuid,
+               mBootPolicyEvent,
+               &mBootPolicyRegistration
+               );
+
+    if (EFI_ERROR (Status)) {
+      EfiCloseEvent (mBootPolicyEvent);
+
+      mBootPolicyEvent = NULL;
+    }
+  }
+
+  //
+  // The volumes present are scanned regardless, as the Apple Boot Policy may
+  // have been installed already.
+  //
+  InternalScanVolumes ();
+
+  return Status;
+}
+
+// mResolveBootFileStage
+STATIC IMAGE_LOAD_STAGE mResolveBootFileStage;
+
+// InternalImageLoadPipelineNotify
+/** Registers the bless stage once the LoadImage pipeline is available.
+
+  @param[in] Event    The event that has been signaled.
+  @param[in] Context  Unused.
+**/
+STATIC
+VOID
+EFIAPI
+InternalImageLoadPipelineNotify (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  EFI_STATUS                   Status;
+  IMAGE_LOAD_PIPELINE_PROTOCOL *ImageLoadPipeline;
+
+  if (mImageLoadPipeline != NULL) {
+    return;
+  }
+
+  Status = EfiLocateProtocol (
+             &gImageLoadPipelineProtocolGuid,
+             NULL,
+             (VOID **)&ImageLoadPipeline
+             );
+
+  if (EFI_ERROR (Status)) {
+    return;
+  }
+
+  mResolveBootFileStage.Type                 = ImageLoadStageResolvePath;
+  mResolveBootFileStage.Order                = IMAGE_LOAD_STAGE_ORDER_BLESS;
+  mResolveBootFileStage.Function.ResolvePath = InternalResolveBootFile;
+
+  ImageLoadPipeline->RegisterStage (ImageLoadPipeline, &mResolveBootFileStage);
+
+  mImageLoadPipeline = ImageLoadPipeline;
+}
+
+// InternalReadyToBootNotify
+/** Warns once a boot option is started if the LoadImage pipeline has never
+    been installed, as this driver depends on ImageLoadPipelineDxe.
+
+  @param[in] Event    The event that has been signaled.
+  @param[in] Context  Unused.
+**/
+STATIC
+VOID
+EFIAPI
+InternalReadyToBootNotify (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  if (mImageLoadPipeline == NULL) {
+    DEBUG ((
+      DEBUG_WARN,
+      "Bless: ImageLoadPipelineDxe is not loaded, boot files are not resolved\n"
+      ));
+  }
+
+  EfiCloseEvent (mReadyToBootEvent);
+
+  mReadyToBootEvent = NULL;
 }
 
 // BlessUnload
@@ -167,23 +614,44 @@ BlessUnload (
   IN EFI_HANDLE  ImageHandle
   )
 {
-  EFI_TPL OldTpl;
+  if (mReadyToBootEvent != NULL) {
+    EfiCloseEvent (mReadyToBootEvent);
+
+    mReadyToBootEvent = NULL;
+  }
+
+  if (mImageLoadPipelineEvent != NULL) {
+    EfiCloseEvent (mImageLoadPipelineEvent);
+
+    mImageLoadPipelineEvent = NULL;
+  }
+
+  if (mImageLoadPipeline != NULL) {
+    mImageLoadPipeline->UnregisterStage (
+                          mImageLoadPipeline,
+                          &mResolveBootFileStage
+                          );
 
-  DEBUG_CODE (
-    ASSERT (mLoadImage != NULL);
-    );
+    mImageLoadPipeline = NULL;
+  }
 
-  OldTpl = EfiRaiseTPL (TPL_HIGH_LEVEL);
+  if (mBootPolicyEvent != NULL) {
+    EfiCloseEvent (mBootPolicyEvent);
 
-  gBS->LoadImage = mLoadImage;
+    mBootPolicyEvent = NULL;
+  }
 
-  UPDATE_EFI_TABLE_CRC32 (gBS);
+  if (mFileSystemEvent != NULL) {
+    EfiCloseEvent (mFileSystemEvent);
 
-  EfiRestoreTPL (OldTpl);
+    mFileSystemEvent = NULL;
+  }
 
-  DEBUG_CODE (
-    mLoadImage = NULL;
-    );
+  while (!IsListEmpty (&mBlessCache)) {
+    InternalFreeCacheEntry (
+      BLESS_CACHE_ENTRY_FROM_LINK (GetFirstNode (&mBlessCache))
+      );
+  }
 
   return EFI_SUCCESS;
 }
@@ -194,8 +662,8 @@ BlessUnload (
   @param[in] ImageHandle  The firmware allocated handle for the EFI image.  
   @param[in] SystemTable  A pointer to the EFI System Table.
 
-  @retval EFI_SUCCESS          The entry point is executed successfully.
-  @retval EFI_ALREADY_STARTED  The protocol has already been installed.
+  @retval EFI_SUCCESS  The entry point is executed successfully.
+  @retval other        The pipeline notification could not be registered.
 **/
 EFI_STATUS
 EFIAPI
@@ -204,20 +672,61 @@ BlessMain (
   IN EFI_SYSTEM_TABLE  *SystemTable
   )
 {
-  EFI_TPL OldTpl;
+  EFI_STATUS Status;
+  EFI_STATUS PreScanStatus;
+
+  Status = EfiCreateEvent (
+             EVT_NOTIFY_SIGNAL,
+             TPL_CALLBACK,
+             InternalImageLoadPipelineNotify,
+             NULL,
+             &mImageLoadPipelineEvent
+             );
+
+  if (!EFI_ERROR (Status)) {
+    Status = EfiRegisterProtocolNotify (
+               &gImageLoadPipelineProtocolGuid,
+               mImageLoadPipelineEvent,
+               &mImageLoadPipelineRegistration
+               );
+
+    if (EFI_ERROR (Status)) {
+      EfiCloseEvent (mImageLoadPipelineEvent);
 
-  DEBUG_CODE (
-    ASSERT (mLoadImage == NULL);
-    );
+      mImageLoadPipelineEvent = NULL;
+    }
+  }
 
-  OldTpl = EfiRaiseTPL (TPL_HIGH_LEVEL);
+  ASSERT_EFI_ERROR (Status);
+
+  if (!EFI_ERROR (Status)) {
+    InternalImageLoadPipelineNotify (mImageLoadPipelineEvent, NULL);
+
+    //
+    // The warning is diagnostic only, hence failing to register it is not
+    // fatal.
+    //
+    if (mImageLoadPipeline == NULL) {
+      EfiCreateEventReadyToBootEx (
+        TPL_CALLBACK,
+        InternalReadyToBootNotify,
+        NULL,
+        &mReadyToBootEvent
+        );
+    }
 
-  mLoadImage     = gBS->LoadImage;
-  gBS->LoadImage = InternalLoadImage;
-  
-  UPDATE_EFI_TABLE_CRC32 (gBS);
+    if (FeaturePcdGet (PcdBlessPreScan)) {
+      PreScanStatus = InternalPreScanVolumes ();
 
-  EfiRestoreTPL (OldTpl);
+      if (EFI_ERROR (PreScanStatus)) {
+        DEBUG ((
+          DEBUG_WARN,
+          "Bless: Volumes cannot be pre-scanned - %r\n",
+          PreScanStatus
+          ));
+      }
+    }
+  }
 
-  return EFI_SUCCESS;
+  return Status;
 }
@@ -20,115 +20,659 @@
 #include <IndustryStandard/AppleMachoImage.h>
 #include <IndustryStandard/AppleFatBinaryImage.h>
 
+#include <Protocol/ImageLoadPipeline.h>
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
 #include <Library/CupertinoFatBinaryLib.h>
 #include <Library/DebugLib.h>
-#include <Library/DxeServicesLib.h>
+#include <Library/DevicePathLib.h>
 #include <Library/EfiBootServicesLib.h>
-#include <Library/MiscRuntimeLib.h>
 #include <Library/MemoryAllocationLib.h>
+#include <Library/PcdLib.h>
 #include <Library/UefiBootServicesTableLib.h>
 #include <Library/UefiLib.h>
 
-// mLoadImage
-STATIC EFI_IMAGE_LOAD mLoadImage;
-
-// InternalLoadImage
-/** Loads an EFI image into memory. Supports the Fat Binary format.
-
-  @param[in]   BootPolicy         If TRUE, indicates that the request
-                                  originates from the boot manager, and that
-                                  the boot manager is attempting to load
-                                  FilePath as a boot selection. Ignored if
-                                  SourceBuffer is not NULL.
-  @param[in]   ParentImageHandle  The caller's image handle.
-  @param[in]   DevicePath         The DeviceHandle specific file path from
-                                  which the image is loaded.
-  @param[in]   SourceBuffer       If not NULL, a pointer to the memory location
-                                  containing a copy of the image to be loaded.
-  @param[in]   SourceSize         The size in bytes of SourceBuffer. Ignored if
-                                  SourceBuffer is NULL.
-  @param[out]  ImageHandle        The pointer to the returned image handle that
-                                  is created when the  image is successfully
-                                  loaded.
-
-  @retval EFI_SUCCESS             Image was loaded into memory correctly.
-  @retval EFI_NOT_FOUND           Both SourceBuffer and DevicePath are NULL.
-  @retval EFI_INVALID_PARAMETER   One or more parameters are invalid.
-  @retval EFI_UNSUPPORTED         The image type is not supported.
-  @retval EFI_OUT_OF_RESOURCES    Image was not loaded due to insufficient
-                                  resources.
-  @retval EFI_LOAD_ERROR          Image was not loaded because the image format
-                                  was corrupt or not understood.
-  @retval EFI_DEVICE_ERROR        Image was not loaded because the device
-                                  returned a read error.
-  @retval EFI_ACCESS_DENIED       Image was not loaded because the platform
-                                  policy prohibits the image from being loaded.
-                                  NULL is returned in *ImageHandle.
-  @retval EFI_SECURITY_VIOLATION  Image was loaded and an ImageHandle was
-                                  created with a valid
-                                  EFI_LOADED_IMAGE_PROTOCOL. However, the
-                                  current platform policy specifies that the
-                                  image should not be started.
+// MAXIMUM_FAT_ARCHITECTURES
+#define MAXIMUM_FAT_ARCHITECTURES  16
+
+// IMAGE_CACHE_ENTRY
+/// A thinned image read from a file.  The device path and the image follow
+/// the entry.
+typedef struct {
+  LIST_ENTRY Link;
+  UINTN      DevicePathSize;
+  UINT64     FileSize;
+  EFI_TIME   ModificationTime;
+  UINTN      ImageSize;
+} IMAGE_CACHE_ENTRY;
+
+// IMAGE_CACHE_ENTRY_FROM_LINK
+#define IMAGE_CACHE_ENTRY_FROM_LINK(Entry)  \
+  BASE_CR ((Entry), IMAGE_CACHE_ENTRY, Link)
+
+// IMAGE_CACHE_ENTRY_DEVICE_PATH
+#define IMAGE_CACHE_ENTRY_DEVICE_PATH(Entry)  ((VOID *)((Entry) + 1))
+
+// IMAGE_CACHE_ENTRY_IMAGE
+#define IMAGE_CACHE_ENTRY_IMAGE(Entry)  \
+  ((VOID *)((UINTN)((Entry) + 1) + ALIGN_VALUE ((Entry)->DevicePathSize, 8)))
+
+// IMAGE_CACHE_ENTRY_SIZE
+#define IMAGE_CACHE_ENTRY_SIZE(Entry)                           \
+  (sizeof (*(Entry)) + ALIGN_VALUE ((Entry)->DevicePathSize, 8) \
+    + (Entry)->ImageSize)
+
+// mImageLoadPipeline
+STATIC IMAGE_LOAD_PIPELINE_PROTOCOL *mImageLoadPipeline = NULL;
+
+// mImageLoadPipelineEvent
+STATIC EFI_EVENT mImageLoadPipelineEvent = NULL;
+
+// mImageLoadPipelineRegistration
+STATIC VOID *mImageLoadPipelineRegistration = NULL;
+
+// mReadyToBootEvent
+STATIC EFI_EVENT mReadyToBootEvent = NULL;
+
+// mImageCache
+/// The cached images, most recently used first.
+STATIC LIST_ENTRY mImageCache = INITIALIZE_LIST_HEAD_VARIABLE (mImageCache);
+
+// mImageCacheSize
+STATIC UINTN mImageCacheSize = 0;
+
+// mCpuSupportsX8664h
+/// Whether the CPU supports the Haswell feature set x86_64h slices are built
+/// for.  Detected once on entry.
+STATIC BOOLEAN mCpuSupportsX8664h = FALSE;
+
+// InternalDetectX8664hSupport
+/** Returns whether the CPU supports the features required by x86_64h code.
+    AVX state must have been enabled by the firmware, as the image will run
+    before the kernel enables it.
+**/
+STATIC
+BOOLEAN
+InternalDetectX8664hSupport (
+  VOID
+  )
+{
+#if defined (MDE_CPU_X64)
+  UINT32 MaximumLeaf;
+  UINT32 MaximumExtendedLeaf;
+  UINT32 Ebx;
+  UINT32 Ecx;
+
+  AsmCpuid (0, &MaximumLeaf, NULL, NULL, NULL);
+  AsmCpuid (0x80000000, &MaximumExtendedLeaf, NULL, NULL, NULL);
+
+  if ((MaximumLeaf < 7) || (MaximumExtendedLeaf < 0x80000001)) {
+    return FALSE;
+  }
+
+  //
+  // FMA, MOVBE, OSXSAVE and AVX.
+  //
+  AsmCpuid (1, NULL, NULL, &Ecx, NULL);
+
+  if ((Ecx & (BIT12 | BIT22 | BIT27 | BIT28))
+        != (BIT12 | BIT22 | BIT27 | BIT28)) {
+    return FALSE;
+  }
+
+  //
+  // BMI1, AVX2 and BMI2.
+  //
+  AsmCpuidEx (7, 0, NULL, &Ebx, NULL, NULL);
+
+  if ((Ebx & (BIT3 | BIT5 | BIT8)) != (BIT3 | BIT5 | BIT8)) {
+    return FALSE;
+  }
+
+  //
+  // LZCNT.
+  //
+  AsmCpuid (0x80000001, NULL, NULL, &Ecx, NULL);
+
+  return (BOOLEAN)((Ecx & BIT5) != 0);
+#else
+  return FALSE;
+#endif
+}
+
+// InternalSelectFatArch
+/** Selects the slice of a Fat Binary best suited for the current CPU.  An
+    x86_64h slice is preferred over the generic one when the CPU supports it.
+
+  @param[in] FatArchs          The architecture headers of the Fat Binary.
+  @param[in] NumberOfFatArchs  The number of entries in FatArchs.
+
+  @return  The selected architecture header or NULL.
+**/
+STATIC
+CONST MACH_FAT_ARCH *
+InternalSelectFatArch (
+  IN CONST MACH_FAT_ARCH  *FatArchs,
+  IN UINT32               NumberOfFatArchs
+  )
+{
+  CONST MACH_FAT_ARCH *Selected;
+  UINTN               SelectedRank;
+  UINTN               Rank;
+  UINT32              Index;
+
+  Selected     = NULL;
+  SelectedRank = 0;
+
+  for (Index = 0; Index < NumberOfFatArchs; ++Index) {
+#if defined (MDE_CPU_X64)
+    if (FatArchs[Index].CpuType != MACH_CPU_TYPE_X86_64) {
+      continue;
+    }
+
+    Rank = 1;
+
+    if ((FatArchs[Index].CpuSubtype & ~MACH_CPU_SUBTYPE_MASK)
+          == MACH_CPU_SUBTYPE_X86_64_H) {
+      if (!mCpuSupportsX8664h) {
+        continue;
+      }
+
+      Rank = 2;
+    }
+#else
+    if (FatArchs[Index].CpuType != MACH_CPU_TYPE_X86) {
+      continue;
+    }
+
+    Rank = 1;
+#endif
+
+    if (Rank > SelectedRank) {
+      Selected     = &FatArchs[Index];
+      SelectedRank = Rank;
+    }
+  }
+
+  return Selected;
+}
+
+// InternalThinFatBinary
+/** Returns the slice of a Fat Binary in memory best suited for the current
+    CPU.  Buffers that are no EFI Fat Binary are passed to
+    ThinFatBinaryEfiForCurrentCpu().
+
+  @param[in]      Buffer      The image buffer.
+  @param[in, out] BufferSize  The size, in bytes, of Buffer.  On output, the
+                              size of the returned slice.
+
+  @return  The selected slice or NULL.
+**/
+STATIC
+VOID *
+InternalThinFatBinary (
+  IN     VOID   *Buffer,
+  IN OUT UINTN  *BufferSize
+  )
+{
+  CONST MACH_FAT_HEADER *FatHeader;
+  CONST MACH_FAT_ARCH   *FatArch;
+
+  FatHeader = (CONST MACH_FAT_HEADER *)Buffer;
+
+  if ((*BufferSize < sizeof (*FatHeader))
+   || (FatHeader->Signature != EFI_FAT_BINARY_SIGNATURE)
+   || (FatHeader->NumberOfFatArch
+         > ((*BufferSize - sizeof (*FatHeader)) / sizeof (*FatArch)))) {
+    return ThinFatBinaryEfiForCurrentCpu (Buffer, BufferSize);
+  }
+
+  FatArch = InternalSelectFatArch (
+              &FatHeader->FatArch[0],
+              FatHeader->NumberOfFatArch
+              );
+
+  if ((FatArch == NULL)
+   || (FatArch->Offset > *BufferSize)
+   || (FatArch->Size > (*BufferSize - FatArch->Offset))) {
+    return NULL;
+  }
+
+  *BufferSize = FatArch->Size;
+
+  return (VOID *)((UINTN)Buffer + FatArch->Offset);
+}
+
+// InternalFreeImageCacheEntry
+STATIC
+VOID
+InternalFreeImageCacheEntry (
+  IN IMAGE_CACHE_ENTRY  *Entry
+  )
+{
+  RemoveEntryList (&Entry->Link);
+
+  mImageCacheSize -= IMAGE_CACHE_ENTRY_SIZE (Entry);
+
+  FreePool ((VOID *)Entry);
+}
+
+// InternalLookupCachedImage
+/** Returns a copy of a cached image if the file has not changed since it was
+    read.
+
+  @param[in]  DevicePath  The device path of the file.
+  @param[in]  FileInfo    The current information of the file.
+  @param[out] Buffer      Returns a pool buffer holding the image.
+  @param[out] BufferSize  Returns the size, in bytes, of Buffer.
+
+  @retval TRUE   The cached image has been returned.
+  @retval FALSE  The image is not cached.
+**/
+STATIC
+BOOLEAN
+InternalLookupCachedImage (
+  IN  EFI_DEVICE_PATH_PROTOCOL  *DevicePath,
+  IN  CONST EFI_FILE_INFO       *FileInfo,
+  OUT VOID                      **Buffer,
+  OUT UINTN                     *BufferSize
+  )
+{
+  LIST_ENTRY        *Link;
+  IMAGE_CACHE_ENTRY *Entry;
+  UINTN             DevicePathSize;
+
+  DevicePathSize = GetDevicePathSize (DevicePath);
+
+  for (
+    Link = GetFirstNode (&mImageCache);
+    !IsNull (&mImageCache, Link);
+    Link = GetNextNode (&mImageCache, Link)
+    ) {
+    Entry = IMAGE_CACHE_ENTRY_FROM_LINK (Link);
+
+    if ((Entry->DevicePathSize != DevicePathSize)
+     || (CompareMem (
+           IMAGE_CACHE_ENTRY_DEVICE_PATH (Entry),
+           DevicePath,
+           DevicePathSize
+           ) != 0)) {
+      continue;
+    }
+
+    if ((Entry->FileSize != FileInfo->FileSize)
+     || (CompareMem (
+           &Entry->ModificationTime,
+           &FileInfo->ModificationTime,
+           sizeof (Entry->ModificationTime)
+           ) != 0)) {
+      InternalFreeImageCacheEntry (Entry);
+      return FALSE;
+    }
+
+    *Buffer = AllocateCopyPool (
+                Entry->ImageSize,
+                IMAGE_CACHE_ENTRY_IMAGE (Entry)
+                );
+
+    if (*Buffer == NULL) {
+      return FALSE;
+    }
+
+    *BufferSize = Entry->ImageSize;
+
+    RemoveEntryList (&Entry->Link);
+    InsertHeadList (&mImageCache, &Entry->Link);
+
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
+// InternalCacheImage
+/** Adds a thinned image to the cache, evicting the least recently used images
+    to stay within the budget.
+
+  @param[in] DevicePath  The device path of the file.
+  @param[in] FileInfo    The information of the file the image was read from.
+  @param[in] Image       The thinned image.
+  @param[in] ImageSize   The size, in bytes, of Image.
+**/
+STATIC
+VOID
+InternalCacheImage (
+  IN EFI_DEVICE_PATH_PROTOCOL  *DevicePath,
+  IN CONST EFI_FILE_INFO       *FileInfo,
+  IN VOID                      *Image,
+  IN UINTN                     ImageSize
+  )
+{
+  IMAGE_CACHE_ENTRY *Entry;
+  UINTN             DevicePathSize;
+  UINTN             EntrySize;
+
+  DevicePathSize = GetDevicePathSize (DevicePath);
+  EntrySize      = (sizeof (*Entry) + ALIGN_VALUE (DevicePathSize, 8));
+
+  if ((ImageSize > FixedPcdGet32 (PcdFatBinaryImageCacheSize))
+   || (EntrySize > (FixedPcdGet32 (PcdFatBinaryImageCacheSize) - ImageSize))) {
+    return;
+  }
+
+  EntrySize += ImageSize;
+
+  while ((mImageCacheSize + EntrySize)
+           > FixedPcdGet32 (PcdFatBinaryImageCacheSize)) {
+    ASSERT (!IsListEmpty (&mImageCache));
+
+    InternalFreeImageCacheEntry (
+      IMAGE_CACHE_ENTRY_FROM_LINK (GetPreviousNode (&mImageCache, &mImageCache))
+      );
+  }
+
+  Entry = AllocatePool (EntrySize);
+
+  if (Entry == NULL) {
+    return;
+  }
+
+  Entry->DevicePathSize = DevicePathSize;
+  Entry->FileSize       = FileInfo->FileSize;
+  Entry->ImageSize      = ImageSize;
+
+  CopyMem (
+    &Entry->ModificationTime,
+    &FileInfo->ModificationTime,
+    sizeof (Entry->ModificationTime)
+    );
+
+  CopyMem (IMAGE_CACHE_ENTRY_DEVICE_PATH (Entry), DevicePath, DevicePathSize);
+  CopyMem (IMAGE_CACHE_ENTRY_IMAGE (Entry), Image, ImageSize);
+
+  InsertHeadList (&mImageCache, &Entry->Link);
+
+  mImageCacheSize += EntrySize;
+}
+
+// InternalFreeImageCache
+STATIC
+VOID
+InternalFreeImageCache (
+  VOID
+  )
+{
+  while (!IsListEmpty (&mImageCache)) {
+    InternalFreeImageCacheEntry (
+      IMAGE_CACHE_ENTRY_FROM_LINK (GetFirstNode (&mImageCache))
+      );
+  }
+}
+
+// InternalReadFile
+/** Reads exactly Size bytes from the current position of a file.
+
+  @param[in]  File    The file to read from.
+  @param[in]  Size    The number of bytes to read.
+  @param[out] Buffer  The buffer to read into.
+
+  @retval EFI_SUCCESS       The bytes have been read.
+  @retval EFI_END_OF_FILE   The file ended before Size bytes have been read.
+  @retval other             The file could not be read.
+**/
+STATIC
+EFI_STATUS
+InternalReadFile (
+  IN  EFI_FILE_PROTOCOL  *File,
+  IN  UINTN              Size,
+  OUT VOID               *Buffer
+  )
+{
+  EFI_STATUS Status;
+  UINTN      ReadSize;
+
+  ReadSize = Size;
+  Status   = File->Read (File, &ReadSize, Buffer);
+
+  if (!EFI_ERROR (Status) && (ReadSize != Size)) {
+    Status = EFI_END_OF_FILE;
+  }
+
+  return Status;
+}
+
+// InternalReadImageFile
+/** Reads the slice of a Fat Binary matching the current CPU, or the entire
+    file if it is not a Fat Binary.  Only the Fat header and the slice are
+    read from the file, unless the image is cached.
+
+  @param[in]  DevicePath  The device path of the file.
+  @param[in]  File        The opened file, positioned at its start.
+  @param[in]  FileInfo    The information of File.
+  @param[out] Buffer      Returns a pool buffer holding the image.
+  @param[out] BufferSize  Returns the size, in bytes, of Buffer.
+
+  @retval EFI_SUCCESS    The image has been read.
+  @retval EFI_NOT_FOUND  The Fat Binary does not contain a matching slice.
+  @retval other          The file could not be read.
 **/
 STATIC
 EFI_STATUS
 EFIAPI
-InternalLoadImage (
-  IN  BOOLEAN                   BootPolicy,
-  IN  EFI_HANDLE                ParentImageHandle,
+InternalReadImageFile (
   IN  EFI_DEVICE_PATH_PROTOCOL  *DevicePath,
-  IN  VOID                      *SourceBuffer, OPTIONAL
-  IN  UINTN                     SourceSize,
-  OUT EFI_HANDLE                *ImageHandle
+  IN  EFI_FILE_PROTOCOL         *File,
+  IN  CONST EFI_FILE_INFO       *FileInfo,
+  OUT VOID                      **Buffer,
+  OUT UINTN                     *BufferSize
   )
 {
-  EFI_STATUS Status;
+  EFI_STATUS          Status;
+  UINT64              FileSize;
+  MACH_FAT_HEADER     FatHeader;
+  MACH_FAT_ARCH       FatArchs[MAXIMUM_FAT_ARCHITECTURES];
+  CONST MACH_FAT_ARCH *FatArch;
+  UINT64              Offset;
+  UINT64              Size;
+
+  if ((FixedPcdGet32 (PcdFatBinaryImageCacheSize) != 0)
+   && InternalLookupCachedImage (DevicePath, FileInfo, Buffer, BufferSize)) {
+    return EFI_SUCCESS;
+  }
+
+  FileSize = FileInfo->FileSize;
+  Status   = InternalReadFile (File, sizeof (FatHeader), (VOID *)&FatHeader);
+
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
 
-  VOID       *OriginalBuffer;
-  UINT32     AuthenticationStatus;
+  Offset = 0;
+  Size   = FileSize;
+
+  if (FatHeader.Signature == EFI_FAT_BINARY_SIGNATURE) {
+    Status = EFI_NOT_FOUND;
+
+    if ((FatHeader.NumberOfFatArch != 0)
+     && (FatHeader.NumberOfFatArch <= ARRAY_SIZE (FatArchs))) {
+      Status = InternalReadFile (
+                 File,
+                 (FatHeader.NumberOfFatArch * sizeof (FatArchs[0])),
+                 (VOID *)&FatArchs[0]
+                 );
+
+      if (!EFI_ERROR (Status)) {
+        FatArch = InternalSelectFatArch (
+                    &FatArchs[0],
+                    FatHeader.NumberOfFatArch
+                    );
+
+        if (FatArch != NULL) {
+          Offset = FatArch->Offset;
+          Size   = FatArch->Size;
+        } else {
+          Status = EFI_NOT_FOUND;
+        }
+      }
+    }
+
+    if (!EFI_ERROR (Status)
+     && ((Offset > FileSize) || (Size > (FileSize - Offset)))) {
+      Status = EFI_LOAD_ERROR;
+    }
+  }
 
-  ASSERT (ParentImageHandle != NULL);
-  ASSERT (DevicePath != NULL);
-  ASSERT ((((SourceSize != 0) ? 1 : 0)
-    ^ ((SourceBuffer == NULL) ? 1 : 0)) != 0);
+  if (!EFI_ERROR (Status) && ((Size == 0) || (Size > MAX_UINTN))) {
+    Status = EFI_LOAD_ERROR;
+  }
 
-  ASSERT (ImageHandle != NULL);
-  ASSERT (!EfiAtRuntime ());
-  ASSERT (EfiGetCurrentTpl () < TPL_CALLBACK);
-  ASSERT (mLoadImage != NULL);
+  if (!EFI_ERROR (Status)) {
+    Status = File->SetPosition (File, Offset);
+  }
 
-  OriginalBuffer = NULL;
+  if (!EFI_ERROR (Status)) {
+    *Buffer = AllocatePool ((UINTN)Size);
 
-  if (SourceBuffer == NULL) {
-    SourceBuffer = GetFileBufferByFilePath (
-                     BootPolicy,
-                     DevicePath,
-                     &SourceSize,
-                     &AuthenticationStatus
-                     );
+    if (*Buffer == NULL) {
+      Status = EFI_OUT_OF_RESOURCES;
+    }
   }
 
-  if (SourceBuffer != NULL) {
-    OriginalBuffer = SourceBuffer;
-    SourceBuffer   = ThinFatBinaryEfiForCurrentCpu (SourceBuffer, &SourceSize);
+  if (!EFI_ERROR (Status)) {
+    Status = InternalReadFile (File, (UINTN)Size, *Buffer);
+
+    if (EFI_ERROR (Status)) {
+      FreePool (*Buffer);
+    }
   }
 
-  Status = mLoadImage (
-             BootPolicy,
-             ParentImageHandle,
-             DevicePath,
-             SourceBuffer,
-             SourceSize,
-             ImageHandle
-             );
+  if (!EFI_ERROR (Status)) {
+    *BufferSize = (UINTN)Size;
 
-  if (OriginalBuffer != NULL) {
-    FreePool (OriginalBuffer);
+    if (FixedPcdGet32 (PcdFatBinaryImageCacheSize) != 0) {
+      InternalCacheImage (DevicePath, FileInfo, *Buffer, *BufferSize);
+    }
   }
 
   return Status;
 }
 
+// InternalThinImage
+/** Narrows an image in memory to the slice best suited for the current CPU.
+
+  @param[in]  Image         The image to thin.
+  @param[in]  ImageSize     The size, in bytes, of Image.
+  @param[out] NewImage      Returns the slice within Image.
+  @param[out] NewImageSize  Returns the size, in bytes, of NewImage.
+  @param[out] Allocated     Returns FALSE.
+
+  @retval EFI_SUCCESS      The slice has been returned.
+  @retval EFI_UNSUPPORTED  No slice has been found.
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+InternalThinImage (
+  IN  VOID     *Image,
+  IN  UINTN    ImageSize,
+  OUT VOID     **NewImage,
+  OUT UINTN    *NewImageSize,
+  OUT BOOLEAN  *Allocated
+  )
+{
+  *NewImageSize = ImageSize;
+  *NewImage     = InternalThinFatBinary (Image, NewImageSize);
+  *Allocated    = FALSE;
+
+  //
+  // Leave the image to the firmware, which may support Fat Binaries itself.
+  //
+  if (*NewImage == NULL) {
+    return EFI_UNSUPPORTED;
+  }
+
+  return EFI_SUCCESS;
+}
+
+// mReadImageFileStage
+STATIC IMAGE_LOAD_STAGE mReadImageFileStage;
+
+// mThinImageStage
+STATIC IMAGE_LOAD_STAGE mThinImageStage;
+
+// InternalImageLoadPipelineNotify
+/** Registers the Fat Binary stages once the LoadImage pipeline is available.
+
+  @param[in] Event    The event that has been signaled.
+  @param[in] Context  Unused.
+**/
+STATIC
+VOID
+EFIAPI
+InternalImageLoadPipelineNotify (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  EFI_STATUS                   Status;
+  IMAGE_LOAD_PIPELINE_PROTOCOL *ImageLoadPipeline;
+
+  if (mImageLoadPipeline != NULL) {
+    return;
+  }
+
+  Status = EfiLocateProtocol (
+             &gImageLoadPipelineProtocolGuid,
+             NULL,
+             (VOID **)&ImageLoadPipeline
+             );
+
+  if (EFI_ERROR (Status)) {
+    return;
+  }
+
+  mReadImageFileStage.Type              = ImageLoadStageReadFile;
+  mReadImageFileStage.Order             = IMAGE_LOAD_STAGE_ORDER_FAT_BINARY;
+  mReadImageFileStage.Function.ReadFile = InternalReadImageFile;
+
+  mThinImageStage.Type               = ImageLoadStageTransform;
+  mThinImageStage.Order              = IMAGE_LOAD_STAGE_ORDER_FAT_BINARY;
+  mThinImageStage.Function.Transform = InternalThinImage;
+
+  ImageLoadPipeline->RegisterStage (ImageLoadPipeline, &mReadImageFileStage);
+  ImageLoadPipeline->RegisterStage (ImageLoadPipeline, &mThinImageStage);
+
+  mImageLoadPipeline = ImageLoadPipeline;
+}
+
+// InternalReadyToBootNotify
+/** Warns once a boot option is started if the LoadImage pipeline has never
+    been installed, as this driver depends on ImageLoadPipelineDxe.
+
+  @param[in] Event    The event that has been signaled.
+  @param[in] Context  Unused.
+**/
+STATIC
+VOID
+EFIAPI
+InternalReadyToBootNotify (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  if (mImageLoadPipeline == NULL) {
+    DEBUG ((
+      DEBUG_WARN,
+      "FatBinary: ImageLoadPipelineDxe is not loaded, Fat Binaries cannot be loaded\n"
+      ));
+  }
+
+  EfiCloseEvent (mReadyToBootEvent);
+
+  mReadyToBootEvent = NULL;
+}
+
 // FatBinaryUnload
 EFI_STATUS
 EFIAPI
@@ -136,23 +680,33 @@ FatBinaryUnload (
   IN EFI_HANDLE  ImageHandle
   )
 {
-  EFI_TPL OldTpl;
+  if (mReadyToBootEvent != NULL) {
+    EfiCloseEvent (mReadyToBootEvent);
 
-  DEBUG_CODE (
-    ASSERT (mLoadImage != NULL);
-    );
+    mReadyToBootEvent = NULL;
+  }
 
-  OldTpl = EfiRaiseTPL (TPL_HIGH_LEVEL);
+  if (mImageLoadPipelineEvent != NULL) {
+    EfiCloseEvent (mImageLoadPipelineEvent);
 
-  gBS->LoadImage = mLoadImage;
-  
-  UPDATE_EFI_TABLE_CRC32 (gBS);
+    mImageLoadPipelineEvent = NULL;
+  }
 
-  EfiRestoreTPL (OldTpl);
+  if (mImageLoadPipeline != NULL) {
+    mImageLoadPipeline->UnregisterStage (
+                          mImageLoadPipeline,
+                          &mReadImageFileStage
+                          );
 
-  DEBUG_CODE (
-    mLoadImage = NULL;
-    );
+    mImageLoadPipeline->UnregisterStage (
+                          mImageLoadPipeline,
+                          &mThinImageStage
+                          );
+
+    mImageLoadPipeline = NULL;
+  }
+
+  InternalFreeImageCache ();
 
   return EFI_SUCCESS;
 }
@@ -163,8 +717,8 @@ FatBinaryUnload (
   @param[in] ImageHandle  The firmware allocated handle for the EFI image.  
   @param[in] SystemTable  A pointer to the EFI System Table.
 
-  @retval EFI_SUCCESS         The entry point is executed successfully.
-  @retval EFI_ALREADY_STARTED The protocol has already been installed.
+  @retval EFI_SUCCESS  The entry point is executed successfully.
+  @retval other        The pipeline notification could not be registered.
 **/
 EFI_STATUS
 EFIAPI
@@ -173,20 +727,54 @@ FatBinaryMain (
   IN EFI_SYSTEM_TABLE  *SystemTable
   )
 {
-  EFI_TPL OldTpl;
+  EFI_STATUS Status;
 
-  DEBUG_CODE (
-    ASSERT (mLoadImage == NULL);
-    );
+  mCpuSupportsX8664h = InternalDetectX8664hSupport ();
+
+  //
+  // The stages are registered independent of whether the pipeline driver has
+  // been loaded before or after this one.
+  //
+  Status = EfiCreateEvent (
+             EVT_NOTIFY_SIGNAL,
+             TPL_CALLBACK,
+             InternalImageLoadPipelineNotify,
+             NULL,
+             &mImageLoadPipelineEvent
+             );
 
-  OldTpl = EfiRaiseTPL (TPL_HIGH_LEVEL);
+  if (!EFI_ERROR (Status)) {
+    Status = EfiRegisterProtocolNotify (
+               &gImageLoadPipelineProtocolGuid,
+               mImageLoadPipelineEvent,
+               &mImageLoadPipelineRegistration
+               );
 
-  mLoadImage     = gBS->LoadImage;
-  gBS->LoadImage = InternalLoadImage;
+    if (EFI_ERROR (Status)) {
+      EfiCloseEvent (mImageLoadPipelineEvent);
 
-  UPDATE_EFI_TABLE_CRC32 (gBS);
+      mImageLoadPipelineEvent = NULL;
+    }
+  }
 
-  EfiRestoreTPL (OldTpl);
+  ASSERT_EFI_ERROR (Status);
+
+  if (!EFI_ERROR (Status)) {
+    InternalImageLoadPipelineNotify (mImageLoadPipelineEvent, NULL);
+
+    //
+    // The warning is diagnostic only, hence failing to register it is not
+    // fatal.
+    //
+    if (mImageLoadPipeline == NULL) {
+      EfiCreateEventReadyToBootEx (
+        TPL_CALLBACK,
+        InternalReadyToBootNotify,
+        NULL,
+        &mReadyToBootEvent
+        );
+    }
+  }
 
-  return EFI_SUCCESS;
+  return Status;
 }
@@ -0,0 +1,850 @@
+/** @file
+  Copyright (C) 2015 - 2017, CupertinoNet.  All rights reserved.<BR>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+**/
+
+#include <Uefi.h>
+
+#include <Guid/FileInfo.h>
+
+#include <IndustryStandard/CompressedImage.h>
+#include <IndustryStandard/PeImage.h>
+
+#include <Protocol/ImageLoadPipeline.h>
+#include <Protocol/SimpleFileSystem.h>
+
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
+#include <Library/DevicePathLib.h>
+#include <Library/DxeServicesLib.h>
+#include <Library/EfiBootServicesLib.h>
+#include <Library/Lz4DecompressLib.h>
+#include <Library/MiscRuntimeLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/PcdLib.h>
+#include <Library/ServiceHookLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
+
+#include "ImageLoadPipelineInternal.h"
+
+// IMAGE_LOAD_STAGE_FROM_LINK
+#define IMAGE_LOAD_STAGE_FROM_LINK(Entry)  \
+  BASE_CR ((Entry), IMAGE_LOAD_STAGE, Link)
+
+// mLoadImage
+STATIC EFI_IMAGE_LOAD mLoadImage = NULL;
+
+// mStages
+/// The registered stages per type, in ascending order.
+STATIC LIST_ENTRY mStages[ImageLoadStageMaximum];
+
+// InternalRegisterStage
+/** Adds a stage to the pipeline.
+
+  @param[in] This   The protocol instance.
+  @param[in] Stage  The stage to add.
+
+  @retval EFI_SUCCESS            The stage has been added.
+  @retval EFI_INVALID_PARAMETER  The stage type is invalid.
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+InternalRegisterStage (
+  IN IMAGE_LOAD_PIPELINE_PROTOCOL  *This,
+  IN IMAGE_LOAD_STAGE              *Stage
+  )
+{
+  LIST_ENTRY *Stages;
+  LIST_ENTRY *Link;
+
+  if ((Stage == NULL) || (Stage->Type >= ImageLoadStageMaximum)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Stages = &mStages[Stage->Type];
+
+  for (
+    Link = GetFirstNode (Stages);
+    !IsNull (Stages, Link);
+    Link = GetNextNode (Stages, Link)
+    ) {
+    if (IMAGE_LOAD_STAGE_FROM_LINK (Link)->Order > Stage->Order) {
+      break;
+    }
+  }
+
+  //
+  // Insert the stage in front of the first one with a greater order.
+  //
+  InsertTailList (Link, &Stage->Link);
+
+  return EFI_SUCCESS;
+}
+
+// InternalUnregisterStage
+/** Removes a stage from the pipeline.
+
+  @param[in] This   The protocol instance.
+  @param[in] Stage  The stage to remove.
+
+  @retval EFI_SUCCESS  The stage has been removed.
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+InternalUnregisterStage (
+  IN IMAGE_LOAD_PIPELINE_PROTOCOL  *This,
+  IN IMAGE_LOAD_STAGE              *Stage
+  )
+{
+  ASSERT (Stage != NULL);
+
+  RemoveEntryList (&Stage->Link);
+
+  return EFI_SUCCESS;
+}
+
+// mImageLoadPipeline
+STATIC IMAGE_LOAD_PIPELINE_PROTOCOL mImageLoadPipeline = {
+  IMAGE_LOAD_PIPELINE_PROTOCOL_REVISION,
+  InternalRegisterStage,
+  InternalUnregisterStage
+};
+
+// InternalResolvePath
+/** Runs the path resolution stages.
+
+  @param[in] BootPolicy  Whether the boot manager loads a boot selection.
+  @param[in] DevicePath  The device path passed to LoadImage().
+
+  @return  The device path to load the image from.
+**/
+STATIC
+EFI_DEVICE_PATH_PROTOCOL *
+InternalResolvePath (
+  IN BOOLEAN                   BootPolicy,
+  IN EFI_DEVICE_PATH_PROTOCOL  *DevicePath
+  )
+{
+  EFI_STATUS               Status;
+  LIST_ENTRY               *Stages;
+  LIST_ENTRY               *Link;
+  EFI_DEVICE_PATH_PROTOCOL *ResolvedPath;
+
+  Stages = &mStages[ImageLoadStageResolvePath];
+
+  for (
+    Link = GetFirstNode (Stages);
+    !IsNull (Stages, Link);
+    Link = GetNextNode (Stages, Link)
+    ) {
+    Status = IMAGE_LOAD_STAGE_FROM_LINK (Link)->Function.ResolvePath (
+                                                           BootPolicy,
+                                                           DevicePath,
+                                                           &ResolvedPath
+                                                           );
+
+    if (!EFI_ERROR (Status)) {
+      DevicePath = ResolvedPath;
+    }
+  }
+
+  return DevicePath;
+}
+
+// InternalGetFileInfo
+EFI_FILE_INFO *
+InternalGetFileInfo (
+  IN EFI_FILE_PROTOCOL  *File
+  )
+{
+  EFI_STATUS    Status;
+  EFI_FILE_INFO *FileInfo;
+  UINTN         FileInfoSize;
+
+  FileInfoSize = 0;
+  Status       = File->GetInfo (File, &gEfiFileInfoGuid, &FileInfoSize, NULL);
+
+  if (Status != EFI_BUFFER_TOO_SMALL) {
+    return NULL;
+  }
+
+  FileInfo = AllocatePool (FileInfoSize);
+
+  if (FileInfo != NULL) {
+    Status = File->GetInfo (
+                     File,
+                     &gEfiFileInfoGuid,
+                     &FileInfoSize,
+                     (VOID *)FileInfo
+                     );
+
+    if (EFI_ERROR (Status)) {
+      FreePool ((VOID *)FileInfo);
+      FileInfo = NULL;
+    }
+  }
+
+  return FileInfo;
+}
+
+// InternalOpenFileByDevicePath
+/** Opens the file a device path points to on a Simple File System.
+
+  @param[in]  DevicePath  The device path of the file.
+  @param[out] File        Returns the opened file.
+
+  @retval EFI_SUCCESS      The file has been opened.
+  @retval EFI_UNSUPPORTED  DevicePath does not point to a file.
+  @retval other            The file could not be opened.
+**/
+STATIC
+EFI_STATUS
+InternalOpenFileByDevicePath (
+  IN  EFI_DEVICE_PATH_PROTOCOL  *DevicePath,
+  OUT EFI_FILE_PROTOCOL         **File
+  )
+{
+  EFI_STATUS                      Status;
+  EFI_DEVICE_PATH_PROTOCOL        *RemainingPath;
+  EFI_HANDLE                      Handle;
+  EFI_SIMPLE_FILE_SYSTEM_PROTOCOL *FileSystem;
+  EFI_FILE_PROTOCOL               *Directory;
+  EFI_FILE_PROTOCOL               *Next;
+  FILEPATH_DEVICE_PATH            *FilePathNode;
+
+  RemainingPath = DevicePath;
+  Status        = EfiLocateDevicePath (
+                    &gEfiSimpleFileSystemProtocolGuid,
+                    &RemainingPath,
+                    &Handle
+                    );
+
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  Status = EfiHandleProtocol (
+             Handle,
+             &gEfiSimpleFileSystemProtocolGuid,
+             (VOID **)&FileSystem
+             );
+
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  Status = FileSystem->OpenVolume (FileSystem, &Directory);
+
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  while (!IsDevicePathEnd (RemainingPath)) {
+    if ((DevicePathType (RemainingPath) != MEDIA_DEVICE_PATH)
+     || (DevicePathSubType (RemainingPath) != MEDIA_FILEPATH_DP)) {
+      Status = EFI_UNSUPPORTED;
+      break;
+    }
+
+    //
+    // The path name may be unaligned within the device path.
+    //
+    FilePathNode = AllocateCopyPool (
+                     DevicePathNodeLength (RemainingPath),
+                     RemainingPath
+                     );
+
+    if (FilePathNode == NULL) {
+      Status = EFI_OUT_OF_RESOURCES;
+      break;
+    }
+
+    Status = Directory->Open (
+                          Directory,
+                          &Next,
+                          FilePathNode->PathName,
+                          EFI_FILE_MODE_READ,
+                          0
+                          );
+
+    FreePool ((VOID *)FilePathNode);
+
+    if (EFI_ERROR (Status)) {
+      break;
+    }
+
+    Directory->Close (Directory);
+
+    Directory     = Next;
+    RemainingPath = NextDevicePathNode (RemainingPath);
+  }
+
+  if (EFI_ERROR (Status)) {
+    Directory->Close (Directory);
+    return Status;
+  }
+
+  *File = Directory;
+
+  return EFI_SUCCESS;
+}
+
+// InternalReadFileImage
+/** Reads an image from an opened file.  The file read stages are given the
+    chance to read only parts of the file, otherwise the entire file is read
+    at once.
+
+  @param[in]  DevicePath  The device path of the file.
+  @param[in]  File        The opened file.
+  @param[out] Buffer      Returns a pool buffer holding the image.
+  @param[out] BufferSize  Returns the size, in bytes, of Buffer.
+
+  @retval EFI_SUCCESS  The image has been read.
+  @retval other        The file could not be read.
+**/
+STATIC
+EFI_STATUS
+InternalReadFileImage (
+  IN  EFI_DEVICE_PATH_PROTOCOL  *DevicePath,
+  IN  EFI_FILE_PROTOCOL         *File,
+  OUT VOID                      **Buffer,
+  OUT UINTN                     *BufferSize
+  )
+{
+  EFI_STATUS    Status;
+  EFI_FILE_INFO *FileInfo;
+  LIST_ENTRY    *Stages;
+  LIST_ENTRY    *Link;
+  UINTN         ReadSize;
+
+  FileInfo = InternalGetFileInfo (File);
+
+  if (FileInfo == NULL) {
+    return EFI_DEVICE_ERROR;
+  }
+
+  if ((FileInfo->Attribute & EFI_FILE_DIRECTORY) != 0) {
+    FreePool ((VOID *)FileInfo);
+    return EFI_UNSUPPORTED;
+  }
+
+  Stages = &mStages[ImageLoadStageReadFile];
+
+  for (
+    Link = GetFirstNode (Stages);
+    !IsNull (Stages, Link);
+    Link = GetNextNode (Stages, Link)
+    ) {
+    Status = File->SetPosition (File, 0);
+
+    if (EFI_ERROR (Status)) {
+      break;
+    }
+
+    Status = IMAGE_LOAD_STAGE_FROM_LINK (Link)->Function.ReadFile (
+                                                           DevicePath,
+                                                           File,
+                                                           FileInfo,
+                                                           Buffer,
+                                                           BufferSize
+                                                           );
+
+    if (!EFI_ERROR (Status)) {
+      FreePool ((VOID *)FileInfo);
+      return EFI_SUCCESS;
+    }
+  }
+
+  Status = EFI_LOAD_ERROR;
+
+  if ((FileInfo->FileSize != 0) && (FileInfo->FileSize <= MAX_UINTN)) {
+    Status = File->SetPosition (File, 0);
+  }
+
+  ReadSize = (UINTN)FileInfo->FileSize;
+
+  FreePool ((VOID *)FileInfo);
+
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  *Buffer = AllocatePool (ReadSize);
+
+  if (*Buffer == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  *BufferSize = ReadSize;
+  Status      = File->Read (File, &ReadSize, *Buffer);
+
+  if (!EFI_ERROR (Status) && (ReadSize != *BufferSize)) {
+    Status = EFI_END_OF_FILE;
+  }
+
+  if (EFI_ERROR (Status)) {
+    FreePool (*Buffer);
+  }
+
+  return Status;
+}
+
+// InternalReadImage
+/** Reads an image into a single pool buffer.  Files on Simple File Systems
+    are read through the file read stages, Firmware Volumes and Load File
+    devices through the generic path.
+
+  @param[in]  BootPolicy  Whether the boot manager loads a boot selection.
+  @param[in]  DevicePath  The device path of the image.
+  @param[out] Buffer      Returns a pool buffer holding the image.
+  @param[out] BufferSize  Returns the size, in bytes, of Buffer.
+
+  @retval EFI_SUCCESS  The image has been read.
+  @retval other        The image could not be read.
+**/
+STATIC
+EFI_STATUS
+InternalReadImage (
+  IN  BOOLEAN                   BootPolicy,
+  IN  EFI_DEVICE_PATH_PROTOCOL  *DevicePath,
+  OUT VOID                      **Buffer,
+  OUT UINTN                     *BufferSize
+  )
+{
+  EFI_STATUS        Status;
+  EFI_FILE_PROTOCOL *File;
+  UINT32            AuthenticationStatus;
+
+  Status = InternalOpenFileByDevicePath (DevicePath, &File);
+
+  if (!EFI_ERROR (Status)) {
+    Status = InternalReadFileImage (DevicePath, File, Buffer, BufferSize);
+
+    File->Close (File);
+
+    if (!EFI_ERROR (Status)) {
+      return EFI_SUCCESS;
+    }
+  }
+
+  *Buffer = GetFileBufferByFilePath (
+              BootPolicy,
+              DevicePath,
+              BufferSize,
+              &AuthenticationStatus
+              );
+
+  return ((*Buffer != NULL) ? EFI_SUCCESS : EFI_NOT_FOUND);
+}
+
+// InternalReadTicks
+/** Returns a timestamp for the load statistics, or 0 if unsupported.
+**/
+STATIC
+UINT64
+InternalReadTicks (
+  VOID
+  )
+{
+#if defined (MDE_CPU_IA32) || defined (MDE_CPU_X64)
+  return AsmReadTsc ();
+#else
+  return 0;
+#endif
+}
+
+// InternalDecompressImage
+/** Decompresses an image wrapped in a compressed container.
+
+  @param[in, out] Allocation  The pool buffer backing Image or NULL.  On
+                              output, the pool buffer backing the
+                              decompressed image.
+  @param[in, out] Image       The image to decompress.  On output, the
+                              decompressed image.
+  @param[in, out] ImageSize   The size, in bytes, of Image.  On output, the
+                              size of the decompressed image.
+**/
+STATIC
+VOID
+InternalDecompressImage (
+  IN OUT VOID   **Allocation,
+  IN OUT VOID   **Image,
+  IN OUT UINTN  *ImageSize
+  )
+{
+  RETURN_STATUS                 Status;
+  CONST COMPRESSED_IMAGE_HEADER *Header;
+  VOID                          *NewImage;
+
+  Header = (CONST COMPRESSED_IMAGE_HEADER *)*Image;
+
+  if ((*ImageSize < sizeof (*Header))
+   || (Header->Signature != COMPRESSED_IMAGE_SIGNATURE)) {
+    return;
+  }
+
+  if ((Header->Version != COMPRESSED_IMAGE_VERSION)
+   || (Header->Algorithm != COMPRESSED_IMAGE_ALGORITHM_LZ4)
+   || (Header->CompressedSize > (*ImageSize - sizeof (*Header)))) {
+    DEBUG ((DEBUG_WARN, "ImageLoadPipeline: Unsupported compressed image\n"));
+    return;
+  }
+
+  //
+  // The header is not trusted, the allocation is bounded before the data
+  // has been decoded.
+  //
+  if ((Header->UncompressedSize < sizeof (EFI_IMAGE_NT_HEADERS32))
+   || (Header->UncompressedSize
+         > FixedPcdGet32 (PcdMaximumDecompressedImageSize))) {
+    DEBUG ((
+      DEBUG_WARN,
+      "ImageLoadPipeline: Compressed image size %u out of bounds\n",
+      Header->UncompressedSize
+      ));
+    return;
+  }
+
+  NewImage = AllocatePool (Header->UncompressedSize);
+
+  if (NewImage == NULL) {
+    return;
+  }
+
+  Status = Lz4DecompressBlock (
+             (CONST VOID *)(Header + 1),
+             Header->CompressedSize,
+             NewImage,
+             Header->UncompressedSize
+             );
+
+  if (RETURN_ERROR (Status)) {
+    DEBUG ((DEBUG_WARN, "ImageLoadPipeline: Corrupted compressed image\n"));
+    FreePool (NewImage);
+    return;
+  }
+
+  *ImageSize = Header->UncompressedSize;
+
+  if (*Allocation != NULL) {
+    FreePool (*Allocation);
+  }
+
+  *Allocation = NewImage;
+  *Image      = NewImage;
+}
+
+// InternalTransformImage
+/** Decompresses an image and runs the transform stages on it.
+
+  @param[in, out] Allocation  The pool buffer backing Image or NULL.  On
+                              output, the pool buffer backing the transformed
+                              image.
+  @param[in, out] Image       The image to transform.  On output, the
+                              transformed image.
+  @param[in, out] ImageSize   The size, in bytes, of Image.  On output, the
+                              size of the transformed image.
+**/
+STATIC
+VOID
+InternalTransformImage (
+  IN OUT VOID   **Allocation,
+  IN OUT VOID   **Image,
+  IN OUT UINTN  *ImageSize
+  )
+{
+  EFI_STATUS Status;
+  LIST_ENTRY *Stages;
+  LIST_ENTRY *Link;
+  VOID       *NewImage;
+  UINTN      NewImageSize;
+  BOOLEAN    Allocated;
+
+  //
+  // The transform stages operate on the plain image.
+  //
+  if (FeaturePcdGet (PcdDecompressImages)) {
+    InternalDecompressImage (Allocation, Image, ImageSize);
+  }
+
+  Stages = &mStages[ImageLoadStageTransform];
+
+  for (
+    Link = GetFirstNode (Stages);
+    !IsNull (Stages, Link);
+    Link = GetNextNode (Stages, Link)
+    ) {
+    Allocated = FALSE;
+    Status    = IMAGE_LOAD_STAGE_FROM_LINK (Link)->Function.Transform (
+                                                              *Image,
+                                                              *ImageSize,
+                                                              &NewImage,
+                                                              &NewImageSize,
+                                                              &Allocated
+                                                              );
+
+    if (EFI_ERROR (Status)) {
+      continue;
+    }
+
+    //
+    // A new buffer no longer references the previous one.
+    //
+    if (Allocated) {
+      if (*Allocation != NULL) {
+        FreePool (*Allocation);
+      }
+
+      *Allocation = NewImage;
+    }
+
+    *Image     = NewImage;
+    *ImageSize = NewImageSize;
+  }
+}
+
+// InternalLoadImage
+/** Loads an EFI image into memory through the registered stages.
+
+  @param[in]   BootPolicy         If TRUE, indicates that the request
+                                  originates from the boot manager, and that
+                                  the boot manager is attempting to load
+                                  FilePath as a boot selection. Ignored if
+                                  SourceBuffer is not NULL.
+  @param[in]   ParentImageHandle  The caller's image handle.
+  @param[in]   DevicePath         The DeviceHandle specific file path from
+                                  which the image is loaded.
+  @param[in]   SourceBuffer       If not NULL, a pointer to the memory location
+                                  containing a copy of the image to be loaded.
+  @param[in]   SourceSize         The size in bytes of SourceBuffer. Ignored if
+                                  SourceBuffer is NULL.
+  @param[out]  ImageHandle        The pointer to the returned image handle that
+                                  is created when the  image is successfully
+                                  loaded.
+
+  @retval EFI_SUCCESS             Image was loaded into memory correctly.
+  @retval EFI_NOT_FOUND           Both SourceBuffer and DevicePath are NULL.
+  @retval EFI_INVALID_PARAMETER   One or more parameters are invalid.
+  @retval EFI_UNSUPPORTED         The image type is not supported.
+  @retval EFI_OUT_OF_RESOURCES    Image was not loaded due to insufficient
+                                  resources.
+  @retval EFI_LOAD_ERROR          Image was not loaded because the image format
+                                  was corrupt or not understood.
+  @retval EFI_DEVICE_ERROR        Image was not loaded because the device
+                                  returned a read error.
+  @retval EFI_ACCESS_DENIED       Image was not loaded because the platform
+                                  policy prohibits the image from being loaded.
+                                  NULL is returned in *ImageHandle.
+  @retval EFI_SECURITY_VIOLATION  Image was loaded and an ImageHandle was
+                                  created with a valid
+                                  EFI_LOADED_IMAGE_PROTOCOL. However, the
+                                  current platform policy specifies that the
+                                  image should not be started.
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+InternalLoadImage (
+  IN  BOOLEAN                   BootPolicy,
+  IN  EFI_HANDLE                ParentImageHandle,
+  IN  EFI_DEVICE_PATH_PROTOCOL  *DevicePath,
+  IN  VOID                      *SourceBuffer, OPTIONAL
+  IN  UINTN                     SourceSize,
+  OUT EFI_HANDLE                *ImageHandle
+  )
+{
+  EFI_STATUS Status;
+  VOID       *Allocation;
+  UINT64     StartTicks;
+  UINT64     ReadTicks;
+  UINTN      ReadSize;
+
+  ASSERT (ParentImageHandle != NULL);
+  ASSERT (DevicePath != NULL);
+  ASSERT ((((SourceSize != 0) ? 1 : 0)
+    ^ ((SourceBuffer == NULL) ? 1 : 0)) != 0);
+
+  ASSERT (ImageHandle != NULL);
+  ASSERT (!EfiAtRuntime ());
+  ASSERT (EfiGetCurrentTpl () < TPL_CALLBACK);
+  ASSERT (mLoadImage != NULL);
+
+  Allocation = NULL;
+  StartTicks = InternalReadTicks ();
+  ReadTicks  = 0;
+  ReadSize   = SourceSize;
+
+  if ((SourceBuffer == NULL) && (DevicePath != NULL)) {
+    DevicePath = InternalResolvePath (BootPolicy, DevicePath);
+    Status     = InternalReadImage (
+                   BootPolicy,
+                   DevicePath,
+                   &Allocation,
+                   &SourceSize
+                   );
+
+    if (!EFI_ERROR (Status)) {
+      SourceBuffer = Allocation;
+    }
+
+    ReadTicks  = (InternalReadTicks () - StartTicks);
+    StartTicks = (StartTicks + ReadTicks);
+    ReadSize   = SourceSize;
+  }
+
+  if (SourceBuffer != NULL) {
+    InternalTransformImage (&Allocation, &SourceBuffer, &SourceSize);
+
+    DEBUG ((
+      DEBUG_VERBOSE,
+      "ImageLoadPipeline: Read %lu bytes in %lu ticks, transformed to %lu bytes in %lu ticks\n",
+      (UINT64)ReadSize,
+      ReadTicks,
+      (UINT64)SourceSize,
+      (InternalReadTicks () - StartTicks)
+      ));
+  }
+
+  Status = mLoadImage (
+             BootPolicy,
+             ParentImageHandle,
+             DevicePath,
+             SourceBuffer,
+             SourceSize,
+             ImageHandle
+             );
+
+  //
+  // The files the boot selection reads next are fetched while it runs.
+  //
+  if (!EFI_ERROR (Status) && BootPolicy && (DevicePath != NULL)) {
+    ReadAheadStart (DevicePath);
+  }
+
+  if (Allocation != NULL) {
+    FreePool (Allocation);
+  }
+
+  return Status;
+}
+
+// mLoadImageHook
+STATIC SERVICE_HOOK mLoadImageHook = SERVICE_HOOK_BOOT (
+                                       LoadImage,
+                                       InternalLoadImage,
+                                       &mLoadImage
+                                       );
+
+// ImageLoadPipelineUnload
+EFI_STATUS
+EFIAPI
+ImageLoadPipelineUnload (
+  IN EFI_HANDLE  ImageHandle
+  )
+{
+  EFI_STATUS Status;
+  UINTN      Index;
+
+  DEBUG_CODE (
+    ASSERT (mLoadImage != NULL);
+    );
+
+  //
+  // The stage providers call back into this image until they are unloaded.
+  //
+  for (Index = 0; Index < ARRAY_SIZE (mStages); ++Index) {
+    if (!IsListEmpty (&mStages[Index])) {
+      return EFI_ACCESS_DENIED;
+    }
+  }
+
+  if (!ReadAheadFree ()) {
+    return EFI_ACCESS_DENIED;
+  }
+
+  Status = EfiUninstallMultipleProtocolInterfaces (
+             ImageHandle,
+             &gImageLoadPipelineProtocolGuid,
+             (VOID *)&mImageLoadPipeline,
+             NULL
+             );
+
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  Status = ServiceHookUninstallList (&mLoadImageHook, 1);
+
+  if (!EFI_ERROR (Status)) {
+    DEBUG_CODE (
+      mLoadImage = NULL;
+      );
+  }
+
+  return Status;
+}
+
+// ImageLoadPipelineMain
+/**
+
+  @param[in] ImageHandle  The firmware allocated handle for the EFI image.
+  @param[in] SystemTable  A pointer to the EFI System Table.
+
+  @retval EFI_SUCCESS          The entry point is executed successfully.
+  @retval EFI_ALREADY_STARTED  The protocol has already been installed.
+**/
+EFI_STATUS
+EFIAPI
+ImageLoadPipelineMain (
+  IN EFI_HANDLE        ImageHandle,
+  IN EFI_SYSTEM_TABLE  *SystemTable
+  )
+{
+  EFI_STATUS Status;
+  UINTN      Index;
+
+  DEBUG_CODE (
+    ASSERT (mLoadImage == NULL);
+    );
+
+  for (Index = 0; Index < ARRAY_SIZE (mStages); ++Index) {
+    InitializeListHead (&mStages[Index]);
+  }
+
+  Status = ServiceHookInstallList (&mLoadImageHook, 1);
+
+  ASSERT_EFI_ERROR (Status);
+
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  Status = EfiInstallMultipleProtocolInterfaces (
+             &ImageHandle,
+             &gImageLoadPipelineProtocolGuid,
+             (VOID *)&mImageLoadPipeline,
+             NULL
+             );
+
+  ASSERT_EFI_ERROR (Status);
+
+  if (EFI_ERROR (Status)) {
+    ServiceHookUninstallList (&mLoadImageHook, 1);
+  }
+
+  return Status;
+}
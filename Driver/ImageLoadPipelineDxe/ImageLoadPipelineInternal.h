@@ -0,0 +1,59 @@
+/** @file
+  Copyright (C) 2017, CupertinoNet.  All rights reserved.<BR>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+**/
+
+#ifndef IMAGE_LOAD_PIPELINE_INTERNAL_H_
+#define IMAGE_LOAD_PIPELINE_INTERNAL_H_
+
+/**
+  Returns the information of a file.
+
+  @param[in] File  The file to query.
+
+  @return  A pool buffer holding the file information or NULL.
+
+**/
+EFI_FILE_INFO *
+InternalGetFileInfo (
+  IN EFI_FILE_PROTOCOL  *File
+  );
+
+/**
+  Starts reading the files configured by PcdImageReadAheadFiles from the
+  volume of a loaded boot selection.  The files are served from memory when
+  they are opened from that volume later on.
+
+  @param[in] DevicePath  The device path the boot selection was loaded from.
+
+**/
+VOID
+ReadAheadStart (
+  IN EFI_DEVICE_PATH_PROTOCOL  *DevicePath
+  );
+
+/**
+  Frees the files read ahead.
+
+  @retval TRUE   All resources have been released.
+  @retval FALSE  Reads are still pending or file handles referencing this
+                 image may still be in use.
+
+**/
+BOOLEAN
+ReadAheadFree (
+  VOID
+  );
+
+#endif // IMAGE_LOAD_PIPELINE_INTERNAL_H_
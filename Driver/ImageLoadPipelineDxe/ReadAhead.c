@@ -0,0 +1,1363 @@
+/** @file
+  Copyright (C) 2017, CupertinoNet.  All rights reserved.<BR>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+**/
+
+#include <Uefi.h>
+
+#include <Guid/FileInfo.h>
+
+#include <Protocol/BlockIo.h>
+#include <Protocol/SimpleFileSystem.h>
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/DevicePathLib.h>
+#include <Library/EfiBootServicesLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/PcdLib.h>
+#include <Library/ServiceHookLib.h>
+#include <Library/UefiLib.h>
+
+#include "ImageLoadPipelineInternal.h"
+
+// READ_AHEAD_ENTRY
+typedef struct {
+  LIST_ENTRY        Link;
+  /// The volume-relative path of the file without leading separators.
+  CONST CHAR16      *FileName;
+  /// The file while the read is pending, NULL once it has completed.
+  EFI_FILE_PROTOCOL *File;
+  EFI_FILE_INFO     *FileInfo;
+  /// Token.Buffer is NULL if the read has failed.
+  EFI_FILE_IO_TOKEN Token;
+} READ_AHEAD_ENTRY;
+
+// READ_AHEAD_ENTRY_FROM_LINK
+#define READ_AHEAD_ENTRY_FROM_LINK(Entry)  \
+  BASE_CR ((Entry), READ_AHEAD_ENTRY, Link)
+
+#define READ_AHEAD_FILE_SIGNATURE  SIGNATURE_32 ('R', 'A', 'F', 'i')
+
+// READ_AHEAD_FILE
+typedef struct {
+  UINT32            Signature;
+  EFI_FILE_PROTOCOL Protocol;
+  READ_AHEAD_ENTRY  *Entry;
+  UINT64            Position;
+} READ_AHEAD_FILE;
+
+// READ_AHEAD_FILE_FROM_PROTOCOL
+#define READ_AHEAD_FILE_FROM_PROTOCOL(This)  \
+  CR ((This), READ_AHEAD_FILE, Protocol, READ_AHEAD_FILE_SIGNATURE)
+
+#define READ_AHEAD_FILTER_SIGNATURE  SIGNATURE_32 ('R', 'A', 'F', 'l')
+
+// READ_AHEAD_FILTER
+/// A file of the read-ahead volume.  All calls are passed on to the file
+/// system driver, changes of the volume drop the files read ahead.
+typedef struct {
+  UINT32            Signature;
+  EFI_FILE_PROTOCOL Protocol;
+  EFI_FILE_PROTOCOL *File;
+  /// Whether File is a root directory the files read ahead are served from.
+  BOOLEAN           Root;
+} READ_AHEAD_FILTER;
+
+// READ_AHEAD_FILTER_FROM_PROTOCOL
+#define READ_AHEAD_FILTER_FROM_PROTOCOL(This)  \
+  CR ((This), READ_AHEAD_FILTER, Protocol, READ_AHEAD_FILTER_SIGNATURE)
+
+// mEntries
+STATIC LIST_ENTRY mEntries = INITIALIZE_LIST_HEAD_VARIABLE (mEntries);
+
+// mFileNames
+/// A copy of PcdImageReadAheadFiles the entries' file names point into.
+STATIC CHAR16 *mFileNames = NULL;
+
+// InternalWrapFile
+/// Filters are returned for the files opened through a filter.
+STATIC
+EFI_FILE_PROTOCOL *
+InternalWrapFile (
+  IN EFI_FILE_PROTOCOL  *File,
+  IN BOOLEAN            Root
+  );
+
+// mHandle
+/// The handle of the volume the files are read from.
+STATIC EFI_HANDLE mHandle = NULL;
+
+// mFileSystem
+/// The file system the files are read from.  NULL once it has been removed.
+STATIC EFI_SIMPLE_FILE_SYSTEM_PROTOCOL *mFileSystem = NULL;
+
+// mBlockIo
+/// The block device below mFileSystem or NULL.
+STATIC EFI_BLOCK_IO_PROTOCOL *mBlockIo = NULL;
+
+// mMediaId
+/// The media the files have been read from.
+STATIC UINT32 mMediaId = 0;
+
+// mEntriesValid
+/// Whether the entries still reflect the volume.
+STATIC BOOLEAN mEntriesValid = FALSE;
+
+// mFileSystemInterposed
+/// Whether the file system filter has been returned to a caller.
+STATIC BOOLEAN mFileSystemInterposed = FALSE;
+
+// mHooksInstalled
+STATIC BOOLEAN mHooksInstalled = FALSE;
+
+// mHandleProtocol
+STATIC EFI_HANDLE_PROTOCOL mHandleProtocol = NULL;
+
+// mOpenProtocol
+STATIC EFI_OPEN_PROTOCOL mOpenProtocol = NULL;
+
+// InternalSkipSeparators
+STATIC
+CONST CHAR16 *
+InternalSkipSeparators (
+  IN CONST CHAR16  *FileName
+  )
+{
+  while (*FileName == L'\\') {
+    ++FileName;
+  }
+
+  return FileName;
+}
+
+// InternalFindEntry
+/** Returns the entry of a file name opened from the root directory.
+
+  @param[in] FileName  The file name to look up.
+
+  @return  The matching entry or NULL.
+**/
+STATIC
+READ_AHEAD_ENTRY *
+InternalFindEntry (
+  IN CONST CHAR16  *FileName
+  )
+{
+  LIST_ENTRY       *Link;
+  READ_AHEAD_ENTRY *Entry;
+  CONST CHAR16     *Name;
+  CONST CHAR16     *EntryName;
+
+  FileName = InternalSkipSeparators (FileName);
+
+  for (
+    Link = GetFirstNode (&mEntries);
+    !IsNull (&mEntries, Link);
+    Link = GetNextNode (&mEntries, Link)
+    ) {
+    Entry     = READ_AHEAD_ENTRY_FROM_LINK (Link);
+    Name      = FileName;
+    EntryName = Entry->FileName;
+
+    //
+    // File names are case-insensitive on the file systems booted from.
+    //
+    while ((*Name != L'\0')
+       && (CharToUpper (*Name) == CharToUpper (*EntryName))) {
+      ++Name;
+      ++EntryName;
+    }
+
+    if (*Name == *EntryName) {
+      return Entry;
+    }
+  }
+
+  return NULL;
+}
+
+// InternalCompleteEntry
+/** Finishes the read of an entry.
+
+  @param[in, out] Entry  The entry to finish the read of.
+  @param[in]      Wait   Whether to wait for a pending read.
+
+  @retval TRUE   The file has been read into Entry->Token.Buffer.
+  @retval FALSE  The read is pending or has failed.
+**/
+STATIC
+BOOLEAN
+InternalCompleteEntry (
+  IN OUT READ_AHEAD_ENTRY  *Entry,
+  IN     BOOLEAN           Wait
+  )
+{
+  EFI_STATUS Status;
+  UINTN      Index;
+
+  if (Entry->File != NULL) {
+    Status = EfiCheckEvent (Entry->Token.Event);
+
+    if (Status == EFI_NOT_READY) {
+      if (!Wait) {
+        return FALSE;
+      }
+
+      EfiWaitForEvent (1, &Entry->Token.Event, &Index);
+    }
+
+    EfiCloseEvent (Entry->Token.Event);
+    Entry->File->Close (Entry->File);
+
+    Entry->Token.Event = NULL;
+    Entry->File        = NULL;
+
+    if (EFI_ERROR (Entry->Token.Status)
+     || (Entry->Token.BufferSize != (UINTN)Entry->FileInfo->FileSize)) {
+      DEBUG ((
+        DEBUG_WARN,
+        "ImageLoadPipeline: Reading ahead %s failed - %r\n",
+        Entry->FileName,
+        Entry->Token.Status
+        ));
+
+      FreePool (Entry->Token.Buffer);
+      Entry->Token.Buffer = NULL;
+    }
+  }
+
+  return (Entry->Token.Buffer != NULL);
+}
+
+// InternalFreeEntry
+STATIC
+VOID
+InternalFreeEntry (
+  IN READ_AHEAD_ENTRY  *Entry
+  )
+{
+  ASSERT (Entry->File == NULL);
+
+  if (Entry->Token.Buffer != NULL) {
+    FreePool (Entry->Token.Buffer);
+  }
+
+  FreePool ((VOID *)Entry->FileInfo);
+  FreePool ((VOID *)Entry);
+}
+
+// InternalInvalidateEntries
+/** Stops serving the files read ahead, as the volume may have changed.
+**/
+STATIC
+VOID
+InternalInvalidateEntries (
+  VOID
+  )
+{
+  if (mEntriesValid) {
+    DEBUG ((
+      DEBUG_INFO,
+      "ImageLoadPipeline: Volume changed, dropping the files read ahead\n"
+      ));
+
+    mEntriesValid = FALSE;
+  }
+}
+
+// InternalDropFileSystem
+/** Stops reading ahead from a file system that has been removed.
+**/
+STATIC
+VOID
+InternalDropFileSystem (
+  VOID
+  )
+{
+  InternalInvalidateEntries ();
+
+  mHandle     = NULL;
+  mFileSystem = NULL;
+  mBlockIo    = NULL;
+}
+
+// InternalCheckMedia
+STATIC
+VOID
+InternalCheckMedia (
+  VOID
+  )
+{
+  if ((mBlockIo != NULL) && (mBlockIo->Media->MediaId != mMediaId)) {
+    InternalInvalidateEntries ();
+  }
+}
+
+// InternalFileOpen
+STATIC
+EFI_STATUS
+EFIAPI
+InternalFileOpen (
+  IN  EFI_FILE_PROTOCOL  *This,
+  OUT EFI_FILE_PROTOCOL  **NewHandle,
+  IN  CHAR16             *FileName,
+  IN  UINT64             OpenMode,
+  IN  UINT64             Attributes
+  )
+{
+  return EFI_UNSUPPORTED;
+}
+
+// InternalFileClose
+STATIC
+EFI_STATUS
+EFIAPI
+InternalFileClose (
+  IN EFI_FILE_PROTOCOL  *This
+  )
+{
+  FreePool ((VOID *)READ_AHEAD_FILE_FROM_PROTOCOL (This));
+
+  return EFI_SUCCESS;
+}
+
+// InternalFileDelete
+STATIC
+EFI_STATUS
+EFIAPI
+InternalFileDelete (
+  IN EFI_FILE_PROTOCOL  *This
+  )
+{
+  InternalFileClose (This);
+
+  return EFI_WARN_DELETE_FAILURE;
+}
+
+// InternalFileRead
+STATIC
+EFI_STATUS
+EFIAPI
+InternalFileRead (
+  IN     EFI_FILE_PROTOCOL  *This,
+  IN OUT UINTN              *BufferSize,
+  OUT    VOID               *Buffer
+  )
+{
+  READ_AHEAD_FILE *File;
+  UINTN           FileSize;
+
+  File     = READ_AHEAD_FILE_FROM_PROTOCOL (This);
+  FileSize = File->Entry->Token.BufferSize;
+
+  if (File->Position > FileSize) {
+    return EFI_DEVICE_ERROR;
+  }
+
+  if (*BufferSize > (FileSize - (UINTN)File->Position)) {
+    *BufferSize = (FileSize - (UINTN)File->Position);
+  }
+
+  CopyMem (
+    Buffer,
+    ((UINT8 *)File->Entry->Token.Buffer + (UINTN)File->Position),
+    *BufferSize
+    );
+
+  File->Position += *BufferSize;
+
+  return EFI_SUCCESS;
+}
+
+// InternalFileWrite
+STATIC
+EFI_STATUS
+EFIAPI
+InternalFileWrite (
+  IN     EFI_FILE_PROTOCOL  *This,
+  IN OUT UINTN              *BufferSize,
+  IN     VOID               *Buffer
+  )
+{
+  return EFI_ACCESS_DENIED;
+}
+
+// InternalFileGetPosition
+STATIC
+EFI_STATUS
+EFIAPI
+InternalFileGetPosition (
+  IN  EFI_FILE_PROTOCOL  *This,
+  OUT UINT64             *Position
+  )
+{
+  *Position = READ_AHEAD_FILE_FROM_PROTOCOL (This)->Position;
+
+  return EFI_SUCCESS;
+}
+
+// InternalFileSetPosition
+STATIC
+EFI_STATUS
+EFIAPI
+InternalFileSetPosition (
+  IN EFI_FILE_PROTOCOL  *This,
+  IN UINT64             Position
+  )
+{
+  READ_AHEAD_FILE *File;
+
+  File = READ_AHEAD_FILE_FROM_PROTOCOL (This);
+
+  //
+  // The maximum position requests the end of the file.
+  //
+  if (Position == MAX_UINT64) {
+    Position = File->Entry->Token.BufferSize;
+  }
+
+  File->Position = Position;
+
+  return EFI_SUCCESS;
+}
+
+// InternalFileGetInfo
+STATIC
+EFI_STATUS
+EFIAPI
+InternalFileGetInfo (
+  IN     EFI_FILE_PROTOCOL  *This,
+  IN     EFI_GUID           *InformationType,
+  IN OUT UINTN              *BufferSize,
+  OUT    VOID               *Buffer
+  )
+{
+  CONST EFI_FILE_INFO *FileInfo;
+
+  if (!CompareGuid (InformationType, &gEfiFileInfoGuid)) {
+    return EFI_UNSUPPORTED;
+  }
+
+  FileInfo = READ_AHEAD_FILE_FROM_PROTOCOL (This)->Entry->FileInfo;
+
+  if (*BufferSize < FileInfo->Size) {
+    *BufferSize = (UINTN)FileInfo->Size;
+    return EFI_BUFFER_TOO_SMALL;
+  }
+
+  *BufferSize = (UINTN)FileInfo->Size;
+  CopyMem (Buffer, (CONST VOID *)FileInfo, *BufferSize);
+
+  return EFI_SUCCESS;
+}
+
+// InternalFileSetInfo
+STATIC
+EFI_STATUS
+EFIAPI
+InternalFileSetInfo (
+  IN EFI_FILE_PROTOCOL  *This,
+  IN EFI_GUID           *InformationType,
+  IN UINTN              BufferSize,
+  IN VOID               *Buffer
+  )
+{
+  return EFI_ACCESS_DENIED;
+}
+
+// InternalFileFlush
+STATIC
+EFI_STATUS
+EFIAPI
+InternalFileFlush (
+  IN EFI_FILE_PROTOCOL  *This
+  )
+{
+  return EFI_ACCESS_DENIED;
+}
+
+// mFileTemplate
+/// The read-only file protocol serving an entry from memory.
+STATIC CONST EFI_FILE_PROTOCOL mFileTemplate = {
+  EFI_FILE_PROTOCOL_REVISION,
+  InternalFileOpen,
+  InternalFileClose,
+  InternalFileDelete,
+  InternalFileRead,
+  InternalFileWrite,
+  InternalFileGetPosition,
+  InternalFileSetPosition,
+  InternalFileGetInfo,
+  InternalFileSetInfo,
+  InternalFileFlush
+};
+
+// InternalOpenEntry
+/** Opens a file read ahead from memory.
+
+  @param[in]  FileName   The name of the file to open.
+  @param[out] NewHandle  Returns the opened file.
+
+  @retval EFI_SUCCESS    The file has been opened from memory.
+  @retval EFI_NOT_FOUND  The file has not been read ahead.
+**/
+STATIC
+EFI_STATUS
+InternalOpenEntry (
+  IN  CONST CHAR16       *FileName,
+  OUT EFI_FILE_PROTOCOL  **NewHandle
+  )
+{
+  READ_AHEAD_ENTRY *Entry;
+  READ_AHEAD_FILE  *File;
+
+  InternalCheckMedia ();
+
+  if (!mEntriesValid) {
+    return EFI_NOT_FOUND;
+  }
+
+  Entry = InternalFindEntry (FileName);
+
+  //
+  // Waiting for the read is only possible at TPL_APPLICATION, otherwise
+  // the file is read again.
+  //
+  if ((Entry == NULL)
+   || !InternalCompleteEntry (
+         Entry,
+         (BOOLEAN)(EfiGetCurrentTpl () == TPL_APPLICATION)
+         )) {
+    return EFI_NOT_FOUND;
+  }
+
+  File = AllocatePool (sizeof (*File));
+
+  if (File == NULL) {
+    return EFI_NOT_FOUND;
+  }
+
+  File->Signature = READ_AHEAD_FILE_SIGNATURE;
+  File->Entry     = Entry;
+  File->Position  = 0;
+
+  CopyMem (
+    (VOID *)&File->Protocol,
+    (CONST VOID *)&mFileTemplate,
+    sizeof (File->Protocol)
+    );
+
+  *NewHandle = &File->Protocol;
+
+  DEBUG ((
+    DEBUG_VERBOSE,
+    "ImageLoadPipeline: Serving %s from memory\n",
+    Entry->FileName
+    ));
+
+  return EFI_SUCCESS;
+}
+
+// InternalFilterOpen
+/** Opens a file of the read-ahead volume.  Files that have been read ahead
+    are served from memory when opened from a root directory.
+
+  @param[in]  This        The directory to open the file from.
+  @param[out] NewHandle   Returns the opened file.
+  @param[in]  FileName    The name of the file to open.
+  @param[in]  OpenMode    The mode to open the file with.
+  @param[in]  Attributes  The attributes for a newly created file.
+
+  @return  The status of the open operation.
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+InternalFilterOpen (
+  IN  EFI_FILE_PROTOCOL  *This,
+  OUT EFI_FILE_PROTOCOL  **NewHandle,
+  IN  CHAR16             *FileName,
+  IN  UINT64             OpenMode,
+  IN  UINT64             Attributes
+  )
+{
+  EFI_STATUS        Status;
+  READ_AHEAD_FILTER *Filter;
+
+  Filter = READ_AHEAD_FILTER_FROM_PROTOCOL (This);
+
+  if (Filter->Root
+   && (OpenMode == EFI_FILE_MODE_READ)
+   && (NewHandle != NULL)
+   && (FileName != NULL)) {
+    Status = InternalOpenEntry (FileName, NewHandle);
+
+    if (!EFI_ERROR (Status)) {
+      return Status;
+    }
+  }
+
+  if ((OpenMode & EFI_FILE_MODE_WRITE) != 0) {
+    InternalInvalidateEntries ();
+  }
+
+  Status = Filter->File->Open (
+                           Filter->File,
+                           NewHandle,
+                           FileName,
+                           OpenMode,
+                           Attributes
+                           );
+
+  if (!EFI_ERROR (Status)) {
+    *NewHandle = InternalWrapFile (*NewHandle, FALSE);
+  }
+
+  return Status;
+}
+
+// InternalFilterClose
+STATIC
+EFI_STATUS
+EFIAPI
+InternalFilterClose (
+  IN EFI_FILE_PROTOCOL  *This
+  )
+{
+  EFI_STATUS        Status;
+  READ_AHEAD_FILTER *Filter;
+
+  Filter = READ_AHEAD_FILTER_FROM_PROTOCOL (This);
+  Status = Filter->File->Close (Filter->File);
+
+  FreePool ((VOID *)Filter);
+
+  return Status;
+}
+
+// InternalFilterDelete
+STATIC
+EFI_STATUS
+EFIAPI
+InternalFilterDelete (
+  IN EFI_FILE_PROTOCOL  *This
+  )
+{
+  EFI_STATUS        Status;
+  READ_AHEAD_FILTER *Filter;
+
+  InternalInvalidateEntries ();
+
+  Filter = READ_AHEAD_FILTER_FROM_PROTOCOL (This);
+  Status = Filter->File->Delete (Filter->File);
+
+  FreePool ((VOID *)Filter);
+
+  return Status;
+}
+
+// InternalFilterRead
+STATIC
+EFI_STATUS
+EFIAPI
+InternalFilterRead (
+  IN     EFI_FILE_PROTOCOL  *This,
+  IN OUT UINTN              *BufferSize,
+  OUT    VOID               *Buffer
+  )
+{
+  EFI_FILE_PROTOCOL *File;
+
+  File = READ_AHEAD_FILTER_FROM_PROTOCOL (This)->File;
+
+  return File->Read (File, BufferSize, Buffer);
+}
+
+// InternalFilterWrite
+STATIC
+EFI_STATUS
+EFIAPI
+InternalFilterWrite (
+  IN     EFI_FILE_PROTOCOL  *This,
+  IN OUT UINTN              *BufferSize,
+  IN     VOID               *Buffer
+  )
+{
+  EFI_FILE_PROTOCOL *File;
+
+  InternalInvalidateEntries ();
+
+  File = READ_AHEAD_FILTER_FROM_PROTOCOL (This)->File;
+
+  return File->Write (File, BufferSize, Buffer);
+}
+
+// InternalFilterGetPosition
+STATIC
+EFI_STATUS
+EFIAPI
+InternalFilterGetPosition (
+  IN  EFI_FILE_PROTOCOL  *This,
+  OUT UINT64             *Position
+  )
+{
+  EFI_FILE_PROTOCOL *File;
+
+  File = READ_AHEAD_FILTER_FROM_PROTOCOL (This)->File;
+
+  return File->GetPosition (File, Position);
+}
+
+// InternalFilterSetPosition
+STATIC
+EFI_STATUS
+EFIAPI
+InternalFilterSetPosition (
+  IN EFI_FILE_PROTOCOL  *This,
+  IN UINT64             Position
+  )
+{
+  EFI_FILE_PROTOCOL *File;
+
+  File = READ_AHEAD_FILTER_FROM_PROTOCOL (This)->File;
+
+  return File->SetPosition (File, Position);
+}
+
+// InternalFilterGetInfo
+STATIC
+EFI_STATUS
+EFIAPI
+InternalFilterGetInfo (
+  IN     EFI_FILE_PROTOCOL  *This,
+  IN     EFI_GUID           *InformationType,
+  IN OUT UINTN              *BufferSize,
+  OUT    VOID               *Buffer
+  )
+{
+  EFI_FILE_PROTOCOL *File;
+
+  File = READ_AHEAD_FILTER_FROM_PROTOCOL (This)->File;
+
+  return File->GetInfo (File, InformationType, BufferSize, Buffer);
+}
+
+// InternalFilterSetInfo
+STATIC
+EFI_STATUS
+EFIAPI
+InternalFilterSetInfo (
+  IN EFI_FILE_PROTOCOL  *This,
+  IN EFI_GUID           *InformationType,
+  IN UINTN              BufferSize,
+  IN VOID               *Buffer
+  )
+{
+  EFI_FILE_PROTOCOL *File;
+
+  InternalInvalidateEntries ();
+
+  File = READ_AHEAD_FILTER_FROM_PROTOCOL (This)->File;
+
+  return File->SetInfo (File, InformationType, BufferSize, Buffer);
+}
+
+// InternalFilterFlush
+STATIC
+EFI_STATUS
+EFIAPI
+InternalFilterFlush (
+  IN EFI_FILE_PROTOCOL  *This
+  )
+{
+  EFI_FILE_PROTOCOL *File;
+
+  File = READ_AHEAD_FILTER_FROM_PROTOCOL (This)->File;
+
+  return File->Flush (File);
+}
+
+// InternalFilterOpenEx
+STATIC
+EFI_STATUS
+EFIAPI
+InternalFilterOpenEx (
+  IN     EFI_FILE_PROTOCOL  *This,
+  OUT    EFI_FILE_PROTOCOL  **NewHandle,
+  IN     CHAR16             *FileName,
+  IN     UINT64             OpenMode,
+  IN     UINT64             Attributes,
+  IN OUT EFI_FILE_IO_TOKEN  *Token
+  )
+{
+  EFI_FILE_PROTOCOL *File;
+
+  //
+  // The file is returned on completion and cannot be filtered, hence changes
+  // made through it are not seen.
+  //
+  InternalInvalidateEntries ();
+
+  File = READ_AHEAD_FILTER_FROM_PROTOCOL (This)->File;
+
+  return File->OpenEx (File, NewHandle, FileName, OpenMode, Attributes, Token);
+}
+
+// InternalFilterReadEx
+STATIC
+EFI_STATUS
+EFIAPI
+InternalFilterReadEx (
+  IN     EFI_FILE_PROTOCOL  *This,
+  IN OUT EFI_FILE_IO_TOKEN  *Token
+  )
+{
+  EFI_FILE_PROTOCOL *File;
+
+  File = READ_AHEAD_FILTER_FROM_PROTOCOL (This)->File;
+
+  return File->ReadEx (File, Token);
+}
+
+// InternalFilterWriteEx
+STATIC
+EFI_STATUS
+EFIAPI
+InternalFilterWriteEx (
+  IN     EFI_FILE_PROTOCOL  *This,
+  IN OUT EFI_FILE_IO_TOKEN  *Token
+  )
+{
+  EFI_FILE_PROTOCOL *File;
+
+  InternalInvalidateEntries ();
+
+  File = READ_AHEAD_FILTER_FROM_PROTOCOL (This)->File;
+
+  return File->WriteEx (File, Token);
+}
+
+// InternalFilterFlushEx
+STATIC
+EFI_STATUS
+EFIAPI
+InternalFilterFlushEx (
+  IN     EFI_FILE_PROTOCOL  *This,
+  IN OUT EFI_FILE_IO_TOKEN  *Token
+  )
+{
+  EFI_FILE_PROTOCOL *File;
+
+  File = READ_AHEAD_FILTER_FROM_PROTOCOL (This)->File;
+
+  return File->FlushEx (File, Token);
+}
+
+// mFilterTemplate
+STATIC CONST EFI_FILE_PROTOCOL mFilterTemplate = {
+  EFI_FILE_PROTOCOL_REVISION2,
+  InternalFilterOpen,
+  InternalFilterClose,
+  InternalFilterDelete,
+  InternalFilterRead,
+  InternalFilterWrite,
+  InternalFilterGetPosition,
+  InternalFilterSetPosition,
+  InternalFilterGetInfo,
+  InternalFilterSetInfo,
+  InternalFilterFlush,
+  InternalFilterOpenEx,
+  InternalFilterReadEx,
+  InternalFilterWriteEx,
+  InternalFilterFlushEx
+};
+
+// InternalWrapFile
+/** Returns a filter of a file opened from the read-ahead volume.
+
+  @param[in] File  The file to filter.
+  @param[in] Root  Whether File is a root directory.
+
+  @return  The filter or File if it cannot be allocated.
+**/
+STATIC
+EFI_FILE_PROTOCOL *
+InternalWrapFile (
+  IN EFI_FILE_PROTOCOL  *File,
+  IN BOOLEAN            Root
+  )
+{
+  READ_AHEAD_FILTER *Filter;
+
+  Filter = AllocatePool (sizeof (*Filter));
+
+  if (Filter == NULL) {
+    //
+    // Changes made through the plain file are not seen.
+    //
+    InternalInvalidateEntries ();
+    return File;
+  }
+
+  Filter->Signature = READ_AHEAD_FILTER_SIGNATURE;
+  Filter->File      = File;
+  Filter->Root      = Root;
+
+  CopyMem (
+    (VOID *)&Filter->Protocol,
+    (CONST VOID *)&mFilterTemplate,
+    sizeof (Filter->Protocol)
+    );
+
+  Filter->Protocol.Revision = File->Revision;
+
+  if (File->Revision < EFI_FILE_PROTOCOL_REVISION2) {
+    Filter->Protocol.OpenEx  = NULL;
+    Filter->Protocol.ReadEx  = NULL;
+    Filter->Protocol.WriteEx = NULL;
+    Filter->Protocol.FlushEx = NULL;
+  }
+
+  return &Filter->Protocol;
+}
+
+// InternalOpenVolume
+/** Opens the root directory of the read-ahead volume.
+
+  @param[in]  This  The Simple File System filter.
+  @param[out] Root  Returns the root directory.
+
+  @return  The status of the open operation.
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+InternalOpenVolume (
+  IN  EFI_SIMPLE_FILE_SYSTEM_PROTOCOL  *This,
+  OUT EFI_FILE_PROTOCOL                **Root
+  )
+{
+  EFI_STATUS Status;
+  VOID       *Interface;
+
+  //
+  // The file system may have been removed since the filter has been
+  // returned.
+  //
+  if (mFileSystem != NULL) {
+    Status = mHandleProtocol (
+               mHandle,
+               &gEfiSimpleFileSystemProtocolGuid,
+               &Interface
+               );
+
+    if (EFI_ERROR (Status) || (Interface != (VOID *)mFileSystem)) {
+      InternalDropFileSystem ();
+    }
+  }
+
+  if (mFileSystem == NULL) {
+    return EFI_NO_MEDIA;
+  }
+
+  Status = mFileSystem->OpenVolume (mFileSystem, Root);
+
+  if (Status == EFI_MEDIA_CHANGED) {
+    InternalInvalidateEntries ();
+  }
+
+  if (!EFI_ERROR (Status)) {
+    *Root = InternalWrapFile (*Root, TRUE);
+  }
+
+  return Status;
+}
+
+// mFileSystemFilter
+/// The Simple File System instance returned for the read-ahead volume.
+STATIC EFI_SIMPLE_FILE_SYSTEM_PROTOCOL mFileSystemFilter = {
+  EFI_SIMPLE_FILE_SYSTEM_PROTOCOL_REVISION,
+  InternalOpenVolume
+};
+
+// InternalInterposeFileSystem
+/** Replaces the read-ahead file system returned by a protocol lookup with
+    its filter.
+
+  @param[in]      Handle     The handle the protocol has been looked up on.
+  @param[in]      Protocol   The protocol that has been looked up.
+  @param[in]      Status     The status of the lookup.
+  @param[in, out] Interface  The interface that has been returned.
+**/
+STATIC
+VOID
+InternalInterposeFileSystem (
+  IN     EFI_HANDLE  Handle,
+  IN     EFI_GUID    *Protocol,
+  IN     EFI_STATUS  Status,
+  IN OUT VOID        **Interface
+  )
+{
+  if ((mFileSystem == NULL)
+   || (Handle != mHandle)
+   || (Protocol == NULL)
+   || (Interface == NULL)
+   || !CompareGuid (Protocol, &gEfiSimpleFileSystemProtocolGuid)) {
+    return;
+  }
+
+  //
+  // A file system that has been uninstalled or reinstalled, e.g. by a
+  // disconnect, is not read ahead from anymore.
+  //
+  if (EFI_ERROR (Status) || (*Interface != (VOID *)mFileSystem)) {
+    InternalDropFileSystem ();
+    return;
+  }
+
+  *Interface            = (VOID *)&mFileSystemFilter;
+  mFileSystemInterposed = TRUE;
+}
+
+// InternalHandleProtocol
+STATIC
+EFI_STATUS
+EFIAPI
+InternalHandleProtocol (
+  IN  EFI_HANDLE  Handle,
+  IN  EFI_GUID    *Protocol,
+  OUT VOID        **Interface
+  )
+{
+  EFI_STATUS Status;
+
+  Status = mHandleProtocol (Handle, Protocol, Interface);
+
+  InternalInterposeFileSystem (Handle, Protocol, Status, Interface);
+
+  return Status;
+}
+
+// InternalOpenProtocol
+STATIC
+EFI_STATUS
+EFIAPI
+InternalOpenProtocol (
+  IN  EFI_HANDLE  Handle,
+  IN  EFI_GUID    *Protocol,
+  OUT VOID        **Interface OPTIONAL,
+  IN  EFI_HANDLE  AgentHandle,
+  IN  EFI_HANDLE  ControllerHandle,
+  IN  UINT32      Attributes
+  )
+{
+  EFI_STATUS Status;
+
+  Status = mOpenProtocol (
+             Handle,
+             Protocol,
+             Interface,
+             AgentHandle,
+             ControllerHandle,
+             Attributes
+             );
+
+  //
+  // Drivers binding to the file system are returned the driver's instance.
+  //
+  if ((Attributes == EFI_OPEN_PROTOCOL_BY_HANDLE_PROTOCOL)
+   || (Attributes == EFI_OPEN_PROTOCOL_GET_PROTOCOL)) {
+    InternalInterposeFileSystem (Handle, Protocol, Status, Interface);
+  }
+
+  return Status;
+}
+
+// mReadAheadHooks
+STATIC SERVICE_HOOK mReadAheadHooks[] = {
+  SERVICE_HOOK_BOOT (HandleProtocol, InternalHandleProtocol, &mHandleProtocol),
+  SERVICE_HOOK_BOOT (OpenProtocol, InternalOpenProtocol, &mOpenProtocol)
+};
+
+// InternalStartRead
+/** Starts the non-blocking read of a file relative to a root directory.
+
+  @param[in]      Root      The root directory to open the file from.
+  @param[in]      FileName  The name of the file to read.
+  @param[in, out] Budget    The number of bytes that may still be read.  On
+                            output, decremented by the size of the file.
+**/
+STATIC
+VOID
+InternalStartRead (
+  IN     EFI_FILE_PROTOCOL  *Root,
+  IN     CONST CHAR16       *FileName,
+  IN OUT UINT32             *Budget
+  )
+{
+  EFI_STATUS        Status;
+  EFI_FILE_PROTOCOL *File;
+  READ_AHEAD_ENTRY  *Entry;
+
+  Status = Root->Open (
+                   Root,
+                   &File,
+                   (CHAR16 *)FileName,
+                   EFI_FILE_MODE_READ,
+                   0
+                   );
+
+  if (EFI_ERROR (Status)) {
+    return;
+  }
+
+  //
+  // Only revision 2 file protocols read asynchronously.
+  //
+  Entry = NULL;
+
+  if (File->Revision >= EFI_FILE_PROTOCOL_REVISION2) {
+    Entry = AllocateZeroPool (sizeof (*Entry));
+  }
+
+  if (Entry == NULL) {
+    File->Close (File);
+    return;
+  }
+
+  Entry->FileInfo = InternalGetFileInfo (File);
+
+  if ((Entry->FileInfo != NULL)
+   && ((Entry->FileInfo->Attribute & EFI_FILE_DIRECTORY) == 0)
+   && (Entry->FileInfo->FileSize != 0)
+   && (Entry->FileInfo->FileSize <= *Budget)) {
+    Entry->Token.BufferSize = (UINTN)Entry->FileInfo->FileSize;
+    Entry->Token.Buffer     = AllocatePool (Entry->Token.BufferSize);
+
+    if (Entry->Token.Buffer != NULL) {
+      Status = EfiCreateEvent (0, 0, NULL, NULL, &Entry->Token.Event);
+
+      if (!EFI_ERROR (Status)) {
+        Status = File->ReadEx (File, &Entry->Token);
+
+        if (!EFI_ERROR (Status)) {
+          Entry->FileName = FileName;
+          Entry->File     = File;
+
+          InsertTailList (&mEntries, &Entry->Link);
+
+          *Budget -= (UINT32)Entry->Token.BufferSize;
+
+          DEBUG ((
+            DEBUG_INFO,
+            "ImageLoadPipeline: Reading ahead %s (%lu bytes)\n",
+            FileName,
+            (UINT64)Entry->Token.BufferSize
+            ));
+
+          return;
+        }
+
+        EfiCloseEvent (Entry->Token.Event);
+      }
+
+      FreePool (Entry->Token.Buffer);
+    }
+  }
+
+  if (Entry->FileInfo != NULL) {
+    FreePool ((VOID *)Entry->FileInfo);
+  }
+
+  FreePool ((VOID *)Entry);
+  File->Close (File);
+}
+
+// ReadAheadStart
+VOID
+ReadAheadStart (
+  IN EFI_DEVICE_PATH_PROTOCOL  *DevicePath
+  )
+{
+  EFI_STATUS                      Status;
+  EFI_HANDLE                      Handle;
+  EFI_SIMPLE_FILE_SYSTEM_PROTOCOL *FileSystem;
+  EFI_BLOCK_IO_PROTOCOL           *BlockIo;
+  EFI_FILE_PROTOCOL               *Root;
+  CHAR16                          *FileName;
+  CHAR16                          *Separator;
+  UINT32                          Budget;
+
+  Budget = FixedPcdGet32 (PcdImageReadAheadBudget);
+
+  //
+  // Only the volume of the first boot selection is read ahead from.
+  //
+  if ((Budget == 0) || (mFileSystem != NULL) || (mFileNames != NULL)) {
+    return;
+  }
+
+  Status = EfiLocateDevicePath (
+             &gEfiSimpleFileSystemProtocolGuid,
+             &DevicePath,
+             &Handle
+             );
+
+  if (EFI_ERROR (Status)) {
+    return;
+  }
+
+  Status = EfiHandleProtocol (
+             Handle,
+             &gEfiSimpleFileSystemProtocolGuid,
+             (VOID **)&FileSystem
+             );
+
+  if (EFI_ERROR (Status)) {
+    return;
+  }
+
+  FileName   = (CHAR16 *)FixedPcdGetPtr (PcdImageReadAheadFiles);
+  mFileNames = AllocateCopyPool (StrSize (FileName), FileName);
+
+  if (mFileNames == NULL) {
+    return;
+  }
+
+  Status = FileSystem->OpenVolume (FileSystem, &Root);
+
+  if (!EFI_ERROR (Status)) {
+    for (FileName = mFileNames; *FileName != L'\0'; FileName = Separator) {
+      for (
+        Separator = FileName;
+        (*Separator != L'\0') && (*Separator != L';');
+        ++Separator
+        );
+
+      if (*Separator != L'\0') {
+        *Separator = L'\0';
+        ++Separator;
+      }
+
+      FileName = (CHAR16 *)InternalSkipSeparators (FileName);
+
+      if (*FileName != L'\0') {
+        InternalStartRead (Root, FileName, &Budget);
+      }
+    }
+
+    Root->Close (Root);
+  }
+
+  if (IsListEmpty (&mEntries)) {
+    //
+    // Keep mFileNames so that no other volume is read ahead from.
+    //
+    return;
+  }
+
+  //
+  // The file system is not changed, lookups of it return a filter instead.
+  //
+  Status = ServiceHookInstallList (
+             mReadAheadHooks,
+             ARRAY_SIZE (mReadAheadHooks)
+             );
+
+  if (EFI_ERROR (Status)) {
+    return;
+  }
+
+  Status = EfiHandleProtocol (
+             Handle,
+             &gEfiBlockIoProtocolGuid,
+             (VOID **)&BlockIo
+             );
+
+  if (!EFI_ERROR (Status)) {
+    mBlockIo = BlockIo;
+    mMediaId = BlockIo->Media->MediaId;
+  }
+
+  mHandle         = Handle;
+  mFileSystem     = FileSystem;
+  mEntriesValid   = TRUE;
+  mHooksInstalled = TRUE;
+}
+
+// ReadAheadFree
+BOOLEAN
+ReadAheadFree (
+  VOID
+  )
+{
+  EFI_STATUS       Status;
+  LIST_ENTRY       *Link;
+  READ_AHEAD_ENTRY *Entry;
+
+  //
+  // The filter and the files opened through it may still be in use.
+  //
+  if (mFileSystemInterposed) {
+    return FALSE;
+  }
+
+  for (
+    Link = GetFirstNode (&mEntries);
+    !IsNull (&mEntries, Link);
+    Link = GetNextNode (&mEntries, Link)
+    ) {
+    Entry = READ_AHEAD_ENTRY_FROM_LINK (Link);
+
+    InternalCompleteEntry (Entry, FALSE);
+
+    if (Entry->File != NULL) {
+      return FALSE;
+    }
+  }
+
+  if (mHooksInstalled) {
+    Status = ServiceHookUninstallList (
+               mReadAheadHooks,
+               ARRAY_SIZE (mReadAheadHooks)
+               );
+
+    if (EFI_ERROR (Status)) {
+      return FALSE;
+    }
+
+    mHooksInstalled = FALSE;
+  }
+
+  mHandle       = NULL;
+  mFileSystem   = NULL;
+  mBlockIo      = NULL;
+  mEntriesValid = FALSE;
+
+  while (!IsListEmpty (&mEntries)) {
+    Entry = READ_AHEAD_ENTRY_FROM_LINK (GetFirstNode (&mEntries));
+
+    RemoveEntryList (&Entry->Link);
+    InternalFreeEntry (Entry);
+  }
+
+  if (mFileNames != NULL) {
+    FreePool ((VOID *)mFileNames);
+    mFileNames = NULL;
+  }
+
+  return TRUE;
+}
@@ -0,0 +1,104 @@
+/** @file
+  Binary format of the memory map trace recorded by FirmwareFixesLib.
+
+  The trace is published as an EFI configuration table.  It consists of a
+  MEMORY_MAP_TRACE_HEADER followed by a ring of fixed-size
+  MEMORY_MAP_TRACE_RECORDs.  Record N is stored at index
+  N % NumberOfRecords; once NumberOfWrittenRecords exceeds NumberOfRecords,
+  the oldest records have been overwritten.
+
+  Copyright (C) 2017, CupertinoNet.  All rights reserved.<BR>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+**/
+
+#ifndef MEMORY_MAP_TRACE_H_
+#define MEMORY_MAP_TRACE_H_
+
+// MEMORY_MAP_TRACE_GUID
+#define MEMORY_MAP_TRACE_GUID  \
+  { 0x74E23F11, 0xECCD, 0x40D0, { 0xAB, 0x8F, 0x2A, 0x0B, 0xC6, 0x8D, 0xC0, 0xE1 } }
+
+// MEMORY_MAP_TRACE_SIGNATURE
+#define MEMORY_MAP_TRACE_SIGNATURE  SIGNATURE_32 ('M', 'M', 'T', 'R')
+
+// MEMORY_MAP_TRACE_VERSION
+#define MEMORY_MAP_TRACE_VERSION  1
+
+///
+/// The stage of InternalGetMemoryMap() a record has been produced by.  The
+/// firmware stage diffs the map returned by the firmware against the one
+/// returned by the previous call.  Every other stage diffs its output against
+/// the output of the stage before.
+///
+#define MEMORY_MAP_TRACE_STAGE_FIRMWARE  0
+#define MEMORY_MAP_TRACE_STAGE_SHRINK    1
+#define MEMORY_MAP_TRACE_STAGE_FIX       2
+#define MEMORY_MAP_TRACE_STAGE_MAXIMUM   3
+
+///
+/// A GetMemoryMap() call by the Apple booter started.  NumberOfPages holds
+/// the number of descriptors returned by the firmware.
+///
+#define MEMORY_MAP_TRACE_RECORD_CALL      0
+///
+/// The descriptor has been added.
+///
+#define MEMORY_MAP_TRACE_RECORD_ADDED     1
+///
+/// The descriptor has been removed.
+///
+#define MEMORY_MAP_TRACE_RECORD_REMOVED   2
+///
+/// The descriptor kept its range, but changed its type or attributes.
+/// OldType and OldAttribute hold the previous values.
+///
+#define MEMORY_MAP_TRACE_RECORD_RETYPED   3
+///
+/// The map did not fit the snapshot buffer and the stage has not been
+/// diffed.  NumberOfPages holds the number of descriptors.
+///
+#define MEMORY_MAP_TRACE_RECORD_OVERFLOW  4
+
+#pragma pack (1)
+
+// MEMORY_MAP_TRACE_RECORD
+typedef struct {
+  UINT8                Kind;
+  UINT8                Stage;
+  UINT16               Reserved;
+  UINT32               Sequence;
+  UINT32               Type;
+  UINT32               OldType;
+  EFI_PHYSICAL_ADDRESS PhysicalStart;
+  UINT64               NumberOfPages;
+  UINT64               Attribute;
+  UINT64               OldAttribute;
+} MEMORY_MAP_TRACE_RECORD;
+
+// MEMORY_MAP_TRACE_HEADER
+typedef struct {
+  UINT32 Signature;
+  UINT16 Version;
+  UINT16 HeaderSize;
+  UINT32 RecordSize;
+  UINT32 NumberOfRecords;
+  UINT64 NumberOfWrittenRecords;
+} MEMORY_MAP_TRACE_HEADER;
+
+#pragma pack ()
+
+// gMemoryMapTraceGuid
+extern EFI_GUID gMemoryMapTraceGuid;
+
+#endif // MEMORY_MAP_TRACE_H_
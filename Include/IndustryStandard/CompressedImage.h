@@ -0,0 +1,47 @@
+/** @file
+  Copyright (C) 2017, CupertinoNet.  All rights reserved.<BR>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+**/
+
+#ifndef COMPRESSED_IMAGE_H_
+#define COMPRESSED_IMAGE_H_
+
+// COMPRESSED_IMAGE_SIGNATURE
+#define COMPRESSED_IMAGE_SIGNATURE  SIGNATURE_32 ('C', 'E', 'F', 'I')
+
+// COMPRESSED_IMAGE_VERSION
+#define COMPRESSED_IMAGE_VERSION  1
+
+///
+/// The image is compressed as a single LZ4 block without a frame.
+///
+#define COMPRESSED_IMAGE_ALGORITHM_LZ4  1
+
+///
+/// A container wrapping a compressed EFI image or Fat Binary.  The
+/// compressed data immediately follows the header.
+///
+#pragma pack (1)
+
+typedef struct {
+  UINT32 Signature;
+  UINT16 Version;
+  UINT16 Algorithm;
+  UINT32 UncompressedSize;
+  UINT32 CompressedSize;
+} COMPRESSED_IMAGE_HEADER;
+
+#pragma pack ()
+
+#endif // COMPRESSED_IMAGE_H_
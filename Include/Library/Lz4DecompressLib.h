@@ -0,0 +1,45 @@
+/** @file
+  Copyright (C) 2017, CupertinoNet.  All rights reserved.<BR>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+**/
+
+#ifndef LZ4_DECOMPRESS_LIB_H_
+#define LZ4_DECOMPRESS_LIB_H_
+
+/**
+  Decompresses a single LZ4 block.  The input is untrusted and fully
+  bounds-checked.
+
+  @param[in]  Source           The compressed block.
+  @param[in]  SourceSize       The size, in bytes, of Source.
+  @param[out] Destination      The buffer to decompress into.
+  @param[in]  DestinationSize  The exact size, in bytes, of the decompressed
+                               data.
+
+  @retval RETURN_SUCCESS           The block has been decompressed.
+  @retval RETURN_VOLUME_CORRUPTED  The block is malformed or does not
+                                   decompress to exactly DestinationSize
+                                   bytes.
+
+**/
+RETURN_STATUS
+EFIAPI
+Lz4DecompressBlock (
+  IN  CONST VOID  *Source,
+  IN  UINTN       SourceSize,
+  OUT VOID        *Destination,
+  IN  UINTN       DestinationSize
+  );
+
+#endif // LZ4_DECOMPRESS_LIB_H_
@@ -0,0 +1,192 @@
+/** @file
+  Copyright (C) 2017, CupertinoNet.  All rights reserved.<BR>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+**/
+
+#ifndef SERVICE_HOOK_LIB_H_
+#define SERVICE_HOOK_LIB_H_
+
+// SERVICE_HOOK_TABLE
+typedef enum {
+  ServiceHookTableBoot,
+  ServiceHookTableRuntime,
+  ServiceHookTableMaximum
+} SERVICE_HOOK_TABLE;
+
+///
+/// A hook of a single Boot or Runtime Services slot.  The node is owned by
+/// the caller and must stay valid while it is installed.  On installation,
+/// *Original receives the service the hook has to call, which is the
+/// previous hook of the slot or the firmware service.  The library updates
+/// *Original when a hook below is removed, so hooks dispatch with a direct
+/// call through *Original and never look up the table.
+/// Hooks of runtime slots are entered through a thunk in Runtime Services
+/// code, so that they can be bypassed when they cannot be removed.
+///
+typedef struct {
+  LIST_ENTRY         Link;
+  SERVICE_HOOK_TABLE Table;
+  UINTN              Offset;
+  VOID               *Hook;
+  VOID               **Original;
+  BOOLEAN            Installed;
+  BOOLEAN            Bypassed;
+  VOID               *Thunk;
+} SERVICE_HOOK;
+
+///
+/// Initializers for static SERVICE_HOOK nodes.
+///
+#define SERVICE_HOOK_BOOT(Member, Hook, Original)               \
+  { { NULL, NULL }, ServiceHookTableBoot,                       \
+    OFFSET_OF (EFI_BOOT_SERVICES, Member), (VOID *)(Hook),      \
+    (VOID **)(Original), FALSE, FALSE, NULL }
+
+#define SERVICE_HOOK_RUNTIME(Member, Hook, Original)            \
+  { { NULL, NULL }, ServiceHookTableRuntime,                    \
+    OFFSET_OF (EFI_RUNTIME_SERVICES, Member), (VOID *)(Hook),   \
+    (VOID **)(Original), FALSE, FALSE, NULL }
+
+///
+/// The state of a batch of hook changes.  All changes of a transaction are
+/// applied at TPL_HIGH_LEVEL and the CRC32 of every changed table is
+/// updated once on commit.
+///
+typedef struct {
+  VOID    *Registry;
+  EFI_TPL OldTpl;
+  BOOLEAN Changed[ServiceHookTableMaximum];
+} SERVICE_HOOK_TRANSACTION;
+
+/**
+  Starts a transaction.  Must be called at or below TPL_NOTIFY, as the shared
+  registry may need to be located or installed.
+
+  @param[out] Transaction  The transaction to start.
+
+  @retval EFI_SUCCESS           The transaction has been started and the TPL
+                                has been raised to TPL_HIGH_LEVEL.
+  @retval EFI_OUT_OF_RESOURCES  The registry could not be allocated.
+
+**/
+EFI_STATUS
+ServiceHookBeginTransaction (
+  OUT SERVICE_HOOK_TRANSACTION  *Transaction
+  );
+
+/**
+  Installs Hook as the outermost hook of its slot.  A hook bypassed by
+  ServiceHookBypass() is reenabled at its current position.
+
+  @param[in, out] Transaction  The transaction started by
+                               ServiceHookBeginTransaction().
+  @param[in, out] Hook         The hook to install.
+
+  @retval EFI_SUCCESS          Hook has been installed.
+  @retval EFI_ALREADY_STARTED  Hook is installed already.
+
+**/
+EFI_STATUS
+ServiceHookInstall (
+  IN OUT SERVICE_HOOK_TRANSACTION  *Transaction,
+  IN OUT SERVICE_HOOK              *Hook
+  );
+
+/**
+  Removes Hook from the chain of its slot.  The hook above it, or the table
+  slot if Hook is the outermost one, is redirected to the service Hook
+  called.
+
+  @param[in, out] Transaction  The transaction started by
+                               ServiceHookBeginTransaction().
+  @param[in, out] Hook         The hook to remove.
+
+  @retval EFI_SUCCESS        Hook has been removed.
+  @retval EFI_NOT_STARTED    Hook is not installed.
+  @retval EFI_ACCESS_DENIED  Hook has been interposed by code not using this
+                             library and cannot be removed safely.
+
+**/
+EFI_STATUS
+ServiceHookUninstall (
+  IN OUT SERVICE_HOOK_TRANSACTION  *Transaction,
+  IN OUT SERVICE_HOOK              *Hook
+  );
+
+/**
+  Makes the thunk of a hook that cannot be removed call the service Hook
+  calls, so that Hook itself is no longer entered.  The hook stays linked and
+  the thunk follows the removal of the hooks below it.  This is to be used
+  for runtime hooks that are not to be called after ExitBootServices().
+
+  @param[in, out] Transaction  The transaction started by
+                               ServiceHookBeginTransaction().
+  @param[in, out] Hook         The hook to bypass.
+
+  @retval EFI_SUCCESS      Hook has been bypassed.
+  @retval EFI_NOT_STARTED  Hook is not installed.
+  @retval EFI_UNSUPPORTED  Hook has not been installed with a thunk.
+
+**/
+EFI_STATUS
+ServiceHookBypass (
+  IN OUT SERVICE_HOOK_TRANSACTION  *Transaction,
+  IN OUT SERVICE_HOOK              *Hook
+  );
+
+/**
+  Completes a transaction, updates the CRC32 of every changed table and
+  restores the TPL.
+
+  @param[in] Transaction  The transaction to complete.
+
+**/
+VOID
+ServiceHookCommitTransaction (
+  IN SERVICE_HOOK_TRANSACTION  *Transaction
+  );
+
+/**
+  Installs an array of hooks in a single transaction.  Either all hooks are
+  installed or none.
+
+  @param[in, out] Hooks          The hooks to install.
+  @param[in]      NumberOfHooks  The number of hooks in Hooks.
+
+  @return  The status of the first failing operation or EFI_SUCCESS.
+
+**/
+EFI_STATUS
+ServiceHookInstallList (
+  IN OUT SERVICE_HOOK  *Hooks,
+  IN     UINTN         NumberOfHooks
+  );
+
+/**
+  Removes an array of hooks in a single transaction.  Hooks that are not
+  installed or cannot be removed are skipped.
+
+  @param[in, out] Hooks          The hooks to remove.
+  @param[in]      NumberOfHooks  The number of hooks in Hooks.
+
+  @return  The status of the first failing removal or EFI_SUCCESS.
+
+**/
+EFI_STATUS
+ServiceHookUninstallList (
+  IN OUT SERVICE_HOOK  *Hooks,
+  IN     UINTN         NumberOfHooks
+  );
+
+#endif // SERVICE_HOOK_LIB_H_
@@ -0,0 +1,121 @@
+/** @file
+  Copyright (C) 2017, CupertinoNet.  All rights reserved.<BR>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+**/
+
+#ifndef APPLE_BOOTER_LIFECYCLE_H_
+#define APPLE_BOOTER_LIFECYCLE_H_
+
+// APPLE_BOOTER_LIFECYCLE_PROTOCOL_GUID
+#define APPLE_BOOTER_LIFECYCLE_PROTOCOL_GUID  \
+  { 0xF464E965, 0xCEA5, 0x4D8C, { 0x99, 0x7A, 0xE7, 0x98, 0xEF, 0xD6, 0xCD, 0x30 } }
+
+// APPLE_BOOTER_LIFECYCLE_PROTOCOL_REVISION
+#define APPLE_BOOTER_LIFECYCLE_PROTOCOL_REVISION  0x00000001
+
+///
+/// Well-known callback orders.  Start callbacks run in ascending, exit
+/// callbacks in descending order.
+///
+#define APPLE_BOOTER_CALLBACK_ORDER_FIRMWARE_FIXES  0x00000100
+
+// APPLE_BOOTER_LIFECYCLE_PROTOCOL
+typedef struct APPLE_BOOTER_LIFECYCLE_PROTOCOL APPLE_BOOTER_LIFECYCLE_PROTOCOL;
+
+// APPLE_BOOTER_START
+/** Called right before the Apple booter is started.
+
+  @param[in] BooterHandle  The image handle of the booter.
+  @param[in] Context       The context of the callback.
+**/
+typedef
+VOID
+(EFIAPI *APPLE_BOOTER_START)(
+  IN EFI_HANDLE  BooterHandle,
+  IN VOID        *Context
+  );
+
+// APPLE_BOOTER_EXIT
+/** Called once the Apple booter has returned from StartImage().
+
+  @param[in] BooterHandle  The image handle of the booter.
+  @param[in] ExitStatus    The status StartImage() has returned.
+  @param[in] Context       The context of the callback.
+**/
+typedef
+VOID
+(EFIAPI *APPLE_BOOTER_EXIT)(
+  IN EFI_HANDLE  BooterHandle,
+  IN EFI_STATUS  ExitStatus,
+  IN VOID        *Context
+  );
+
+///
+/// The callbacks of a booter lifecycle client.  The node is owned by the
+/// registering image and must stay valid until it has been unregistered.
+/// Start and Exit are optional.
+///
+typedef struct {
+  LIST_ENTRY         Link;
+  UINT32             Order;
+  APPLE_BOOTER_START Start;
+  APPLE_BOOTER_EXIT  Exit;
+  VOID               *Context;
+} APPLE_BOOTER_CALLBACK;
+
+// APPLE_BOOTER_LIFECYCLE_REGISTER_CALLBACK
+/** Adds a client to the booter lifecycle.
+
+  @param[in] This      The protocol instance.
+  @param[in] Callback  The callbacks to add.
+
+  @retval EFI_SUCCESS  The callbacks have been added.
+**/
+typedef
+EFI_STATUS
+(EFIAPI *APPLE_BOOTER_LIFECYCLE_REGISTER_CALLBACK)(
+  IN APPLE_BOOTER_LIFECYCLE_PROTOCOL  *This,
+  IN APPLE_BOOTER_CALLBACK            *Callback
+  );
+
+// APPLE_BOOTER_LIFECYCLE_UNREGISTER_CALLBACK
+/** Removes a client from the booter lifecycle.
+
+  @param[in] This      The protocol instance.
+  @param[in] Callback  The callbacks to remove.
+
+  @retval EFI_SUCCESS  The callbacks have been removed.
+**/
+typedef
+EFI_STATUS
+(EFIAPI *APPLE_BOOTER_LIFECYCLE_UNREGISTER_CALLBACK)(
+  IN APPLE_BOOTER_LIFECYCLE_PROTOCOL  *This,
+  IN APPLE_BOOTER_CALLBACK            *Callback
+  );
+
+///
+/// Installed by AppleBooterNotifyDxe, which calls the registered clients
+/// directly whenever it starts the Apple booter.  Supersedes the
+/// installation of gAppleBooterHandleProtocolGuid.
+///
+struct APPLE_BOOTER_LIFECYCLE_PROTOCOL {
+  UINT32                                     Revision;
+  APPLE_BOOTER_LIFECYCLE_REGISTER_CALLBACK   RegisterCallback;
+  APPLE_BOOTER_LIFECYCLE_UNREGISTER_CALLBACK UnregisterCallback;
+};
+
+// gAppleBooterLifecycleProtocolGuid
+extern EFI_GUID gAppleBooterLifecycleProtocolGuid;
+
+#endif // APPLE_BOOTER_LIFECYCLE_H_
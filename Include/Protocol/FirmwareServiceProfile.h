@@ -0,0 +1,79 @@
+/** @file
+  Copyright (C) 2017, CupertinoNet.  All rights reserved.<BR>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+**/
+
+#ifndef FIRMWARE_SERVICE_PROFILE_H_
+#define FIRMWARE_SERVICE_PROFILE_H_
+
+// FIRMWARE_SERVICE_PROFILE_PROTOCOL_GUID
+#define FIRMWARE_SERVICE_PROFILE_PROTOCOL_GUID  \
+  { 0x526C7754, 0xB757, 0x406C, { 0xA3, 0xF3, 0xE8, 0x90, 0x4A, 0x8B, 0xD4, 0x18 } }
+
+// FIRMWARE_SERVICE_PROFILE_PROTOCOL_REVISION
+#define FIRMWARE_SERVICE_PROFILE_PROTOCOL_REVISION  0x00000001
+
+///
+/// The number of latency buckets per service.  Bucket 0 counts calls that
+/// took less than one tick, bucket N > 0 those that took [2^(N-1), 2^N)
+/// ticks.  The last bucket also counts all longer calls.
+///
+#define FIRMWARE_SERVICE_PROFILE_BUCKETS  40
+
+// FIRMWARE_SERVICE_PROFILE_NAME_SIZE
+#define FIRMWARE_SERVICE_PROFILE_NAME_SIZE  24
+
+// FIRMWARE_SERVICE_PROFILE_SERVICE
+typedef enum {
+  FirmwareServiceProfileGetMemoryMap,
+  FirmwareServiceProfileHandleProtocol,
+  FirmwareServiceProfileAllocatePages,
+  FirmwareServiceProfileAllocatePool,
+  FirmwareServiceProfileExitBootServices,
+  FirmwareServiceProfileFreePages,
+  FirmwareServiceProfileFreePool,
+  FirmwareServiceProfileSetVirtualAddressMap,
+  FirmwareServiceProfileGetVariable,
+  FirmwareServiceProfileGetNextVariableName,
+  FirmwareServiceProfileSetVariable,
+  FirmwareServiceProfileMaximum
+} FIRMWARE_SERVICE_PROFILE_SERVICE;
+
+///
+/// The latency profile of a single service.  Latencies are measured in Time
+/// Stamp Counter ticks and only cover the time spent in the firmware.
+///
+typedef struct {
+  CHAR8  Name[FIRMWARE_SERVICE_PROFILE_NAME_SIZE];
+  UINT64 NumberOfCalls;
+  UINT64 TotalTicks;
+  UINT64 MaximumTicks;
+  UINT64 Histogram[FIRMWARE_SERVICE_PROFILE_BUCKETS];
+} FIRMWARE_SERVICE_PROFILE_ENTRY;
+
+///
+/// Data-only protocol exposing the latency profiles of the Boot and Runtime
+/// Services interposed by FirmwareFixesLib.  Services[] is indexed by
+/// FIRMWARE_SERVICE_PROFILE_SERVICE.
+///
+typedef struct {
+  UINT32                         Revision;
+  UINT32                         NumberOfServices;
+  FIRMWARE_SERVICE_PROFILE_ENTRY Services[FirmwareServiceProfileMaximum];
+} FIRMWARE_SERVICE_PROFILE_PROTOCOL;
+
+// gFirmwareServiceProfileProtocolGuid
+extern EFI_GUID gFirmwareServiceProfileProtocolGuid;
+
+#endif // FIRMWARE_SERVICE_PROFILE_H_
@@ -0,0 +1,178 @@
+/** @file
+  Copyright (C) 2017, CupertinoNet.  All rights reserved.<BR>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+**/
+
+#ifndef IMAGE_LOAD_PIPELINE_H_
+#define IMAGE_LOAD_PIPELINE_H_
+
+#include <Guid/FileInfo.h>
+
+#include <Protocol/SimpleFileSystem.h>
+
+// IMAGE_LOAD_PIPELINE_PROTOCOL_GUID
+#define IMAGE_LOAD_PIPELINE_PROTOCOL_GUID  \
+  { 0xFFC2C108, 0x5965, 0x41AB, { 0x83, 0x2F, 0x33, 0xAE, 0x24, 0xAB, 0xF1, 0xE0 } }
+
+// IMAGE_LOAD_PIPELINE_PROTOCOL_REVISION
+#define IMAGE_LOAD_PIPELINE_PROTOCOL_REVISION  0x00000001
+
+///
+/// Well-known stage orders.  Stages of the same type run in ascending order.
+///
+#define IMAGE_LOAD_STAGE_ORDER_BLESS       0x00000100
+#define IMAGE_LOAD_STAGE_ORDER_FAT_BINARY  0x00000200
+
+// IMAGE_LOAD_PIPELINE_PROTOCOL
+typedef struct IMAGE_LOAD_PIPELINE_PROTOCOL IMAGE_LOAD_PIPELINE_PROTOCOL;
+
+// IMAGE_LOAD_STAGE_TYPE
+typedef enum {
+  ImageLoadStageResolvePath,
+  ImageLoadStageReadFile,
+  ImageLoadStageTransform,
+  ImageLoadStageMaximum
+} IMAGE_LOAD_STAGE_TYPE;
+
+// IMAGE_LOAD_STAGE_RESOLVE_PATH
+/** Resolves the device path of the image to load.
+
+  @param[in]  BootPolicy    Whether the boot manager loads a boot selection.
+  @param[in]  DevicePath    The device path resolved by the previous stages.
+  @param[out] ResolvedPath  Returns the device path to load from.  It is
+                            owned by the stage.
+
+  @retval EFI_SUCCESS  DevicePath has been resolved to ResolvedPath.
+  @retval other        DevicePath is kept.
+**/
+typedef
+EFI_STATUS
+(EFIAPI *IMAGE_LOAD_STAGE_RESOLVE_PATH)(
+  IN  BOOLEAN                   BootPolicy,
+  IN  EFI_DEVICE_PATH_PROTOCOL  *DevicePath,
+  OUT EFI_DEVICE_PATH_PROTOCOL  **ResolvedPath
+  );
+
+// IMAGE_LOAD_STAGE_READ_FILE
+/** Reads the image from a file opened by the pipeline.  The first stage that
+    succeeds provides the image, otherwise the entire file is read.
+
+  @param[in]  DevicePath  The device path of the file.
+  @param[in]  File        The opened file, positioned at its start.
+  @param[in]  FileInfo    The information of File.
+  @param[out] Buffer      Returns a pool buffer holding the image.
+  @param[out] BufferSize  Returns the size, in bytes, of Buffer.
+
+  @retval EFI_SUCCESS  The image has been read.
+  @retval other        The stage did not read the image.  The file position
+                       may have been changed.
+**/
+typedef
+EFI_STATUS
+(EFIAPI *IMAGE_LOAD_STAGE_READ_FILE)(
+  IN  EFI_DEVICE_PATH_PROTOCOL  *DevicePath,
+  IN  EFI_FILE_PROTOCOL         *File,
+  IN  CONST EFI_FILE_INFO       *FileInfo,
+  OUT VOID                      **Buffer,
+  OUT UINTN                     *BufferSize
+  );
+
+// IMAGE_LOAD_STAGE_TRANSFORM
+/** Transforms the plain image in memory, e.g. by thinning it.  Compressed
+    images have already been decompressed by the pipeline.
+
+  @param[in]  Image         The image returned by the previous stages.
+  @param[in]  ImageSize     The size, in bytes, of Image.
+  @param[out] NewImage      Returns the transformed image.  It either points
+                            into Image or is a pool buffer owned by the
+                            pipeline.
+  @param[out] NewImageSize  Returns the size, in bytes, of NewImage.
+  @param[out] Allocated     Returns whether NewImage is a pool buffer.
+
+  @retval EFI_SUCCESS      The image has been transformed.
+  @retval EFI_UNSUPPORTED  The stage does not apply to Image.
+  @retval other            The image could not be transformed and is kept.
+**/
+typedef
+EFI_STATUS
+(EFIAPI *IMAGE_LOAD_STAGE_TRANSFORM)(
+  IN  VOID     *Image,
+  IN  UINTN    ImageSize,
+  OUT VOID     **NewImage,
+  OUT UINTN    *NewImageSize,
+  OUT BOOLEAN  *Allocated
+  );
+
+///
+/// A stage of the LoadImage pipeline.  The node is owned by the registering
+/// image and must stay valid until it has been unregistered.
+///
+typedef struct {
+  LIST_ENTRY            Link;
+  IMAGE_LOAD_STAGE_TYPE Type;
+  UINT32                Order;
+  union {
+    IMAGE_LOAD_STAGE_RESOLVE_PATH ResolvePath;
+    IMAGE_LOAD_STAGE_READ_FILE    ReadFile;
+    IMAGE_LOAD_STAGE_TRANSFORM    Transform;
+  }                     Function;
+} IMAGE_LOAD_STAGE;
+
+// IMAGE_LOAD_PIPELINE_REGISTER_STAGE
+/** Adds a stage to the pipeline.
+
+  @param[in] This   The protocol instance.
+  @param[in] Stage  The stage to add.
+
+  @retval EFI_SUCCESS            The stage has been added.
+  @retval EFI_INVALID_PARAMETER  The stage type is invalid.
+**/
+typedef
+EFI_STATUS
+(EFIAPI *IMAGE_LOAD_PIPELINE_REGISTER_STAGE)(
+  IN IMAGE_LOAD_PIPELINE_PROTOCOL  *This,
+  IN IMAGE_LOAD_STAGE              *Stage
+  );
+
+// IMAGE_LOAD_PIPELINE_UNREGISTER_STAGE
+/** Removes a stage from the pipeline.
+
+  @param[in] This   The protocol instance.
+  @param[in] Stage  The stage to remove.
+
+  @retval EFI_SUCCESS  The stage has been removed.
+**/
+typedef
+EFI_STATUS
+(EFIAPI *IMAGE_LOAD_PIPELINE_UNREGISTER_STAGE)(
+  IN IMAGE_LOAD_PIPELINE_PROTOCOL  *This,
+  IN IMAGE_LOAD_STAGE              *Stage
+  );
+
+///
+/// Installed by ImageLoadPipelineDxe, which owns the only LoadImage hook.
+/// Images are resolved, read once into a single buffer, transformed and
+/// handed to the firmware loader by the registered stages, independent of
+/// the order in which the stage providers have been loaded.
+///
+struct IMAGE_LOAD_PIPELINE_PROTOCOL {
+  UINT32                               Revision;
+  IMAGE_LOAD_PIPELINE_REGISTER_STAGE   RegisterStage;
+  IMAGE_LOAD_PIPELINE_UNREGISTER_STAGE UnregisterStage;
+};
+
+// gImageLoadPipelineProtocolGuid
+extern EFI_GUID gImageLoadPipelineProtocolGuid;
+
+#endif // IMAGE_LOAD_PIPELINE_H_
@@ -0,0 +1,48 @@
+/** @file
+  Copyright (C) 2017, CupertinoNet.  All rights reserved.<BR>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+**/
+
+#ifndef SERVICE_HOOK_REGISTRY_H_
+#define SERVICE_HOOK_REGISTRY_H_
+
+// SERVICE_HOOK_REGISTRY_PROTOCOL_GUID
+#define SERVICE_HOOK_REGISTRY_PROTOCOL_GUID  \
+  { 0x788E9C22, 0x3731, 0x4D60, { 0xBE, 0x3D, 0xF1, 0x2A, 0x99, 0x01, 0x45, 0x80 } }
+
+// SERVICE_HOOK_REGISTRY_PROTOCOL_REVISION
+#define SERVICE_HOOK_REGISTRY_PROTOCOL_REVISION  0x00000002
+
+///
+/// Data-only protocol shared by all ServiceHookLib instances.  It is
+/// allocated from pool so that it outlives the image that installed it.
+/// Hooks holds the SERVICE_HOOK nodes of all images in the order they have
+/// been installed, so that the hooks of a slot form a chain from the oldest
+/// (innermost) to the newest (outermost) one.
+/// Thunks is an array of NumberOfThunks thunks in Runtime Services code,
+/// owned by ServiceHookLib, the hooks of runtime slots are entered through.
+///
+typedef struct {
+  UINT32     Revision;
+  UINT32     Reserved;
+  LIST_ENTRY Hooks;
+  VOID       *Thunks;
+  UINTN      NumberOfThunks;
+  UINTN      NumberOfUsedThunks;
+} SERVICE_HOOK_REGISTRY_PROTOCOL;
+
+// gServiceHookRegistryProtocolGuid
+extern EFI_GUID gServiceHookRegistryProtocolGuid;
+
+#endif // SERVICE_HOOK_REGISTRY_H_
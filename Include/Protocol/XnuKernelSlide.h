@@ -0,0 +1,69 @@
+/** @file
+  Copyright (C) 2017, CupertinoNet.  All rights reserved.<BR>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+**/
+
+#ifndef XNU_KERNEL_SLIDE_H_
+#define XNU_KERNEL_SLIDE_H_
+
+// XNU_KERNEL_SLIDE_PROTOCOL_GUID
+#define XNU_KERNEL_SLIDE_PROTOCOL_GUID  \
+  { 0x1D822299, 0xDFAD, 0x43A7, { 0x92, 0x3C, 0x26, 0x5A, 0xC3, 0xFF, 0x7B, 0x33 } }
+
+// XNU_KERNEL_SLIDE_PROTOCOL_REVISION
+#define XNU_KERNEL_SLIDE_PROTOCOL_REVISION  0x00000001
+
+///
+/// The physical address the kernel is loaded at with a slide of 0.
+///
+#define XNU_KERNEL_SLIDE_BASE         BASE_1MB
+
+///
+/// The distance in bytes between two consecutive slide values.
+///
+#define XNU_KERNEL_SLIDE_GRANULARITY  SIZE_2MB
+
+///
+/// The number of slide values boot.efi chooses from.
+///
+#define XNU_KERNEL_SLIDE_MAXIMUM      256
+
+// XNU_KERNEL_SLIDE_ADDRESS
+#define XNU_KERNEL_SLIDE_ADDRESS(Slide)  \
+  (XNU_KERNEL_SLIDE_BASE + ((UINT64)(Slide) * XNU_KERNEL_SLIDE_GRANULARITY))
+
+///
+/// The top of the highest kernel window for a kernel of RequiredSize bytes.
+///
+#define XNU_KERNEL_SLIDE_CEILING(RequiredSize)  \
+  (XNU_KERNEL_SLIDE_ADDRESS (XNU_KERNEL_SLIDE_MAXIMUM - 1) + (RequiredSize))
+
+///
+/// Data-only protocol describing which kernel slides fit the memory map the
+/// Apple booter has been handed last.  Bit N of ValidSlides is set if the
+/// window [XNU_KERNEL_SLIDE_ADDRESS (N), + RequiredSize) lies within a single
+/// free memory descriptor.
+///
+typedef struct {
+  UINT32 Revision;
+  UINT32 NumberOfValidSlides;
+  UINT64 RequiredSize;
+  UINT64 NumberOfUpdates;
+  UINT8  ValidSlides[XNU_KERNEL_SLIDE_MAXIMUM / 8];
+} XNU_KERNEL_SLIDE_PROTOCOL;
+
+// gXnuKernelSlideProtocolGuid
+extern EFI_GUID gXnuKernelSlideProtocolGuid;
+
+#endif // XNU_KERNEL_SLIDE_H_
@@ -0,0 +1,451 @@
+/** @file
+  Copyright (C) 2017, CupertinoNet.  All rights reserved.<BR>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+**/
+
+#include <Uefi.h>
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/EfiBootServicesLib.h>
+#include <Library/PcdLib.h>
+
+#include "FirmwareFixesInternal.h"
+
+// ALLOCATION_RECORD
+typedef struct {
+  EFI_PHYSICAL_ADDRESS Address;
+  UINT64               Size;
+  VOID                 *Caller;
+  UINT32               Sequence;
+  EFI_MEMORY_TYPE      MemoryType;
+  BOOLEAN              Used;
+  BOOLEAN              Pool;
+} ALLOCATION_RECORD;
+
+///
+/// Memory types the OEMs and OS loaders may define are summarized in the last
+/// entry of the report.
+///
+#define ALLOCATION_TRACKER_TYPES  ((UINTN)EfiMaxMemoryType + 1)
+
+STATIC ALLOCATION_RECORD *mAllocationRecords    = NULL;
+STATIC UINTN             mAllocationMask       = 0;
+STATIC UINTN             mAllocationShift      = 0;
+STATIC UINTN             mNumberOfAllocations  = 0;
+STATIC UINT32            mAllocationSequence   = 0;
+STATIC UINT32            mUntrackedFrees       = 0;
+STATIC UINT32            mDroppedAllocations   = 0;
+STATIC BOOLEAN           mReportingAllocations = FALSE;
+
+// InternalGetAllocationSlot
+STATIC
+UINTN
+InternalGetAllocationSlot (
+  IN EFI_PHYSICAL_ADDRESS  Address
+  )
+{
+  //
+  // Pool allocations are at least 8-byte aligned.  Fibonacci hashing keeps
+  // the high bits of the product, which depend on all bits of the address,
+  // so that even page- and large-page-aligned addresses spread over the whole
+  // table.
+  //
+  return (UINTN)RShiftU64 (
+                  MultU64x64 (RShiftU64 (Address, 3), 0x9E3779B97F4A7C15ULL),
+                  (64 - mAllocationShift)
+                  );
+}
+
+// InternalFindAllocation
+STATIC
+ALLOCATION_RECORD *
+InternalFindAllocation (
+  IN EFI_PHYSICAL_ADDRESS  Address
+  )
+{
+  ALLOCATION_RECORD *Record;
+  UINTN             Slot;
+
+  Slot = InternalGetAllocationSlot (Address);
+
+  for (Record = &mAllocationRecords[Slot];
+       Record->Used;
+       Record = &mAllocationRecords[Slot]) {
+    if (Record->Address == Address) {
+      return Record;
+    }
+
+    Slot = ((Slot + 1) & mAllocationMask);
+  }
+
+  return NULL;
+}
+
+// InternalFindContainingAllocation
+STATIC
+ALLOCATION_RECORD *
+InternalFindContainingAllocation (
+  IN EFI_PHYSICAL_ADDRESS  Address,
+  IN UINT64                Size
+  )
+{
+  ALLOCATION_RECORD *Record;
+  UINTN             Index;
+
+  //
+  // The table is keyed by the start of the allocations, hence frees of pages
+  // from within an allocation have to walk it.  These are rare compared to
+  // frees of whole allocations.
+  //
+  for (Index = 0; Index <= mAllocationMask; ++Index) {
+    Record = &mAllocationRecords[Index];
+
+    if (Record->Used
+     && !Record->Pool
+     && (Address > Record->Address)
+     && ((Address + Size) <= (Record->Address + Record->Size))) {
+      return Record;
+    }
+  }
+
+  return NULL;
+}
+
+// InternalInsertAllocation
+STATIC
+VOID
+InternalInsertAllocation (
+  IN CONST ALLOCATION_RECORD  *Record
+  )
+{
+  UINTN Slot;
+
+  Slot = InternalGetAllocationSlot (Record->Address);
+
+  while (mAllocationRecords[Slot].Used) {
+    Slot = ((Slot + 1) & mAllocationMask);
+  }
+
+  CopyMem (&mAllocationRecords[Slot], Record, sizeof (*Record));
+
+  ++mNumberOfAllocations;
+}
+
+// InternalRemoveAllocation
+STATIC
+VOID
+InternalRemoveAllocation (
+  IN ALLOCATION_RECORD  *Record
+  )
+{
+  UINTN Hole;
+  UINTN Slot;
+  UINTN Home;
+
+  //
+  // Shift the following records of the cluster back so that no lookup stops
+  // early at the hole, which avoids tombstones.
+  //
+  Hole = (UINTN)(Record - mAllocationRecords);
+  Slot = Hole;
+
+  while (TRUE) {
+    Slot = ((Slot + 1) & mAllocationMask);
+
+    if (!mAllocationRecords[Slot].Used) {
+      break;
+    }
+
+    Home = InternalGetAllocationSlot (mAllocationRecords[Slot].Address);
+
+    if (((Slot - Home) & mAllocationMask) >= ((Slot - Hole) & mAllocationMask)) {
+      CopyMem (
+        &mAllocationRecords[Hole],
+        &mAllocationRecords[Slot],
+        sizeof (mAllocationRecords[Hole])
+        );
+
+      Hole = Slot;
+    }
+  }
+
+  mAllocationRecords[Hole].Used = FALSE;
+
+  --mNumberOfAllocations;
+}
+
+// AllocationTrackerInitialize
+VOID
+AllocationTrackerInitialize (
+  VOID
+  )
+{
+  EFI_STATUS Status;
+  UINTN      NumberOfRecords;
+
+  ASSERT (mAllocationRecords == NULL);
+
+  NumberOfRecords = FixedPcdGet32 (PcdBooterAllocationRecords);
+
+  ASSERT (NumberOfRecords > 1);
+  ASSERT ((NumberOfRecords & (NumberOfRecords - 1)) == 0);
+
+  Status = EfiAllocatePool (
+             EfiBootServicesData,
+             (NumberOfRecords * sizeof (*mAllocationRecords)),
+             (VOID **)&mAllocationRecords
+             );
+
+  if (EFI_ERROR (Status)) {
+    mAllocationRecords = NULL;
+    return;
+  }
+
+  ZeroMem (
+    (VOID *)mAllocationRecords,
+    (NumberOfRecords * sizeof (*mAllocationRecords))
+    );
+
+  mAllocationMask       = (NumberOfRecords - 1);
+  mAllocationShift      = (UINTN)HighBitSet32 ((UINT32)NumberOfRecords);
+  mNumberOfAllocations  = 0;
+  mAllocationSequence   = 0;
+  mUntrackedFrees       = 0;
+  mDroppedAllocations   = 0;
+  mReportingAllocations = FALSE;
+}
+
+// AllocationTrackerAdd
+VOID
+AllocationTrackerAdd (
+  IN EFI_PHYSICAL_ADDRESS  Address,
+  IN UINT64                Size,
+  IN EFI_MEMORY_TYPE       MemoryType,
+  IN BOOLEAN               Pool,
+  IN VOID                  *Caller
+  )
+{
+  ALLOCATION_RECORD Record;
+
+  if ((mAllocationRecords == NULL) || mReportingAllocations) {
+    return;
+  }
+
+  ++mAllocationSequence;
+
+  //
+  // Keep one slot free so that lookups always terminate.
+  //
+  if (mNumberOfAllocations == mAllocationMask) {
+    ++mDroppedAllocations;
+    return;
+  }
+
+  Record.Address    = Address;
+  Record.Size       = Size;
+  Record.Caller     = Caller;
+  Record.Sequence   = mAllocationSequence;
+  Record.MemoryType = MemoryType;
+  Record.Used       = TRUE;
+  Record.Pool       = Pool;
+
+  InternalInsertAllocation (&Record);
+}
+
+// AllocationTrackerRemove
+VOID
+AllocationTrackerRemove (
+  IN EFI_PHYSICAL_ADDRESS  Address,
+  IN UINT64                Size
+  )
+{
+  ALLOCATION_RECORD    *Record;
+  ALLOCATION_RECORD    Remainder;
+  EFI_PHYSICAL_ADDRESS End;
+
+  if ((mAllocationRecords == NULL) || mReportingAllocations) {
+    return;
+  }
+
+  Record = InternalFindAllocation (Address);
+
+  if ((Record == NULL) && (Size != 0)) {
+    Record = InternalFindContainingAllocation (Address, Size);
+  }
+
+  if (Record == NULL) {
+    ++mUntrackedFrees;
+    return;
+  }
+
+  CopyMem (&Remainder, Record, sizeof (Remainder));
+
+  End = (Remainder.Address + Remainder.Size);
+
+  //
+  // Pages may be freed partially from anywhere within an allocation.  The
+  // part in front stays in place as its start, and thereby its slot, does
+  // not change, the part behind is tracked as a new record of the original
+  // call.
+  //
+  if (Remainder.Address < Address) {
+    Record->Size = (Address - Remainder.Address);
+  } else {
+    InternalRemoveAllocation (Record);
+  }
+
+  if (!Remainder.Pool && ((Address + Size) < End)) {
+    if (mNumberOfAllocations == mAllocationMask) {
+      ++mDroppedAllocations;
+      return;
+    }
+
+    Remainder.Address = (Address + Size);
+    Remainder.Size    = (End - Remainder.Address);
+
+    InternalInsertAllocation (&Remainder);
+  }
+}
+
+// AllocationTrackerGetStatistics
+VOID
+AllocationTrackerGetStatistics (
+  OUT UINTN   *NumberOfAllocations,
+  OUT UINT32  *UntrackedFrees,
+  OUT UINTN   *MaximumProbeLength
+  )
+{
+  UINTN Index;
+  UINTN Home;
+  UINTN ProbeLength;
+
+  *NumberOfAllocations = mNumberOfAllocations;
+  *UntrackedFrees      = mUntrackedFrees;
+  *MaximumProbeLength  = 0;
+
+  if (mAllocationRecords == NULL) {
+    return;
+  }
+
+  for (Index = 0; Index <= mAllocationMask; ++Index) {
+    if (mAllocationRecords[Index].Used) {
+      Home        = InternalGetAllocationSlot (mAllocationRecords[Index].Address);
+      ProbeLength = ((Index - Home) & mAllocationMask);
+
+      if (ProbeLength > *MaximumProbeLength) {
+        *MaximumProbeLength = ProbeLength;
+      }
+    }
+  }
+}
+
+// AllocationTrackerReport
+VOID
+AllocationTrackerReport (
+  VOID
+  )
+{
+  UINT64               Sizes[ALLOCATION_TRACKER_TYPES];
+  UINT32               Counts[ALLOCATION_TRACKER_TYPES];
+  EFI_PHYSICAL_ADDRESS Lowest[ALLOCATION_TRACKER_TYPES];
+  ALLOCATION_RECORD    *Record;
+  UINTN                Index;
+  UINTN                Type;
+
+  if (mAllocationRecords == NULL) {
+    return;
+  }
+
+  //
+  // Reporting may allocate from within DebugLib, which must not change the
+  // table while it is being walked.
+  //
+  mReportingAllocations = TRUE;
+
+  ZeroMem (Sizes, sizeof (Sizes));
+  ZeroMem (Counts, sizeof (Counts));
+  SetMem (Lowest, sizeof (Lowest), 0xFF);
+
+  for (Index = 0; Index <= mAllocationMask; ++Index) {
+    Record = &mAllocationRecords[Index];
+
+    if (!Record->Used) {
+      continue;
+    }
+
+    Type = (UINTN)Record->MemoryType;
+
+    if (Type >= EfiMaxMemoryType) {
+      Type = EfiMaxMemoryType;
+    }
+
+    Sizes[Type] += Record->Size;
+    ++Counts[Type];
+
+    if (Record->Address < Lowest[Type]) {
+      Lowest[Type] = Record->Address;
+    }
+
+    DEBUG ((
+      DEBUG_VERBOSE,
+      "FirmwareFixes: Outstanding %a 0x%lx-0x%lx type 0x%x from 0x%p, age %u\n",
+      (Record->Pool ? "pool" : "pages"),
+      Record->Address,
+      (Record->Address + Record->Size - 1),
+      (UINT32)Record->MemoryType,
+      Record->Caller,
+      (mAllocationSequence - Record->Sequence)
+      ));
+  }
+
+  DEBUG ((
+    DEBUG_INFO,
+    "FirmwareFixes: %u booter allocations outstanding of %u, %u dropped, %u untracked frees\n",
+    (UINT32)mNumberOfAllocations,
+    mAllocationSequence,
+    mDroppedAllocations,
+    mUntrackedFrees
+    ));
+
+  for (Type = 0; Type < ALLOCATION_TRACKER_TYPES; ++Type) {
+    if (Counts[Type] != 0) {
+      DEBUG ((
+        DEBUG_INFO,
+        "FirmwareFixes: Type %a%u: %u allocations, 0x%lx bytes, lowest 0x%lx\n",
+        ((Type == EfiMaxMemoryType) ? ">=" : ""),
+        (UINT32)Type,
+        Counts[Type],
+        Sizes[Type],
+        Lowest[Type]
+        ));
+    }
+  }
+
+  mReportingAllocations = FALSE;
+}
+
+// AllocationTrackerFree
+VOID
+AllocationTrackerFree (
+  VOID
+  )
+{
+  if (mAllocationRecords != NULL) {
+    EfiFreePool ((VOID *)mAllocationRecords);
+
+    mAllocationRecords = NULL;
+  }
+}
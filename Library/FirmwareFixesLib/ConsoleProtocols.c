@@ -0,0 +1,213 @@
+/** @file
+  Copyright (C) 2017, CupertinoNet.  All rights reserved.<BR>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+**/
+
+#include <Uefi.h>
+
+#include <Protocol/GraphicsOutput.h>
+#include <Protocol/SimpleTextOut.h>
+#include <Protocol/UgaDraw.h>
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/EfiBootServicesLib.h>
+
+#include "FirmwareFixesInternal.h"
+
+///
+/// A console protocol served for the console handle when the firmware has
+/// not installed it there.  The first instance in the protocol database is
+/// cached with its handle and looked up again when an instance is installed.
+///
+typedef struct {
+  EFI_GUID   *Protocol;
+  EFI_HANDLE Handle;
+  VOID       *Interface;
+  EFI_EVENT  Event;
+  VOID       *Registration;
+} CONSOLE_PROTOCOL;
+
+STATIC CONSOLE_PROTOCOL mConsoleProtocols[] = {
+  { &gEfiGraphicsOutputProtocolGuid, NULL, NULL, NULL, NULL },
+  { &gEfiUgaDrawProtocolGuid,        NULL, NULL, NULL, NULL },
+  { &gEfiSimpleTextOutProtocolGuid,  NULL, NULL, NULL, NULL }
+};
+
+/**
+  Invoke a notification event
+
+  @param[in] Event    Event whose notification function is being invoked.
+  @param[in] Context  The pointer to the notification function's context,
+                      which is implementation-dependent.
+
+**/
+STATIC
+VOID
+EFIAPI
+InternalConsoleProtocolNotify (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  EFI_STATUS       Status;
+  CONSOLE_PROTOCOL *ConsoleProtocol;
+  UINTN            NumberOfHandles;
+  EFI_HANDLE       *Handles;
+
+  ASSERT (Context != NULL);
+
+  ConsoleProtocol         = (CONSOLE_PROTOCOL *)Context;
+  ConsoleProtocol->Handle = NULL;
+
+  Status = EfiLocateHandleBuffer (
+             ByProtocol,
+             ConsoleProtocol->Protocol,
+             NULL,
+             &NumberOfHandles,
+             &Handles
+             );
+
+  if (EFI_ERROR (Status)) {
+    return;
+  }
+
+  Status = EfiHandleProtocol (
+             Handles[0],
+             ConsoleProtocol->Protocol,
+             &ConsoleProtocol->Interface
+             );
+
+  if (!EFI_ERROR (Status)) {
+    ConsoleProtocol->Handle = Handles[0];
+  }
+
+  EfiFreePool ((VOID *)Handles);
+}
+
+// ConsoleProtocolsInitialize
+VOID
+ConsoleProtocolsInitialize (
+  VOID
+  )
+{
+  EFI_STATUS       Status;
+  CONSOLE_PROTOCOL *ConsoleProtocol;
+  UINTN            Index;
+
+  for (Index = 0; Index < ARRAY_SIZE (mConsoleProtocols); ++Index) {
+    ConsoleProtocol = &mConsoleProtocols[Index];
+
+    ASSERT (ConsoleProtocol->Event == NULL);
+
+    ConsoleProtocol->Handle    = NULL;
+    ConsoleProtocol->Interface = NULL;
+
+    Status = EfiCreateEvent (
+               EVT_NOTIFY_SIGNAL,
+               TPL_CALLBACK,
+               InternalConsoleProtocolNotify,
+               (VOID *)ConsoleProtocol,
+               &ConsoleProtocol->Event
+               );
+
+    if (!EFI_ERROR (Status)) {
+      Status = EfiRegisterProtocolNotify (
+                 ConsoleProtocol->Protocol,
+                 ConsoleProtocol->Event,
+                 &ConsoleProtocol->Registration
+                 );
+
+      if (EFI_ERROR (Status)) {
+        EfiCloseEvent (ConsoleProtocol->Event);
+      }
+    }
+
+    //
+    // Without a notification, the protocol is looked up on every call.
+    // Otherwise, the instances present are cached once the TPL is lowered.
+    //
+    if (EFI_ERROR (Status)) {
+      ConsoleProtocol->Event = NULL;
+    } else {
+      EfiSignalEvent (ConsoleProtocol->Event);
+    }
+  }
+}
+
+// ConsoleProtocolsLookup
+EFI_STATUS
+ConsoleProtocolsLookup (
+  IN  EFI_HANDLE_PROTOCOL  HandleProtocol,
+  IN  EFI_GUID             *Protocol,
+  OUT VOID                 **Interface
+  )
+{
+  EFI_STATUS       Status;
+  CONSOLE_PROTOCOL *ConsoleProtocol;
+  UINTN            Index;
+
+  for (Index = 0; Index < ARRAY_SIZE (mConsoleProtocols); ++Index) {
+    ConsoleProtocol = &mConsoleProtocols[Index];
+
+    if (!CompareGuid (Protocol, ConsoleProtocol->Protocol)) {
+      continue;
+    }
+
+    //
+    // The cached instance may have been uninstalled or reinstalled since,
+    // which does not signal the notification.
+    //
+    if (ConsoleProtocol->Handle != NULL) {
+      Status = HandleProtocol (
+                 ConsoleProtocol->Handle,
+                 Protocol,
+                 &ConsoleProtocol->Interface
+                 );
+
+      if (!EFI_ERROR (Status)) {
+        *Interface = ConsoleProtocol->Interface;
+
+        return EFI_SUCCESS;
+      }
+
+      ConsoleProtocol->Handle = NULL;
+    }
+
+    return EfiLocateProtocol (Protocol, NULL, Interface);
+  }
+
+  return EFI_UNSUPPORTED;
+}
+
+// ConsoleProtocolsFree
+VOID
+ConsoleProtocolsFree (
+  VOID
+  )
+{
+  UINTN Index;
+
+  for (Index = 0; Index < ARRAY_SIZE (mConsoleProtocols); ++Index) {
+    if (mConsoleProtocols[Index].Event != NULL) {
+      EfiCloseEvent (mConsoleProtocols[Index].Event);
+
+      mConsoleProtocols[Index].Event = NULL;
+    }
+
+    mConsoleProtocols[Index].Handle    = NULL;
+    mConsoleProtocols[Index].Interface = NULL;
+  }
+}
@@ -0,0 +1,198 @@
+/** @file
+  Copyright (C) 2017, CupertinoNet.  All rights reserved.<BR>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+**/
+
+#include <Uefi.h>
+
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
+#include <Library/EfiBootServicesLib.h>
+#include <Library/PcdLib.h>
+
+#include "FirmwareFixesInternal.h"
+
+STATIC EFI_PHYSICAL_ADDRESS mEmergencyArena         = 0;
+STATIC UINTN                mEmergencyArenaSize     = 0;
+STATIC UINTN                mEmergencyArenaUsed     = 0;
+STATIC UINT32               mEmergencyAllocations   = 0;
+STATIC UINT32               mEmergencyArenaFailures = 0;
+
+// InternalEmergencyArenaAllocate
+STATIC
+EFI_PHYSICAL_ADDRESS
+InternalEmergencyArenaAllocate (
+  IN EFI_MEMORY_TYPE       MemoryType,
+  IN UINTN                 Size,
+  IN UINTN                 Alignment,
+  IN EFI_PHYSICAL_ADDRESS  MaximumAddress
+  )
+{
+  UINTN Offset;
+
+  //
+  // The arena is Boot Services memory and cannot back memory that must
+  // survive ExitBootServices().
+  //
+  if ((mEmergencyArena == 0)
+   || ((MemoryType != EfiLoaderCode)
+    && (MemoryType != EfiLoaderData)
+    && (MemoryType != EfiBootServicesCode)
+    && (MemoryType != EfiBootServicesData))) {
+    ++mEmergencyArenaFailures;
+    return 0;
+  }
+
+  Offset = ALIGN_VALUE (mEmergencyArenaUsed, Alignment);
+
+  if ((Offset > mEmergencyArenaSize)
+   || (Size > (mEmergencyArenaSize - Offset))
+   || ((mEmergencyArena + Offset + Size - 1) > MaximumAddress)) {
+    ++mEmergencyArenaFailures;
+    return 0;
+  }
+
+  mEmergencyArenaUsed = (Offset + Size);
+
+  ++mEmergencyAllocations;
+
+  return (mEmergencyArena + Offset);
+}
+
+// EmergencyArenaInitialize
+VOID
+EmergencyArenaInitialize (
+  VOID
+  )
+{
+  EFI_STATUS           Status;
+  EFI_PHYSICAL_ADDRESS Address;
+  UINTN                Pages;
+
+  ASSERT (mEmergencyArena == 0);
+
+  Pages = FixedPcdGet32 (PcdEmergencyArenaPages);
+
+  Status = EfiAllocatePages (
+             AllocateAnyPages,
+             EfiBootServicesData,
+             Pages,
+             &Address
+             );
+
+  if (EFI_ERROR (Status)) {
+    return;
+  }
+
+  mEmergencyArena         = Address;
+  mEmergencyArenaSize     = EFI_PAGES_TO_SIZE (Pages);
+  mEmergencyArenaUsed     = 0;
+  mEmergencyAllocations   = 0;
+  mEmergencyArenaFailures = 0;
+}
+
+// EmergencyArenaAllocatePages
+EFI_STATUS
+EmergencyArenaAllocatePages (
+  IN     EFI_ALLOCATE_TYPE     Type,
+  IN     EFI_MEMORY_TYPE       MemoryType,
+  IN     UINTN                 Pages,
+  IN OUT EFI_PHYSICAL_ADDRESS  *Memory
+  )
+{
+  EFI_PHYSICAL_ADDRESS Address;
+
+  if ((Memory == NULL) || (Type == AllocateAddress)) {
+    ++mEmergencyArenaFailures;
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Address = InternalEmergencyArenaAllocate (
+              MemoryType,
+              EFI_PAGES_TO_SIZE (Pages),
+              EFI_PAGE_SIZE,
+              ((Type == AllocateMaxAddress) ? *Memory : MAX_ADDRESS)
+              );
+
+  if (Address == 0) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  *Memory = Address;
+
+  return EFI_SUCCESS;
+}
+
+// EmergencyArenaAllocatePool
+EFI_STATUS
+EmergencyArenaAllocatePool (
+  IN  EFI_MEMORY_TYPE  PoolType,
+  IN  UINTN            Size,
+  OUT VOID             **Buffer
+  )
+{
+  EFI_PHYSICAL_ADDRESS Address;
+
+  if (Buffer == NULL) {
+    ++mEmergencyArenaFailures;
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Address = InternalEmergencyArenaAllocate (
+              PoolType,
+              Size,
+              sizeof (UINT64),
+              MAX_ADDRESS
+              );
+
+  if (Address == 0) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  *Buffer = (VOID *)(UINTN)Address;
+
+  return EFI_SUCCESS;
+}
+
+// EmergencyArenaReport
+VOID
+EmergencyArenaReport (
+  VOID
+  )
+{
+  if ((mEmergencyAllocations != 0) || (mEmergencyArenaFailures != 0)) {
+    DEBUG ((
+      DEBUG_WARN,
+      "FirmwareFixes: %u late allocations in %lu of %lu bytes, %u failed\n",
+      mEmergencyAllocations,
+      (UINT64)mEmergencyArenaUsed,
+      (UINT64)mEmergencyArenaSize,
+      mEmergencyArenaFailures
+      ));
+  }
+}
+
+// EmergencyArenaFree
+VOID
+EmergencyArenaFree (
+  VOID
+  )
+{
+  if (mEmergencyArena != 0) {
+    EfiFreePages (mEmergencyArena, EFI_SIZE_TO_PAGES (mEmergencyArenaSize));
+
+    mEmergencyArena     = 0;
+    mEmergencyArenaSize = 0;
+  }
+}
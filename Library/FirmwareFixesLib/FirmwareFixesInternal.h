@@ -31,10 +31,18 @@
 #ifndef FIRMWARE_FIXES_INTERNAL_H_
 #define FIRMWARE_FIXES_INTERNAL_H_
 
+#include <Guid/MemoryMapTrace.h>
+
+#include <Library/ServiceHookLib.h>
+
 #define MEMORY_DESCRIPTOR_PHYSICAL_TOP(MemoryDescriptor)  \
   ((MemoryDescriptor)->PhysicalStart                      \
     + EFI_PAGES_TO_SIZE ((UINTN)((MemoryDescriptor)->NumberOfPages)))
 
+#define MEMORY_DESCRIPTOR_VIRTUAL_TOP(MemoryDescriptor)  \
+  ((MemoryDescriptor)->VirtualStart                      \
+    + EFI_PAGES_TO_SIZE ((UINTN)((MemoryDescriptor)->NumberOfPages)))
+
 #define RELOCATION_BLOCK_SIGNATURE  SIGNATURE_32 ('R', 'E', 'L', 'B')
 
 typedef struct {
@@ -54,11 +62,19 @@ typedef struct {
   RT_RELOC_PROTECT_INFO RelocInfo[50]; // TODO: Allocate this dynamic.
 } RT_RELOC_PROTECT_DATA;
 
+// MEMORY_MAP_TRACE_ENTRY
+typedef struct {
+  UINT32               Type;
+  EFI_PHYSICAL_ADDRESS PhysicalStart;
+  UINT64               NumberOfPages;
+  UINT64               Attribute;
+} MEMORY_MAP_TRACE_ENTRY;
+
 extern BOOLEAN mXnuPrepareStartSignaledInCurrentBooter;
 
 VOID
 InternalOverrideSystemTable (
-  IN VOID  *Registration
+  IN EFI_HANDLE  BooterHandle
   );
 
 VOID
@@ -76,6 +92,26 @@ RestoreFirmwareServices (
   VOID
   );
 
+/**
+  Removes a hook.  A hook interposed by code not using ServiceHookLib cannot
+  be removed and is bypassed instead, so that it is not called after
+  ExitBootServices() has reclaimed its memory.
+
+  @param[in, out] Transaction  The transaction to remove the hook in.
+  @param[in, out] Hook         The hook to remove.
+
+  @retval EFI_SUCCESS          Hook has been removed or was not installed.
+  @retval EFI_WARN_STALE_DATA  Hook could not be removed and has been
+                               bypassed.
+  @retval EFI_ACCESS_DENIED    Hook could neither be removed nor bypassed.
+
+**/
+EFI_STATUS
+UnhookService (
+  IN OUT SERVICE_HOOK_TRANSACTION  *Transaction,
+  IN OUT SERVICE_HOOK              *Hook
+  );
+
 VOID
 FixMemoryMap (
   IN     UINTN                  MemoryMapSize,
@@ -90,6 +126,40 @@ ShrinkMemoryMap (
   IN UINTN                  DescriptorSize
   );
 
+/**
+  Protect RT data from relocation by marking them MemoryMapIO.  Except area
+  with EFI system table.
+
+  @param[in]      MemoryMapSize    The size in bytes of MemoryMap.
+  @param[in]      DescriptorSize   The size in bytes of an entry in MemoryMap.
+  @param[in, out] MemoryMap        The memory map to patch.
+  @param[in]      SystemTableArea  The physical start of the area holding the
+                                   EFI System Table.
+
+**/
+VOID
+ProtectRutimeMemoryFromRelocation (
+  IN UINTN                  MemoryMapSize,
+  IN UINTN                  DescriptorSize,
+  IN EFI_MEMORY_DESCRIPTOR  *MemoryMap,
+  IN UINTN                  SystemTableArea
+  );
+
+/**
+  Restores the memory types changed by ProtectRutimeMemoryFromRelocation().
+
+  @param[in]      MemoryMapSize   The size in bytes of MemoryMap.
+  @param[in]      DescriptorSize  The size in bytes of an entry in MemoryMap.
+  @param[in, out] MemoryMap       The memory map to restore.
+
+**/
+VOID
+RestoreRuntimeMemoryProtectTypes (
+  IN     UINTN                  MemoryMapSize,
+  IN     UINTN                  DescriptorSize,
+  IN OUT EFI_MEMORY_DESCRIPTOR  *MemoryMap
+  );
+
 /**
   Copies RT flagged areas to separate Memory Map, defines virtual to phisycal
   address mapping and calls SetVirtualAddressMap() only with that partial
@@ -106,18 +176,28 @@ ShrinkMemoryMap (
   same, although it seems that just assigning VirtualStart = PhysicalStart for
   non-RT areas also does the job.
 
-  @param[in] MemoryMapSize   The size in bytes of VirtualMap.
-  @param[in] DescriptorSize  The size in bytes of an entry in the VirtualMap.
-  @param[in] VirtualMap      An array of memory descriptors which contain new
-                             virtual address mapping information for all
-                             runtime ranges.
+  If PcdCoalesceVirtualAddressMap is enabled, runs of RT descriptors of the
+  same type and attributes that are contiguous both physically and virtually
+  are merged into a single descriptor.
+
+  @param[in, out] MemoryMapSize   On input, the size in bytes of VirtualMap.
+                                  On output, the size in bytes of the
+                                  returned partial Memory Map.
+  @param[in]      DescriptorSize  The size in bytes of an entry in the
+                                  VirtualMap.
+  @param[in]      VirtualMap      An array of memory descriptors which contain
+                                  new virtual address mapping information for
+                                  all runtime ranges.
+
+  @return  The partial Memory Map or NULL if it does not fit the internal
+           buffer.
 
 **/
 EFI_MEMORY_DESCRIPTOR *
 GetPartialVirtualAddressMap (
-  IN UINTN                  MemoryMapSize,
-  IN UINTN                  DescriptorSize,
-  IN EFI_MEMORY_DESCRIPTOR  *VirtualMap
+  IN OUT UINTN                  *MemoryMapSize,
+  IN     UINTN                  DescriptorSize,
+  IN     EFI_MEMORY_DESCRIPTOR  *VirtualMap
   );
 
 /**
@@ -127,6 +207,9 @@ GetPartialVirtualAddressMap (
   addresses during the change.  Linux and Windows are doing the same thing and
   problem is not visible there.
 
+  Ranges that are contiguous both virtually and physically are mapped with a
+  single page table update.
+
   @param[in] MemoryMapSize   The size in bytes of VirtualMap.
   @param[in] DescriptorSize  The size in bytes of an entry in the VirtualMap.
   @param[in] VirtualMap      An array of memory descriptors which contain new
@@ -141,4 +224,466 @@ MapVirtualPages (
   IN EFI_MEMORY_DESCRIPTOR  *VirtualMap
   );
 
+/**
+  Computes which kernel slides fit the memory map.  A slide is valid if its
+  window of RequiredSize bytes lies within a single free descriptor.
+
+  @param[in]  MemoryMapSize   The size in bytes of MemoryMap.
+  @param[in]  MemoryMap       The memory map to inspect.
+  @param[in]  DescriptorSize  The size in bytes of an entry in MemoryMap.
+  @param[in]  RequiredSize    The size in bytes of the kernel window.
+  @param[out] ValidSlides     The bitmap receiving the valid slides.
+
+  @return  The number of valid slides.
+
+**/
+UINTN
+GetKernelSlideBitmap (
+  IN  UINTN                  MemoryMapSize,
+  IN  EFI_MEMORY_DESCRIPTOR  *MemoryMap,
+  IN  UINTN                  DescriptorSize,
+  IN  UINT64                 RequiredSize,
+  OUT UINT8                  *ValidSlides
+  );
+
+/**
+  Recomputes the kernel slides published via gXnuKernelSlideProtocolGuid and
+  logs them if they changed.  Does not call any Boot Services.
+
+  @param[in] MemoryMapSize   The size in bytes of MemoryMap.
+  @param[in] MemoryMap       The memory map handed to the Apple booter.
+  @param[in] DescriptorSize  The size in bytes of an entry in MemoryMap.
+
+**/
+VOID
+UpdateKernelSlides (
+  IN UINTN                  MemoryMapSize,
+  IN EFI_MEMORY_DESCRIPTOR  *MemoryMap,
+  IN UINTN                  DescriptorSize
+  );
+
+VOID
+InstallKernelSlideProtocol (
+  VOID
+  );
+
+VOID
+UninstallKernelSlideProtocol (
+  VOID
+  );
+
+/**
+  Starts recording memory map traces into Trace.  The trace is not
+  allocated by the library, as the caller determines its memory type.
+
+  @param[in, out] Trace            The trace buffer to initialize.  It must
+                                   hold NumberOfRecords records after the
+                                   header.
+  @param[in]      NumberOfRecords  The capacity of the record ring.
+  @param[in, out] Entries          The buffer used for the memory map
+                                   snapshots.
+  @param[in]      NumberOfEntries  The number of entries in Entries.  Half
+                                   of them are available per snapshot.
+
+**/
+VOID
+MemoryMapTraceInitialize (
+  IN OUT MEMORY_MAP_TRACE_HEADER  *Trace,
+  IN     UINT32                   NumberOfRecords,
+  IN OUT MEMORY_MAP_TRACE_ENTRY   *Entries,
+  IN     UINTN                    NumberOfEntries
+  );
+
+/**
+  Stops recording memory map traces.  Must be called before the buffers
+  passed to MemoryMapTraceInitialize() are freed.
+
+**/
+VOID
+MemoryMapTraceReset (
+  VOID
+  );
+
+/**
+  Records the start of a GetMemoryMap() call and the difference of the memory
+  map returned by the firmware to the one of the previous call.
+
+  @param[in] MemoryMapSize   The size in bytes of MemoryMap.
+  @param[in] MemoryMap       The memory map returned by the firmware.
+  @param[in] DescriptorSize  The size in bytes of an entry in MemoryMap.
+
+**/
+VOID
+MemoryMapTraceBegin (
+  IN UINTN                  MemoryMapSize,
+  IN EFI_MEMORY_DESCRIPTOR  *MemoryMap,
+  IN UINTN                  DescriptorSize
+  );
+
+/**
+  Records the difference of the memory map to the output of the previous
+  stage.
+
+  @param[in] Stage           The MEMORY_MAP_TRACE_STAGE that has just run.
+  @param[in] MemoryMapSize   The size in bytes of MemoryMap.
+  @param[in] MemoryMap       The memory map produced by Stage.
+  @param[in] DescriptorSize  The size in bytes of an entry in MemoryMap.
+
+**/
+VOID
+MemoryMapTraceStage (
+  IN UINT8                  Stage,
+  IN UINTN                  MemoryMapSize,
+  IN EFI_MEMORY_DESCRIPTOR  *MemoryMap,
+  IN UINTN                  DescriptorSize
+  );
+
+UINT64
+MemoryMapTraceGetNumberOfRecords (
+  VOID
+  );
+
+/**
+  Installs the profiling wrappers of all interposed services.  They are to be
+  installed before the other hooks so that only the time spent in the
+  firmware is measured.  The wrappers are removed again when Boot Services
+  are exited, until CloseServiceProfileEvent() is called.
+
+  @param[in, out] Transaction  The transaction to install the wrappers in.
+
+**/
+VOID
+HookProfiledServices (
+  IN OUT SERVICE_HOOK_TRANSACTION  *Transaction
+  );
+
+VOID
+UnhookProfiledServices (
+  IN OUT SERVICE_HOOK_TRANSACTION  *Transaction
+  );
+
+/**
+  Stops removing the profiling wrappers when Boot Services are exited.  To
+  be called once the wrappers have been removed otherwise.
+
+**/
+VOID
+CloseServiceProfileEvent (
+  VOID
+  );
+
+/**
+  Logs the call counts and latencies of all profiled services.
+
+**/
+VOID
+DumpServiceProfile (
+  VOID
+  );
+
+/**
+  Publishes the service profile.
+
+**/
+VOID
+InstallServiceProfile (
+  VOID
+  );
+
+VOID
+UninstallServiceProfile (
+  VOID
+  );
+
+/**
+  Allocates the booter allocation table.  Must be called before the memory
+  allocation services are hooked.
+
+**/
+VOID
+AllocationTrackerInitialize (
+  VOID
+  );
+
+/**
+  Records an allocation made by the booter.
+
+  @param[in] Address     The start of the allocation.
+  @param[in] Size        The size in bytes of the allocation.
+  @param[in] MemoryType  The memory type of the allocation.
+  @param[in] Pool        Whether the allocation has been made from pool.
+  @param[in] Caller      The return address of the allocating call.
+
+**/
+VOID
+AllocationTrackerAdd (
+  IN EFI_PHYSICAL_ADDRESS  Address,
+  IN UINT64                Size,
+  IN EFI_MEMORY_TYPE       MemoryType,
+  IN BOOLEAN               Pool,
+  IN VOID                  *Caller
+  );
+
+/**
+  Removes an allocation freed by the booter.
+
+  The freed pages may lie anywhere within a tracked page allocation, which is
+  shrunk or split accordingly.
+
+  @param[in] Address  The start of the freed memory.
+  @param[in] Size     The size in bytes of the freed pages.  0 for pool.
+
+**/
+VOID
+AllocationTrackerRemove (
+  IN EFI_PHYSICAL_ADDRESS  Address,
+  IN UINT64                Size
+  );
+
+/**
+  Returns the statistics of the booter allocation table.
+
+  @param[out] NumberOfAllocations  The number of tracked allocations.
+  @param[out] UntrackedFrees       The number of frees that did not match any
+                                   tracked allocation.
+  @param[out] MaximumProbeLength   The largest distance of a tracked
+                                   allocation from its hash slot.
+
+**/
+VOID
+AllocationTrackerGetStatistics (
+  OUT UINTN   *NumberOfAllocations,
+  OUT UINT32  *UntrackedFrees,
+  OUT UINTN   *MaximumProbeLength
+  );
+
+/**
+  Logs the outstanding booter allocations by memory type.  Does not call any
+  Boot Services.
+
+**/
+VOID
+AllocationTrackerReport (
+  VOID
+  );
+
+VOID
+AllocationTrackerFree (
+  VOID
+  );
+
+/**
+  Registers for the installation of the console protocols served by
+  ConsoleProtocolsLookup().
+
+**/
+VOID
+ConsoleProtocolsInitialize (
+  VOID
+  );
+
+/**
+  Returns an instance of a console protocol the firmware has not installed on
+  the console handle.  The cached instance is verified to be still installed,
+  otherwise the protocol database is searched.
+
+  @param[in]  HandleProtocol  The HandleProtocol() service to verify the
+                              cached instance with.
+  @param[in]  Protocol        The protocol to look up.
+  @param[out] Interface       Returns the protocol instance.
+
+  @retval EFI_SUCCESS      The instance has been returned.
+  @retval EFI_NOT_FOUND    No instance of Protocol has been installed.
+  @retval EFI_UNSUPPORTED  Protocol is no console protocol.
+
+**/
+EFI_STATUS
+ConsoleProtocolsLookup (
+  IN  EFI_HANDLE_PROTOCOL  HandleProtocol,
+  IN  EFI_GUID             *Protocol,
+  OUT VOID                 **Interface
+  );
+
+VOID
+ConsoleProtocolsFree (
+  VOID
+  );
+
+/**
+  Reserves the arena serving allocations after the memory allocation
+  services have been disabled.
+
+**/
+VOID
+EmergencyArenaInitialize (
+  VOID
+  );
+
+EFI_STATUS
+EmergencyArenaAllocatePages (
+  IN     EFI_ALLOCATE_TYPE     Type,
+  IN     EFI_MEMORY_TYPE       MemoryType,
+  IN     UINTN                 Pages,
+  IN OUT EFI_PHYSICAL_ADDRESS  *Memory
+  );
+
+EFI_STATUS
+EmergencyArenaAllocatePool (
+  IN  EFI_MEMORY_TYPE  PoolType,
+  IN  UINTN            Size,
+  OUT VOID             **Buffer
+  );
+
+VOID
+EmergencyArenaReport (
+  VOID
+  );
+
+VOID
+EmergencyArenaFree (
+  VOID
+  );
+
+/**
+  Allocates the buffers used to retry ExitBootServices() after a MapKey
+  mismatch.
+
+**/
+VOID
+MapKeyRecoveryInitialize (
+  VOID
+  );
+
+/**
+  Saves the fixed memory map returned to the booter.
+
+**/
+VOID
+MapKeyRecoverySnapshot (
+  IN UINTN                  MemoryMapSize,
+  IN EFI_MEMORY_DESCRIPTOR  *MemoryMap,
+  IN UINTN                  DescriptorSize
+  );
+
+EFI_MEMORY_DESCRIPTOR *
+MapKeyRecoveryGetBuffer (
+  OUT UINTN  *BufferSize
+  );
+
+/**
+  Returns whether the booter's memory map is still valid for the OS, which
+  is the case if all memory that is not reclaimed matches the current map.
+
+**/
+BOOLEAN
+MapKeyRecoveryIsCompatible (
+  IN UINTN                  MemoryMapSize,
+  IN EFI_MEMORY_DESCRIPTOR  *MemoryMap,
+  IN UINTN                  DescriptorSize
+  );
+
+VOID
+MapKeyRecoveryRecord (
+  IN BOOLEAN  Recovered
+  );
+
+VOID
+MapKeyRecoveryFree (
+  VOID
+  );
+
+/**
+  Allocates the variable cache.  The cache disables and unhooks itself when
+  Boot Services are exited.
+
+**/
+VOID
+VariableCacheInitialize (
+  VOID
+  );
+
+/**
+  Drops all cached variables.
+
+**/
+VOID
+VariableCacheInvalidate (
+  VOID
+  );
+
+VOID
+HookVariableCache (
+  IN OUT SERVICE_HOOK_TRANSACTION  *Transaction
+  );
+
+VOID
+UnhookVariableCache (
+  IN OUT SERVICE_HOOK_TRANSACTION  *Transaction
+  );
+
+VOID
+VariableCacheFree (
+  VOID
+  );
+
+/**
+  Allocates the variable enumeration snapshot.  The snapshot is built when
+  an enumeration starts, dropped on every SetVariable() call and disabled
+  when Boot Services are exited.
+
+**/
+VOID
+VariableIndexInitialize (
+  VOID
+  );
+
+VOID
+HookVariableIndex (
+  IN OUT SERVICE_HOOK_TRANSACTION  *Transaction
+  );
+
+VOID
+UnhookVariableIndex (
+  IN OUT SERVICE_HOOK_TRANSACTION  *Transaction
+  );
+
+VOID
+VariableIndexFree (
+  VOID
+  );
+
+/**
+  Allocates the variable write buffer.  The buffer is flushed and unhooked
+  when Boot Services are exited.
+
+**/
+VOID
+VariableWriteBufferInitialize (
+  VOID
+  );
+
+/**
+  Passes all deferred variable writes on to the firmware.
+
+**/
+VOID
+VariableWriteBufferFlush (
+  VOID
+  );
+
+VOID
+HookVariableWriteBuffer (
+  IN OUT SERVICE_HOOK_TRANSACTION  *Transaction
+  );
+
+VOID
+UnhookVariableWriteBuffer (
+  IN OUT SERVICE_HOOK_TRANSACTION  *Transaction
+  );
+
+VOID
+VariableWriteBufferFree (
+  VOID
+  );
+
 #endif // FIRMWARE_FIXES_INTERNAL_H_
@@ -30,9 +30,9 @@
 
 #include <Uefi.h>
 
-#include <Guid/AppleBooterExitNamedEvent.h>
+#include <Guid/MemoryMapTrace.h>
 
-#include <Protocol/AppleBooterHandle.h>
+#include <Protocol/AppleBooterLifecycle.h>
 
 #include <Library/DebugLib.h>
 #include <Library/EfiBootServicesLib.h>
@@ -42,28 +42,34 @@
 
 #include "FirmwareFixesInternal.h"
 
-STATIC EFI_EVENT mAppleBooterHandleNotifyEvent   = NULL;
-STATIC VOID      *mAppleBooterHandleRegistration = NULL;
+STATIC EFI_EVENT mAppleBooterLifecycleNotifyEvent   = NULL;
+STATIC VOID      *mAppleBooterLifecycleRegistration = NULL;
+
+STATIC APPLE_BOOTER_LIFECYCLE_PROTOCOL *mAppleBooterLifecycle = NULL;
 
 STATIC UINTN mAppleBooterLevel = 0;
 
+STATIC MEMORY_MAP_TRACE_HEADER *mMemoryMapTrace        = NULL;
+STATIC MEMORY_MAP_TRACE_ENTRY  *mMemoryMapTraceEntries = NULL;
+
 GLOBAL_REMOVE_IF_UNREFERENCED
 BOOLEAN mXnuPrepareStartSignaledInCurrentBooter = FALSE;
 
 /**
-  Invoke a notification event
+  Called once the Apple booter has returned from StartImage().
 
-  @param[in] Event    Event whose notification function is being invoked.
-  @param[in] Context  The pointer to the notification function's context,
-                      which is implementation-dependent.
+  @param[in] BooterHandle  The image handle of the booter.
+  @param[in] ExitStatus    The status StartImage() has returned.
+  @param[in] Context       Unused.
 
 **/
 STATIC
 VOID
 EFIAPI
-InternalAppleBooterExitNotify (
-  IN EFI_EVENT  Event,
-  IN VOID       *Context
+InternalAppleBooterExit (
+  IN EFI_HANDLE  BooterHandle,
+  IN EFI_STATUS  ExitStatus,
+  IN VOID        *Context
   )
 {
   --mAppleBooterLevel;
@@ -73,33 +79,80 @@ InternalAppleBooterExitNotify (
       InternalFreeSystemTableCopy ();
     }
 
+    //
+    // Pass the deferred writes on while the services below the buffer are
+    // still installed.
+    //
+    if (PcdGetBool (PcdCoalesceVariableWrites)) {
+      VariableWriteBufferFlush ();
+    }
+
     RestoreFirmwareServices ();
 
-    EfiCloseEvent (Event);
+    if (PcdGetBool (PcdProfileFirmwareServices)) {
+      DumpServiceProfile ();
+    }
+
+    if (PcdGetBool (PcdHandleGop)) {
+      ConsoleProtocolsFree ();
+    }
+
+    if (PcdGetBool (PcdTrackBooterAllocations)) {
+      AllocationTrackerReport ();
+      AllocationTrackerFree ();
+    }
+
+    if (PcdGetBool (PcdEmergencyArena)) {
+      EmergencyArenaFree ();
+    }
+
+    if (PcdGetBool (PcdRecoverMapKeyMismatch)) {
+      MapKeyRecoveryFree ();
+    }
+
+    if (PcdGetBool (PcdCacheVariables)) {
+      VariableCacheFree ();
+    }
+
+    if (PcdGetBool (PcdIndexVariableNames)) {
+      VariableIndexFree ();
+    }
+
+    if (PcdGetBool (PcdCoalesceVariableWrites)) {
+      VariableWriteBufferFree ();
+    }
+
+    if (PcdGetBool (PcdTraceMemoryMap)) {
+      DEBUG ((
+        DEBUG_INFO,
+        "FirmwareFixes: %ld memory map trace records at 0x%p\n",
+        MemoryMapTraceGetNumberOfRecords (),
+        mMemoryMapTrace
+        ));
+    }
   }
 }
 
 /**
-  Invoke a notification event
+  Called right before the Apple booter is started.
 
-  @param[in] Event    Event whose notification function is being invoked.
-  @param[in] Context  The pointer to the notification function's context,
-                      which is implementation-dependent.
+  @param[in] BooterHandle  The image handle of the booter.
+  @param[in] Context       Unused.
 
 **/
 STATIC
 VOID
 EFIAPI
-InternalAppleBooterStartNotify (
-  IN EFI_EVENT  Event,
-  IN VOID       *Context
+InternalAppleBooterStart (
+  IN EFI_HANDLE  BooterHandle,
+  IN VOID        *Context
   )
 {
   //
   // The allocation might have failed, so run thus on any level.
   //
   if (PcdGetBool (PcdPreserveSystemTable)) {
-    InternalOverrideSystemTable (mAppleBooterHandleRegistration);
+    InternalOverrideSystemTable (BooterHandle);
   }
 
   DEBUG_CODE (
@@ -108,19 +161,130 @@ InternalAppleBooterStartNotify (
 
   if (mAppleBooterLevel == 0) {
     OverrideFirmwareServices ();
- 
-    EfiNamedEventListen (
-      &gAppleBooterExitNamedEventGuid,
-      TPL_NOTIFY,
-      InternalAppleBooterExitNotify,
-      NULL,
-      NULL
-      );
   }
 
   ++mAppleBooterLevel;
 }
 
+// mAppleBooterCallback
+STATIC APPLE_BOOTER_CALLBACK mAppleBooterCallback = {
+  { NULL, NULL },
+  APPLE_BOOTER_CALLBACK_ORDER_FIRMWARE_FIXES,
+  InternalAppleBooterStart,
+  InternalAppleBooterExit,
+  NULL
+};
+
+/**
+  Registers the booter callbacks once the booter lifecycle is available.
+
+  @param[in] Event    The event that has been signaled.
+  @param[in] Context  Unused.
+
+**/
+STATIC
+VOID
+EFIAPI
+InternalAppleBooterLifecycleNotify (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  EFI_STATUS                      Status;
+  APPLE_BOOTER_LIFECYCLE_PROTOCOL *AppleBooterLifecycle;
+
+  if (mAppleBooterLifecycle != NULL) {
+    return;
+  }
+
+  Status = EfiLocateProtocol (
+             &gAppleBooterLifecycleProtocolGuid,
+             NULL,
+             (VOID **)&AppleBooterLifecycle
+             );
+
+  if (EFI_ERROR (Status)) {
+    return;
+  }
+
+  AppleBooterLifecycle->RegisterCallback (
+                          AppleBooterLifecycle,
+                          &mAppleBooterCallback
+                          );
+
+  mAppleBooterLifecycle = AppleBooterLifecycle;
+}
+
+/**
+  Allocates the memory map trace and publishes it as a configuration table.
+  The trace is allocated as Runtime Services Data so that it can be retrieved
+  from the booted OS too.
+
+**/
+STATIC
+VOID
+InternalInstallMemoryMapTrace (
+  VOID
+  )
+{
+  EFI_STATUS Status;
+  UINTN      TraceSize;
+  UINTN      EntriesSize;
+
+  TraceSize   = (sizeof (*mMemoryMapTrace)
+                  + (FixedPcdGet32 (PcdMemoryMapTraceRecords)
+                      * sizeof (MEMORY_MAP_TRACE_RECORD)));
+  EntriesSize = (2 * FixedPcdGet32 (PcdMemoryMapTraceDescriptors)
+                  * sizeof (*mMemoryMapTraceEntries));
+
+  Status = EfiAllocatePool (
+             EfiRuntimeServicesData,
+             TraceSize,
+             (VOID **)&mMemoryMapTrace
+             );
+
+  if (EFI_ERROR (Status)) {
+    mMemoryMapTrace = NULL;
+    return;
+  }
+
+  Status = EfiAllocatePool (
+             EfiBootServicesData,
+             EntriesSize,
+             (VOID **)&mMemoryMapTraceEntries
+             );
+
+  if (!EFI_ERROR (Status)) {
+    Status = EfiInstallConfigurationTable (
+               &gMemoryMapTraceGuid,
+               (VOID *)mMemoryMapTrace
+               );
+
+    //
+    // The GetMemoryMap() hook records into the buffers once initialized,
+    // hence this is done only when they are certain to be kept.
+    //
+    if (!EFI_ERROR (Status)) {
+      MemoryMapTraceInitialize (
+        mMemoryMapTrace,
+        FixedPcdGet32 (PcdMemoryMapTraceRecords),
+        mMemoryMapTraceEntries,
+        (2 * FixedPcdGet32 (PcdMemoryMapTraceDescriptors))
+        );
+
+      return;
+    }
+
+    EfiFreePool ((VOID *)mMemoryMapTraceEntries);
+
+    mMemoryMapTraceEntries = NULL;
+  }
+
+  EfiFreePool ((VOID *)mMemoryMapTrace);
+
+  mMemoryMapTrace = NULL;
+}
+
 VOID
 FirmwareFixesLibConstructor (
   VOID
@@ -128,20 +292,34 @@ FirmwareFixesLibConstructor (
 {
   EFI_EVENT Event;
 
+  if (PcdGetBool (PcdReportKernelSlides)) {
+    InstallKernelSlideProtocol ();
+  }
+
+  if (PcdGetBool (PcdTraceMemoryMap)) {
+    InternalInstallMemoryMapTrace ();
+  }
+
+  if (PcdGetBool (PcdProfileFirmwareServices)) {
+    InstallServiceProfile ();
+  }
+
   Event = MiscCreateNotifySignalEvent (
-            InternalAppleBooterStartNotify,
+            InternalAppleBooterLifecycleNotify,
             NULL
             );
 
   if (Event != NULL) {
-    mAppleBooterHandleNotifyEvent = Event;
+    mAppleBooterLifecycleNotifyEvent = Event;
 
     EfiRegisterProtocolNotify (
-      &gAppleBooterHandleProtocolGuid,
-      mAppleBooterHandleNotifyEvent,
-      &mAppleBooterHandleRegistration
+      &gAppleBooterLifecycleProtocolGuid,
+      mAppleBooterLifecycleNotifyEvent,
+      &mAppleBooterLifecycleRegistration
       );
   }
+
+  InternalAppleBooterLifecycleNotify (Event, NULL);
 }
 
 VOID
@@ -149,9 +327,38 @@ FirmwareFixesLibDestructor (
   VOID
   )
 {
-  if (mAppleBooterHandleNotifyEvent != NULL) {
-    EfiCloseEvent (mAppleBooterHandleNotifyEvent);
+  if (mAppleBooterLifecycleNotifyEvent != NULL) {
+    EfiCloseEvent (mAppleBooterLifecycleNotifyEvent);
+
+    mAppleBooterLifecycleNotifyEvent = NULL;
+  }
+
+  if (mAppleBooterLifecycle != NULL) {
+    mAppleBooterLifecycle->UnregisterCallback (
+                             mAppleBooterLifecycle,
+                             &mAppleBooterCallback
+                             );
+
+    mAppleBooterLifecycle = NULL;
+  }
+
+  if (PcdGetBool (PcdReportKernelSlides)) {
+    UninstallKernelSlideProtocol ();
+  }
+
+  if (PcdGetBool (PcdProfileFirmwareServices)) {
+    UninstallServiceProfile ();
+  }
+
+  if (mMemoryMapTrace != NULL) {
+    MemoryMapTraceReset ();
+
+    EfiInstallConfigurationTable (&gMemoryMapTraceGuid, NULL);
+
+    EfiFreePool ((VOID *)mMemoryMapTraceEntries);
+    EfiFreePool ((VOID *)mMemoryMapTrace);
 
-    mAppleBooterHandleNotifyEvent = NULL;
+    mMemoryMapTraceEntries = NULL;
+    mMemoryMapTrace        = NULL;
   }
 }
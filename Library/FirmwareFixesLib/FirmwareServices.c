@@ -32,12 +32,11 @@
 
 #include <Guid/XnuPrepareStartNamedEvent.h>
 
-#include <Protocol/GraphicsOutput.h>
-
 #include <Library/BaseMemoryLib.h>
 #include <Library/DebugLib.h>
 #include <Library/EfiBootServicesLib.h>
 #include <Library/PcdLib.h>
+#include <Library/ServiceHookLib.h>
 #include <Library/UefiLib.h>
 #include <Library/UefiBootServicesTableLib.h>
 #include <Library/UefiRuntimeServicesTableLib.h>
@@ -56,6 +55,11 @@ STATIC EFI_EXIT_BOOT_SERVICES mExitBootServices = NULL;
 
 STATIC BOOLEAN mDisableMemoryAllocationServices = FALSE;
 
+///
+/// The number of times ExitBootServices() is retried with a fresh MapKey.
+///
+#define MAP_KEY_RECOVERY_ATTEMPTS  2
+
 STATIC EFI_GET_MEMORY_MAP mGetMemoryMap = NULL;
 
 STATIC EFI_HANDLE_PROTOCOL mHandleProtocol = NULL;
@@ -64,6 +68,12 @@ STATIC EFI_SET_VIRTUAL_ADDRESS_MAP mSetVirtualAddressMap = NULL;
 
 STATIC VOID *gRtWpDisableShims = NULL;
 
+///
+/// The write protection shims are never removed, as the OS keeps calling
+/// them.  They are installed on the first booter start only.
+///
+STATIC BOOLEAN mRtWpDisableShimsInstalled = FALSE;
+
 // TODO: Get rid of this and just use a ConSplitter.
 /**
   Queries a handle to determine if it supports a specified protocol.
@@ -97,8 +107,9 @@ InternalHandleProtocol (
 
   if ((Status == EFI_UNSUPPORTED)
    && (Handle == gST->ConsoleOutHandle)
-   && CompareGuid (Protocol, &gEfiGraphicsOutputProtocolGuid)) {
-    Status = EfiLocateProtocol (Protocol, NULL, Interface);
+   && (Protocol != NULL)
+   && (Interface != NULL)) {
+    Status = ConsoleProtocolsLookup (mHandleProtocol, Protocol, Interface);
   }
 
   return Status;
@@ -138,14 +149,23 @@ InternalSetVirtualAddressMap (
   IN EFI_MEMORY_DESCRIPTOR  *VirtualMap
   )
 {
+  EFI_MEMORY_DESCRIPTOR *PartialVirtualMap;
+  UINTN                 PartialMemoryMapSize;
+
   ASSERT (mSetVirtualAddressMap != NULL);
 
   if (PcdGetBool (PcdPartialVirtualAddressMap)) {
-    VirtualMap = GetPartialVirtualAddressMap (
-                   MemoryMapSize,
-                   DescriptorSize,
-                   VirtualMap
-                   );
+    PartialMemoryMapSize = MemoryMapSize;
+    PartialVirtualMap    = GetPartialVirtualAddressMap (
+                             &PartialMemoryMapSize,
+                             DescriptorSize,
+                             VirtualMap
+                             );
+
+    if (PartialVirtualMap != NULL) {
+      MemoryMapSize = PartialMemoryMapSize;
+      VirtualMap    = PartialVirtualMap;
+    }
   }
 
   if (PcdGetBool (PcdMapVirtualPages)) {
@@ -185,6 +205,73 @@ InternalXnuPrepareStartNotify (
 }
 #endif
 
+/**
+  Applies the enabled memory map fixups to a memory map returned by the
+  firmware.
+
+  @param[in, out] MemoryMapSize   A pointer to the size, in bytes, of the
+                                  MemoryMap buffer.  On output, the size of
+                                  the fixed memory map.
+  @param[in, out] MemoryMap       The memory map to fix.
+  @param[in]      DescriptorSize  The size, in bytes, of an individual
+                                  EFI_MEMORY_DESCRIPTOR.
+
+**/
+STATIC
+VOID
+InternalProcessMemoryMap (
+  IN OUT UINTN                  *MemoryMapSize,
+  IN OUT EFI_MEMORY_DESCRIPTOR  *MemoryMap,
+  IN     UINTN                  DescriptorSize
+  )
+{
+  if (PcdGetBool (PcdTraceMemoryMap)) {
+    MemoryMapTraceBegin (*MemoryMapSize, MemoryMap, DescriptorSize);
+  }
+
+  if (PcdGetBool (PcdShrinkMemoryMap)) {
+    ShrinkMemoryMap (
+      MemoryMapSize,
+      MemoryMap,
+      DescriptorSize
+      );
+
+    if (PcdGetBool (PcdTraceMemoryMap)) {
+      MemoryMapTraceStage (
+        MEMORY_MAP_TRACE_STAGE_SHRINK,
+        *MemoryMapSize,
+        MemoryMap,
+        DescriptorSize
+        );
+    }
+  }
+
+  if (PcdGetBool (PcdFixMemoryMap)) {
+    FixMemoryMap (
+      *MemoryMapSize,
+      MemoryMap,
+      DescriptorSize
+      );
+
+    if (PcdGetBool (PcdTraceMemoryMap)) {
+      MemoryMapTraceStage (
+        MEMORY_MAP_TRACE_STAGE_FIX,
+        *MemoryMapSize,
+        MemoryMap,
+        DescriptorSize
+        );
+    }
+  }
+
+  if (PcdGetBool (PcdReportKernelSlides)) {
+    UpdateKernelSlides (
+      *MemoryMapSize,
+      MemoryMap,
+      DescriptorSize
+      );
+  }
+}
+
 /**
   Returns the current memory map.
 
@@ -260,23 +347,82 @@ InternalGetMemoryMap (
              );
 
   if (!NonAppleBooterCall && !EFI_ERROR (Status)) {
-    if (PcdGetBool (PcdShrinkMemoryMap)) {
-      ShrinkMemoryMap (
-        MemoryMapSize,
-        MemoryMap,
-        *DescriptorSize
-        );
+    InternalProcessMemoryMap (MemoryMapSize, MemoryMap, *DescriptorSize);
+
+    if (PcdGetBool (PcdRecoverMapKeyMismatch)) {
+      MapKeyRecoverySnapshot (*MemoryMapSize, MemoryMap, *DescriptorSize);
     }
+  }
 
-    if (PcdGetBool (PcdFixMemoryMap)) {
-      FixMemoryMap (
-        *MemoryMapSize,
-        MemoryMap,
-        *DescriptorSize
-        );
+  return Status;
+}
+
+/**
+  Retries ExitBootServices() with the current MapKey if the memory map has
+  only changed in memory the OS reclaims.
+
+  @param[in] ImageHandle  Handle that identifies the exiting image.
+
+  @retval EFI_SUCCESS            Boot services have been terminated.
+  @retval EFI_INVALID_PARAMETER  The memory map could not be recovered.
+
+**/
+STATIC
+EFI_STATUS
+InternalRecoverExitBootServices (
+  IN EFI_HANDLE  ImageHandle
+  )
+{
+  EFI_STATUS            Status;
+  EFI_MEMORY_DESCRIPTOR *MemoryMap;
+  UINTN                 MemoryMapSize;
+  UINTN                 MapKey;
+  UINTN                 DescriptorSize;
+  UINT32                DescriptorVersion;
+  UINTN                 Attempt;
+
+  Status = EFI_INVALID_PARAMETER;
+
+  for (Attempt = 0; Attempt < MAP_KEY_RECOVERY_ATTEMPTS; ++Attempt) {
+    MemoryMap = MapKeyRecoveryGetBuffer (&MemoryMapSize);
+
+    if (MemoryMap == NULL) {
+      break;
+    }
+
+    Status = mGetMemoryMap (
+               &MemoryMapSize,
+               MemoryMap,
+               &MapKey,
+               &DescriptorSize,
+               &DescriptorVersion
+               );
+
+    if (EFI_ERROR (Status)) {
+      Status = EFI_INVALID_PARAMETER;
+      break;
+    }
+
+    InternalProcessMemoryMap (&MemoryMapSize, MemoryMap, DescriptorSize);
+
+    if (!MapKeyRecoveryIsCompatible (
+           MemoryMapSize,
+           MemoryMap,
+           DescriptorSize
+           )) {
+      Status = EFI_INVALID_PARAMETER;
+      break;
+    }
+
+    Status = mExitBootServices (ImageHandle, MapKey);
+
+    if (Status != EFI_INVALID_PARAMETER) {
+      break;
     }
   }
 
+  MapKeyRecoveryRecord ((BOOLEAN)!EFI_ERROR (Status));
+
   return Status;
 }
 
@@ -298,16 +444,42 @@ InternalExitBootServices (
   IN UINTN       MapKey
   )
 {
-  EFI_STATUS Status;
+  STATIC BOOLEAN AllocationsReported = FALSE;
+
+  EFI_STATUS     Status;
 
   ASSERT (mExitBootServices != NULL);
 
-  mDisableMemoryAllocationServices = TRUE;
+  //
+  // Report only on the first call, as the report may change the memory map
+  // and the booter will retry with a new MapKey.
+  //
+  if (PcdGetBool (PcdTrackBooterAllocations) && !AllocationsReported) {
+    AllocationsReported = TRUE;
+
+    AllocationTrackerReport ();
+  }
+
+  if (PcdGetBool (PcdDisableMemoryAllocationServicesBeforeExitBS)) {
+    mDisableMemoryAllocationServices = TRUE;
+  }
 
   Status = mExitBootServices (ImageHandle, MapKey);
 
+  if ((Status == EFI_INVALID_PARAMETER)
+   && PcdGetBool (PcdRecoverMapKeyMismatch)) {
+    Status = InternalRecoverExitBootServices (ImageHandle);
+  }
+
   ASSERT_EFI_ERROR (Status);
 
+  //
+  // The notifications have run, report the allocations served to them.
+  //
+  if (PcdGetBool (PcdEmergencyArena)) {
+    EmergencyArenaReport ();
+  }
+
   return Status;
 }
 
@@ -360,11 +532,25 @@ InternalAllocatePages (
     if (Status != EFI_OUT_OF_RESOURCES) {
       ASSERT_EFI_ERROR (Status);
     }
+
+    if (PcdGetBool (PcdTrackBooterAllocations) && !EFI_ERROR (Status)) {
+      AllocationTrackerAdd (
+        *Memory,
+        EFI_PAGES_TO_SIZE (Pages),
+        MemoryType,
+        FALSE,
+        RETURN_ADDRESS (0)
+        );
+    }
   } else {
     DEBUG ((
       DEBUG_VERBOSE,
       "Memory allocation function called while disabled.\n"
       ));
+
+    if (PcdGetBool (PcdEmergencyArena)) {
+      Status = EmergencyArenaAllocatePages (Type, MemoryType, Pages, Memory);
+    }
   }
 
   return Status;
@@ -401,6 +587,10 @@ InternalFreePages (
     Status = mFreePages (Memory, Pages);
 
     ASSERT_EFI_ERROR (Status);
+
+    if (PcdGetBool (PcdTrackBooterAllocations) && !EFI_ERROR (Status)) {
+      AllocationTrackerRemove (Memory, EFI_PAGES_TO_SIZE (Pages));
+    }
   } else {
     DEBUG ((
       DEBUG_VERBOSE,
@@ -452,11 +642,25 @@ InternalAllocatePool (
     if (Status != EFI_OUT_OF_RESOURCES) {
       ASSERT_EFI_ERROR (Status);
     }
+
+    if (PcdGetBool (PcdTrackBooterAllocations) && !EFI_ERROR (Status)) {
+      AllocationTrackerAdd (
+        (EFI_PHYSICAL_ADDRESS)(UINTN)*Buffer,
+        Size,
+        PoolType,
+        TRUE,
+        RETURN_ADDRESS (0)
+        );
+    }
   } else {
     DEBUG ((
       DEBUG_VERBOSE,
       "Memory allocation function called while disabled.\n"
       ));
+
+    if (PcdGetBool (PcdEmergencyArena)) {
+      Status = EmergencyArenaAllocatePool (PoolType, Size, Buffer);
+    }
   }
 
   return Status;
@@ -488,6 +692,10 @@ InternalFreePool (
     Status = mFreePool (Buffer);
 
     ASSERT_EFI_ERROR (Status);
+
+    if (PcdGetBool (PcdTrackBooterAllocations) && !EFI_ERROR (Status)) {
+      AllocationTrackerRemove ((EFI_PHYSICAL_ADDRESS)(UINTN)Buffer, 0);
+    }
   } else {
     DEBUG ((
       DEBUG_VERBOSE,
@@ -498,19 +706,87 @@ InternalFreePool (
   return Status;
 }
 
+// RT_WP_DISABLE_SHIM
+typedef struct {
+  UINTN *Shim;
+  UINTN *Original;
+} RT_WP_DISABLE_SHIM;
+
+STATIC SERVICE_HOOK mGetMemoryMapHook = SERVICE_HOOK_BOOT (
+                                          GetMemoryMap,
+                                          InternalGetMemoryMap,
+                                          &mGetMemoryMap
+                                          );
+
+STATIC SERVICE_HOOK mHandleProtocolHook = SERVICE_HOOK_BOOT (
+                                            HandleProtocol,
+                                            InternalHandleProtocol,
+                                            &mHandleProtocol
+                                            );
+
+STATIC SERVICE_HOOK mMemoryAllocationHooks[] = {
+  SERVICE_HOOK_BOOT (AllocatePages,    InternalAllocatePages,    &mAllocatePages),
+  SERVICE_HOOK_BOOT (AllocatePool,     InternalAllocatePool,     &mAllocatePool),
+  SERVICE_HOOK_BOOT (ExitBootServices, InternalExitBootServices, &mExitBootServices),
+  SERVICE_HOOK_BOOT (FreePages,        InternalFreePages,        &mFreePages),
+  SERVICE_HOOK_BOOT (FreePool,         InternalFreePool,         &mFreePool)
+};
+
+STATIC SERVICE_HOOK mSetVirtualAddressMapHook = SERVICE_HOOK_RUNTIME (
+                                                  SetVirtualAddressMap,
+                                                  InternalSetVirtualAddressMap,
+                                                  &mSetVirtualAddressMap
+                                                  );
+
+//
+// The hooks and the slots they call are located in the runtime copy of the
+// shims and are assigned once it has been made.
+//
+STATIC CONST RT_WP_DISABLE_SHIM mRtWpDisableShimOffsets[] = {
+  { &RtWpDisableGetVariable,               &gGetVariable               },
+  { &RtWpDisableGetNextVariableName,       &gGetNextVariableName       },
+  { &RtWpDisableSetVariable,               &gSetVariable               },
+  { &RtWpDisableGetTime,                   &gGetTime                   },
+  { &RtWpDisableSetTime,                   &gSetTime                   },
+  { &RtWpDisableGetWakeupTime,             &gGetWakeupTime             },
+  { &RtWpDisableSetWakeupTime,             &gSetWakeupTime             },
+  { &RtWpDisableGetNextHighMonotonicCount, &gGetNextHighMonotonicCount },
+  { &RtWpDisableResetSystem,               &gResetSystem               },
+  { &RtWpDisableUpdateCapsule,             &gUpdateCapsule             },
+  { &RtWpDisableQueryCapsuleCapabilities,  &gQueryCapsuleCapabilities  },
+  { &RtWpDisableQueryVariableInfo,         &gQueryVariableInfo         }
+};
+
+//
+// Indexed by the bits of PcdRuntimeWriteProtectionShims.
+//
+STATIC SERVICE_HOOK mRtWpDisableHooks[] = {
+  SERVICE_HOOK_RUNTIME (GetVariable,               NULL, NULL),
+  SERVICE_HOOK_RUNTIME (GetNextVariableName,       NULL, NULL),
+  SERVICE_HOOK_RUNTIME (SetVariable,               NULL, NULL),
+  SERVICE_HOOK_RUNTIME (GetTime,                   NULL, NULL),
+  SERVICE_HOOK_RUNTIME (SetTime,                   NULL, NULL),
+  SERVICE_HOOK_RUNTIME (GetWakeupTime,             NULL, NULL),
+  SERVICE_HOOK_RUNTIME (SetWakeupTime,             NULL, NULL),
+  SERVICE_HOOK_RUNTIME (GetNextHighMonotonicCount, NULL, NULL),
+  SERVICE_HOOK_RUNTIME (ResetSystem,               NULL, NULL),
+  SERVICE_HOOK_RUNTIME (UpdateCapsule,             NULL, NULL),
+  SERVICE_HOOK_RUNTIME (QueryCapsuleCapabilities,  NULL, NULL),
+  SERVICE_HOOK_RUNTIME (QueryVariableInfo,         NULL, NULL)
+};
+
 VOID
 OverrideFirmwareServices (
   VOID
   )
 {
-  BOOLEAN    Result;
-  EFI_TPL    OldTpl;
-  EFI_STATUS Status;
+  BOOLEAN                  Result;
+  EFI_STATUS               Status;
+  SERVICE_HOOK_TRANSACTION Transaction;
+  UINTN                    Index;
 
-  UINTN      CodeAddress;
-  UINTN      GetVariableOffset;
-  UINTN      GetNextVariableNameOffset;
-  UINTN      SetVariableOffset;
+  UINTN                    CodeAddress;
+  UINTN                    CodeSize;
 
   DEBUG_CODE (
     ASSERT (!mFirmwareServicesOverriden);
@@ -522,126 +798,238 @@ OverrideFirmwareServices (
     Result = VirtualMemoryConstructor ();
   }
 
-  OldTpl = EfiRaiseTPL (TPL_HIGH_LEVEL);
-
-  mGetMemoryMap     = gBS->GetMemoryMap;
-  gBS->GetMemoryMap = InternalGetMemoryMap;
+  if (PcdGetBool (PcdTrackBooterAllocations)) {
+    AllocationTrackerInitialize ();
+  }
 
-  if (PcdGetBool (PcdHandleGop)) {
-    mHandleProtocol     = gBS->HandleProtocol;
-    gBS->HandleProtocol = InternalHandleProtocol;
+  if (PcdGetBool (PcdRecoverMapKeyMismatch)) {
+    MapKeyRecoveryInitialize ();
   }
 
-  if (PcdGetBool (PcdDisableMemoryAllocationServicesBeforeExitBS)) {
-    mAllocatePages     = gBS->AllocatePages;
-    gBS->AllocatePages = InternalAllocatePages;
+  //
+  // Reserve the arena before the firmware services are disabled, so that
+  // serving late allocations does not change the memory map.
+  //
+  if (PcdGetBool (PcdDisableMemoryAllocationServicesBeforeExitBS)
+   && PcdGetBool (PcdEmergencyArena)) {
+    EmergencyArenaInitialize ();
+  }
 
-    mAllocatePool     = gBS->AllocatePool;
-    gBS->AllocatePool = InternalAllocatePool;
+  if (PcdGetBool (PcdCacheVariables)) {
+    VariableCacheInitialize ();
+  }
 
-    mExitBootServices     = gBS->ExitBootServices;
-    gBS->ExitBootServices = InternalExitBootServices;
+  if (PcdGetBool (PcdIndexVariableNames)) {
+    VariableIndexInitialize ();
+  }
 
-    mFreePages     = gBS->FreePages;
-    gBS->FreePages = InternalFreePages;
+  if (PcdGetBool (PcdCoalesceVariableWrites)) {
+    VariableWriteBufferInitialize ();
+  }
 
-    mFreePool     = gBS->FreePool;
-    gBS->FreePool = InternalFreePool;
+  //
+  // Allocate the shims before raising the TPL, as pool services must not be
+  // called above TPL_NOTIFY.  The copy of a previous booter start is still
+  // installed and must neither be leaked nor have its hooks rewritten.
+  //
+  if (gRtWpDisableShims == NULL) {
+    CodeAddress = (UINTN)&gRtWpDisableShimsDataStart;
+    CodeSize    = ((UINTN)&gRtWpDisableShimsDataEnd - CodeAddress);
+
+    Status = EfiAllocatePool (
+               EfiRuntimeServicesCode,
+               CodeSize,
+               &gRtWpDisableShims
+               );
+
+    if (!EFI_ERROR (Status)) {
+      CopyMem (gRtWpDisableShims, (VOID *)CodeAddress, CodeSize);
+
+      for (Index = 0; Index < ARRAY_SIZE (mRtWpDisableHooks); ++Index) {
+        mRtWpDisableHooks[Index].Hook = (VOID *)(
+          (UINTN)gRtWpDisableShims
+            + ((UINTN)mRtWpDisableShimOffsets[Index].Shim - CodeAddress)
+          );
+
+        mRtWpDisableHooks[Index].Original = (VOID **)(
+          (UINTN)gRtWpDisableShims
+            + ((UINTN)mRtWpDisableShimOffsets[Index].Original - CodeAddress)
+          );
+      }
+    } else {
+      gRtWpDisableShims = NULL;
+    }
   }
 
-  UPDATE_EFI_TABLE_CRC32 (gBS);
+  Status = ServiceHookBeginTransaction (&Transaction);
 
-  if (PcdGetBool (PcdPartialVirtualAddressMap) || Result) {
-    mSetVirtualAddressMap     = gRT->SetVirtualAddressMap;
-    gRT->SetVirtualAddressMap = InternalSetVirtualAddressMap;
-  } else {
-    mSetVirtualAddressMap = NULL;
+  ASSERT_EFI_ERROR (Status);
+
+  if (EFI_ERROR (Status)) {
+    return;
   }
 
-  CodeAddress = (UINTN)&gRtWpDisableShimsDataStart;
+  if (PcdGetBool (PcdProfileFirmwareServices)) {
+    HookProfiledServices (&Transaction);
+  }
 
-  Status = EfiAllocatePool (
-             EfiRuntimeServicesCode,
-             ((UINTN)&gRtWpDisableShimsDataEnd - CodeAddress),
-             &gRtWpDisableShims
-             );
+  ServiceHookInstall (&Transaction, &mGetMemoryMapHook);
 
-  if (!EFI_ERROR (Status)) {
-    gGetVariable         = (UINTN)gRT->GetVariable;
-    gGetNextVariableName = (UINTN)gRT->GetNextVariableName;
-    gSetVariable         = (UINTN)gRT->SetVariable;
-
-    CopyMem (
-      gRtWpDisableShims,
-      (VOID *)CodeAddress,
-      ((UINTN)&gRtWpDisableShimsDataEnd - CodeAddress)
-      );
+  if (PcdGetBool (PcdHandleGop)) {
+    ConsoleProtocolsInitialize ();
+    ServiceHookInstall (&Transaction, &mHandleProtocolHook);
+  }
+
+  if (PcdGetBool (PcdDisableMemoryAllocationServicesBeforeExitBS)
+   || PcdGetBool (PcdTrackBooterAllocations)) {
+    for (Index = 0; Index < ARRAY_SIZE (mMemoryAllocationHooks); ++Index) {
+      ServiceHookInstall (&Transaction, &mMemoryAllocationHooks[Index]);
+    }
+  }
+
+  if (PcdGetBool (PcdPartialVirtualAddressMap) || Result) {
+    ServiceHookInstall (&Transaction, &mSetVirtualAddressMapHook);
+  }
 
-    
-    GetVariableOffset         = ((UINTN)&RtWpDisableGetVariable - CodeAddress);
-    GetNextVariableNameOffset = ((UINTN)&RtWpDisableGetNextVariableName - CodeAddress);
-    SetVariableOffset         = ((UINTN)&RtWpDisableSetVariable - CodeAddress);
+  if ((gRtWpDisableShims != NULL) && !mRtWpDisableShimsInstalled) {
+    for (Index = 0; Index < ARRAY_SIZE (mRtWpDisableHooks); ++Index) {
+      if ((FixedPcdGet32 (PcdRuntimeWriteProtectionShims) & (1U << Index))
+            != 0) {
+        Status = ServiceHookInstall (&Transaction, &mRtWpDisableHooks[Index]);
+
+        if (EFI_ERROR (Status)) {
+          DEBUG ((
+            DEBUG_ERROR,
+            "FirmwareFixes: Runtime write protection shim %u not installed - %r\n",
+            (UINT32)Index,
+            Status
+            ));
+        }
+      }
+    }
 
-    gRT->GetVariable = (EFI_GET_VARIABLE)(
-                         (UINTN)gRtWpDisableShims + GetVariableOffset
-                         );
+    mRtWpDisableShimsInstalled = TRUE;
+  }
 
-    gRT->GetNextVariableName = (EFI_GET_NEXT_VARIABLE_NAME)(
-                                 (UINTN)gRtWpDisableShims + GetNextVariableNameOffset
-                                 );
+  //
+  // Deferred writes, cache hits and enumerations are served without passing
+  // the write protection shims.
+  //
+  if (PcdGetBool (PcdCoalesceVariableWrites)) {
+    HookVariableWriteBuffer (&Transaction);
+  }
 
-    gRT->SetVariable = (EFI_SET_VARIABLE)(
-                         (UINTN)gRtWpDisableShims + SetVariableOffset
-                         );
-  } else {
-    gRtWpDisableShims = NULL;
+  if (PcdGetBool (PcdCacheVariables)) {
+    HookVariableCache (&Transaction);
   }
 
-  UPDATE_EFI_TABLE_CRC32 (gRT);
+  if (PcdGetBool (PcdIndexVariableNames)) {
+    HookVariableIndex (&Transaction);
+  }
 
-  EfiRestoreTPL (OldTpl);
+  ServiceHookCommitTransaction (&Transaction);
 
   DEBUG_CODE (
     mFirmwareServicesOverriden = TRUE;
     );
 }
 
+// UnhookService
+EFI_STATUS
+UnhookService (
+  IN OUT SERVICE_HOOK_TRANSACTION  *Transaction,
+  IN OUT SERVICE_HOOK              *Hook
+  )
+{
+  EFI_STATUS Status;
+
+  Status = ServiceHookUninstall (Transaction, Hook);
+
+  if (Status != EFI_ACCESS_DENIED) {
+    return EFI_SUCCESS;
+  }
+
+  Status = ServiceHookBypass (Transaction, Hook);
+
+  if (!EFI_ERROR (Status)) {
+    DEBUG ((
+      DEBUG_WARN,
+      "FirmwareFixes: Hook 0x%p interposed, bypassed\n",
+      Hook->Hook
+      ));
+
+    return EFI_WARN_STALE_DATA;
+  }
+
+  //
+  // Boot Services hooks are not called after ExitBootServices().
+  //
+  DEBUG ((
+    ((Hook->Table == ServiceHookTableRuntime) ? DEBUG_ERROR : DEBUG_WARN),
+    "FirmwareFixes: Hook 0x%p interposed, cannot be removed - %r\n",
+    Hook->Hook,
+    Status
+    ));
+
+  ASSERT (Hook->Table != ServiceHookTableRuntime);
+
+  return EFI_ACCESS_DENIED;
+}
+
 VOID
 RestoreFirmwareServices (
   VOID
   )
 {
-  EFI_TPL OldTpl;
+  EFI_STATUS               Status;
+  SERVICE_HOOK_TRANSACTION Transaction;
+  UINTN                    Index;
 
   DEBUG_CODE (
     ASSERT (mFirmwareServicesOverriden);
     );
 
-  OldTpl = EfiRaiseTPL (TPL_HIGH_LEVEL);
+  Status = ServiceHookBeginTransaction (&Transaction);
+
+  ASSERT_EFI_ERROR (Status);
 
-  gBS->GetMemoryMap = mGetMemoryMap;
+  if (EFI_ERROR (Status)) {
+    return;
+  }
 
-  if (PcdGetBool (PcdHandleGop)) {
-    gBS->HandleProtocol = mHandleProtocol;
+  //
+  // The runtime variable shims stay installed for the OS.
+  //
+  if (PcdGetBool (PcdIndexVariableNames)) {
+    UnhookVariableIndex (&Transaction);
   }
 
-  if (PcdGetBool (PcdDisableMemoryAllocationServicesBeforeExitBS)) {
-    gBS->AllocatePages    = mAllocatePages;
-    gBS->AllocatePool     = mAllocatePool;
-    gBS->ExitBootServices = mExitBootServices;
-    gBS->FreePages        = mFreePages;
-    gBS->FreePool         = mFreePool;
+  if (PcdGetBool (PcdCacheVariables)) {
+    UnhookVariableCache (&Transaction);
+  }
+
+  if (PcdGetBool (PcdCoalesceVariableWrites)) {
+    UnhookVariableWriteBuffer (&Transaction);
   }
 
-  UPDATE_EFI_TABLE_CRC32 (gBS);
+  UnhookService (&Transaction, &mSetVirtualAddressMapHook);
+
+  for (Index = ARRAY_SIZE (mMemoryAllocationHooks); Index > 0; --Index) {
+    UnhookService (&Transaction, &mMemoryAllocationHooks[Index - 1]);
+  }
 
-  if (mSetVirtualAddressMap != NULL) {
-    gRT->SetVirtualAddressMap = mSetVirtualAddressMap;
+  UnhookService (&Transaction, &mHandleProtocolHook);
+  UnhookService (&Transaction, &mGetMemoryMapHook);
 
-    UPDATE_EFI_TABLE_CRC32 (gRT);
+  if (PcdGetBool (PcdProfileFirmwareServices)) {
+    UnhookProfiledServices (&Transaction);
   }
 
-  EfiRestoreTPL (OldTpl);
+  ServiceHookCommitTransaction (&Transaction);
+
+  if (PcdGetBool (PcdProfileFirmwareServices)) {
+    CloseServiceProfileEvent ();
+  }
 
   DEBUG_CODE (
     mFirmwareServicesOverriden = FALSE;
@@ -0,0 +1,146 @@
+/** @file
+  Copyright (C) 2017, CupertinoNet.  All rights reserved.<BR>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+**/
+
+#include <Uefi.h>
+
+#include <Protocol/XnuKernelSlide.h>
+
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/EfiBootServicesLib.h>
+#include <Library/PcdLib.h>
+
+#include "FirmwareFixesInternal.h"
+
+STATIC EFI_HANDLE mKernelSlideHandle = NULL;
+
+STATIC XNU_KERNEL_SLIDE_PROTOCOL mKernelSlide = {
+  XNU_KERNEL_SLIDE_PROTOCOL_REVISION,
+  0,
+  FixedPcdGet64 (PcdKernelSlideRequiredSize),
+  0,
+  { 0 }
+};
+
+// UpdateKernelSlides
+VOID
+UpdateKernelSlides (
+  IN UINTN                  MemoryMapSize,
+  IN EFI_MEMORY_DESCRIPTOR  *MemoryMap,
+  IN UINTN                  DescriptorSize
+  )
+{
+  UINT8 ValidSlides[XNU_KERNEL_SLIDE_MAXIMUM / 8];
+  UINTN NumberOfValidSlides;
+  UINTN Index;
+
+  //
+  // This runs from within GetMemoryMap(), hence no Boot Services may be
+  // called that could change the memory map.  The protocol instance is
+  // updated in place.
+  //
+  NumberOfValidSlides = GetKernelSlideBitmap (
+                          MemoryMapSize,
+                          MemoryMap,
+                          DescriptorSize,
+                          mKernelSlide.RequiredSize,
+                          ValidSlides
+                          );
+
+  ++mKernelSlide.NumberOfUpdates;
+
+  if ((mKernelSlide.NumberOfUpdates == 1)
+   || (CompareMem (
+         (VOID *)ValidSlides,
+         (VOID *)mKernelSlide.ValidSlides,
+         sizeof (ValidSlides)
+         ) != 0)) {
+    CopyMem (
+      (VOID *)mKernelSlide.ValidSlides,
+      (VOID *)ValidSlides,
+      sizeof (ValidSlides)
+      );
+
+    mKernelSlide.NumberOfValidSlides = (UINT32)NumberOfValidSlides;
+
+    DEBUG ((
+      ((NumberOfValidSlides == 0) ? DEBUG_WARN : DEBUG_INFO),
+      "FirmwareFixes: %u of %u kernel slides valid for 0x%lx bytes\n",
+      (UINT32)NumberOfValidSlides,
+      XNU_KERNEL_SLIDE_MAXIMUM,
+      mKernelSlide.RequiredSize
+      ));
+
+    DEBUG_CODE (
+      for (Index = 0; Index < ARRAY_SIZE (ValidSlides); Index += 8) {
+        DEBUG ((
+          DEBUG_VERBOSE,
+          "FirmwareFixes: Slides %03u-%03u %02x%02x%02x%02x%02x%02x%02x%02x\n",
+          (UINT32)(Index * 8),
+          (UINT32)((Index * 8) + 63),
+          ValidSlides[Index + 0],
+          ValidSlides[Index + 1],
+          ValidSlides[Index + 2],
+          ValidSlides[Index + 3],
+          ValidSlides[Index + 4],
+          ValidSlides[Index + 5],
+          ValidSlides[Index + 6],
+          ValidSlides[Index + 7]
+          ));
+      }
+      );
+  }
+}
+
+// InstallKernelSlideProtocol
+VOID
+InstallKernelSlideProtocol (
+  VOID
+  )
+{
+  EFI_STATUS Status;
+
+  Status = EfiInstallMultipleProtocolInterfaces (
+             &mKernelSlideHandle,
+             &gXnuKernelSlideProtocolGuid,
+             (VOID *)&mKernelSlide,
+             NULL
+             );
+
+  ASSERT_EFI_ERROR (Status);
+
+  if (EFI_ERROR (Status)) {
+    mKernelSlideHandle = NULL;
+  }
+}
+
+// UninstallKernelSlideProtocol
+VOID
+UninstallKernelSlideProtocol (
+  VOID
+  )
+{
+  if (mKernelSlideHandle != NULL) {
+    EfiUninstallMultipleProtocolInterfaces (
+      mKernelSlideHandle,
+      &gXnuKernelSlideProtocolGuid,
+      (VOID *)&mKernelSlide,
+      NULL
+      );
+
+    mKernelSlideHandle = NULL;
+  }
+}
@@ -0,0 +1,228 @@
+/** @file
+  Copyright (C) 2017, CupertinoNet.  All rights reserved.<BR>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+**/
+
+#include <Uefi.h>
+
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/EfiBootServicesLib.h>
+#include <Library/PcdLib.h>
+
+#include "FirmwareFixesInternal.h"
+
+STATIC EFI_MEMORY_DESCRIPTOR *mMapKeyRecoverySnapshot      = NULL;
+STATIC UINTN                 mMapKeyRecoverySnapshotSize   = 0;
+STATIC UINTN                 mMapKeyRecoveryDescriptorSize = 0;
+STATIC EFI_MEMORY_DESCRIPTOR *mMapKeyRecoveryBuffer        = NULL;
+STATIC UINT32                mMapKeyMismatches             = 0;
+STATIC UINT32                mMapKeyRecoveries             = 0;
+
+// InternalIsReclaimedMemoryType
+STATIC
+BOOLEAN
+InternalIsReclaimedMemoryType (
+  IN UINT32  Type
+  )
+{
+  return (BOOLEAN)((Type == EfiConventionalMemory)
+                || (Type == EfiBootServicesCode)
+                || (Type == EfiBootServicesData));
+}
+
+// InternalNextPreservedDescriptor
+STATIC
+EFI_MEMORY_DESCRIPTOR *
+InternalNextPreservedDescriptor (
+  IN     EFI_MEMORY_DESCRIPTOR  *MemoryMap,
+  IN     UINTN                  MemoryMapSize,
+  IN     UINTN                  DescriptorSize,
+  IN OUT UINTN                  *Offset
+  )
+{
+  EFI_MEMORY_DESCRIPTOR *Descriptor;
+
+  while ((*Offset + DescriptorSize) <= MemoryMapSize) {
+    Descriptor = (EFI_MEMORY_DESCRIPTOR *)((UINTN)MemoryMap + *Offset);
+    *Offset   += DescriptorSize;
+
+    if (!InternalIsReclaimedMemoryType (Descriptor->Type)) {
+      return Descriptor;
+    }
+  }
+
+  return NULL;
+}
+
+// MapKeyRecoveryInitialize
+VOID
+MapKeyRecoveryInitialize (
+  VOID
+  )
+{
+  EFI_STATUS Status;
+
+  ASSERT (mMapKeyRecoverySnapshot == NULL);
+
+  Status = EfiAllocatePool (
+             EfiBootServicesData,
+             (2 * FixedPcdGet32 (PcdMapKeyRecoveryBufferSize)),
+             (VOID **)&mMapKeyRecoverySnapshot
+             );
+
+  if (EFI_ERROR (Status)) {
+    mMapKeyRecoverySnapshot = NULL;
+    return;
+  }
+
+  mMapKeyRecoveryBuffer = (EFI_MEMORY_DESCRIPTOR *)(
+                            (UINTN)mMapKeyRecoverySnapshot
+                              + FixedPcdGet32 (PcdMapKeyRecoveryBufferSize)
+                            );
+
+  mMapKeyRecoverySnapshotSize   = 0;
+  mMapKeyRecoveryDescriptorSize = 0;
+  mMapKeyMismatches             = 0;
+  mMapKeyRecoveries             = 0;
+}
+
+// MapKeyRecoverySnapshot
+VOID
+MapKeyRecoverySnapshot (
+  IN UINTN                  MemoryMapSize,
+  IN EFI_MEMORY_DESCRIPTOR  *MemoryMap,
+  IN UINTN                  DescriptorSize
+  )
+{
+  if (mMapKeyRecoverySnapshot == NULL) {
+    return;
+  }
+
+  //
+  // A map that does not fit cannot be compared, which disables the
+  // recovery until the next call.
+  //
+  if (MemoryMapSize > FixedPcdGet32 (PcdMapKeyRecoveryBufferSize)) {
+    mMapKeyRecoverySnapshotSize = 0;
+    return;
+  }
+
+  CopyMem (mMapKeyRecoverySnapshot, MemoryMap, MemoryMapSize);
+
+  mMapKeyRecoverySnapshotSize   = MemoryMapSize;
+  mMapKeyRecoveryDescriptorSize = DescriptorSize;
+}
+
+// MapKeyRecoveryGetBuffer
+EFI_MEMORY_DESCRIPTOR *
+MapKeyRecoveryGetBuffer (
+  OUT UINTN  *BufferSize
+  )
+{
+  if ((mMapKeyRecoverySnapshot == NULL)
+   || (mMapKeyRecoverySnapshotSize == 0)) {
+    return NULL;
+  }
+
+  *BufferSize = FixedPcdGet32 (PcdMapKeyRecoveryBufferSize);
+
+  return mMapKeyRecoveryBuffer;
+}
+
+// MapKeyRecoveryIsCompatible
+BOOLEAN
+MapKeyRecoveryIsCompatible (
+  IN UINTN                  MemoryMapSize,
+  IN EFI_MEMORY_DESCRIPTOR  *MemoryMap,
+  IN UINTN                  DescriptorSize
+  )
+{
+  EFI_MEMORY_DESCRIPTOR *Snapshot;
+  EFI_MEMORY_DESCRIPTOR *Current;
+  UINTN                 SnapshotOffset;
+  UINTN                 CurrentOffset;
+
+  if ((mMapKeyRecoverySnapshotSize == 0)
+   || (DescriptorSize != mMapKeyRecoveryDescriptorSize)) {
+    return FALSE;
+  }
+
+  //
+  // The OS reclaims all Boot Services memory, hence the booter's map stays
+  // valid as long as only such memory has changed since it was returned.
+  //
+  SnapshotOffset = 0;
+  CurrentOffset  = 0;
+
+  do {
+    Snapshot = InternalNextPreservedDescriptor (
+                 mMapKeyRecoverySnapshot,
+                 mMapKeyRecoverySnapshotSize,
+                 DescriptorSize,
+                 &SnapshotOffset
+                 );
+
+    Current = InternalNextPreservedDescriptor (
+                MemoryMap,
+                MemoryMapSize,
+                DescriptorSize,
+                &CurrentOffset
+                );
+
+    if ((Snapshot == NULL) || (Current == NULL)) {
+      return (BOOLEAN)(Snapshot == Current);
+    }
+  } while ((Snapshot->Type == Current->Type)
+        && (Snapshot->PhysicalStart == Current->PhysicalStart)
+        && (Snapshot->NumberOfPages == Current->NumberOfPages)
+        && (Snapshot->Attribute == Current->Attribute));
+
+  return FALSE;
+}
+
+// MapKeyRecoveryRecord
+VOID
+MapKeyRecoveryRecord (
+  IN BOOLEAN  Recovered
+  )
+{
+  ++mMapKeyMismatches;
+
+  if (Recovered) {
+    ++mMapKeyRecoveries;
+  }
+
+  DEBUG ((
+    (Recovered ? DEBUG_INFO : DEBUG_WARN),
+    "FirmwareFixes: MapKey mismatch %u, %u recovered\n",
+    mMapKeyMismatches,
+    mMapKeyRecoveries
+    ));
+}
+
+// MapKeyRecoveryFree
+VOID
+MapKeyRecoveryFree (
+  VOID
+  )
+{
+  if (mMapKeyRecoverySnapshot != NULL) {
+    EfiFreePool ((VOID *)mMapKeyRecoverySnapshot);
+
+    mMapKeyRecoverySnapshot     = NULL;
+    mMapKeyRecoveryBuffer       = NULL;
+    mMapKeyRecoverySnapshotSize = 0;
+  }
+}
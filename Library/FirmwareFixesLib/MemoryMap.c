@@ -30,8 +30,12 @@
 
 #include <Uefi.h>
 
+#include <Protocol/XnuKernelSlide.h>
+
+#include <Library/BaseLib.h>
 #include <Library/BaseMemoryLib.h>
 #include <Library/DebugLib.h>
+#include <Library/PcdLib.h>
 #include <Library/UefiLib.h>
 #include <Library/VirtualMemoryLib.h>
 
@@ -64,61 +68,84 @@ STATIC RT_RELOC_PROTECT_DATA gRelocInfoData;
   same, although it seems that just assigning VirtualStart = PhysicalStart for
   non-RT areas also does the job.
 
-  @param[in] MemoryMapSize   The size in bytes of VirtualMap.
-  @param[in] DescriptorSize  The size in bytes of an entry in the VirtualMap.
-  @param[in] VirtualMap      An array of memory descriptors which contain new
-                             virtual address mapping information for all
-                             runtime ranges.
+  If PcdCoalesceVirtualAddressMap is enabled, runs of RT descriptors of the
+  same type and attributes that are contiguous both physically and virtually
+  are merged into a single descriptor.
+
+  @param[in, out] MemoryMapSize   On input, the size in bytes of VirtualMap.
+                                  On output, the size in bytes of the
+                                  returned partial Memory Map.
+  @param[in]      DescriptorSize  The size in bytes of an entry in the
+                                  VirtualMap.
+  @param[in]      VirtualMap      An array of memory descriptors which contain
+                                  new virtual address mapping information for
+                                  all runtime ranges.
+
+  @return  The partial Memory Map or NULL if it does not fit the internal
+           buffer.
 
 **/
 EFI_MEMORY_DESCRIPTOR *
 GetPartialVirtualAddressMap (
-  IN UINTN                  MemoryMapSize,
-  IN UINTN                  DescriptorSize,
-  IN EFI_MEMORY_DESCRIPTOR  *VirtualMap
+  IN OUT UINTN                  *MemoryMapSize,
+  IN     UINTN                  DescriptorSize,
+  IN     EFI_MEMORY_DESCRIPTOR  *VirtualMap
   )
 {
   EFI_MEMORY_DESCRIPTOR *VirtualAddressMap;
 
   EFI_MEMORY_DESCRIPTOR *MemoryDescriptor;
   EFI_MEMORY_DESCRIPTOR *VirtualMemoryDescriptor;
+  EFI_MEMORY_DESCRIPTOR *PreviousDescriptor;
   UINTN                 VirtualMemoryMapSize;
   UINTN                 Index;
 
-  ASSERT (MemoryMapSize > 0);
+  ASSERT (MemoryMapSize != NULL);
+  ASSERT (*MemoryMapSize > 0);
   ASSERT (DescriptorSize > 0);
-  ASSERT (DescriptorSize <= MemoryMapSize);
-  ASSERT ((MemoryMapSize % DescriptorSize) == 0);
+  ASSERT (DescriptorSize <= *MemoryMapSize);
+  ASSERT ((*MemoryMapSize % DescriptorSize) == 0);
   ASSERT (VirtualMap != NULL);
 
   MemoryDescriptor        = VirtualMap;
   VirtualMemoryDescriptor = mVirtualAddressMap;
+  PreviousDescriptor      = NULL;
   VirtualMemoryMapSize    = 0;
 
   VirtualAddressMap = mVirtualAddressMap;
 
-  for (Index = 0; Index < (MemoryMapSize / DescriptorSize); ++Index) {
+  for (Index = 0; Index < (*MemoryMapSize / DescriptorSize); ++Index) {
     if ((MemoryDescriptor->Attribute & EFI_MEMORY_RUNTIME) != 0) {
-      if ((VirtualMemoryMapSize + DescriptorSize) > sizeof (mVirtualAddressMap)) {
-        VirtualAddressMap = NULL;
+      if (PcdGetBool (PcdCoalesceVirtualAddressMap)
+       && (PreviousDescriptor != NULL)
+       && (PreviousDescriptor->Type == MemoryDescriptor->Type)
+       && (PreviousDescriptor->Attribute == MemoryDescriptor->Attribute)
+       && (MEMORY_DESCRIPTOR_PHYSICAL_TOP (PreviousDescriptor) == MemoryDescriptor->PhysicalStart)
+       && (MEMORY_DESCRIPTOR_VIRTUAL_TOP (PreviousDescriptor) == MemoryDescriptor->VirtualStart)) {
+        PreviousDescriptor->NumberOfPages += MemoryDescriptor->NumberOfPages;
+      } else {
+        if ((VirtualMemoryMapSize + DescriptorSize) > sizeof (mVirtualAddressMap)) {
+          VirtualAddressMap = NULL;
 
-        ASSERT (FALSE);
+          ASSERT (FALSE);
 
-        break;
-      }
+          break;
+        }
 
-      CopyMem (
-        (VOID *)VirtualMemoryDescriptor,
-        (VOID *)MemoryDescriptor,
-        DescriptorSize
-        );
+        CopyMem (
+          (VOID *)VirtualMemoryDescriptor,
+          (VOID *)MemoryDescriptor,
+          DescriptorSize
+          );
 
-      VirtualMemoryDescriptor = NEXT_MEMORY_DESCRIPTOR (
-                                  VirtualMemoryDescriptor,
-                                  DescriptorSize
-                                  );
+        PreviousDescriptor      = VirtualMemoryDescriptor;
+        VirtualMemoryDescriptor = NEXT_MEMORY_DESCRIPTOR (
+                                    VirtualMemoryDescriptor,
+                                    DescriptorSize
+                                    );
 
-      VirtualMemoryMapSize += DescriptorSize;
+        VirtualMemoryMapSize += DescriptorSize;
+      }
     }
 
     MemoryDescriptor = NEXT_MEMORY_DESCRIPTOR (
@@ -127,6 +154,10 @@ GetPartialVirtualAddressMap (
                          );
   }
 
+  if (VirtualAddressMap != NULL) {
+    *MemoryMapSize = VirtualMemoryMapSize;
+  }
+
   return VirtualAddressMap;
 }
 
@@ -137,6 +168,9 @@ GetPartialVirtualAddressMap (
   addresses during the change.  Linux and Windows are doing the same thing and
   problem is not visible there.
 
+  Ranges that are contiguous both virtually and physically are mapped with a
+  single page table update.
+
   @param[in] MemoryMapSize   The size in bytes of VirtualMap.
   @param[in] DescriptorSize  The size in bytes of an entry in the VirtualMap.
   @param[in] VirtualMap      An array of memory descriptors which contain new
@@ -153,11 +187,14 @@ MapVirtualPages (
 {
   EFI_MEMORY_DESCRIPTOR *MemoryDescriptor;
   VOID                  *PageTable;
-  UINTN                  Index;
+  UINTN                 Index;
+  EFI_VIRTUAL_ADDRESS   VirtualStart;
+  EFI_PHYSICAL_ADDRESS  PhysicalStart;
+  UINT64                NumberOfPages;
 
   ASSERT (MemoryMapSize > 0);
   ASSERT (DescriptorSize > 0);
-  ASSERT (DescriptorSize < MemoryMapSize);
+  ASSERT (DescriptorSize <= MemoryMapSize);
   ASSERT ((MemoryMapSize % DescriptorSize) == 0);
   ASSERT (VirtualMap != NULL);
 
@@ -165,13 +202,36 @@ MapVirtualPages (
 
   PageTable = VirtualMemoryGetPageTable (NULL);
 
+  VirtualStart  = 0;
+  PhysicalStart = 0;
+  NumberOfPages = 0;
+
   for (Index = 0; Index < (MemoryMapSize / DescriptorSize); ++Index) {
-    VirtualMemoryMapVirtualPages (
-      PageTable,
-      MemoryDescriptor->VirtualStart,
-      MemoryDescriptor->NumberOfPages,
-      MemoryDescriptor->PhysicalStart
-      );
+    //
+    // Only runtime ranges are assigned a virtual address and identity mapped
+    // ranges are covered by the firmware's page table already.
+    //
+    if (((MemoryDescriptor->Attribute & EFI_MEMORY_RUNTIME) != 0)
+     && (MemoryDescriptor->VirtualStart != MemoryDescriptor->PhysicalStart)) {
+      if ((NumberOfPages > 0)
+       && ((VirtualStart + EFI_PAGES_TO_SIZE (NumberOfPages)) == MemoryDescriptor->VirtualStart)
+       && ((PhysicalStart + EFI_PAGES_TO_SIZE (NumberOfPages)) == MemoryDescriptor->PhysicalStart)) {
+        NumberOfPages += MemoryDescriptor->NumberOfPages;
+      } else {
+        if (NumberOfPages > 0) {
+          VirtualMemoryMapVirtualPages (
+            PageTable,
+            VirtualStart,
+            NumberOfPages,
+            PhysicalStart
+            );
+        }
+
+        VirtualStart  = MemoryDescriptor->VirtualStart;
+        PhysicalStart = MemoryDescriptor->PhysicalStart;
+        NumberOfPages = MemoryDescriptor->NumberOfPages;
+      }
+    }
 
     MemoryDescriptor = NEXT_MEMORY_DESCRIPTOR (
                          MemoryDescriptor,
@@ -179,6 +239,15 @@ MapVirtualPages (
                          );
   }
 
+  if (NumberOfPages > 0) {
+    VirtualMemoryMapVirtualPages (
+      PageTable,
+      VirtualStart,
+      NumberOfPages,
+      PhysicalStart
+      );
+  }
+
   VirtualMemoryFlashCaches ();
 }
 
@@ -313,12 +382,15 @@ ShrinkMemoryMap (
         // We need to copy [MemoryDescriptor, end of list] to MemoryMap + 1.
         //
         CopyMem (
-          (VOID *)MemoryMapWalker,
+          (VOID *)NEXT_MEMORY_DESCRIPTOR (MemoryMapWalker, DescriptorSize),
           (VOID *)MemoryDescriptor,
           OffsetToEnd
           );
 
-        MemoryDescriptor = MemoryMapWalker;
+        MemoryDescriptor = NEXT_MEMORY_DESCRIPTOR (
+                             MemoryMapWalker,
+                             DescriptorSize
+                             );
         MergeDescriptors = FALSE;
       }
 
@@ -379,3 +451,86 @@ FixMemoryMap (
     MemoryMapWalker = NEXT_MEMORY_DESCRIPTOR (MemoryMapWalker, DescriptorSize);
   }
 }
+
+/**
+  Computes which kernel slides fit the memory map.  A slide is valid if its
+  window of RequiredSize bytes lies within a single free descriptor.
+
+  @param[in]  MemoryMapSize   The size in bytes of MemoryMap.
+  @param[in]  MemoryMap       The memory map to inspect.
+  @param[in]  DescriptorSize  The size in bytes of an entry in MemoryMap.
+  @param[in]  RequiredSize    The size in bytes of the kernel window.
+  @param[out] ValidSlides     The bitmap receiving the valid slides.
+
+  @return  The number of valid slides.
+
+**/
+UINTN
+GetKernelSlideBitmap (
+  IN  UINTN                  MemoryMapSize,
+  IN  EFI_MEMORY_DESCRIPTOR  *MemoryMap,
+  IN  UINTN                  DescriptorSize,
+  IN  UINT64                 RequiredSize,
+  OUT UINT8                  *ValidSlides
+  )
+{
+  UINTN                 NumberOfValidSlides;
+  EFI_MEMORY_DESCRIPTOR *MemoryMapWalker;
+  EFI_PHYSICAL_ADDRESS  Start;
+  EFI_PHYSICAL_ADDRESS  End;
+  UINT64                LowestSlide;
+  UINT64                HighestSlide;
+  UINT64                Slide;
+  UINTN                 Index;
+
+  ASSERT (DescriptorSize > 0);
+  ASSERT (RequiredSize > 0);
+  ASSERT (ValidSlides != NULL);
+
+  ZeroMem ((VOID *)ValidSlides, (XNU_KERNEL_SLIDE_MAXIMUM / 8));
+
+  NumberOfValidSlides = 0;
+  MemoryMapWalker     = MemoryMap;
+
+  for (Index = 0; Index < (MemoryMapSize / DescriptorSize); ++Index) {
+    if ((MemoryMapWalker->Type == EfiBootServicesCode)
+     || (MemoryMapWalker->Type == EfiBootServicesData)
+     || (MemoryMapWalker->Type == EfiConventionalMemory)) {
+      Start = MemoryMapWalker->PhysicalStart;
+      End   = MEMORY_DESCRIPTOR_PHYSICAL_TOP (MemoryMapWalker);
+
+      if ((End >= (XNU_KERNEL_SLIDE_BASE + RequiredSize))
+       && ((End - RequiredSize) >= Start)) {
+        LowestSlide = 0;
+
+        if (Start > XNU_KERNEL_SLIDE_BASE) {
+          LowestSlide = DivU64x32 (
+                          (Start - XNU_KERNEL_SLIDE_BASE
+                            + XNU_KERNEL_SLIDE_GRANULARITY - 1),
+                          XNU_KERNEL_SLIDE_GRANULARITY
+                          );
+        }
+
+        HighestSlide = DivU64x32 (
+                         (End - RequiredSize - XNU_KERNEL_SLIDE_BASE),
+                         XNU_KERNEL_SLIDE_GRANULARITY
+                         );
+
+        if (HighestSlide >= XNU_KERNEL_SLIDE_MAXIMUM) {
+          HighestSlide = (XNU_KERNEL_SLIDE_MAXIMUM - 1);
+        }
+
+        for (Slide = LowestSlide; Slide <= HighestSlide; ++Slide) {
+          if ((ValidSlides[Slide / 8] & (1U << (Slide % 8))) == 0) {
+            ValidSlides[Slide / 8] |= (UINT8)(1U << (Slide % 8));
+            ++NumberOfValidSlides;
+          }
+        }
+      }
+    }
+
+    MemoryMapWalker = NEXT_MEMORY_DESCRIPTOR (MemoryMapWalker, DescriptorSize);
+  }
+
+  return NumberOfValidSlides;
+}
@@ -0,0 +1,379 @@
+/** @file
+  Copyright (C) 2017, CupertinoNet.  All rights reserved.<BR>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+**/
+
+#include <Uefi.h>
+
+#include <Guid/MemoryMapTrace.h>
+
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+
+#include "FirmwareFixesInternal.h"
+
+// MEMORY_MAP_TRACE_SNAPSHOT
+typedef struct {
+  UINTN                  NumberOfEntries;
+  MEMORY_MAP_TRACE_ENTRY *Entries;
+} MEMORY_MAP_TRACE_SNAPSHOT;
+
+#define MEMORY_MAP_TRACE_SNAPSHOT_INVALID  MAX_UINTN
+
+STATIC MEMORY_MAP_TRACE_HEADER   *mTrace           = NULL;
+STATIC MEMORY_MAP_TRACE_RECORD   *mTraceRecords    = NULL;
+STATIC UINTN                     mMaximumEntries   = 0;
+STATIC UINT32                    mSequence         = 0;
+STATIC MEMORY_MAP_TRACE_SNAPSHOT mFirmwareSnapshot = { 0, NULL };
+STATIC MEMORY_MAP_TRACE_SNAPSHOT mStageSnapshot    = { 0, NULL };
+
+// InternalTraceRecord
+STATIC
+MEMORY_MAP_TRACE_RECORD *
+InternalTraceRecord (
+  IN UINT8  Kind,
+  IN UINT8  Stage
+  )
+{
+  MEMORY_MAP_TRACE_RECORD *Record;
+
+  Record = &mTraceRecords[
+              mTrace->NumberOfWrittenRecords % mTrace->NumberOfRecords
+              ];
+
+  ++mTrace->NumberOfWrittenRecords;
+
+  Record->Kind     = Kind;
+  Record->Stage    = Stage;
+  Record->Reserved = 0;
+  Record->Sequence = mSequence;
+
+  return Record;
+}
+
+// InternalTraceEntry
+STATIC
+VOID
+InternalTraceEntry (
+  IN UINT8                         Kind,
+  IN UINT8                         Stage,
+  IN CONST MEMORY_MAP_TRACE_ENTRY  *Entry,
+  IN CONST MEMORY_MAP_TRACE_ENTRY  *OldEntry OPTIONAL
+  )
+{
+  MEMORY_MAP_TRACE_RECORD *Record;
+
+  Record = InternalTraceRecord (Kind, Stage);
+
+  Record->Type          = Entry->Type;
+  Record->PhysicalStart = Entry->PhysicalStart;
+  Record->NumberOfPages = Entry->NumberOfPages;
+  Record->Attribute     = Entry->Attribute;
+
+  if (OldEntry != NULL) {
+    Record->OldType      = OldEntry->Type;
+    Record->OldAttribute = OldEntry->Attribute;
+  } else {
+    Record->OldType      = Entry->Type;
+    Record->OldAttribute = Entry->Attribute;
+  }
+}
+
+// InternalTraceCount
+STATIC
+VOID
+InternalTraceCount (
+  IN UINT8  Kind,
+  IN UINT8  Stage,
+  IN UINTN  NumberOfDescriptors
+  )
+{
+  MEMORY_MAP_TRACE_RECORD *Record;
+
+  Record = InternalTraceRecord (Kind, Stage);
+
+  Record->Type          = 0;
+  Record->OldType       = 0;
+  Record->PhysicalStart = 0;
+  Record->NumberOfPages = NumberOfDescriptors;
+  Record->Attribute     = 0;
+  Record->OldAttribute  = 0;
+}
+
+/**
+  Records the difference between Snapshot and the memory map and replaces
+  Snapshot with the memory map.  Both are expected to be sorted by
+  PhysicalStart, which UEFI memory maps are in practice.  Unsorted maps are
+  still diffed correctly, but may yield additional records.
+
+  If Snapshot is not valid, no records are written and Snapshot is only
+  refreshed.
+
+**/
+STATIC
+VOID
+InternalTraceDiff (
+  IN     UINT8                        Stage,
+  IN OUT MEMORY_MAP_TRACE_SNAPSHOT    *Snapshot,
+  IN     UINTN                        MemoryMapSize,
+  IN     CONST EFI_MEMORY_DESCRIPTOR  *MemoryMap,
+  IN     UINTN                        DescriptorSize
+  )
+{
+  UINTN                       NumberOfDescriptors;
+  UINTN                       OldIndex;
+  UINTN                       NewIndex;
+  CONST EFI_MEMORY_DESCRIPTOR *MemoryDescriptor;
+  MEMORY_MAP_TRACE_ENTRY      *OldEntry;
+  MEMORY_MAP_TRACE_ENTRY      NewEntry;
+
+  NumberOfDescriptors = (MemoryMapSize / DescriptorSize);
+
+  if (NumberOfDescriptors > mMaximumEntries) {
+    InternalTraceCount (
+      MEMORY_MAP_TRACE_RECORD_OVERFLOW,
+      Stage,
+      NumberOfDescriptors
+      );
+
+    Snapshot->NumberOfEntries = MEMORY_MAP_TRACE_SNAPSHOT_INVALID;
+
+    return;
+  }
+
+  OldIndex         = 0;
+  NewIndex         = 0;
+  MemoryDescriptor = MemoryMap;
+
+  if (Snapshot->NumberOfEntries == MEMORY_MAP_TRACE_SNAPSHOT_INVALID) {
+    NewIndex                  = NumberOfDescriptors;
+    Snapshot->NumberOfEntries = 0;
+  }
+
+  while ((OldIndex < Snapshot->NumberOfEntries)
+      || (NewIndex < NumberOfDescriptors)) {
+    OldEntry = NULL;
+
+    if (OldIndex < Snapshot->NumberOfEntries) {
+      OldEntry = &Snapshot->Entries[OldIndex];
+    }
+
+    if (NewIndex < NumberOfDescriptors) {
+      NewEntry.Type          = MemoryDescriptor->Type;
+      NewEntry.PhysicalStart = MemoryDescriptor->PhysicalStart;
+      NewEntry.NumberOfPages = MemoryDescriptor->NumberOfPages;
+      NewEntry.Attribute     = MemoryDescriptor->Attribute;
+    }
+
+    if ((NewIndex >= NumberOfDescriptors)
+     || ((OldEntry != NULL)
+      && (OldEntry->PhysicalStart < NewEntry.PhysicalStart))) {
+      InternalTraceEntry (
+        MEMORY_MAP_TRACE_RECORD_REMOVED,
+        Stage,
+        OldEntry,
+        NULL
+        );
+
+      ++OldIndex;
+    } else if ((OldEntry == NULL)
+            || (OldEntry->PhysicalStart > NewEntry.PhysicalStart)) {
+      InternalTraceEntry (
+        MEMORY_MAP_TRACE_RECORD_ADDED,
+        Stage,
+        &NewEntry,
+        NULL
+        );
+
+      ++NewIndex;
+      MemoryDescriptor = NEXT_MEMORY_DESCRIPTOR (
+                           MemoryDescriptor,
+                           DescriptorSize
+                           );
+    } else {
+      if (OldEntry->NumberOfPages != NewEntry.NumberOfPages) {
+        InternalTraceEntry (
+          MEMORY_MAP_TRACE_RECORD_REMOVED,
+          Stage,
+          OldEntry,
+          NULL
+          );
+
+        InternalTraceEntry (
+          MEMORY_MAP_TRACE_RECORD_ADDED,
+          Stage,
+          &NewEntry,
+          NULL
+          );
+      } else if ((OldEntry->Type != NewEntry.Type)
+              || (OldEntry->Attribute != NewEntry.Attribute)) {
+        InternalTraceEntry (
+          MEMORY_MAP_TRACE_RECORD_RETYPED,
+          Stage,
+          &NewEntry,
+          OldEntry
+          );
+      }
+
+      ++OldIndex;
+      ++NewIndex;
+      MemoryDescriptor = NEXT_MEMORY_DESCRIPTOR (
+                           MemoryDescriptor,
+                           DescriptorSize
+                           );
+    }
+  }
+
+  MemoryDescriptor = MemoryMap;
+
+  for (NewIndex = 0; NewIndex < NumberOfDescriptors; ++NewIndex) {
+    Snapshot->Entries[NewIndex].Type          = MemoryDescriptor->Type;
+    Snapshot->Entries[NewIndex].PhysicalStart = MemoryDescriptor->PhysicalStart;
+    Snapshot->Entries[NewIndex].NumberOfPages = MemoryDescriptor->NumberOfPages;
+    Snapshot->Entries[NewIndex].Attribute     = MemoryDescriptor->Attribute;
+
+    MemoryDescriptor = NEXT_MEMORY_DESCRIPTOR (
+                         MemoryDescriptor,
+                         DescriptorSize
+                         );
+  }
+
+  Snapshot->NumberOfEntries = NumberOfDescriptors;
+}
+
+// MemoryMapTraceInitialize
+VOID
+MemoryMapTraceInitialize (
+  IN OUT MEMORY_MAP_TRACE_HEADER  *Trace,
+  IN     UINT32                   NumberOfRecords,
+  IN OUT MEMORY_MAP_TRACE_ENTRY   *Entries,
+  IN     UINTN                    NumberOfEntries
+  )
+{
+  ASSERT (Trace != NULL);
+  ASSERT (NumberOfRecords > 0);
+  ASSERT (Entries != NULL);
+  ASSERT (NumberOfEntries >= 2);
+
+  Trace->Signature              = MEMORY_MAP_TRACE_SIGNATURE;
+  Trace->Version                = MEMORY_MAP_TRACE_VERSION;
+  Trace->HeaderSize             = sizeof (*Trace);
+  Trace->RecordSize             = sizeof (MEMORY_MAP_TRACE_RECORD);
+  Trace->NumberOfRecords        = NumberOfRecords;
+  Trace->NumberOfWrittenRecords = 0;
+
+  mTrace          = Trace;
+  mTraceRecords   = (MEMORY_MAP_TRACE_RECORD *)(Trace + 1);
+  mMaximumEntries = (NumberOfEntries / 2);
+  mSequence       = 0;
+
+  mFirmwareSnapshot.NumberOfEntries = 0;
+  mFirmwareSnapshot.Entries         = Entries;
+  mStageSnapshot.NumberOfEntries    = 0;
+  mStageSnapshot.Entries            = &Entries[mMaximumEntries];
+}
+
+// MemoryMapTraceReset
+VOID
+MemoryMapTraceReset (
+  VOID
+  )
+{
+  mTrace          = NULL;
+  mTraceRecords   = NULL;
+  mMaximumEntries = 0;
+  mSequence       = 0;
+
+  mFirmwareSnapshot.NumberOfEntries = 0;
+  mFirmwareSnapshot.Entries         = NULL;
+  mStageSnapshot.NumberOfEntries    = 0;
+  mStageSnapshot.Entries            = NULL;
+}
+
+// MemoryMapTraceBegin
+VOID
+MemoryMapTraceBegin (
+  IN UINTN                  MemoryMapSize,
+  IN EFI_MEMORY_DESCRIPTOR  *MemoryMap,
+  IN UINTN                  DescriptorSize
+  )
+{
+  if (mTrace == NULL) {
+    return;
+  }
+
+  ++mSequence;
+
+  InternalTraceCount (
+    MEMORY_MAP_TRACE_RECORD_CALL,
+    MEMORY_MAP_TRACE_STAGE_FIRMWARE,
+    (MemoryMapSize / DescriptorSize)
+    );
+
+  InternalTraceDiff (
+    MEMORY_MAP_TRACE_STAGE_FIRMWARE,
+    &mFirmwareSnapshot,
+    MemoryMapSize,
+    MemoryMap,
+    DescriptorSize
+    );
+
+  mStageSnapshot.NumberOfEntries = mFirmwareSnapshot.NumberOfEntries;
+
+  if (mFirmwareSnapshot.NumberOfEntries != MEMORY_MAP_TRACE_SNAPSHOT_INVALID) {
+    CopyMem (
+      (VOID *)mStageSnapshot.Entries,
+      (VOID *)mFirmwareSnapshot.Entries,
+      (mFirmwareSnapshot.NumberOfEntries * sizeof (*mFirmwareSnapshot.Entries))
+      );
+  }
+}
+
+// MemoryMapTraceStage
+VOID
+MemoryMapTraceStage (
+  IN UINT8                  Stage,
+  IN UINTN                  MemoryMapSize,
+  IN EFI_MEMORY_DESCRIPTOR  *MemoryMap,
+  IN UINTN                  DescriptorSize
+  )
+{
+  ASSERT (Stage > MEMORY_MAP_TRACE_STAGE_FIRMWARE);
+  ASSERT (Stage < MEMORY_MAP_TRACE_STAGE_MAXIMUM);
+
+  if (mTrace == NULL) {
+    return;
+  }
+
+  InternalTraceDiff (
+    Stage,
+    &mStageSnapshot,
+    MemoryMapSize,
+    MemoryMap,
+    DescriptorSize
+    );
+}
+
+// MemoryMapTraceGetNumberOfRecords
+UINT64
+MemoryMapTraceGetNumberOfRecords (
+  VOID
+  )
+{
+  if (mTrace == NULL) {
+    return 0;
+  }
+
+  return mTrace->NumberOfWrittenRecords;
+}
@@ -24,9 +24,27 @@ extern UINTN gRtWpDisableShimsDataEnd;
 extern UINTN gGetVariable;
 extern UINTN gGetNextVariableName;
 extern UINTN gSetVariable;
+extern UINTN gGetTime;
+extern UINTN gSetTime;
+extern UINTN gGetWakeupTime;
+extern UINTN gSetWakeupTime;
+extern UINTN gGetNextHighMonotonicCount;
+extern UINTN gResetSystem;
+extern UINTN gUpdateCapsule;
+extern UINTN gQueryCapsuleCapabilities;
+extern UINTN gQueryVariableInfo;
 
 extern UINTN RtWpDisableGetVariable;
 extern UINTN RtWpDisableGetNextVariableName;
 extern UINTN RtWpDisableSetVariable;
+extern UINTN RtWpDisableGetTime;
+extern UINTN RtWpDisableSetTime;
+extern UINTN RtWpDisableGetWakeupTime;
+extern UINTN RtWpDisableSetWakeupTime;
+extern UINTN RtWpDisableGetNextHighMonotonicCount;
+extern UINTN RtWpDisableResetSystem;
+extern UINTN RtWpDisableUpdateCapsule;
+extern UINTN RtWpDisableQueryCapsuleCapabilities;
+extern UINTN RtWpDisableQueryVariableInfo;
 
 #endif // RUNTIME_WRITE_PROTECTION_DISABLE_H_
@@ -0,0 +1,598 @@
+/** @file
+  Copyright (C) 2017, CupertinoNet.  All rights reserved.<BR>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+**/
+
+#include <Uefi.h>
+
+#include <Protocol/FirmwareServiceProfile.h>
+
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
+#include <Library/EfiBootServicesLib.h>
+#include <Library/ServiceHookLib.h>
+
+#include "FirmwareFixesInternal.h"
+
+STATIC EFI_HANDLE mServiceProfileHandle = NULL;
+
+STATIC EFI_EVENT  mServiceProfileExitBootServicesEvent = NULL;
+
+STATIC FIRMWARE_SERVICE_PROFILE_PROTOCOL mServiceProfile = {
+  FIRMWARE_SERVICE_PROFILE_PROTOCOL_REVISION,
+  FirmwareServiceProfileMaximum,
+  {
+    { "GetMemoryMap" },
+    { "HandleProtocol" },
+    { "AllocatePages" },
+    { "AllocatePool" },
+    { "ExitBootServices" },
+    { "FreePages" },
+    { "FreePool" },
+    { "SetVirtualAddressMap" },
+    { "GetVariable" },
+    { "GetNextVariableName" },
+    { "SetVariable" }
+  }
+};
+
+STATIC EFI_GET_MEMORY_MAP          mProfiledGetMemoryMap          = NULL;
+STATIC EFI_HANDLE_PROTOCOL         mProfiledHandleProtocol        = NULL;
+STATIC EFI_ALLOCATE_PAGES          mProfiledAllocatePages         = NULL;
+STATIC EFI_ALLOCATE_POOL           mProfiledAllocatePool          = NULL;
+STATIC EFI_EXIT_BOOT_SERVICES      mProfiledExitBootServices      = NULL;
+STATIC EFI_FREE_PAGES              mProfiledFreePages             = NULL;
+STATIC EFI_FREE_POOL               mProfiledFreePool              = NULL;
+STATIC EFI_SET_VIRTUAL_ADDRESS_MAP mProfiledSetVirtualAddressMap  = NULL;
+STATIC EFI_GET_VARIABLE            mProfiledGetVariable           = NULL;
+STATIC EFI_GET_NEXT_VARIABLE_NAME  mProfiledGetNextVariableName   = NULL;
+STATIC EFI_SET_VARIABLE            mProfiledSetVariable           = NULL;
+
+// InternalProfileRecord
+STATIC
+VOID
+InternalProfileRecord (
+  IN FIRMWARE_SERVICE_PROFILE_SERVICE  Service,
+  IN UINT64                            StartTicks
+  )
+{
+  FIRMWARE_SERVICE_PROFILE_ENTRY *Entry;
+  UINT64                         Ticks;
+  UINTN                          Bucket;
+
+  Ticks = (AsmReadTsc () - StartTicks);
+  Entry = &mServiceProfile.Services[Service];
+
+  Bucket = 0;
+
+  if (Ticks != 0) {
+    Bucket = ((UINTN)HighBitSet64 (Ticks) + 1);
+
+    if (Bucket >= FIRMWARE_SERVICE_PROFILE_BUCKETS) {
+      Bucket = (FIRMWARE_SERVICE_PROFILE_BUCKETS - 1);
+    }
+  }
+
+  ++Entry->NumberOfCalls;
+  ++Entry->Histogram[Bucket];
+
+  Entry->TotalTicks += Ticks;
+
+  if (Ticks > Entry->MaximumTicks) {
+    Entry->MaximumTicks = Ticks;
+  }
+}
+
+// InternalProfileGetMemoryMap
+STATIC
+EFI_STATUS
+EFIAPI
+InternalProfileGetMemoryMap (
+  IN OUT UINTN                  *MemoryMapSize,
+  IN OUT EFI_MEMORY_DESCRIPTOR  *MemoryMap,
+  OUT    UINTN                  *MapKey,
+  OUT    UINTN                  *DescriptorSize,
+  OUT    UINT32                 *DescriptorVersion
+  )
+{
+  EFI_STATUS Status;
+  UINT64     StartTicks;
+
+  StartTicks = AsmReadTsc ();
+  Status     = mProfiledGetMemoryMap (
+                 MemoryMapSize,
+                 MemoryMap,
+                 MapKey,
+                 DescriptorSize,
+                 DescriptorVersion
+                 );
+
+  InternalProfileRecord (FirmwareServiceProfileGetMemoryMap, StartTicks);
+
+  return Status;
+}
+
+// InternalProfileHandleProtocol
+STATIC
+EFI_STATUS
+EFIAPI
+InternalProfileHandleProtocol (
+  IN  EFI_HANDLE  Handle,
+  IN  EFI_GUID    *Protocol,
+  OUT VOID        **Interface
+  )
+{
+  EFI_STATUS Status;
+  UINT64     StartTicks;
+
+  StartTicks = AsmReadTsc ();
+  Status     = mProfiledHandleProtocol (Handle, Protocol, Interface);
+
+  InternalProfileRecord (FirmwareServiceProfileHandleProtocol, StartTicks);
+
+  return Status;
+}
+
+// InternalProfileAllocatePages
+STATIC
+EFI_STATUS
+EFIAPI
+InternalProfileAllocatePages (
+  IN     EFI_ALLOCATE_TYPE     Type,
+  IN     EFI_MEMORY_TYPE       MemoryType,
+  IN     UINTN                 Pages,
+  IN OUT EFI_PHYSICAL_ADDRESS  *Memory
+  )
+{
+  EFI_STATUS Status;
+  UINT64     StartTicks;
+
+  StartTicks = AsmReadTsc ();
+  Status     = mProfiledAllocatePages (Type, MemoryType, Pages, Memory);
+
+  InternalProfileRecord (FirmwareServiceProfileAllocatePages, StartTicks);
+
+  return Status;
+}
+
+// InternalProfileAllocatePool
+STATIC
+EFI_STATUS
+EFIAPI
+InternalProfileAllocatePool (
+  IN  EFI_MEMORY_TYPE  PoolType,
+  IN  UINTN            Size,
+  OUT VOID             **Buffer
+  )
+{
+  EFI_STATUS Status;
+  UINT64     StartTicks;
+
+  StartTicks = AsmReadTsc ();
+  Status     = mProfiledAllocatePool (PoolType, Size, Buffer);
+
+  InternalProfileRecord (FirmwareServiceProfileAllocatePool, StartTicks);
+
+  return Status;
+}
+
+// InternalProfileExitBootServices
+STATIC
+EFI_STATUS
+EFIAPI
+InternalProfileExitBootServices (
+  IN EFI_HANDLE  ImageHandle,
+  IN UINTN       MapKey
+  )
+{
+  EFI_STATUS Status;
+  UINT64     StartTicks;
+
+  StartTicks = AsmReadTsc ();
+  Status     = mProfiledExitBootServices (ImageHandle, MapKey);
+
+  InternalProfileRecord (FirmwareServiceProfileExitBootServices, StartTicks);
+
+  return Status;
+}
+
+// InternalProfileFreePages
+STATIC
+EFI_STATUS
+EFIAPI
+InternalProfileFreePages (
+  IN EFI_PHYSICAL_ADDRESS  Memory,
+  IN UINTN                 Pages
+  )
+{
+  EFI_STATUS Status;
+  UINT64     StartTicks;
+
+  StartTicks = AsmReadTsc ();
+  Status     = mProfiledFreePages (Memory, Pages);
+
+  InternalProfileRecord (FirmwareServiceProfileFreePages, StartTicks);
+
+  return Status;
+}
+
+// InternalProfileFreePool
+STATIC
+EFI_STATUS
+EFIAPI
+InternalProfileFreePool (
+  IN VOID  *Buffer
+  )
+{
+  EFI_STATUS Status;
+  UINT64     StartTicks;
+
+  StartTicks = AsmReadTsc ();
+  Status     = mProfiledFreePool (Buffer);
+
+  InternalProfileRecord (FirmwareServiceProfileFreePool, StartTicks);
+
+  return Status;
+}
+
+// InternalProfileSetVirtualAddressMap
+STATIC
+EFI_STATUS
+EFIAPI
+InternalProfileSetVirtualAddressMap (
+  IN UINTN                  MemoryMapSize,
+  IN UINTN                  DescriptorSize,
+  IN UINT32                 DescriptorVersion,
+  IN EFI_MEMORY_DESCRIPTOR  *VirtualMap
+  )
+{
+  EFI_STATUS Status;
+  UINT64     StartTicks;
+
+  StartTicks = AsmReadTsc ();
+  Status     = mProfiledSetVirtualAddressMap (
+                 MemoryMapSize,
+                 DescriptorSize,
+                 DescriptorVersion,
+                 VirtualMap
+                 );
+
+  InternalProfileRecord (
+    FirmwareServiceProfileSetVirtualAddressMap,
+    StartTicks
+    );
+
+  return Status;
+}
+
+// InternalProfileGetVariable
+STATIC
+EFI_STATUS
+EFIAPI
+InternalProfileGetVariable (
+  IN     CHAR16    *VariableName,
+  IN     EFI_GUID  *VendorGuid,
+  OUT    UINT32    *Attributes OPTIONAL,
+  IN OUT UINTN     *DataSize,
+  OUT    VOID      *Data OPTIONAL
+  )
+{
+  EFI_STATUS Status;
+  UINT64     StartTicks;
+
+  StartTicks = AsmReadTsc ();
+  Status     = mProfiledGetVariable (
+                 VariableName,
+                 VendorGuid,
+                 Attributes,
+                 DataSize,
+                 Data
+                 );
+
+  InternalProfileRecord (FirmwareServiceProfileGetVariable, StartTicks);
+
+  return Status;
+}
+
+// InternalProfileGetNextVariableName
+STATIC
+EFI_STATUS
+EFIAPI
+InternalProfileGetNextVariableName (
+  IN OUT UINTN     *VariableNameSize,
+  IN OUT CHAR16    *VariableName,
+  IN OUT EFI_GUID  *VendorGuid
+  )
+{
+  EFI_STATUS Status;
+  UINT64     StartTicks;
+
+  StartTicks = AsmReadTsc ();
+  Status     = mProfiledGetNextVariableName (
+                 VariableNameSize,
+                 VariableName,
+                 VendorGuid
+                 );
+
+  InternalProfileRecord (
+    FirmwareServiceProfileGetNextVariableName,
+    StartTicks
+    );
+
+  return Status;
+}
+
+// InternalProfileSetVariable
+STATIC
+EFI_STATUS
+EFIAPI
+InternalProfileSetVariable (
+  IN CHAR16    *VariableName,
+  IN EFI_GUID  *VendorGuid,
+  IN UINT32    Attributes,
+  IN UINTN     DataSize,
+  IN VOID      *Data
+  )
+{
+  EFI_STATUS Status;
+  UINT64     StartTicks;
+
+  StartTicks = AsmReadTsc ();
+  Status     = mProfiledSetVariable (
+                 VariableName,
+                 VendorGuid,
+                 Attributes,
+                 DataSize,
+                 Data
+                 );
+
+  InternalProfileRecord (FirmwareServiceProfileSetVariable, StartTicks);
+
+  return Status;
+}
+
+STATIC SERVICE_HOOK mProfileHooks[] = {
+  SERVICE_HOOK_BOOT (
+    GetMemoryMap,
+    InternalProfileGetMemoryMap,
+    &mProfiledGetMemoryMap
+    ),
+  SERVICE_HOOK_BOOT (
+    HandleProtocol,
+    InternalProfileHandleProtocol,
+    &mProfiledHandleProtocol
+    ),
+  SERVICE_HOOK_BOOT (
+    AllocatePages,
+    InternalProfileAllocatePages,
+    &mProfiledAllocatePages
+    ),
+  SERVICE_HOOK_BOOT (
+    AllocatePool,
+    InternalProfileAllocatePool,
+    &mProfiledAllocatePool
+    ),
+  SERVICE_HOOK_BOOT (
+    ExitBootServices,
+    InternalProfileExitBootServices,
+    &mProfiledExitBootServices
+    ),
+  SERVICE_HOOK_BOOT (
+    FreePages,
+    InternalProfileFreePages,
+    &mProfiledFreePages
+    ),
+  SERVICE_HOOK_BOOT (
+    FreePool,
+    InternalProfileFreePool,
+    &mProfiledFreePool
+    ),
+  SERVICE_HOOK_RUNTIME (
+    SetVirtualAddressMap,
+    InternalProfileSetVirtualAddressMap,
+    &mProfiledSetVirtualAddressMap
+    ),
+  SERVICE_HOOK_RUNTIME (
+    GetVariable,
+    InternalProfileGetVariable,
+    &mProfiledGetVariable
+    ),
+  SERVICE_HOOK_RUNTIME (
+    GetNextVariableName,
+    InternalProfileGetNextVariableName,
+    &mProfiledGetNextVariableName
+    ),
+  SERVICE_HOOK_RUNTIME (
+    SetVariable,
+    InternalProfileSetVariable,
+    &mProfiledSetVariable
+    )
+};
+
+/**
+  Invoke a notification event
+
+  @param[in] Event    Event whose notification function is being invoked.
+  @param[in] Context  The pointer to the notification function's context,
+                      which is implementation-dependent.
+
+**/
+STATIC
+VOID
+EFIAPI
+InternalProfileExitBootServicesNotify (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  EFI_STATUS               Status;
+  SERVICE_HOOK_TRANSACTION Transaction;
+
+  //
+  // The wrappers are located in Boot Services memory, hence the runtime
+  // ones must be gone before the kernel calls into the services.  A booter
+  // that boots successfully never exits, so the profile is logged here.
+  //
+  Status = ServiceHookBeginTransaction (&Transaction);
+
+  if (!EFI_ERROR (Status)) {
+    UnhookProfiledServices (&Transaction);
+    ServiceHookCommitTransaction (&Transaction);
+  }
+
+  DumpServiceProfile ();
+}
+
+// HookProfiledServices
+VOID
+HookProfiledServices (
+  IN OUT SERVICE_HOOK_TRANSACTION  *Transaction
+  )
+{
+  EFI_STATUS Status;
+  UINTN      Index;
+
+  if (mServiceProfileExitBootServicesEvent == NULL) {
+    Status = EfiCreateEvent (
+               EVT_SIGNAL_EXIT_BOOT_SERVICES,
+               TPL_NOTIFY,
+               InternalProfileExitBootServicesNotify,
+               NULL,
+               &mServiceProfileExitBootServicesEvent
+               );
+
+    ASSERT_EFI_ERROR (Status);
+
+    if (EFI_ERROR (Status)) {
+      mServiceProfileExitBootServicesEvent = NULL;
+    }
+  }
+
+  for (Index = 0; Index < ARRAY_SIZE (mProfileHooks); ++Index) {
+    ServiceHookInstall (Transaction, &mProfileHooks[Index]);
+  }
+}
+
+// UnhookProfiledServices
+VOID
+UnhookProfiledServices (
+  IN OUT SERVICE_HOOK_TRANSACTION  *Transaction
+  )
+{
+  UINTN Index;
+
+  //
+  // The registry redirects the hooks installed on top of the wrappers.
+  //
+  for (Index = ARRAY_SIZE (mProfileHooks); Index > 0; --Index) {
+    UnhookService (Transaction, &mProfileHooks[Index - 1]);
+  }
+}
+
+// CloseServiceProfileEvent
+VOID
+CloseServiceProfileEvent (
+  VOID
+  )
+{
+  if (mServiceProfileExitBootServicesEvent != NULL) {
+    EfiCloseEvent (mServiceProfileExitBootServicesEvent);
+
+    mServiceProfileExitBootServicesEvent = NULL;
+  }
+}
+
+// DumpServiceProfile
+VOID
+DumpServiceProfile (
+  VOID
+  )
+{
+  FIRMWARE_SERVICE_PROFILE_ENTRY *Entry;
+  UINTN                          Index;
+  UINTN                          Bucket;
+
+  for (Index = 0; Index < ARRAY_SIZE (mServiceProfile.Services); ++Index) {
+    Entry = &mServiceProfile.Services[Index];
+
+    if (Entry->NumberOfCalls == 0) {
+      continue;
+    }
+
+    DEBUG ((
+      DEBUG_INFO,
+      "FirmwareFixes: %a %ld calls, %ld ticks, %ld ticks max\n",
+      Entry->Name,
+      Entry->NumberOfCalls,
+      Entry->TotalTicks,
+      Entry->MaximumTicks
+      ));
+
+    DEBUG_CODE (
+      for (Bucket = 0; Bucket < FIRMWARE_SERVICE_PROFILE_BUCKETS; ++Bucket) {
+        if (Entry->Histogram[Bucket] != 0) {
+          DEBUG ((
+            DEBUG_VERBOSE,
+            "FirmwareFixes: %a < 2^%u ticks: %ld\n",
+            Entry->Name,
+            (UINT32)Bucket,
+            Entry->Histogram[Bucket]
+            ));
+        }
+      }
+      );
+  }
+}
+
+// InstallServiceProfile
+VOID
+InstallServiceProfile (
+  VOID
+  )
+{
+  EFI_STATUS Status;
+
+  Status = EfiInstallMultipleProtocolInterfaces (
+             &mServiceProfileHandle,
+             &gFirmwareServiceProfileProtocolGuid,
+             (VOID *)&mServiceProfile,
+             NULL
+             );
+
+  ASSERT_EFI_ERROR (Status);
+
+  if (EFI_ERROR (Status)) {
+    mServiceProfileHandle = NULL;
+  }
+}
+
+// UninstallServiceProfile
+VOID
+UninstallServiceProfile (
+  VOID
+  )
+{
+  CloseServiceProfileEvent ();
+
+  if (mServiceProfileHandle != NULL) {
+    EfiUninstallMultipleProtocolInterfaces (
+      mServiceProfileHandle,
+      &gFirmwareServiceProfileProtocolGuid,
+      (VOID *)&mServiceProfile,
+      NULL
+      );
+
+    mServiceProfileHandle = NULL;
+  }
+}
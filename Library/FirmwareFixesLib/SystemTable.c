@@ -17,7 +17,6 @@
 
 #include <Uefi.h>
 
-#include <Protocol/AppleBooterHandle.h>
 #include <Protocol/LoadedImage.h>
 
 #include <Library/DebugLib.h>
@@ -47,14 +46,13 @@ InternalFreeSystemTableCopy (
 
 VOID
 InternalOverrideSystemTable (
-  IN VOID  *Registration
+  IN EFI_HANDLE  BooterHandle
   )
 {
   EFI_STATUS                Status;
-  EFI_HANDLE                BooterHandle;
   EFI_LOADED_IMAGE_PROTOCOL *LoadedImage;
 
-  ASSERT (Registration != NULL);
+  ASSERT (BooterHandle != NULL);
 
   if (mSTCopy == NULL) {
     mSTCopy = AllocateXnuSupportData (gST->Hdr.HeaderSize);
@@ -66,26 +64,16 @@ InternalOverrideSystemTable (
         gST->Hdr.HeaderSize
         );
 
-      Status = EfiLocateProtocol (
-                 &gAppleBooterHandleProtocolGuid,
-                 Registration,
-                 (VOID **)&BooterHandle
+      Status = EfiHandleProtocol (
+                 BooterHandle,
+                 &gEfiLoadedImageProtocolGuid,
+                 (VOID **)&LoadedImage
                  );
 
-      ASSERT (Status != EFI_NOT_FOUND);
+      ASSERT (Status != EFI_UNSUPPORTED);
 
       if (!EFI_ERROR (Status)) {
-        Status = EfiHandleProtocol (
-                   BooterHandle,
-                   &gEfiLoadedImageProtocolGuid,
-                   (VOID **)&LoadedImage
-                   );
-
-        ASSERT (Status != EFI_UNSUPPORTED);
-
-        if (!EFI_ERROR (Status)) {
-          LoadedImage->SystemTable = mSTCopy;
-        }
+        LoadedImage->SystemTable = mSTCopy;
       }
 
       if (EFI_ERROR (Status)) {
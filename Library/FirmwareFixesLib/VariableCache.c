@@ -0,0 +1,657 @@
+/** @file
+  Copyright (C) 2017, CupertinoNet.  All rights reserved.<BR>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+**/
+
+#include <Uefi.h>
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/EfiBootServicesLib.h>
+#include <Library/PcdLib.h>
+#include <Library/ServiceHookLib.h>
+
+#include "FirmwareFixesInternal.h"
+
+///
+/// The maximum length, including the terminator, of a cached variable name.
+///
+#define VARIABLE_CACHE_NAME_LENGTH  64
+
+///
+/// The number of slots searched for a variable, starting at its hash.
+///
+#define VARIABLE_CACHE_PROBES  4
+
+// VARIABLE_CACHE_ENTRY
+typedef struct {
+  UINT32   Hash;
+  BOOLEAN  Used;
+  BOOLEAN  Found;
+  BOOLEAN  Oversized;
+  EFI_GUID VendorGuid;
+  CHAR16   Name[VARIABLE_CACHE_NAME_LENGTH];
+  UINT32   Attributes;
+  UINTN    DataSize;
+} VARIABLE_CACHE_ENTRY;
+
+// VARIABLE_CACHE_ENTRY_DATA
+#define VARIABLE_CACHE_ENTRY_DATA(Entry)  ((VOID *)((Entry) + 1))
+
+STATIC UINT8     *mVariableCache                     = NULL;
+STATIC UINTN     mVariableCacheEntrySize             = 0;
+STATIC UINTN     mVariableCacheMask                  = 0;
+STATIC UINTN     mVariableCacheEvictions             = 0;
+STATIC UINT64    mVariableCacheHits                  = 0;
+STATIC UINT64    mVariableCacheMisses                = 0;
+STATIC UINT32    mVariableCacheGeneration            = 0;
+STATIC BOOLEAN   mVariableCacheEnabled               = FALSE;
+STATIC BOOLEAN   mVariableCacheBusy                  = FALSE;
+STATIC EFI_EVENT mVariableCacheExitBootServicesEvent = NULL;
+
+STATIC EFI_GET_VARIABLE mCachedGetVariable = NULL;
+STATIC EFI_SET_VARIABLE mCachedSetVariable = NULL;
+
+// InternalGetVariableCacheEntry
+STATIC
+VARIABLE_CACHE_ENTRY *
+InternalGetVariableCacheEntry (
+  IN UINTN  Slot
+  )
+{
+  return (VARIABLE_CACHE_ENTRY *)(
+           mVariableCache + ((Slot & mVariableCacheMask) * mVariableCacheEntrySize)
+           );
+}
+
+// InternalHashVariable
+STATIC
+UINT32
+InternalHashVariable (
+  IN  CONST CHAR16    *VariableName,
+  IN  CONST EFI_GUID  *VendorGuid,
+  OUT UINTN           *NameSize
+  )
+{
+  UINT32 Hash;
+  UINTN  Index;
+
+  //
+  // FNV-1a over the name, seeded with the first GUID field.
+  //
+  Hash = (0x811C9DC5U ^ VendorGuid->Data1);
+
+  for (Index = 0; VariableName[Index] != L'\0'; ++Index) {
+    Hash ^= VariableName[Index];
+    Hash *= 0x01000193U;
+  }
+
+  *NameSize = ((Index + 1) * sizeof (*VariableName));
+
+  return Hash;
+}
+
+// InternalFindVariableCacheEntry
+STATIC
+VARIABLE_CACHE_ENTRY *
+InternalFindVariableCacheEntry (
+  IN CONST CHAR16    *VariableName,
+  IN CONST EFI_GUID  *VendorGuid,
+  IN UINT32          Hash,
+  IN UINTN           NameSize
+  )
+{
+  VARIABLE_CACHE_ENTRY *Entry;
+  UINTN                Index;
+
+  for (Index = 0; Index < VARIABLE_CACHE_PROBES; ++Index) {
+    Entry = InternalGetVariableCacheEntry (Hash + Index);
+
+    if (Entry->Used
+     && (Entry->Hash == Hash)
+     && CompareGuid (&Entry->VendorGuid, VendorGuid)
+     && (CompareMem (Entry->Name, VariableName, NameSize) == 0)) {
+      return Entry;
+    }
+  }
+
+  return NULL;
+}
+
+// InternalAllocateVariableCacheEntry
+STATIC
+VARIABLE_CACHE_ENTRY *
+InternalAllocateVariableCacheEntry (
+  IN UINT32  Hash
+  )
+{
+  VARIABLE_CACHE_ENTRY *Entry;
+  UINTN                Index;
+
+  for (Index = 0; Index < VARIABLE_CACHE_PROBES; ++Index) {
+    Entry = InternalGetVariableCacheEntry (Hash + Index);
+
+    if (!Entry->Used) {
+      return Entry;
+    }
+  }
+
+  //
+  // Evict the probed slots in turn.
+  //
+  ++mVariableCacheEvictions;
+
+  return InternalGetVariableCacheEntry (
+           Hash + (mVariableCacheEvictions % VARIABLE_CACHE_PROBES)
+           );
+}
+
+// InternalReturnCachedVariable
+STATIC
+EFI_STATUS
+InternalReturnCachedVariable (
+  IN     CONST VARIABLE_CACHE_ENTRY  *Entry,
+  OUT    UINT32                      *Attributes OPTIONAL,
+  IN OUT UINTN                       *DataSize,
+  OUT    VOID                        *Data OPTIONAL
+  )
+{
+  if (!Entry->Found) {
+    return EFI_NOT_FOUND;
+  }
+
+  //
+  // The attributes are returned with EFI_BUFFER_TOO_SMALL as well.
+  //
+  if (Attributes != NULL) {
+    *Attributes = Entry->Attributes;
+  }
+
+  if (*DataSize < Entry->DataSize) {
+    *DataSize = Entry->DataSize;
+
+    return EFI_BUFFER_TOO_SMALL;
+  }
+
+  if (Data == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  CopyMem (Data, VARIABLE_CACHE_ENTRY_DATA (Entry), Entry->DataSize);
+
+  *DataSize = Entry->DataSize;
+
+  return EFI_SUCCESS;
+}
+
+// InternalCanReturnCachedVariable
+STATIC
+BOOLEAN
+InternalCanReturnCachedVariable (
+  IN CONST VARIABLE_CACHE_ENTRY  *Entry,
+  IN CONST UINT32                *Attributes OPTIONAL,
+  IN CONST UINTN                 *DataSize
+  )
+{
+  //
+  // Of variables too large for an entry only the size is cached.  Firmware
+  // predating UEFI 2.7 does not return the attributes with
+  // EFI_BUFFER_TOO_SMALL, which leaves them 0 as no variable exists without
+  // attributes.
+  //
+  return (BOOLEAN)(!Entry->Oversized
+                || ((*DataSize < Entry->DataSize)
+                 && ((Attributes == NULL) || (Entry->Attributes != 0))));
+}
+
+/**
+  Returns the value of a variable.  The value is served from and added to
+  the cache while Boot Services are active.
+
+  @param[in]      VariableName  A Null-terminated string that is the name of
+                                the vendor's variable.
+  @param[in]      VendorGuid    A unique identifier for the vendor.
+  @param[out]     Attributes    If not NULL, a pointer to the memory location
+                                to return the attributes bitmask for the
+                                variable.
+  @param[in, out] DataSize      On input, the size in bytes of the return Data
+                                buffer.  On output the size of data returned
+                                in Data.
+  @param[out]     Data          The buffer to return the contents of the
+                                variable.  May be NULL with a zero DataSize in
+                                order to determine the size buffer needed.
+
+  @retval EFI_SUCCESS            The function completed successfully.
+  @retval EFI_NOT_FOUND          The variable was not found.
+  @retval EFI_BUFFER_TOO_SMALL   The DataSize is too small for the result.
+  @retval EFI_INVALID_PARAMETER  A parameter is invalid.
+  @retval EFI_DEVICE_ERROR       The variable could not be retrieved due to a
+                                 hardware error.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+InternalCachedGetVariable (
+  IN     CHAR16    *VariableName,
+  IN     EFI_GUID  *VendorGuid,
+  OUT    UINT32    *Attributes OPTIONAL,
+  IN OUT UINTN     *DataSize,
+  OUT    VOID      *Data OPTIONAL
+  )
+{
+  EFI_STATUS           Status;
+  VARIABLE_CACHE_ENTRY *Entry;
+  UINT32               Hash;
+  UINTN                NameSize;
+  UINTN                EntryDataSize;
+  UINT32               EntryAttributes;
+  UINT32               Generation;
+
+  if (!mVariableCacheEnabled
+   || mVariableCacheBusy
+   || (VariableName == NULL)
+   || (VendorGuid == NULL)
+   || (DataSize == NULL)) {
+    return mCachedGetVariable (
+             VariableName,
+             VendorGuid,
+             Attributes,
+             DataSize,
+             Data
+             );
+  }
+
+  //
+  // Calls from notification functions of a higher TPL bypass the cache
+  // while it is being updated.
+  //
+  mVariableCacheBusy = TRUE;
+
+  Hash  = InternalHashVariable (VariableName, VendorGuid, &NameSize);
+  Entry = NULL;
+
+  if (NameSize <= sizeof (Entry->Name)) {
+    Entry = InternalFindVariableCacheEntry (
+              VariableName,
+              VendorGuid,
+              Hash,
+              NameSize
+              );
+
+    if ((Entry != NULL)
+     && InternalCanReturnCachedVariable (Entry, Attributes, DataSize)) {
+      ++mVariableCacheHits;
+
+      Status = InternalReturnCachedVariable (
+                 Entry,
+                 Attributes,
+                 DataSize,
+                 Data
+                 );
+
+      mVariableCacheBusy = FALSE;
+
+      return Status;
+    }
+
+    ++mVariableCacheMisses;
+
+    //
+    // The entry cannot answer this call, which is left to the firmware.
+    //
+    if (Entry != NULL) {
+      mVariableCacheBusy = FALSE;
+
+      return mCachedGetVariable (
+               VariableName,
+               VendorGuid,
+               Attributes,
+               DataSize,
+               Data
+               );
+    }
+
+    //
+    // Read the variable into the cache first, so that size queries are
+    // answered from the cache too.
+    //
+    Entry       = InternalAllocateVariableCacheEntry (Hash);
+    Entry->Used = FALSE;
+    Generation  = mVariableCacheGeneration;
+
+    EntryAttributes = 0;
+    EntryDataSize   = (mVariableCacheEntrySize - sizeof (*Entry));
+    Status          = mCachedGetVariable (
+                        VariableName,
+                        VendorGuid,
+                        &EntryAttributes,
+                        &EntryDataSize,
+                        VARIABLE_CACHE_ENTRY_DATA (Entry)
+                        );
+
+    if (Status == EFI_NOT_FOUND) {
+      EntryAttributes = 0;
+      EntryDataSize   = 0;
+    }
+
+    //
+    // A nested SetVariable() may have invalidated the cache meanwhile.
+    //
+    if (((Status == EFI_SUCCESS)
+      || (Status == EFI_NOT_FOUND)
+      || (Status == EFI_BUFFER_TOO_SMALL))
+     && (Generation == mVariableCacheGeneration)) {
+      Entry->Hash       = Hash;
+      Entry->Used       = TRUE;
+      Entry->Found      = (BOOLEAN)(Status != EFI_NOT_FOUND);
+      Entry->Oversized  = (BOOLEAN)(Status == EFI_BUFFER_TOO_SMALL);
+      Entry->Attributes = EntryAttributes;
+      Entry->DataSize   = EntryDataSize;
+
+      CopyGuid (&Entry->VendorGuid, VendorGuid);
+      CopyMem (Entry->Name, VariableName, NameSize);
+
+      if (InternalCanReturnCachedVariable (Entry, Attributes, DataSize)) {
+        Status = InternalReturnCachedVariable (
+                   Entry,
+                   Attributes,
+                   DataSize,
+                   Data
+                   );
+
+        mVariableCacheBusy = FALSE;
+
+        return Status;
+      }
+    }
+  }
+
+  mVariableCacheBusy = FALSE;
+
+  //
+  // The variable is too large to be cached or could not be read.
+  //
+  return mCachedGetVariable (
+           VariableName,
+           VendorGuid,
+           Attributes,
+           DataSize,
+           Data
+           );
+}
+
+/**
+  Sets the value of a variable and drops it from the cache.
+
+  @param[in] VariableName  A Null-terminated string that is the name of the
+                           vendor's variable.
+  @param[in] VendorGuid    A unique identifier for the vendor.
+  @param[in] Attributes    Attributes bitmask to set for the variable.
+  @param[in] DataSize      The size in bytes of the Data buffer.
+  @param[in] Data          The contents for the variable.
+
+  @retval EFI_SUCCESS            The firmware has successfully stored the
+                                 variable and its data as defined by the
+                                 Attributes.
+  @retval EFI_INVALID_PARAMETER  An invalid combination of attribute bits,
+                                 name, and GUID was supplied, or the DataSize
+                                 exceeds the maximum allowed.
+  @retval EFI_OUT_OF_RESOURCES   Not enough storage is available to hold the
+                                 variable and its data.
+  @retval EFI_DEVICE_ERROR       A variable could not be saved due to a
+                                 hardware failure.
+  @retval EFI_WRITE_PROTECTED    The variable in question is read-only or
+                                 cannot be deleted.
+  @retval EFI_NOT_FOUND          The variable trying to be updated or deleted
+                                 was not found.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+InternalCachedSetVariable (
+  IN CHAR16    *VariableName,
+  IN EFI_GUID  *VendorGuid,
+  IN UINT32    Attributes,
+  IN UINTN     DataSize,
+  IN VOID      *Data
+  )
+{
+  EFI_STATUS           Status;
+  VARIABLE_CACHE_ENTRY *Entry;
+  UINT32               Hash;
+  UINTN                NameSize;
+
+  Status = mCachedSetVariable (
+             VariableName,
+             VendorGuid,
+             Attributes,
+             DataSize,
+             Data
+             );
+
+  //
+  // Invalidate regardless of the result, as a failed write may still have
+  // changed the variable.  A GetVariable() call interrupted by this one must
+  // not cache its result.
+  //
+  if (mVariableCacheEnabled
+   && (VariableName != NULL)
+   && (VendorGuid != NULL)) {
+    ++mVariableCacheGeneration;
+
+    Hash  = InternalHashVariable (VariableName, VendorGuid, &NameSize);
+    Entry = NULL;
+
+    if (NameSize <= sizeof (Entry->Name)) {
+      Entry = InternalFindVariableCacheEntry (
+                VariableName,
+                VendorGuid,
+                Hash,
+                NameSize
+                );
+
+      if (Entry != NULL) {
+        Entry->Used = FALSE;
+      }
+    }
+  }
+
+  return Status;
+}
+
+STATIC SERVICE_HOOK mVariableCacheHooks[] = {
+  SERVICE_HOOK_RUNTIME (
+    GetVariable,
+    InternalCachedGetVariable,
+    &mCachedGetVariable
+    ),
+  SERVICE_HOOK_RUNTIME (
+    SetVariable,
+    InternalCachedSetVariable,
+    &mCachedSetVariable
+    )
+};
+
+/**
+  Invoke a notification event
+
+  @param[in] Event    Event whose notification function is being invoked.
+  @param[in] Context  The pointer to the notification function's context,
+                      which is implementation-dependent.
+
+**/
+STATIC
+VOID
+EFIAPI
+InternalVariableCacheExitBootServicesNotify (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  EFI_STATUS               Status;
+  SERVICE_HOOK_TRANSACTION Transaction;
+
+  //
+  // The variable services may change their behaviour once Boot Services are
+  // gone, and the hooks are located in Boot Services memory.
+  //
+  mVariableCacheEnabled = FALSE;
+
+  Status = ServiceHookBeginTransaction (&Transaction);
+
+  if (!EFI_ERROR (Status)) {
+    UnhookVariableCache (&Transaction);
+    ServiceHookCommitTransaction (&Transaction);
+  }
+
+  DEBUG ((
+    DEBUG_INFO,
+    "FirmwareFixes: Variable cache %ld hits, %ld misses, %u evictions\n",
+    mVariableCacheHits,
+    mVariableCacheMisses,
+    (UINT32)mVariableCacheEvictions
+    ));
+}
+
+// VariableCacheInitialize
+VOID
+VariableCacheInitialize (
+  VOID
+  )
+{
+  EFI_STATUS Status;
+  UINTN      NumberOfEntries;
+  UINTN      EntrySize;
+
+  ASSERT (mVariableCache == NULL);
+
+  NumberOfEntries = FixedPcdGet32 (PcdVariableCacheEntries);
+
+  ASSERT ((NumberOfEntries & (NumberOfEntries - 1)) == 0);
+
+  EntrySize = ALIGN_VALUE (
+                (sizeof (VARIABLE_CACHE_ENTRY)
+                  + FixedPcdGet32 (PcdVariableCacheDataSize)),
+                sizeof (UINT64)
+                );
+
+  Status = EfiAllocatePool (
+             EfiBootServicesData,
+             (NumberOfEntries * EntrySize),
+             (VOID **)&mVariableCache
+             );
+
+  if (EFI_ERROR (Status)) {
+    mVariableCache = NULL;
+    return;
+  }
+
+  Status = EfiCreateEvent (
+             EVT_SIGNAL_EXIT_BOOT_SERVICES,
+             TPL_NOTIFY,
+             InternalVariableCacheExitBootServicesNotify,
+             NULL,
+             &mVariableCacheExitBootServicesEvent
+             );
+
+  if (EFI_ERROR (Status)) {
+    EfiFreePool ((VOID *)mVariableCache);
+
+    mVariableCache = NULL;
+    return;
+  }
+
+  mVariableCacheEntrySize = EntrySize;
+  mVariableCacheMask      = (NumberOfEntries - 1);
+  mVariableCacheEvictions = 0;
+  mVariableCacheHits      = 0;
+  mVariableCacheMisses    = 0;
+  mVariableCacheBusy      = FALSE;
+
+  VariableCacheInvalidate ();
+}
+
+// VariableCacheInvalidate
+VOID
+VariableCacheInvalidate (
+  VOID
+  )
+{
+  UINTN Index;
+
+  ++mVariableCacheGeneration;
+
+  if (mVariableCache != NULL) {
+    for (Index = 0; Index <= mVariableCacheMask; ++Index) {
+      InternalGetVariableCacheEntry (Index)->Used = FALSE;
+    }
+  }
+}
+
+// HookVariableCache
+VOID
+HookVariableCache (
+  IN OUT SERVICE_HOOK_TRANSACTION  *Transaction
+  )
+{
+  UINTN Index;
+
+  if (mVariableCache != NULL) {
+    for (Index = 0; Index < ARRAY_SIZE (mVariableCacheHooks); ++Index) {
+      ServiceHookInstall (Transaction, &mVariableCacheHooks[Index]);
+    }
+
+    mVariableCacheEnabled = TRUE;
+  }
+}
+
+// UnhookVariableCache
+VOID
+UnhookVariableCache (
+  IN OUT SERVICE_HOOK_TRANSACTION  *Transaction
+  )
+{
+  UINTN Index;
+
+  mVariableCacheEnabled = FALSE;
+
+  //
+  // Hooks that cannot be removed are bypassed through their thunks.
+  //
+  for (Index = ARRAY_SIZE (mVariableCacheHooks); Index > 0; --Index) {
+    UnhookService (Transaction, &mVariableCacheHooks[Index - 1]);
+  }
+}
+
+// VariableCacheFree
+VOID
+VariableCacheFree (
+  VOID
+  )
+{
+  if (mVariableCacheExitBootServicesEvent != NULL) {
+    EfiCloseEvent (mVariableCacheExitBootServicesEvent);
+
+    mVariableCacheExitBootServicesEvent = NULL;
+  }
+
+  if (mVariableCache != NULL) {
+    EfiFreePool ((VOID *)mVariableCache);
+
+    mVariableCache = NULL;
+  }
+}
@@ -0,0 +1,581 @@
+/** @file
+  Copyright (C) 2017, CupertinoNet.  All rights reserved.<BR>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+**/
+
+#include <Uefi.h>
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/EfiBootServicesLib.h>
+#include <Library/PcdLib.h>
+#include <Library/ServiceHookLib.h>
+
+#include "FirmwareFixesInternal.h"
+
+///
+/// A variable of the snapshot.  Entries are packed into the name area in
+/// firmware enumeration order.
+///
+typedef struct {
+  EFI_GUID VendorGuid;
+  UINT32   NameSize;
+  UINT32   Reserved;
+  CHAR16   Name[1];
+} VARIABLE_INDEX_ENTRY;
+
+STATIC UINT8     *mVariableIndexNames                = NULL;
+STATIC UINTN     mVariableIndexNamesSize             = 0;
+STATIC UINT32    *mVariableIndexOffsets              = NULL;
+STATIC UINT16    *mVariableIndexSorted               = NULL;
+STATIC UINTN     mVariableIndexCapacity              = 0;
+STATIC UINTN     mNumberOfIndexedVariables           = 0;
+STATIC BOOLEAN   mVariableIndexValid                 = FALSE;
+STATIC BOOLEAN   mVariableIndexUnusable              = FALSE;
+STATIC BOOLEAN   mVariableIndexEnabled               = FALSE;
+STATIC BOOLEAN   mVariableIndexBusy                  = FALSE;
+STATIC UINT32    mVariableIndexGeneration            = 0;
+STATIC UINT64    mVariableIndexHits                  = 0;
+STATIC UINT32    mVariableIndexBuilds                = 0;
+STATIC EFI_EVENT mVariableIndexExitBootServicesEvent = NULL;
+
+STATIC EFI_GET_NEXT_VARIABLE_NAME mIndexedGetNextVariableName = NULL;
+STATIC EFI_SET_VARIABLE           mIndexedSetVariable         = NULL;
+
+// InternalGetIndexedVariable
+STATIC
+VARIABLE_INDEX_ENTRY *
+InternalGetIndexedVariable (
+  IN UINTN  Ordinal
+  )
+{
+  return (VARIABLE_INDEX_ENTRY *)(
+           mVariableIndexNames + mVariableIndexOffsets[Ordinal]
+           );
+}
+
+// InternalCompareIndexedVariable
+STATIC
+INTN
+InternalCompareIndexedVariable (
+  IN CONST CHAR16                *VariableName,
+  IN CONST EFI_GUID              *VendorGuid,
+  IN CONST VARIABLE_INDEX_ENTRY  *Entry
+  )
+{
+  INTN Result;
+
+  Result = CompareMem (VendorGuid, &Entry->VendorGuid, sizeof (*VendorGuid));
+
+  if (Result == 0) {
+    Result = StrCmp (VariableName, Entry->Name);
+  }
+
+  return Result;
+}
+
+// InternalSearchVariableIndex
+STATIC
+UINTN
+InternalSearchVariableIndex (
+  IN  CONST CHAR16    *VariableName,
+  IN  CONST EFI_GUID  *VendorGuid,
+  OUT BOOLEAN         *Found
+  )
+{
+  UINTN Low;
+  UINTN High;
+  UINTN Middle;
+  INTN  Result;
+
+  Low  = 0;
+  High = mNumberOfIndexedVariables;
+
+  while (Low < High) {
+    Middle = (Low + ((High - Low) / 2));
+    Result = InternalCompareIndexedVariable (
+               VariableName,
+               VendorGuid,
+               InternalGetIndexedVariable (mVariableIndexSorted[Middle])
+               );
+
+    if (Result == 0) {
+      *Found = TRUE;
+      return Middle;
+    }
+
+    if (Result < 0) {
+      High = Middle;
+    } else {
+      Low = (Middle + 1);
+    }
+  }
+
+  *Found = FALSE;
+
+  return Low;
+}
+
+// InternalBuildVariableIndex
+STATIC
+VOID
+InternalBuildVariableIndex (
+  VOID
+  )
+{
+  EFI_STATUS           Status;
+  VARIABLE_INDEX_ENTRY *Entry;
+  VARIABLE_INDEX_ENTRY *Previous;
+  UINTN                Offset;
+  UINTN                NameSize;
+  UINTN                Position;
+  BOOLEAN              Found;
+  UINT32               Generation;
+
+  ++mVariableIndexBuilds;
+
+  mNumberOfIndexedVariables = 0;
+  Generation                = mVariableIndexGeneration;
+  Previous                  = NULL;
+  Offset                    = 0;
+
+  //
+  // Every name is read in place, starting from a copy of the previous one,
+  // so that no separate buffer is needed.
+  //
+  while (TRUE) {
+    NameSize = ((Previous != NULL) ? Previous->NameSize : sizeof (CHAR16));
+
+    if ((mNumberOfIndexedVariables == mVariableIndexCapacity)
+     || ((Offset + OFFSET_OF (VARIABLE_INDEX_ENTRY, Name) + NameSize)
+           > mVariableIndexNamesSize)) {
+      mVariableIndexUnusable = TRUE;
+      return;
+    }
+
+    Entry    = (VARIABLE_INDEX_ENTRY *)(mVariableIndexNames + Offset);
+    NameSize = (mVariableIndexNamesSize
+                 - Offset
+                 - OFFSET_OF (VARIABLE_INDEX_ENTRY, Name));
+
+    if (Previous == NULL) {
+      ZeroMem (&Entry->VendorGuid, sizeof (Entry->VendorGuid));
+      Entry->Name[0] = L'\0';
+    } else {
+      CopyGuid (&Entry->VendorGuid, &Previous->VendorGuid);
+      CopyMem (Entry->Name, Previous->Name, Previous->NameSize);
+    }
+
+    Status = mIndexedGetNextVariableName (
+               &NameSize,
+               Entry->Name,
+               &Entry->VendorGuid
+               );
+
+    //
+    // Give up on an enumeration that changed the variables itself and on
+    // names that do not fit.  Only the latter fails again until a variable
+    // is written.
+    //
+    if (Generation != mVariableIndexGeneration) {
+      return;
+    }
+
+    if (Status == EFI_NOT_FOUND) {
+      break;
+    }
+
+    if (EFI_ERROR (Status)) {
+      mVariableIndexUnusable = TRUE;
+      return;
+    }
+
+    Entry->NameSize = (UINT32)StrSize (Entry->Name);
+
+    Position = InternalSearchVariableIndex (
+                 Entry->Name,
+                 &Entry->VendorGuid,
+                 &Found
+                 );
+
+    //
+    // A firmware returning a name twice would loop forever.
+    //
+    if (Found) {
+      mVariableIndexUnusable = TRUE;
+      return;
+    }
+
+    CopyMem (
+      &mVariableIndexSorted[Position + 1],
+      &mVariableIndexSorted[Position],
+      ((mNumberOfIndexedVariables - Position) * sizeof (*mVariableIndexSorted))
+      );
+
+    mVariableIndexSorted[Position]                   = (UINT16)mNumberOfIndexedVariables;
+    mVariableIndexOffsets[mNumberOfIndexedVariables] = (UINT32)Offset;
+
+    ++mNumberOfIndexedVariables;
+
+    Previous = Entry;
+    Offset  += ALIGN_VALUE (
+                 (OFFSET_OF (VARIABLE_INDEX_ENTRY, Name) + Entry->NameSize),
+                 sizeof (UINT64)
+                 );
+  }
+
+  mVariableIndexValid = TRUE;
+
+  DEBUG ((
+    DEBUG_VERBOSE,
+    "FirmwareFixes: Indexed %u variables in %u bytes\n",
+    (UINT32)mNumberOfIndexedVariables,
+    (UINT32)Offset
+    ));
+}
+
+/**
+  Enumerates the current variable names.  Repeated enumerations are served
+  from a snapshot while Boot Services are active.
+
+  @param[in, out] VariableNameSize  The size of the VariableName buffer.
+  @param[in, out] VariableName      On input, supplies the last VariableName
+                                    that was returned by GetNextVariableName().
+                                    On output, returns the Nullterminated
+                                    string of the current variable.
+  @param[in, out] VendorGuid        On input, supplies the last VendorGuid that
+                                    was returned by GetNextVariableName().  On
+                                    output, returns the VendorGuid of the
+                                    current variable.
+
+  @retval EFI_SUCCESS            The function completed successfully.
+  @retval EFI_NOT_FOUND          The next variable was not found.
+  @retval EFI_BUFFER_TOO_SMALL   The VariableNameSize is too small for the
+                                 result.
+  @retval EFI_INVALID_PARAMETER  A parameter is invalid.
+  @retval EFI_DEVICE_ERROR       The variable could not be retrieved due to a
+                                 hardware error.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+InternalIndexedGetNextVariableName (
+  IN OUT UINTN     *VariableNameSize,
+  IN OUT CHAR16    *VariableName,
+  IN OUT EFI_GUID  *VendorGuid
+  )
+{
+  EFI_STATUS           Status;
+  VARIABLE_INDEX_ENTRY *Entry;
+  UINTN                Ordinal;
+  UINTN                Position;
+  BOOLEAN              Found;
+
+  if (!mVariableIndexEnabled
+   || mVariableIndexBusy
+   || (VariableNameSize == NULL)
+   || (VariableName == NULL)
+   || (VendorGuid == NULL)) {
+    return mIndexedGetNextVariableName (
+             VariableNameSize,
+             VariableName,
+             VendorGuid
+             );
+  }
+
+  //
+  // Calls from notification functions of a higher TPL bypass the index
+  // while it is being built or read.
+  //
+  mVariableIndexBusy = TRUE;
+
+  Found   = FALSE;
+  Ordinal = 0;
+
+  if (VariableName[0] == L'\0') {
+    //
+    // An enumeration starts, which is the only point to build the index at,
+    // as the firmware then has no enumeration state to keep.  A build that
+    // failed is not retried before the variables change.
+    //
+    if (!mVariableIndexValid && !mVariableIndexUnusable) {
+      InternalBuildVariableIndex ();
+    }
+
+    Found = mVariableIndexValid;
+  } else if (mVariableIndexValid) {
+    Position = InternalSearchVariableIndex (VariableName, VendorGuid, &Found);
+
+    if (Found) {
+      Ordinal = (mVariableIndexSorted[Position] + 1);
+    }
+  }
+
+  if (!Found) {
+    mVariableIndexBusy = FALSE;
+
+    return mIndexedGetNextVariableName (
+             VariableNameSize,
+             VariableName,
+             VendorGuid
+             );
+  }
+
+  ++mVariableIndexHits;
+
+  if (Ordinal == mNumberOfIndexedVariables) {
+    Status = EFI_NOT_FOUND;
+  } else {
+    Entry = InternalGetIndexedVariable (Ordinal);
+
+    if (*VariableNameSize < Entry->NameSize) {
+      Status = EFI_BUFFER_TOO_SMALL;
+    } else {
+      CopyMem (VariableName, Entry->Name, Entry->NameSize);
+      CopyGuid (VendorGuid, &Entry->VendorGuid);
+
+      Status = EFI_SUCCESS;
+    }
+
+    *VariableNameSize = Entry->NameSize;
+  }
+
+  mVariableIndexBusy = FALSE;
+
+  return Status;
+}
+
+/**
+  Sets the value of a variable and invalidates the enumeration snapshot.
+
+  @param[in] VariableName  A Null-terminated string that is the name of the
+                           vendor's variable.
+  @param[in] VendorGuid    A unique identifier for the vendor.
+  @param[in] Attributes    Attributes bitmask to set for the variable.
+  @param[in] DataSize      The size in bytes of the Data buffer.
+  @param[in] Data          The contents for the variable.
+
+  @retval EFI_SUCCESS            The firmware has successfully stored the
+                                 variable and its data as defined by the
+                                 Attributes.
+  @retval EFI_INVALID_PARAMETER  An invalid combination of attribute bits,
+                                 name, and GUID was supplied, or the DataSize
+                                 exceeds the maximum allowed.
+  @retval EFI_OUT_OF_RESOURCES   Not enough storage is available to hold the
+                                 variable and its data.
+  @retval EFI_DEVICE_ERROR       A variable could not be saved due to a
+                                 hardware failure.
+  @retval EFI_WRITE_PROTECTED    The variable in question is read-only or
+                                 cannot be deleted.
+  @retval EFI_NOT_FOUND          The variable trying to be updated or deleted
+                                 was not found.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+InternalIndexedSetVariable (
+  IN CHAR16    *VariableName,
+  IN EFI_GUID  *VendorGuid,
+  IN UINT32    Attributes,
+  IN UINTN     DataSize,
+  IN VOID      *Data
+  )
+{
+  EFI_STATUS Status;
+
+  Status = mIndexedSetVariable (
+             VariableName,
+             VendorGuid,
+             Attributes,
+             DataSize,
+             Data
+             );
+
+  //
+  // Any write may create or delete a variable, hence the snapshot is dropped
+  // regardless of the result.
+  //
+  ++mVariableIndexGeneration;
+
+  mVariableIndexValid    = FALSE;
+  mVariableIndexUnusable = FALSE;
+
+  return Status;
+}
+
+STATIC SERVICE_HOOK mVariableIndexHooks[] = {
+  SERVICE_HOOK_RUNTIME (
+    GetNextVariableName,
+    InternalIndexedGetNextVariableName,
+    &mIndexedGetNextVariableName
+    ),
+  SERVICE_HOOK_RUNTIME (
+    SetVariable,
+    InternalIndexedSetVariable,
+    &mIndexedSetVariable
+    )
+};
+
+/**
+  Invoke a notification event
+
+  @param[in] Event    Event whose notification function is being invoked.
+  @param[in] Context  The pointer to the notification function's context,
+                      which is implementation-dependent.
+
+**/
+STATIC
+VOID
+EFIAPI
+InternalVariableIndexExitBootServicesNotify (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  EFI_STATUS               Status;
+  SERVICE_HOOK_TRANSACTION Transaction;
+
+  mVariableIndexEnabled = FALSE;
+
+  Status = ServiceHookBeginTransaction (&Transaction);
+
+  if (!EFI_ERROR (Status)) {
+    UnhookVariableIndex (&Transaction);
+    ServiceHookCommitTransaction (&Transaction);
+  }
+
+  DEBUG ((
+    DEBUG_INFO,
+    "FirmwareFixes: Variable index %ld hits, %u builds\n",
+    mVariableIndexHits,
+    mVariableIndexBuilds
+    ));
+}
+
+// VariableIndexInitialize
+VOID
+VariableIndexInitialize (
+  VOID
+  )
+{
+  EFI_STATUS Status;
+  UINTN      Capacity;
+  UINTN      NamesSize;
+
+  ASSERT (mVariableIndexNames == NULL);
+
+  Capacity  = FixedPcdGet32 (PcdVariableIndexEntries);
+  NamesSize = FixedPcdGet32 (PcdVariableIndexNamesSize);
+
+  ASSERT (Capacity <= MAX_UINT16);
+
+  Status = EfiAllocatePool (
+             EfiBootServicesData,
+             (NamesSize
+               + (Capacity * sizeof (*mVariableIndexOffsets))
+               + (Capacity * sizeof (*mVariableIndexSorted))),
+             (VOID **)&mVariableIndexNames
+             );
+
+  if (EFI_ERROR (Status)) {
+    mVariableIndexNames = NULL;
+    return;
+  }
+
+  Status = EfiCreateEvent (
+             EVT_SIGNAL_EXIT_BOOT_SERVICES,
+             TPL_NOTIFY,
+             InternalVariableIndexExitBootServicesNotify,
+             NULL,
+             &mVariableIndexExitBootServicesEvent
+             );
+
+  if (EFI_ERROR (Status)) {
+    EfiFreePool ((VOID *)mVariableIndexNames);
+
+    mVariableIndexNames = NULL;
+    return;
+  }
+
+  mVariableIndexOffsets = (UINT32 *)(mVariableIndexNames + NamesSize);
+  mVariableIndexSorted  = (UINT16 *)(mVariableIndexOffsets + Capacity);
+
+  mVariableIndexNamesSize   = NamesSize;
+  mVariableIndexCapacity    = Capacity;
+  mNumberOfIndexedVariables = 0;
+  mVariableIndexValid       = FALSE;
+  mVariableIndexUnusable    = FALSE;
+  mVariableIndexBusy        = FALSE;
+  mVariableIndexHits        = 0;
+  mVariableIndexBuilds      = 0;
+}
+
+// HookVariableIndex
+VOID
+HookVariableIndex (
+  IN OUT SERVICE_HOOK_TRANSACTION  *Transaction
+  )
+{
+  UINTN Index;
+
+  if (mVariableIndexNames != NULL) {
+    for (Index = 0; Index < ARRAY_SIZE (mVariableIndexHooks); ++Index) {
+      ServiceHookInstall (Transaction, &mVariableIndexHooks[Index]);
+    }
+
+    mVariableIndexEnabled = TRUE;
+  }
+}
+
+// UnhookVariableIndex
+VOID
+UnhookVariableIndex (
+  IN OUT SERVICE_HOOK_TRANSACTION  *Transaction
+  )
+{
+  UINTN Index;
+
+  mVariableIndexEnabled = FALSE;
+
+  //
+  // Hooks that cannot be removed are bypassed through their thunks.
+  //
+  for (Index = ARRAY_SIZE (mVariableIndexHooks); Index > 0; --Index) {
+    UnhookService (Transaction, &mVariableIndexHooks[Index - 1]);
+  }
+}
+
+// VariableIndexFree
+VOID
+VariableIndexFree (
+  VOID
+  )
+{
+  if (mVariableIndexExitBootServicesEvent != NULL) {
+    EfiCloseEvent (mVariableIndexExitBootServicesEvent);
+
+    mVariableIndexExitBootServicesEvent = NULL;
+  }
+
+  if (mVariableIndexNames != NULL) {
+    EfiFreePool ((VOID *)mVariableIndexNames);
+
+    mVariableIndexNames   = NULL;
+    mVariableIndexOffsets = NULL;
+    mVariableIndexSorted  = NULL;
+  }
+}
@@ -0,0 +1,790 @@
+/** @file
+  Copyright (C) 2017, CupertinoNet.  All rights reserved.<BR>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+**/
+
+#include <Uefi.h>
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/EfiBootServicesLib.h>
+#include <Library/PcdLib.h>
+#include <Library/ServiceHookLib.h>
+#include <Library/UefiLib.h>
+
+#include "FirmwareFixesInternal.h"
+
+///
+/// The maximum length, including the terminator, of a buffered variable name.
+///
+#define VARIABLE_WRITE_NAME_LENGTH  64
+
+///
+/// The only attributes writes are deferred for.  Boot Services only
+/// variables cannot be written once the buffer is flushed on
+/// ExitBootServices().
+///
+#define VARIABLE_WRITE_ATTRIBUTES  \
+  (EFI_VARIABLE_NON_VOLATILE       \
+    | EFI_VARIABLE_BOOTSERVICE_ACCESS | EFI_VARIABLE_RUNTIME_ACCESS)
+
+///
+/// A variable written through the buffer.  The firmware state is known from
+/// the last write that has been passed on, the pending state is the one
+/// returned to the callers.
+///
+typedef struct {
+  BOOLEAN  Used;
+  BOOLEAN  FirmwareExists;
+  BOOLEAN  Pending;
+  BOOLEAN  PendingDelete;
+  BOOLEAN  DeleteFirst;
+  EFI_GUID VendorGuid;
+  CHAR16   Name[VARIABLE_WRITE_NAME_LENGTH];
+  UINTN    NameSize;
+  UINTN    DataSize;
+} VARIABLE_WRITE_ENTRY;
+
+// VARIABLE_WRITE_ENTRY_DATA
+#define VARIABLE_WRITE_ENTRY_DATA(Entry)  ((VOID *)((Entry) + 1))
+
+STATIC UINT8     *mVariableWriteBuffer                     = NULL;
+STATIC UINTN     mVariableWriteEntrySize                   = 0;
+STATIC UINTN     mNumberOfVariableWriteEntries             = 0;
+STATIC BOOLEAN   mVariableWriteBufferEnabled               = FALSE;
+STATIC BOOLEAN   mVariableWriteBufferBusy                  = FALSE;
+STATIC UINT32    mVariableWritesDeferred                   = 0;
+STATIC UINT32    mVariableWritesFlushed                    = 0;
+STATIC EFI_EVENT mVariableWriteBufferExitBootServicesEvent = NULL;
+
+STATIC EFI_GET_VARIABLE           mBufferedGetVariable         = NULL;
+STATIC EFI_GET_NEXT_VARIABLE_NAME mBufferedGetNextVariableName = NULL;
+STATIC EFI_SET_VARIABLE           mBufferedSetVariable         = NULL;
+STATIC EFI_QUERY_VARIABLE_INFO    mBufferedQueryVariableInfo   = NULL;
+STATIC EFI_RESET_SYSTEM           mBufferedResetSystem         = NULL;
+
+// InternalGetVariableWriteEntry
+STATIC
+VARIABLE_WRITE_ENTRY *
+InternalGetVariableWriteEntry (
+  IN UINTN  Index
+  )
+{
+  return (VARIABLE_WRITE_ENTRY *)(
+           mVariableWriteBuffer + (Index * mVariableWriteEntrySize)
+           );
+}
+
+// InternalFindVariableWriteEntry
+STATIC
+VARIABLE_WRITE_ENTRY *
+InternalFindVariableWriteEntry (
+  IN CONST CHAR16    *VariableName,
+  IN CONST EFI_GUID  *VendorGuid
+  )
+{
+  VARIABLE_WRITE_ENTRY *Entry;
+  UINTN                NameSize;
+  UINTN                Index;
+
+  NameSize = StrSize (VariableName);
+
+  if (NameSize > sizeof (Entry->Name)) {
+    return NULL;
+  }
+
+  for (Index = 0; Index < mNumberOfVariableWriteEntries; ++Index) {
+    Entry = InternalGetVariableWriteEntry (Index);
+
+    if (Entry->Used
+     && (Entry->NameSize == NameSize)
+     && CompareGuid (&Entry->VendorGuid, VendorGuid)
+     && (CompareMem (Entry->Name, VariableName, NameSize) == 0)) {
+      return Entry;
+    }
+  }
+
+  return NULL;
+}
+
+// InternalAllocateVariableWriteEntry
+STATIC
+VARIABLE_WRITE_ENTRY *
+InternalAllocateVariableWriteEntry (
+  VOID
+  )
+{
+  VARIABLE_WRITE_ENTRY *Entry;
+  UINTN                Index;
+
+  for (Index = 0; Index < mNumberOfVariableWriteEntries; ++Index) {
+    Entry = InternalGetVariableWriteEntry (Index);
+
+    if (!Entry->Used) {
+      return Entry;
+    }
+  }
+
+  if (mNumberOfVariableWriteEntries
+        < FixedPcdGet32 (PcdVariableWriteBufferEntries)) {
+    Entry = InternalGetVariableWriteEntry (mNumberOfVariableWriteEntries);
+
+    ++mNumberOfVariableWriteEntries;
+
+    return Entry;
+  }
+
+  return NULL;
+}
+
+// InternalFlushVariableWriteEntry
+STATIC
+VOID
+InternalFlushVariableWriteEntry (
+  IN OUT VARIABLE_WRITE_ENTRY  *Entry
+  )
+{
+  EFI_STATUS Status;
+
+  if (!Entry->Pending) {
+    return;
+  }
+
+  Entry->Pending = FALSE;
+
+  //
+  // A variable deleted and written again is deleted in the firmware too, as
+  // the write may change its attributes.
+  //
+  if ((Entry->PendingDelete || Entry->DeleteFirst) && Entry->FirmwareExists) {
+    Status = mBufferedSetVariable (
+               Entry->Name,
+               &Entry->VendorGuid,
+               0,
+               0,
+               NULL
+               );
+
+    if (EFI_ERROR (Status)) {
+      DEBUG ((
+        DEBUG_WARN,
+        "FirmwareFixes: Deferred deletion of %s failed - %r\n",
+        Entry->Name,
+        Status
+        ));
+    }
+
+    Entry->FirmwareExists = FALSE;
+
+    ++mVariableWritesFlushed;
+  }
+
+  if (!Entry->PendingDelete) {
+    Status = mBufferedSetVariable (
+               Entry->Name,
+               &Entry->VendorGuid,
+               VARIABLE_WRITE_ATTRIBUTES,
+               Entry->DataSize,
+               VARIABLE_WRITE_ENTRY_DATA (Entry)
+               );
+
+    if (EFI_ERROR (Status)) {
+      DEBUG ((
+        DEBUG_WARN,
+        "FirmwareFixes: Deferred write of %s failed - %r\n",
+        Entry->Name,
+        Status
+        ));
+    }
+
+    Entry->FirmwareExists = (BOOLEAN)!EFI_ERROR (Status);
+
+    ++mVariableWritesFlushed;
+  }
+
+  Entry->DeleteFirst = FALSE;
+}
+
+// VariableWriteBufferFlush
+VOID
+VariableWriteBufferFlush (
+  VOID
+  )
+{
+  UINTN Index;
+
+  if (mVariableWriteBuffer == NULL) {
+    return;
+  }
+
+  for (Index = 0; Index < mNumberOfVariableWriteEntries; ++Index) {
+    InternalFlushVariableWriteEntry (InternalGetVariableWriteEntry (Index));
+  }
+}
+
+// InternalFlushVariableWriteBuffer
+STATIC
+VOID
+InternalFlushVariableWriteBuffer (
+  VOID
+  )
+{
+  if (mVariableWriteBufferEnabled && !mVariableWriteBufferBusy) {
+    mVariableWriteBufferBusy = TRUE;
+
+    VariableWriteBufferFlush ();
+
+    mVariableWriteBufferBusy = FALSE;
+  }
+}
+
+/**
+  Returns the value of a variable.  Values of deferred writes are returned
+  from the buffer.
+
+  @param[in]      VariableName  A Null-terminated string that is the name of
+                                the vendor's variable.
+  @param[in]      VendorGuid    A unique identifier for the vendor.
+  @param[out]     Attributes    If not NULL, a pointer to the memory location
+                                to return the attributes bitmask for the
+                                variable.
+  @param[in, out] DataSize      On input, the size in bytes of the return Data
+                                buffer.  On output the size of data returned
+                                in Data.
+  @param[out]     Data          The buffer to return the contents of the
+                                variable.  May be NULL with a zero DataSize in
+                                order to determine the size buffer needed.
+
+  @retval EFI_SUCCESS            The function completed successfully.
+  @retval EFI_NOT_FOUND          The variable was not found.
+  @retval EFI_BUFFER_TOO_SMALL   The DataSize is too small for the result.
+  @retval EFI_INVALID_PARAMETER  A parameter is invalid.
+  @retval EFI_DEVICE_ERROR       The variable could not be retrieved due to a
+                                 hardware error.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+InternalBufferedGetVariable (
+  IN     CHAR16    *VariableName,
+  IN     EFI_GUID  *VendorGuid,
+  OUT    UINT32    *Attributes OPTIONAL,
+  IN OUT UINTN     *DataSize,
+  OUT    VOID      *Data OPTIONAL
+  )
+{
+  VARIABLE_WRITE_ENTRY *Entry;
+
+  if (mVariableWriteBufferEnabled
+   && !mVariableWriteBufferBusy
+   && (VariableName != NULL)
+   && (VendorGuid != NULL)
+   && (DataSize != NULL)) {
+    Entry = InternalFindVariableWriteEntry (VariableName, VendorGuid);
+
+    if ((Entry != NULL) && Entry->Pending) {
+      if (Entry->PendingDelete) {
+        return EFI_NOT_FOUND;
+      }
+
+      if (*DataSize < Entry->DataSize) {
+        *DataSize = Entry->DataSize;
+
+        return EFI_BUFFER_TOO_SMALL;
+      }
+
+      if (Data == NULL) {
+        return EFI_INVALID_PARAMETER;
+      }
+
+      CopyMem (Data, VARIABLE_WRITE_ENTRY_DATA (Entry), Entry->DataSize);
+
+      *DataSize = Entry->DataSize;
+
+      if (Attributes != NULL) {
+        *Attributes = VARIABLE_WRITE_ATTRIBUTES;
+      }
+
+      return EFI_SUCCESS;
+    }
+  }
+
+  return mBufferedGetVariable (
+           VariableName,
+           VendorGuid,
+           Attributes,
+           DataSize,
+           Data
+           );
+}
+
+/**
+  Enumerates the current variable names.  Deferred writes are flushed
+  first, as they may create or delete variables.
+
+  @param[in, out] VariableNameSize  The size of the VariableName buffer.
+  @param[in, out] VariableName      On input, supplies the last VariableName
+                                    that was returned by GetNextVariableName().
+                                    On output, returns the Nullterminated
+                                    string of the current variable.
+  @param[in, out] VendorGuid        On input, supplies the last VendorGuid that
+                                    was returned by GetNextVariableName().  On
+                                    output, returns the VendorGuid of the
+                                    current variable.
+
+  @retval EFI_SUCCESS            The function completed successfully.
+  @retval EFI_NOT_FOUND          The next variable was not found.
+  @retval EFI_BUFFER_TOO_SMALL   The VariableNameSize is too small for the
+                                 result.
+  @retval EFI_INVALID_PARAMETER  A parameter is invalid.
+  @retval EFI_DEVICE_ERROR       The variable could not be retrieved due to a
+                                 hardware error.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+InternalBufferedGetNextVariableName (
+  IN OUT UINTN     *VariableNameSize,
+  IN OUT CHAR16    *VariableName,
+  IN OUT EFI_GUID  *VendorGuid
+  )
+{
+  InternalFlushVariableWriteBuffer ();
+
+  return mBufferedGetNextVariableName (
+           VariableNameSize,
+           VariableName,
+           VendorGuid
+           );
+}
+
+/**
+  Sets the value of a variable.  Repeated writes of non-volatile runtime
+  variables are deferred until the buffer is flushed.
+
+  @param[in] VariableName  A Null-terminated string that is the name of the
+                           vendor's variable.
+  @param[in] VendorGuid    A unique identifier for the vendor.
+  @param[in] Attributes    Attributes bitmask to set for the variable.
+  @param[in] DataSize      The size in bytes of the Data buffer.
+  @param[in] Data          The contents for the variable.
+
+  @retval EFI_SUCCESS            The firmware has successfully stored the
+                                 variable and its data as defined by the
+                                 Attributes, or the write has been deferred.
+  @retval EFI_INVALID_PARAMETER  An invalid combination of attribute bits,
+                                 name, and GUID was supplied, or the DataSize
+                                 exceeds the maximum allowed.
+  @retval EFI_OUT_OF_RESOURCES   Not enough storage is available to hold the
+                                 variable and its data.
+  @retval EFI_DEVICE_ERROR       A variable could not be saved due to a
+                                 hardware failure.
+  @retval EFI_WRITE_PROTECTED    The variable in question is read-only or
+                                 cannot be deleted.
+  @retval EFI_NOT_FOUND          The variable trying to be updated or deleted
+                                 was not found.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+InternalBufferedSetVariable (
+  IN CHAR16    *VariableName,
+  IN EFI_GUID  *VendorGuid,
+  IN UINT32    Attributes,
+  IN UINTN     DataSize,
+  IN VOID      *Data
+  )
+{
+  EFI_STATUS           Status;
+  VARIABLE_WRITE_ENTRY *Entry;
+  BOOLEAN              Delete;
+  BOOLEAN              Exists;
+  UINTN                NameSize;
+
+  if (!mVariableWriteBufferEnabled
+   || mVariableWriteBufferBusy
+   || (VariableName == NULL)
+   || (VendorGuid == NULL)) {
+    return mBufferedSetVariable (
+             VariableName,
+             VendorGuid,
+             Attributes,
+             DataSize,
+             Data
+             );
+  }
+
+  mVariableWriteBufferBusy = TRUE;
+
+  Delete = (BOOLEAN)((DataSize == 0) || (Attributes == 0));
+  Entry  = InternalFindVariableWriteEntry (VariableName, VendorGuid);
+
+  if (Entry != NULL) {
+    Exists = (Entry->Pending ? !Entry->PendingDelete : Entry->FirmwareExists);
+
+    //
+    // Only plain deletions and writes keeping the attributes of an existing
+    // variable are deferred.  Everything else is passed on after the pending
+    // write, so that the firmware checks it against the current state.
+    //
+    if (Delete) {
+      if (!Exists) {
+        mVariableWriteBufferBusy = FALSE;
+
+        return EFI_NOT_FOUND;
+      }
+
+      Entry->Pending       = TRUE;
+      Entry->PendingDelete = TRUE;
+      Entry->DeleteFirst   = FALSE;
+
+      ++mVariableWritesDeferred;
+
+      mVariableWriteBufferBusy = FALSE;
+
+      return EFI_SUCCESS;
+    }
+
+    if ((Attributes == VARIABLE_WRITE_ATTRIBUTES)
+     && (DataSize <= (mVariableWriteEntrySize - sizeof (*Entry)))) {
+      //
+      // Keep the deletion of a variable that is written again.
+      //
+      if (Entry->Pending && Entry->PendingDelete && Entry->FirmwareExists) {
+        Entry->DeleteFirst = TRUE;
+      }
+
+      Entry->Pending       = TRUE;
+      Entry->PendingDelete = FALSE;
+      Entry->DataSize      = DataSize;
+
+      CopyMem (VARIABLE_WRITE_ENTRY_DATA (Entry), Data, DataSize);
+
+      ++mVariableWritesDeferred;
+
+      mVariableWriteBufferBusy = FALSE;
+
+      return EFI_SUCCESS;
+    }
+
+    InternalFlushVariableWriteEntry (Entry);
+  }
+
+  Status = mBufferedSetVariable (
+             VariableName,
+             VendorGuid,
+             Attributes,
+             DataSize,
+             Data
+             );
+
+  //
+  // The first successful write of a variable is passed on, so that its
+  // attributes and size have been checked by the firmware before later
+  // writes are deferred.
+  //
+  if (!EFI_ERROR (Status)) {
+    if ((Entry == NULL) && (Attributes == VARIABLE_WRITE_ATTRIBUTES)) {
+      NameSize = StrSize (VariableName);
+
+      if (NameSize <= sizeof (Entry->Name)) {
+        Entry = InternalAllocateVariableWriteEntry ();
+      }
+
+      if (Entry != NULL) {
+        ZeroMem (Entry, sizeof (*Entry));
+
+        Entry->Used     = TRUE;
+        Entry->NameSize = NameSize;
+
+        CopyGuid (&Entry->VendorGuid, VendorGuid);
+        CopyMem (Entry->Name, VariableName, NameSize);
+      }
+    }
+
+    if (Entry != NULL) {
+      Entry->FirmwareExists = (BOOLEAN)!Delete;
+
+      //
+      // Variables with other attributes are not deferred.
+      //
+      if (!Delete && (Attributes != VARIABLE_WRITE_ATTRIBUTES)) {
+        Entry->Used = FALSE;
+      }
+    }
+  }
+
+  mVariableWriteBufferBusy = FALSE;
+
+  return Status;
+}
+
+/**
+  Returns information about the EFI variables.  Deferred writes are flushed
+  first, so that the storage is reported for the current variables.
+
+  @param[in]  Attributes                    Attributes bitmask to specify the
+                                            type of variables on which to
+                                            return information.
+  @param[out] MaximumVariableStorageSize    On output the maximum size of the
+                                            storage space available for the
+                                            EFI variables associated with the
+                                            attributes specified.
+  @param[out] RemainingVariableStorageSize  Returns the remaining size of the
+                                            storage space available for the
+                                            EFI variables associated with the
+                                            attributes specified.
+  @param[out] MaximumVariableSize           Returns the maximum size of the
+                                            individual EFI variables
+                                            associated with the attributes
+                                            specified.
+
+  @retval EFI_SUCCESS            Valid answer returned.
+  @retval EFI_INVALID_PARAMETER  An invalid combination of attribute bits was
+                                 supplied.
+  @retval EFI_UNSUPPORTED        The attribute is not supported on this
+                                 platform.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+InternalBufferedQueryVariableInfo (
+  IN  UINT32  Attributes,
+  OUT UINT64  *MaximumVariableStorageSize,
+  OUT UINT64  *RemainingVariableStorageSize,
+  OUT UINT64  *MaximumVariableSize
+  )
+{
+  InternalFlushVariableWriteBuffer ();
+
+  return mBufferedQueryVariableInfo (
+           Attributes,
+           MaximumVariableStorageSize,
+           RemainingVariableStorageSize,
+           MaximumVariableSize
+           );
+}
+
+/**
+  Resets the entire platform.  Deferred writes are flushed first, as they
+  would be lost otherwise.
+
+  @param[in] ResetType    The type of reset to perform.
+  @param[in] ResetStatus  The status code for the reset.
+  @param[in] DataSize     The size, in bytes, of ResetData.
+  @param[in] ResetData    For a ResetType of EfiResetCold, EfiResetWarm, or
+                          EfiResetShutdown the data buffer starts with a
+                          Null-terminated string, optionally followed by
+                          additional binary data.
+
+**/
+STATIC
+VOID
+EFIAPI
+InternalBufferedResetSystem (
+  IN EFI_RESET_TYPE  ResetType,
+  IN EFI_STATUS      ResetStatus,
+  IN UINTN           DataSize,
+  IN VOID            *ResetData OPTIONAL
+  )
+{
+  //
+  // SetVariable() must not be called above TPL_CALLBACK.  The writes
+  // deferred before a reset from a higher TPL are lost.
+  //
+  if (EfiGetCurrentTpl () <= TPL_CALLBACK) {
+    InternalFlushVariableWriteBuffer ();
+  }
+
+  mBufferedResetSystem (ResetType, ResetStatus, DataSize, ResetData);
+}
+
+STATIC SERVICE_HOOK mVariableWriteBufferHooks[] = {
+  SERVICE_HOOK_RUNTIME (
+    GetVariable,
+    InternalBufferedGetVariable,
+    &mBufferedGetVariable
+    ),
+  SERVICE_HOOK_RUNTIME (
+    GetNextVariableName,
+    InternalBufferedGetNextVariableName,
+    &mBufferedGetNextVariableName
+    ),
+  SERVICE_HOOK_RUNTIME (
+    SetVariable,
+    InternalBufferedSetVariable,
+    &mBufferedSetVariable
+    ),
+  SERVICE_HOOK_RUNTIME (
+    QueryVariableInfo,
+    InternalBufferedQueryVariableInfo,
+    &mBufferedQueryVariableInfo
+    ),
+  SERVICE_HOOK_RUNTIME (
+    ResetSystem,
+    InternalBufferedResetSystem,
+    &mBufferedResetSystem
+    )
+};
+
+/**
+  Invoke a notification event
+
+  @param[in] Event    Event whose notification function is being invoked.
+  @param[in] Context  The pointer to the notification function's context,
+                      which is implementation-dependent.
+
+**/
+STATIC
+VOID
+EFIAPI
+InternalVariableWriteBufferExitBootServicesNotify (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  EFI_STATUS               Status;
+  SERVICE_HOOK_TRANSACTION Transaction;
+
+  mVariableWriteBufferEnabled = FALSE;
+
+  VariableWriteBufferFlush ();
+
+  Status = ServiceHookBeginTransaction (&Transaction);
+
+  if (!EFI_ERROR (Status)) {
+    UnhookVariableWriteBuffer (&Transaction);
+    ServiceHookCommitTransaction (&Transaction);
+  }
+
+  DEBUG ((
+    DEBUG_INFO,
+    "FirmwareFixes: %u variable writes deferred, %u flushed\n",
+    mVariableWritesDeferred,
+    mVariableWritesFlushed
+    ));
+}
+
+// VariableWriteBufferInitialize
+VOID
+VariableWriteBufferInitialize (
+  VOID
+  )
+{
+  EFI_STATUS Status;
+  UINTN      EntrySize;
+
+  ASSERT (mVariableWriteBuffer == NULL);
+
+  EntrySize = ALIGN_VALUE (
+                (sizeof (VARIABLE_WRITE_ENTRY)
+                  + FixedPcdGet32 (PcdVariableWriteBufferDataSize)),
+                sizeof (UINT64)
+                );
+
+  Status = EfiAllocatePool (
+             EfiBootServicesData,
+             (FixedPcdGet32 (PcdVariableWriteBufferEntries) * EntrySize),
+             (VOID **)&mVariableWriteBuffer
+             );
+
+  if (EFI_ERROR (Status)) {
+    mVariableWriteBuffer = NULL;
+    return;
+  }
+
+  //
+  // The booter exit flushes the buffer unless the booter exits Boot Services.
+  // SetVariable() must not be called above TPL_CALLBACK.
+  //
+  Status = EfiCreateEvent (
+             EVT_SIGNAL_EXIT_BOOT_SERVICES,
+             TPL_CALLBACK,
+             InternalVariableWriteBufferExitBootServicesNotify,
+             NULL,
+             &mVariableWriteBufferExitBootServicesEvent
+             );
+
+  if (EFI_ERROR (Status)) {
+    EfiFreePool ((VOID *)mVariableWriteBuffer);
+
+    mVariableWriteBuffer = NULL;
+    return;
+  }
+
+  mVariableWriteEntrySize       = EntrySize;
+  mNumberOfVariableWriteEntries = 0;
+  mVariableWriteBufferBusy      = FALSE;
+  mVariableWritesDeferred       = 0;
+  mVariableWritesFlushed        = 0;
+}
+
+// HookVariableWriteBuffer
+VOID
+HookVariableWriteBuffer (
+  IN OUT SERVICE_HOOK_TRANSACTION  *Transaction
+  )
+{
+  UINTN Index;
+
+  if (mVariableWriteBuffer != NULL) {
+    for (Index = 0; Index < ARRAY_SIZE (mVariableWriteBufferHooks); ++Index) {
+      ServiceHookInstall (Transaction, &mVariableWriteBufferHooks[Index]);
+    }
+
+    mVariableWriteBufferEnabled = TRUE;
+  }
+}
+
+// UnhookVariableWriteBuffer
+VOID
+UnhookVariableWriteBuffer (
+  IN OUT SERVICE_HOOK_TRANSACTION  *Transaction
+  )
+{
+  UINTN Index;
+
+  mVariableWriteBufferEnabled = FALSE;
+
+  //
+  // Hooks that cannot be removed are bypassed through their thunks.
+  //
+  for (Index = ARRAY_SIZE (mVariableWriteBufferHooks); Index > 0; --Index) {
+    UnhookService (Transaction, &mVariableWriteBufferHooks[Index - 1]);
+  }
+}
+
+// VariableWriteBufferFree
+VOID
+VariableWriteBufferFree (
+  VOID
+  )
+{
+  if (mVariableWriteBufferExitBootServicesEvent != NULL) {
+    EfiCloseEvent (mVariableWriteBufferExitBootServicesEvent);
+
+    mVariableWriteBufferExitBootServicesEvent = NULL;
+  }
+
+  if (mVariableWriteBuffer != NULL) {
+    EfiFreePool ((VOID *)mVariableWriteBuffer);
+
+    mVariableWriteBuffer = NULL;
+  }
+}
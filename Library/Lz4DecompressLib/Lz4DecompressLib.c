@@ -0,0 +1,276 @@
+/** @file
+  Copyright (C) 2017, CupertinoNet.  All rights reserved.<BR>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+**/
+
+#include <Base.h>
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/Lz4DecompressLib.h>
+
+// LZ4_MINIMUM_MATCH
+#define LZ4_MINIMUM_MATCH  4
+
+// LZ4_LENGTH_MASK
+#define LZ4_LENGTH_MASK  0x0F
+
+// LZ4_WILD_COPY_SIZE
+/// The unit of the fast copy loops.  They may copy up to this many bytes
+/// more than requested, so they are only used when the buffers leave that
+/// much room.
+#define LZ4_WILD_COPY_SIZE  sizeof (UINT64)
+
+// InternalReadLength
+/** Reads the extension bytes of a literal or match length.
+
+  @param[in, out] Input     The current input position.  On output, the
+                            position after the extension bytes.
+  @param[in]      InputEnd  The end of the input.
+  @param[in, out] Length    The length to extend.
+  @param[in]      Limit     The maximum valid length.
+
+  @retval TRUE   The length has been read.
+  @retval FALSE  The input is truncated or the length exceeds Limit.
+**/
+STATIC
+BOOLEAN
+InternalReadLength (
+  IN OUT CONST UINT8  **Input,
+  IN     CONST UINT8  *InputEnd,
+  IN OUT UINTN        *Length,
+  IN     UINTN        Limit
+  )
+{
+  CONST UINT8 *Ip;
+  UINT8       Byte;
+
+  Ip = *Input;
+
+  do {
+    if (Ip >= InputEnd) {
+      return FALSE;
+    }
+
+    Byte     = *Ip++;
+    *Length += Byte;
+
+    //
+    // Checking every step keeps Length from overflowing.
+    //
+    if (*Length > Limit) {
+      return FALSE;
+    }
+  } while (Byte == MAX_UINT8);
+
+  *Input = Ip;
+
+  return TRUE;
+}
+
+// InternalCopyUnit
+/** Copies LZ4_WILD_COPY_SIZE bytes.  Source may overlap Destination as long
+    as it lies at least LZ4_WILD_COPY_SIZE bytes below.  Staging the unit
+    lets the compiler merge it into single moves and, unlike CopyMem(), costs
+    no call for the short runs LZ4 mostly consists of.
+
+  @param[out] Destination  The buffer to copy to.
+  @param[in]  Source       The buffer to copy from.
+**/
+STATIC
+VOID
+InternalCopyUnit (
+  OUT UINT8        *Destination,
+  IN  CONST UINT8  *Source
+  )
+{
+  UINT8 Unit[LZ4_WILD_COPY_SIZE];
+  UINTN Index;
+
+  for (Index = 0; Index < LZ4_WILD_COPY_SIZE; ++Index) {
+    Unit[Index] = Source[Index];
+  }
+
+  for (Index = 0; Index < LZ4_WILD_COPY_SIZE; ++Index) {
+    Destination[Index] = Unit[Index];
+  }
+}
+
+// InternalWildCopy
+/** Copies memory in units of LZ4_WILD_COPY_SIZE bytes, overrunning the
+    destination by up to LZ4_WILD_COPY_SIZE - 1 bytes.
+
+  @param[out] Destination  The buffer to copy to.
+  @param[in]  Source       The buffer to copy from.
+  @param[in]  Length       The number of bytes to copy.
+**/
+STATIC
+VOID
+InternalWildCopy (
+  OUT UINT8        *Destination,
+  IN  CONST UINT8  *Source,
+  IN  UINTN        Length
+  )
+{
+  UINT8 *End;
+
+  End = (Destination + Length);
+
+  do {
+    InternalCopyUnit (Destination, Source);
+
+    Destination += LZ4_WILD_COPY_SIZE;
+    Source      += LZ4_WILD_COPY_SIZE;
+  } while (Destination < End);
+}
+
+// Lz4DecompressBlock
+RETURN_STATUS
+EFIAPI
+Lz4DecompressBlock (
+  IN  CONST VOID  *Source,
+  IN  UINTN       SourceSize,
+  OUT VOID        *Destination,
+  IN  UINTN       DestinationSize
+  )
+{
+  CONST UINT8 *Ip;
+  CONST UINT8 *IpEnd;
+  UINT8       *Op;
+  UINT8       *OpStart;
+  UINT8       *OpEnd;
+  CONST UINT8 *Match;
+  UINTN       Token;
+  UINTN       Length;
+  UINTN       Offset;
+
+  ASSERT (Source != NULL);
+  ASSERT (Destination != NULL);
+
+  Ip      = (CONST UINT8 *)Source;
+  IpEnd   = (Ip + SourceSize);
+  OpStart = (UINT8 *)Destination;
+  Op      = OpStart;
+  OpEnd   = (Op + DestinationSize);
+
+  while (Ip < IpEnd) {
+    Token  = *Ip++;
+    Length = (Token >> 4);
+
+    //
+    // Literals.  Short runs are copied in two units when both buffers leave
+    // room for them, which covers most sequences.
+    //
+    if ((Length < LZ4_LENGTH_MASK)
+     && ((UINTN)(IpEnd - Ip) >= (2 * LZ4_WILD_COPY_SIZE))
+     && ((UINTN)(OpEnd - Op) >= (2 * LZ4_WILD_COPY_SIZE))) {
+      InternalCopyUnit (Op, Ip);
+      InternalCopyUnit (Op + LZ4_WILD_COPY_SIZE, Ip + LZ4_WILD_COPY_SIZE);
+    } else {
+      if ((Length == LZ4_LENGTH_MASK)
+       && !InternalReadLength (&Ip, IpEnd, &Length, DestinationSize)) {
+        return RETURN_VOLUME_CORRUPTED;
+      }
+
+      if ((Length > (UINTN)(IpEnd - Ip)) || (Length > (UINTN)(OpEnd - Op))) {
+        return RETURN_VOLUME_CORRUPTED;
+      }
+
+      if ((Length != 0)
+       && ((UINTN)(IpEnd - Ip) >= (Length + LZ4_WILD_COPY_SIZE))
+       && ((UINTN)(OpEnd - Op) >= (Length + LZ4_WILD_COPY_SIZE))) {
+        InternalWildCopy (Op, Ip, Length);
+      } else {
+        CopyMem (Op, Ip, Length);
+      }
+    }
+
+    Ip += Length;
+    Op += Length;
+
+    //
+    // The last sequence consists of literals only.
+    //
+    if (Ip == IpEnd) {
+      break;
+    }
+
+    //
+    // Match.
+    //
+    if ((UINTN)(IpEnd - Ip) < sizeof (UINT16)) {
+      return RETURN_VOLUME_CORRUPTED;
+    }
+
+    Offset = (Ip[0] | ((UINTN)Ip[1] << 8));
+    Ip    += sizeof (UINT16);
+
+    if ((Offset == 0) || (Offset > (UINTN)(Op - OpStart))) {
+      return RETURN_VOLUME_CORRUPTED;
+    }
+
+    Length = (Token & LZ4_LENGTH_MASK);
+    Match  = (Op - Offset);
+
+    //
+    // Short matches are copied in three units when they are far enough
+    // behind and the output leaves room for them.
+    //
+    if ((Length < LZ4_LENGTH_MASK)
+     && (Offset >= LZ4_WILD_COPY_SIZE)
+     && ((UINTN)(OpEnd - Op) >= (3 * LZ4_WILD_COPY_SIZE))) {
+      InternalCopyUnit (Op, Match);
+      InternalCopyUnit (Op + LZ4_WILD_COPY_SIZE, Match + LZ4_WILD_COPY_SIZE);
+      InternalCopyUnit (
+        Op + (2 * LZ4_WILD_COPY_SIZE),
+        Match + (2 * LZ4_WILD_COPY_SIZE)
+        );
+
+      Op += (Length + LZ4_MINIMUM_MATCH);
+      continue;
+    }
+
+    if ((Length == LZ4_LENGTH_MASK)
+     && !InternalReadLength (&Ip, IpEnd, &Length, DestinationSize)) {
+      return RETURN_VOLUME_CORRUPTED;
+    }
+
+    Length += LZ4_MINIMUM_MATCH;
+
+    if (Length > (UINTN)(OpEnd - Op)) {
+      return RETURN_VOLUME_CORRUPTED;
+    }
+
+    if ((Offset >= LZ4_WILD_COPY_SIZE)
+     && ((UINTN)(OpEnd - Op) >= (Length + LZ4_WILD_COPY_SIZE))) {
+      InternalWildCopy (Op, Match, Length);
+      Op += Length;
+    } else {
+      //
+      // Short offsets repeat the bytes just written.
+      //
+      while (Length > 0) {
+        *Op++ = *Match++;
+        --Length;
+      }
+    }
+  }
+
+  if ((Ip != IpEnd) || (Op != OpEnd)) {
+    return RETURN_VOLUME_CORRUPTED;
+  }
+
+  return RETURN_SUCCESS;
+}
@@ -0,0 +1,527 @@
+/** @file
+  Copyright (C) 2017, CupertinoNet.  All rights reserved.<BR>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+**/
+
+#include <Uefi.h>
+
+#include <Protocol/ServiceHookRegistry.h>
+
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
+#include <Library/EfiBootServicesLib.h>
+#include <Library/MiscRuntimeLib.h>
+#include <Library/ServiceHookLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
+#include <Library/UefiRuntimeServicesTableLib.h>
+
+///
+/// The number of runtime hooks that can be entered through a thunk.
+///
+#define SERVICE_HOOK_THUNKS  64
+
+#if defined (MDE_CPU_IA32) || defined (MDE_CPU_X64)
+
+#define SERVICE_HOOK_THUNKS_SUPPORTED
+
+///
+/// An indirect jump to Target.  On X64 the operand is RIP-relative and 0, as
+/// Target follows the instruction, on IA32 it is the address of Target.
+///
+#pragma pack (1)
+typedef struct {
+  UINT8  Opcode[2];
+  UINT32 Operand;
+  VOID   *Target;
+} SERVICE_HOOK_THUNK;
+#pragma pack ()
+
+#endif
+
+STATIC SERVICE_HOOK_REGISTRY_PROTOCOL *mRegistry = NULL;
+
+// InternalAllocateThunks
+/** Allocates the thunks of a new registry.  Runtime hooks are installed
+    without a thunk when this fails.
+
+  @param[in, out] Registry  The registry to allocate the thunks of.
+**/
+STATIC
+VOID
+InternalAllocateThunks (
+  IN OUT SERVICE_HOOK_REGISTRY_PROTOCOL  *Registry
+  )
+{
+#ifdef SERVICE_HOOK_THUNKS_SUPPORTED
+  EFI_STATUS Status;
+
+  Status = EfiAllocatePool (
+             EfiRuntimeServicesCode,
+             (SERVICE_HOOK_THUNKS * sizeof (SERVICE_HOOK_THUNK)),
+             &Registry->Thunks
+             );
+
+  if (!EFI_ERROR (Status)) {
+    Registry->NumberOfThunks     = SERVICE_HOOK_THUNKS;
+    Registry->NumberOfUsedThunks = 0;
+
+    return;
+  }
+#endif
+
+  Registry->Thunks             = NULL;
+  Registry->NumberOfThunks     = 0;
+  Registry->NumberOfUsedThunks = 0;
+}
+
+// InternalSetThunkTarget
+STATIC
+VOID
+InternalSetThunkTarget (
+  IN OUT SERVICE_HOOK  *Hook,
+  IN     VOID          *Target
+  )
+{
+#ifdef SERVICE_HOOK_THUNKS_SUPPORTED
+  ASSERT (Hook->Thunk != NULL);
+
+  ((SERVICE_HOOK_THUNK *)Hook->Thunk)->Target = Target;
+#endif
+}
+
+// InternalAssignThunk
+/** Assigns a thunk to a runtime hook that does not have one yet.  The thunk
+    stays with the hook, as it is never freed.
+
+  @param[in, out] Registry  The registry to take the thunk from.
+  @param[in, out] Hook      The hook to assign a thunk to.
+**/
+STATIC
+VOID
+InternalAssignThunk (
+  IN OUT SERVICE_HOOK_REGISTRY_PROTOCOL  *Registry,
+  IN OUT SERVICE_HOOK                    *Hook
+  )
+{
+#ifdef SERVICE_HOOK_THUNKS_SUPPORTED
+  SERVICE_HOOK_THUNK *Thunk;
+
+  if ((Hook->Thunk != NULL)
+   || (Hook->Table != ServiceHookTableRuntime)
+   || (Registry->NumberOfUsedThunks == Registry->NumberOfThunks)) {
+    return;
+  }
+
+  Thunk = &((SERVICE_HOOK_THUNK *)Registry->Thunks)[
+             Registry->NumberOfUsedThunks
+             ];
+
+  ++Registry->NumberOfUsedThunks;
+
+  Thunk->Opcode[0] = 0xFF;
+  Thunk->Opcode[1] = 0x25;
+#ifdef MDE_CPU_X64
+  Thunk->Operand   = 0;
+#else
+  Thunk->Operand   = (UINT32)(UINTN)&Thunk->Target;
+#endif
+
+  Hook->Thunk = (VOID *)Thunk;
+#endif
+}
+
+// InternalGetEntry
+/** Returns the address Hook is entered through by its caller.
+**/
+STATIC
+VOID *
+InternalGetEntry (
+  IN CONST SERVICE_HOOK  *Hook
+  )
+{
+  return ((Hook->Thunk != NULL) ? Hook->Thunk : Hook->Hook);
+}
+
+// InternalGetRegistry
+STATIC
+SERVICE_HOOK_REGISTRY_PROTOCOL *
+InternalGetRegistry (
+  VOID
+  )
+{
+  EFI_STATUS                     Status;
+  SERVICE_HOOK_REGISTRY_PROTOCOL *Registry;
+  EFI_HANDLE                     Handle;
+
+  if (mRegistry != NULL) {
+    return mRegistry;
+  }
+
+  Status = EfiLocateProtocol (
+             &gServiceHookRegistryProtocolGuid,
+             NULL,
+             (VOID **)&Registry
+             );
+
+  if (!EFI_ERROR (Status)) {
+    ASSERT (Registry->Revision == SERVICE_HOOK_REGISTRY_PROTOCOL_REVISION);
+
+    if (Registry->Revision != SERVICE_HOOK_REGISTRY_PROTOCOL_REVISION) {
+      return NULL;
+    }
+  } else {
+    Status = EfiAllocatePool (
+               EfiBootServicesData,
+               sizeof (*Registry),
+               (VOID **)&Registry
+               );
+
+    if (EFI_ERROR (Status)) {
+      return NULL;
+    }
+
+    Registry->Revision = SERVICE_HOOK_REGISTRY_PROTOCOL_REVISION;
+    Registry->Reserved = 0;
+    InitializeListHead (&Registry->Hooks);
+    InternalAllocateThunks (Registry);
+
+    Handle = NULL;
+    Status = EfiInstallMultipleProtocolInterfaces (
+               &Handle,
+               &gServiceHookRegistryProtocolGuid,
+               (VOID *)Registry,
+               NULL
+               );
+
+    if (EFI_ERROR (Status)) {
+      if (Registry->Thunks != NULL) {
+        EfiFreePool (Registry->Thunks);
+      }
+
+      EfiFreePool ((VOID *)Registry);
+      return NULL;
+    }
+  }
+
+  mRegistry = Registry;
+
+  return Registry;
+}
+
+// InternalGetSlot
+STATIC
+VOID **
+InternalGetSlot (
+  IN CONST SERVICE_HOOK  *Hook
+  )
+{
+  UINTN Table;
+
+  ASSERT (Hook->Table < ServiceHookTableMaximum);
+
+  if (Hook->Table == ServiceHookTableBoot) {
+    ASSERT (Hook->Offset < gBS->Hdr.HeaderSize);
+
+    Table = (UINTN)gBS;
+  } else {
+    ASSERT (Hook->Offset < gRT->Hdr.HeaderSize);
+
+    Table = (UINTN)gRT;
+  }
+
+  return (VOID **)(Table + Hook->Offset);
+}
+
+/**
+  Returns the hook of the same slot installed directly after Hook, which is
+  the one calling Hook, or NULL if Hook is the outermost one.
+
+**/
+STATIC
+SERVICE_HOOK *
+InternalGetOuterHook (
+  IN SERVICE_HOOK_REGISTRY_PROTOCOL  *Registry,
+  IN SERVICE_HOOK                    *Hook
+  )
+{
+  LIST_ENTRY   *Entry;
+  SERVICE_HOOK *OuterHook;
+
+  for (
+    Entry = GetNextNode (&Registry->Hooks, &Hook->Link);
+    !IsNull (&Registry->Hooks, Entry);
+    Entry = GetNextNode (&Registry->Hooks, Entry)
+    ) {
+    OuterHook = BASE_CR (Entry, SERVICE_HOOK, Link);
+
+    if ((OuterHook->Table == Hook->Table)
+     && (OuterHook->Offset == Hook->Offset)) {
+      return OuterHook;
+    }
+  }
+
+  return NULL;
+}
+
+// ServiceHookBeginTransaction
+EFI_STATUS
+ServiceHookBeginTransaction (
+  OUT SERVICE_HOOK_TRANSACTION  *Transaction
+  )
+{
+  UINTN Index;
+
+  ASSERT (Transaction != NULL);
+  ASSERT (EfiGetCurrentTpl () <= TPL_NOTIFY);
+
+  Transaction->Registry = (VOID *)InternalGetRegistry ();
+
+  if (Transaction->Registry == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  for (Index = 0; Index < ARRAY_SIZE (Transaction->Changed); ++Index) {
+    Transaction->Changed[Index] = FALSE;
+  }
+
+  Transaction->OldTpl = EfiRaiseTPL (TPL_HIGH_LEVEL);
+
+  return EFI_SUCCESS;
+}
+
+// ServiceHookInstall
+EFI_STATUS
+ServiceHookInstall (
+  IN OUT SERVICE_HOOK_TRANSACTION  *Transaction,
+  IN OUT SERVICE_HOOK              *Hook
+  )
+{
+  SERVICE_HOOK_REGISTRY_PROTOCOL *Registry;
+  VOID                           **Slot;
+
+  ASSERT (Transaction != NULL);
+  ASSERT (Hook != NULL);
+  ASSERT (Hook->Hook != NULL);
+  ASSERT (Hook->Original != NULL);
+
+  if (Hook->Installed) {
+    if (Hook->Bypassed) {
+      InternalSetThunkTarget (Hook, Hook->Hook);
+
+      Hook->Bypassed = FALSE;
+
+      return EFI_SUCCESS;
+    }
+
+    return EFI_ALREADY_STARTED;
+  }
+
+  Registry = (SERVICE_HOOK_REGISTRY_PROTOCOL *)Transaction->Registry;
+  Slot     = InternalGetSlot (Hook);
+
+  InternalAssignThunk (Registry, Hook);
+
+  if (Hook->Thunk != NULL) {
+    InternalSetThunkTarget (Hook, Hook->Hook);
+  }
+
+  *Hook->Original = *Slot;
+  *Slot           = InternalGetEntry (Hook);
+
+  InsertTailList (&Registry->Hooks, &Hook->Link);
+
+  Hook->Installed                   = TRUE;
+  Transaction->Changed[Hook->Table] = TRUE;
+
+  return EFI_SUCCESS;
+}
+
+// ServiceHookUninstall
+EFI_STATUS
+ServiceHookUninstall (
+  IN OUT SERVICE_HOOK_TRANSACTION  *Transaction,
+  IN OUT SERVICE_HOOK              *Hook
+  )
+{
+  SERVICE_HOOK_REGISTRY_PROTOCOL *Registry;
+  SERVICE_HOOK                   *OuterHook;
+  VOID                           **Caller;
+
+  ASSERT (Transaction != NULL);
+  ASSERT (Hook != NULL);
+
+  if (!Hook->Installed) {
+    return EFI_NOT_STARTED;
+  }
+
+  Registry  = (SERVICE_HOOK_REGISTRY_PROTOCOL *)Transaction->Registry;
+  OuterHook = InternalGetOuterHook (Registry, Hook);
+
+  if (OuterHook != NULL) {
+    Caller = OuterHook->Original;
+  } else {
+    Caller = InternalGetSlot (Hook);
+  }
+
+  //
+  // Somebody not using the registry has interposed Hook.  Unlinking it would
+  // either drop their hook or leave them calling freed code.
+  //
+  if (*Caller != InternalGetEntry (Hook)) {
+    return EFI_ACCESS_DENIED;
+  }
+
+  *Caller = *Hook->Original;
+
+  //
+  // A bypassed hook above keeps calling the service Hook called.
+  //
+  if ((OuterHook != NULL) && OuterHook->Bypassed) {
+    InternalSetThunkTarget (OuterHook, *Hook->Original);
+  }
+
+  RemoveEntryList (&Hook->Link);
+
+  Hook->Installed = FALSE;
+  Hook->Bypassed  = FALSE;
+
+  if (OuterHook == NULL) {
+    Transaction->Changed[Hook->Table] = TRUE;
+  }
+
+  return EFI_SUCCESS;
+}
+
+// ServiceHookBypass
+EFI_STATUS
+ServiceHookBypass (
+  IN OUT SERVICE_HOOK_TRANSACTION  *Transaction,
+  IN OUT SERVICE_HOOK              *Hook
+  )
+{
+  ASSERT (Transaction != NULL);
+  ASSERT (Hook != NULL);
+
+  if (!Hook->Installed) {
+    return EFI_NOT_STARTED;
+  }
+
+  if (Hook->Thunk == NULL) {
+    return EFI_UNSUPPORTED;
+  }
+
+  InternalSetThunkTarget (Hook, *Hook->Original);
+
+  Hook->Bypassed = TRUE;
+
+  return EFI_SUCCESS;
+}
+
+// ServiceHookCommitTransaction
+VOID
+ServiceHookCommitTransaction (
+  IN SERVICE_HOOK_TRANSACTION  *Transaction
+  )
+{
+  ASSERT (Transaction != NULL);
+
+  if (Transaction->Changed[ServiceHookTableBoot]) {
+    UPDATE_EFI_TABLE_CRC32 (gBS);
+  }
+
+  if (Transaction->Changed[ServiceHookTableRuntime]) {
+    UPDATE_EFI_TABLE_CRC32 (gRT);
+  }
+
+  EfiRestoreTPL (Transaction->OldTpl);
+}
+
+// ServiceHookInstallList
+EFI_STATUS
+ServiceHookInstallList (
+  IN OUT SERVICE_HOOK  *Hooks,
+  IN     UINTN         NumberOfHooks
+  )
+{
+  EFI_STATUS               Status;
+  SERVICE_HOOK_TRANSACTION Transaction;
+  UINTN                    Index;
+
+  ASSERT (Hooks != NULL);
+
+  Status = ServiceHookBeginTransaction (&Transaction);
+
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  for (Index = 0; Index < NumberOfHooks; ++Index) {
+    Status = ServiceHookInstall (&Transaction, &Hooks[Index]);
+
+    if (EFI_ERROR (Status)) {
+      //
+      // The hooks installed last are the outermost ones and can always be
+      // removed again within the same transaction.
+      //
+      while (Index > 0) {
+        --Index;
+        ServiceHookUninstall (&Transaction, &Hooks[Index]);
+      }
+
+      break;
+    }
+  }
+
+  ServiceHookCommitTransaction (&Transaction);
+
+  return Status;
+}
+
+// ServiceHookUninstallList
+EFI_STATUS
+ServiceHookUninstallList (
+  IN OUT SERVICE_HOOK  *Hooks,
+  IN     UINTN         NumberOfHooks
+  )
+{
+  EFI_STATUS               Status;
+  EFI_STATUS               HookStatus;
+  SERVICE_HOOK_TRANSACTION Transaction;
+  UINTN                    Index;
+
+  ASSERT (Hooks != NULL);
+
+  Status = ServiceHookBeginTransaction (&Transaction);
+
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  //
+  // Remove in reverse order, so that hooks installed by the same list are
+  // unlinked outermost first.
+  //
+  for (Index = NumberOfHooks; Index > 0; --Index) {
+    HookStatus = ServiceHookUninstall (&Transaction, &Hooks[Index - 1]);
+
+    if (!EFI_ERROR (Status) && (HookStatus != EFI_NOT_STARTED)) {
+      Status = HookStatus;
+    }
+  }
+
+  ServiceHookCommitTransaction (&Transaction);
+
+  return Status;
+}
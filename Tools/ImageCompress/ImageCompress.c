@@ -0,0 +1,608 @@
+/** @file
+  Wraps EFI images into LZ4 compressed containers and benchmarks loading
+  them against the plain images.
+
+  Usage: ImageCompress <image> <container>
+         ImageCompress -b [-u] [-n <iterations>] <image> <container>
+
+    -b  Time reading <image> against reading <container> plus decompressing
+        it into a buffer that has been faulted in before.  Run it on a RAM
+        disk (e.g. tmpfs) and on the virtual disk of a QEMU guest to compare
+        both media.
+    -u  Drop the files from the page cache before every read, so that the
+        device is read instead of memory.
+    -n  The number of iterations, 32 by default.
+
+  The firmware side logs the read and transform time of every image loaded
+  through ImageLoadPipelineDxe at DEBUG_VERBOSE.  Containers are only
+  decompressed with PcdDecompressImages.
+
+  Copyright (C) 2017, CupertinoNet.  All rights reserved.<BR>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+**/
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <Base.h>
+
+#include <IndustryStandard/CompressedImage.h>
+
+#include <Library/Lz4DecompressLib.h>
+
+#define LZ4_MINIMUM_MATCH    4
+#define LZ4_LAST_LITERALS    5
+#define LZ4_MATCH_LIMIT      12
+#define LZ4_MAXIMUM_OFFSET   0xFFFF
+#define LZ4_HASH_BITS        16
+
+#define BENCHMARK_ITERATIONS  32
+
+VOID *
+EFIAPI
+CopyMem (
+  OUT VOID       *DestinationBuffer,
+  IN  CONST VOID *SourceBuffer,
+  IN  UINTN      Length
+  )
+{
+  return memmove (DestinationBuffer, SourceBuffer, Length);
+}
+
+UINT64
+EFIAPI
+ReadUnaligned64 (
+  IN CONST UINT64  *Buffer
+  )
+{
+  UINT64 Value;
+
+  memcpy (&Value, Buffer, sizeof (Value));
+
+  return Value;
+}
+
+UINT64
+EFIAPI
+WriteUnaligned64 (
+  OUT UINT64  *Buffer,
+  IN  UINT64  Value
+  )
+{
+  memcpy (Buffer, &Value, sizeof (Value));
+
+  return Value;
+}
+
+// CompressHash
+STATIC
+UINT32
+CompressHash (
+  IN CONST UINT8  *Data
+  )
+{
+  UINT32 Value;
+
+  memcpy (&Value, Data, sizeof (Value));
+
+  return ((Value * 2654435761U) >> (32 - LZ4_HASH_BITS));
+}
+
+// CompressWriteLength
+STATIC
+UINT8 *
+CompressWriteLength (
+  IN UINT8  *Output,
+  IN UINTN  Length
+  )
+{
+  while (Length >= MAX_UINT8) {
+    *Output++ = MAX_UINT8;
+    Length   -= MAX_UINT8;
+  }
+
+  *Output++ = (UINT8)Length;
+
+  return Output;
+}
+
+// CompressWriteSequence
+STATIC
+UINT8 *
+CompressWriteSequence (
+  IN UINT8        *Output,
+  IN CONST UINT8  *Literals,
+  IN UINTN        LiteralLength,
+  IN UINTN        Offset,
+  IN UINTN        MatchLength
+  )
+{
+  UINT8 *Token;
+  UINTN Length;
+
+  Token  = Output++;
+  *Token = (UINT8)(MIN (LiteralLength, 15) << 4);
+
+  if (LiteralLength >= 15) {
+    Output = CompressWriteLength (Output, LiteralLength - 15);
+  }
+
+  memcpy (Output, Literals, LiteralLength);
+  Output += LiteralLength;
+
+  if (MatchLength == 0) {
+    return Output;
+  }
+
+  *Output++ = (UINT8)Offset;
+  *Output++ = (UINT8)(Offset >> 8);
+
+  Length  = (MatchLength - LZ4_MINIMUM_MATCH);
+  *Token |= (UINT8)MIN (Length, 15);
+
+  if (Length >= 15) {
+    Output = CompressWriteLength (Output, Length - 15);
+  }
+
+  return Output;
+}
+
+// CompressBlock
+/** Compresses Input into a single LZ4 block with a greedy matcher.  Output
+    must hold at least CompressBound (InputSize) bytes.
+**/
+STATIC
+UINTN
+CompressBlock (
+  IN  CONST UINT8  *Input,
+  IN  UINTN        InputSize,
+  OUT UINT8        *Output
+  )
+{
+  STATIC UINT32 HashTable[1U << LZ4_HASH_BITS];
+
+  CONST UINT8 *Ip;
+  CONST UINT8 *Anchor;
+  CONST UINT8 *MatchLimit;
+  CONST UINT8 *MatchEnd;
+  CONST UINT8 *Match;
+  UINT8       *Op;
+  UINT32      Hash;
+  UINTN       Position;
+  UINTN       Length;
+
+  Op     = Output;
+  Ip     = Input;
+  Anchor = Input;
+
+  memset (HashTable, 0xFF, sizeof (HashTable));
+
+  if (InputSize > LZ4_MATCH_LIMIT) {
+    MatchLimit = (Input + InputSize - LZ4_MATCH_LIMIT);
+    MatchEnd   = (Input + InputSize - LZ4_LAST_LITERALS);
+
+    while (Ip < MatchLimit) {
+      Hash            = CompressHash (Ip);
+      Position        = HashTable[Hash];
+      HashTable[Hash] = (UINT32)(Ip - Input);
+
+      if ((Position >= (UINTN)(Ip - Input))
+       || (((UINTN)(Ip - Input) - Position) > LZ4_MAXIMUM_OFFSET)
+       || (memcmp (Input + Position, Ip, LZ4_MINIMUM_MATCH) != 0)) {
+        ++Ip;
+        continue;
+      }
+
+      Match = (Input + Position);
+
+      Length = LZ4_MINIMUM_MATCH;
+
+      while (((Ip + Length) < MatchEnd) && (Match[Length] == Ip[Length])) {
+        ++Length;
+      }
+
+      Op = CompressWriteSequence (
+             Op,
+             Anchor,
+             (UINTN)(Ip - Anchor),
+             (UINTN)(Ip - Match),
+             Length
+             );
+
+      Ip    += Length;
+      Anchor = Ip;
+    }
+  }
+
+  return (UINTN)(CompressWriteSequence (
+                   Op,
+                   Anchor,
+                   (UINTN)(Input + InputSize - Anchor),
+                   0,
+                   0
+                   ) - Output);
+}
+
+// CompressBound
+STATIC
+UINTN
+CompressBound (
+  IN UINTN  InputSize
+  )
+{
+  return (InputSize + (InputSize / 255) + 16);
+}
+
+// ReadFile
+STATIC
+UINT8 *
+ReadFile (
+  IN  CONST CHAR8  *Path,
+  IN  BOOLEAN      Uncached,
+  OUT UINTN        *Size
+  )
+{
+  int     Descriptor;
+  off_t   FileSize;
+  UINT8   *Buffer;
+  ssize_t Result;
+  UINTN   Offset;
+
+  Descriptor = open (Path, O_RDONLY);
+
+  if (Descriptor < 0) {
+    perror (Path);
+    return NULL;
+  }
+
+  if (Uncached) {
+    posix_fadvise (Descriptor, 0, 0, POSIX_FADV_DONTNEED);
+  }
+
+  FileSize = lseek (Descriptor, 0, SEEK_END);
+  Buffer   = NULL;
+
+  if ((FileSize > 0) && (lseek (Descriptor, 0, SEEK_SET) == 0)) {
+    Buffer = malloc ((size_t)FileSize);
+  }
+
+  for (Offset = 0; (Buffer != NULL) && (Offset < (UINTN)FileSize);) {
+    Result = read (Descriptor, Buffer + Offset, (size_t)FileSize - Offset);
+
+    if (Result <= 0) {
+      free (Buffer);
+      Buffer = NULL;
+      break;
+    }
+
+    Offset += (UINTN)Result;
+  }
+
+  close (Descriptor);
+
+  if (Buffer == NULL) {
+    fprintf (stderr, "%s: cannot read\n", Path);
+    return NULL;
+  }
+
+  *Size = (UINTN)FileSize;
+
+  return Buffer;
+}
+
+// Compress
+STATIC
+int
+Compress (
+  IN CONST CHAR8  *ImagePath,
+  IN CONST CHAR8  *ContainerPath
+  )
+{
+  UINT8                   *Image;
+  UINTN                   ImageSize;
+  UINT8                   *Container;
+  COMPRESSED_IMAGE_HEADER Header;
+  UINTN                   CompressedSize;
+  UINT8                   *Check;
+  FILE                    *File;
+  int                     Result;
+
+  Image = ReadFile (ImagePath, FALSE, &ImageSize);
+
+  if (Image == NULL) {
+    return EXIT_FAILURE;
+  }
+
+  if (ImageSize > MAX_UINT32) {
+    fprintf (stderr, "%s: too large\n", ImagePath);
+    free (Image);
+    return EXIT_FAILURE;
+  }
+
+  Container      = malloc (sizeof (Header) + CompressBound (ImageSize));
+  Check          = malloc (ImageSize);
+  CompressedSize = 0;
+
+  if ((Container != NULL) && (Check != NULL)) {
+    CompressedSize = CompressBlock (
+                       Image,
+                       ImageSize,
+                       Container + sizeof (Header)
+                       );
+
+    //
+    // Never emit a container the firmware cannot decompress.
+    //
+    if (RETURN_ERROR (Lz4DecompressBlock (
+                        Container + sizeof (Header),
+                        CompressedSize,
+                        Check,
+                        ImageSize
+                        ))
+     || (memcmp (Check, Image, ImageSize) != 0)) {
+      fprintf (stderr, "%s: verification failed\n", ImagePath);
+      CompressedSize = 0;
+    }
+  }
+
+  Result = EXIT_FAILURE;
+
+  if (CompressedSize != 0) {
+    Header.Signature        = COMPRESSED_IMAGE_SIGNATURE;
+    Header.Version          = COMPRESSED_IMAGE_VERSION;
+    Header.Algorithm        = COMPRESSED_IMAGE_ALGORITHM_LZ4;
+    Header.UncompressedSize = (UINT32)ImageSize;
+    Header.CompressedSize   = (UINT32)CompressedSize;
+
+    memcpy (Container, &Header, sizeof (Header));
+
+    File = fopen (ContainerPath, "wb");
+
+    if (File != NULL) {
+      if (fwrite (Container, sizeof (Header) + CompressedSize, 1, File) == 1) {
+        Result = EXIT_SUCCESS;
+      }
+
+      if (fclose (File) != 0) {
+        Result = EXIT_FAILURE;
+      }
+    }
+
+    if (Result != EXIT_SUCCESS) {
+      perror (ContainerPath);
+    } else {
+      printf (
+        "%s: %llu -> %llu bytes (%.1f%%)\n",
+        ContainerPath,
+        (unsigned long long)ImageSize,
+        (unsigned long long)(sizeof (Header) + CompressedSize),
+        (100.0 * (sizeof (Header) + CompressedSize)) / ImageSize
+        );
+    }
+  }
+
+  free (Check);
+  free (Container);
+  free (Image);
+
+  return Result;
+}
+
+// BenchmarkNow
+STATIC
+double
+BenchmarkNow (
+  VOID
+  )
+{
+  struct timespec Time;
+
+  clock_gettime (CLOCK_MONOTONIC, &Time);
+
+  return (Time.tv_sec + (Time.tv_nsec / 1e9));
+}
+
+// Benchmark
+STATIC
+int
+Benchmark (
+  IN CONST CHAR8  *ImagePath,
+  IN CONST CHAR8  *ContainerPath,
+  IN BOOLEAN      Uncached,
+  IN UINTN        Iterations
+  )
+{
+  UINT8                   *Buffer;
+  UINT8                   *Image;
+  COMPRESSED_IMAGE_HEADER Header;
+  UINTN                   Index;
+  double                  Start;
+  double                  ReadTime;
+  double                  ContainerReadTime;
+  double                  DecompressTime;
+  RETURN_STATUS           Status;
+  UINTN                   ImageSize;
+  UINTN                   ContainerSize;
+
+  Buffer = ReadFile (ContainerPath, FALSE, &ContainerSize);
+
+  if (Buffer == NULL) {
+    return EXIT_FAILURE;
+  }
+
+  memcpy (&Header, Buffer, MIN (sizeof (Header), ContainerSize));
+  free (Buffer);
+
+  if ((ContainerSize < sizeof (Header))
+   || (Header.Signature != COMPRESSED_IMAGE_SIGNATURE)
+   || (Header.Algorithm != COMPRESSED_IMAGE_ALGORITHM_LZ4)
+   || (Header.CompressedSize > (ContainerSize - sizeof (Header)))) {
+    fprintf (stderr, "%s: no compressed image\n", ContainerPath);
+    return EXIT_FAILURE;
+  }
+
+  //
+  // Only the decoder is timed.  The destination is allocated and faulted in
+  // once, as the firmware pool is not demand paged.
+  //
+  Image = malloc (Header.UncompressedSize);
+
+  if (Image == NULL) {
+    fprintf (stderr, "%s: out of memory\n", ContainerPath);
+    return EXIT_FAILURE;
+  }
+
+  memset (Image, 0, Header.UncompressedSize);
+
+  ReadTime          = 0;
+  ContainerReadTime = 0;
+  DecompressTime    = 0;
+  ImageSize         = 0;
+
+  for (Index = 0; Index < Iterations; ++Index) {
+    Start  = BenchmarkNow ();
+    Buffer = ReadFile (ImagePath, Uncached, &ImageSize);
+
+    if (Buffer == NULL) {
+      free (Image);
+      return EXIT_FAILURE;
+    }
+
+    ReadTime += (BenchmarkNow () - Start);
+    free (Buffer);
+
+    Start  = BenchmarkNow ();
+    Buffer = ReadFile (ContainerPath, Uncached, &ContainerSize);
+
+    if (Buffer == NULL) {
+      free (Image);
+      return EXIT_FAILURE;
+    }
+
+    ContainerReadTime += (BenchmarkNow () - Start);
+
+    if (ContainerSize < (sizeof (Header) + Header.CompressedSize)) {
+      fprintf (stderr, "%s: changed\n", ContainerPath);
+      free (Buffer);
+      free (Image);
+      return EXIT_FAILURE;
+    }
+
+    Start  = BenchmarkNow ();
+    Status = Lz4DecompressBlock (
+               Buffer + sizeof (Header),
+               Header.CompressedSize,
+               Image,
+               Header.UncompressedSize
+               );
+    DecompressTime += (BenchmarkNow () - Start);
+
+    free (Buffer);
+
+    if (RETURN_ERROR (Status)) {
+      fprintf (stderr, "%s: cannot decompress\n", ContainerPath);
+      free (Image);
+      return EXIT_FAILURE;
+    }
+  }
+
+  free (Image);
+
+  printf (
+    "plain read:            %9.3f ms  %8.1f MB/s  (%llu bytes)\n",
+    (1e3 * ReadTime) / Iterations,
+    ((double)ImageSize * Iterations) / ReadTime / 1e6,
+    (unsigned long long)ImageSize
+    );
+
+  printf (
+    "compressed read:       %9.3f ms  (%llu bytes)\n",
+    (1e3 * ContainerReadTime) / Iterations,
+    (unsigned long long)ContainerSize
+    );
+
+  printf (
+    "decompress:            %9.3f ms  %8.1f MB/s\n",
+    (1e3 * DecompressTime) / Iterations,
+    ((double)Header.UncompressedSize * Iterations) / DecompressTime / 1e6
+    );
+
+  printf (
+    "read plus decompress:  %9.3f ms  (%.2fx plain read)\n",
+    (1e3 * (ContainerReadTime + DecompressTime)) / Iterations,
+    (ContainerReadTime + DecompressTime) / ReadTime
+    );
+
+  return EXIT_SUCCESS;
+}
+
+int
+main (
+  int   argc,
+  char  *argv[]
+  )
+{
+  BOOLEAN DoBenchmark;
+  BOOLEAN Uncached;
+  UINTN   Iterations;
+  int     Option;
+
+  DoBenchmark = FALSE;
+  Uncached    = FALSE;
+  Iterations  = BENCHMARK_ITERATIONS;
+
+  while ((Option = getopt (argc, argv, "bun:")) != -1) {
+    switch (Option) {
+      case 'b':
+        DoBenchmark = TRUE;
+        break;
+
+      case 'u':
+        Uncached = TRUE;
+        break;
+
+      case 'n':
+        Iterations = strtoul (optarg, NULL, 0);
+        break;
+
+      default:
+        Iterations = 0;
+        break;
+    }
+  }
+
+  if (((argc - optind) != 2) || (Iterations == 0)) {
+    fprintf (
+      stderr,
+      "Usage: %s <image> <container>\n"
+      "       %s -b [-u] [-n <iterations>] <image> <container>\n",
+      argv[0],
+      argv[0]
+      );
+
+    return EXIT_FAILURE;
+  }
+
+  if (DoBenchmark) {
+    return Benchmark (argv[optind], argv[optind + 1], Uncached, Iterations);
+  }
+
+  return Compress (argv[optind], argv[optind + 1]);
+}
@@ -0,0 +1,376 @@
+/** @file
+  Host environment used to run FirmwareFixesLib memory map code off-target.
+
+  Copyright (C) 2017, CupertinoNet.  All rights reserved.<BR>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <Uefi.h>
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/EfiBootServicesLib.h>
+#include <Library/PcdLib.h>
+#include <Library/VirtualMemoryLib.h>
+
+#include "HostStubs.h"
+
+BOOLEAN _gPcd_FixedAtBuild_PcdPreserveSystemTable                          = FALSE;
+BOOLEAN _gPcd_FixedAtBuild_PcdPartialVirtualAddressMap                     = FALSE;
+BOOLEAN _gPcd_FixedAtBuild_PcdMapVirtualPages                              = FALSE;
+BOOLEAN _gPcd_FixedAtBuild_PcdShrinkMemoryMap                              = TRUE;
+BOOLEAN _gPcd_FixedAtBuild_PcdFixMemoryMap                                 = TRUE;
+BOOLEAN _gPcd_FixedAtBuild_PcdHandleGop                                    = FALSE;
+BOOLEAN _gPcd_FixedAtBuild_PcdDisableMemoryAllocationServicesBeforeExitBS  = FALSE;
+BOOLEAN _gPcd_FixedAtBuild_PcdSignalAppleOSLoadedEvent                     = FALSE;
+BOOLEAN _gPcd_FixedAtBuild_PcdCoalesceVirtualAddressMap                    = FALSE;
+BOOLEAN _gPcd_FixedAtBuild_PcdReportKernelSlides                           = TRUE;
+UINT64  _gPcd_FixedAtBuild_PcdKernelSlideRequiredSize                      = 0x04000000;
+BOOLEAN _gPcd_FixedAtBuild_PcdTraceMemoryMap                               = FALSE;
+UINT32  _gPcd_FixedAtBuild_PcdMemoryMapTraceRecords                        = 0x00000400;
+UINT32  _gPcd_FixedAtBuild_PcdMemoryMapTraceDescriptors                    = 0x00000200;
+UINT32  _gPcd_FixedAtBuild_PcdBooterAllocationRecords                      = 0x00001000;
+
+// HOST_PCD
+typedef struct {
+  CONST CHAR8 *Name;
+  VOID        *Value;
+  UINTN       Size;
+} HOST_PCD;
+
+#define HOST_PCD_ENTRY(TokenName)  \
+  { #TokenName, &_gPcd_FixedAtBuild_##TokenName, sizeof (_gPcd_FixedAtBuild_##TokenName) }
+
+STATIC HOST_PCD mHostPcds[] = {
+  HOST_PCD_ENTRY (PcdPreserveSystemTable),
+  HOST_PCD_ENTRY (PcdPartialVirtualAddressMap),
+  HOST_PCD_ENTRY (PcdMapVirtualPages),
+  HOST_PCD_ENTRY (PcdShrinkMemoryMap),
+  HOST_PCD_ENTRY (PcdFixMemoryMap),
+  HOST_PCD_ENTRY (PcdHandleGop),
+  HOST_PCD_ENTRY (PcdDisableMemoryAllocationServicesBeforeExitBS),
+  HOST_PCD_ENTRY (PcdSignalAppleOSLoadedEvent),
+  HOST_PCD_ENTRY (PcdCoalesceVirtualAddressMap),
+  HOST_PCD_ENTRY (PcdReportKernelSlides),
+  HOST_PCD_ENTRY (PcdKernelSlideRequiredSize),
+  HOST_PCD_ENTRY (PcdTraceMemoryMap),
+  HOST_PCD_ENTRY (PcdMemoryMapTraceRecords),
+  HOST_PCD_ENTRY (PcdMemoryMapTraceDescriptors),
+  HOST_PCD_ENTRY (PcdBooterAllocationRecords)
+};
+
+BOOLEAN gHostAbortOnAssert        = FALSE;
+UINTN   gHostAssertCount          = 0;
+UINT64  gHostMapVirtualPagesCalls = 0;
+UINT64  gHostMapVirtualPagesPages = 0;
+
+STATIC UINT64 mHostPageTable[512];
+
+// HostAssert
+VOID
+HostAssert (
+  IN CONST CHAR8  *FileName,
+  IN UINTN        LineNumber,
+  IN CONST CHAR8  *Description
+  )
+{
+  ++gHostAssertCount;
+
+  fprintf (
+    stderr,
+    "ASSERT %s(%llu): %s\n",
+    FileName,
+    (unsigned long long)LineNumber,
+    Description
+    );
+
+  if (gHostAbortOnAssert) {
+    abort ();
+  }
+}
+
+// HostSetPcd
+BOOLEAN
+HostSetPcd (
+  IN CONST CHAR8  *Assignment
+  )
+{
+  CONST CHAR8 *Value;
+  CHAR8       *End;
+  UINTN       NameLength;
+  UINT64      Number;
+  UINTN       Index;
+
+  Value = strchr (Assignment, '=');
+
+  if (Value == NULL) {
+    return FALSE;
+  }
+
+  NameLength = (UINTN)(Value - Assignment);
+  ++Value;
+
+  if (strcmp (Value, "TRUE") == 0) {
+    Number = 1;
+  } else if (strcmp (Value, "FALSE") == 0) {
+    Number = 0;
+  } else {
+    Number = strtoull (Value, &End, 0);
+
+    if ((*Value == '\0') || (*End != '\0')) {
+      return FALSE;
+    }
+  }
+
+  for (Index = 0; Index < ARRAY_SIZE (mHostPcds); ++Index) {
+    if ((strlen (mHostPcds[Index].Name) == NameLength)
+     && (strncmp (mHostPcds[Index].Name, Assignment, NameLength) == 0)) {
+      switch (mHostPcds[Index].Size) {
+        case sizeof (UINT8):
+          *(UINT8 *)mHostPcds[Index].Value = (UINT8)Number;
+          break;
+
+        case sizeof (UINT16):
+          *(UINT16 *)mHostPcds[Index].Value = (UINT16)Number;
+          break;
+
+        case sizeof (UINT32):
+          *(UINT32 *)mHostPcds[Index].Value = (UINT32)Number;
+          break;
+
+        default:
+          *(UINT64 *)mHostPcds[Index].Value = Number;
+          break;
+      }
+
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+// HostPrintPcds
+VOID
+HostPrintPcds (
+  VOID
+  )
+{
+  UINT64 Value;
+  UINTN  Index;
+
+  for (Index = 0; Index < ARRAY_SIZE (mHostPcds); ++Index) {
+    Value = 0;
+    memcpy (&Value, mHostPcds[Index].Value, mHostPcds[Index].Size);
+
+    printf (
+      "# %s=0x%llx\n",
+      mHostPcds[Index].Name,
+      (unsigned long long)Value
+      );
+  }
+}
+
+// HostResetCounters
+VOID
+HostResetCounters (
+  VOID
+  )
+{
+  gHostAssertCount          = 0;
+  gHostMapVirtualPagesCalls = 0;
+  gHostMapVirtualPagesPages = 0;
+}
+
+VOID *
+EFIAPI
+CopyMem (
+  OUT VOID       *DestinationBuffer,
+  IN  CONST VOID *SourceBuffer,
+  IN  UINTN      Length
+  )
+{
+  return memmove (DestinationBuffer, SourceBuffer, Length);
+}
+
+VOID *
+EFIAPI
+ZeroMem (
+  OUT VOID  *Buffer,
+  IN  UINTN Length
+  )
+{
+  return memset (Buffer, 0, Length);
+}
+
+VOID *
+EFIAPI
+SetMem (
+  OUT VOID  *Buffer,
+  IN  UINTN Length,
+  IN  UINT8 Value
+  )
+{
+  return memset (Buffer, Value, Length);
+}
+
+INTN
+EFIAPI
+CompareMem (
+  IN CONST VOID  *DestinationBuffer,
+  IN CONST VOID  *SourceBuffer,
+  IN UINTN       Length
+  )
+{
+  return memcmp (DestinationBuffer, SourceBuffer, Length);
+}
+
+UINT64
+EFIAPI
+DivU64x32 (
+  IN UINT64  Dividend,
+  IN UINT32  Divisor
+  )
+{
+  return Dividend / Divisor;
+}
+
+UINT64
+EFIAPI
+MultU64x64 (
+  IN UINT64  Multiplicand,
+  IN UINT64  Multiplier
+  )
+{
+  return Multiplicand * Multiplier;
+}
+
+UINT64
+EFIAPI
+RShiftU64 (
+  IN UINT64  Operand,
+  IN UINTN   Count
+  )
+{
+  ASSERT (Count < 64);
+
+  return Operand >> Count;
+}
+
+INTN
+EFIAPI
+HighBitSet32 (
+  IN UINT32  Operand
+  )
+{
+  if (Operand == 0) {
+    return -1;
+  }
+
+  return 31 - __builtin_clz (Operand);
+}
+
+// EfiAllocatePool
+EFI_STATUS
+EfiAllocatePool (
+  IN  EFI_MEMORY_TYPE  PoolType,
+  IN  UINTN            Size,
+  OUT VOID             **Buffer
+  )
+{
+  *Buffer = malloc (Size);
+
+  return ((*Buffer != NULL) ? EFI_SUCCESS : EFI_OUT_OF_RESOURCES);
+}
+
+// EfiFreePool
+EFI_STATUS
+EfiFreePool (
+  IN VOID  *Buffer
+  )
+{
+  free (Buffer);
+
+  return EFI_SUCCESS;
+}
+
+// VirtualMemoryConstructor
+BOOLEAN
+VirtualMemoryConstructor (
+  VOID
+  )
+{
+  return TRUE;
+}
+
+// VirtualMemoryDestructor
+VOID
+VirtualMemoryDestructor (
+  VOID
+  )
+{
+}
+
+// VirtualMemoryGetPageTable
+VOID *
+VirtualMemoryGetPageTable (
+  IN OUT UINTN  *Flags OPTIONAL
+  )
+{
+  if (Flags != NULL) {
+    *Flags = 0;
+  }
+
+  return (VOID *)&mHostPageTable[0];
+}
+
+// VirtualMemoryGetPhysicalAddress
+EFI_PHYSICAL_ADDRESS
+VirtualMemoryGetPhysicalAddress (
+  IN VOID                 *PageTable,
+  IN EFI_VIRTUAL_ADDRESS  VirtualAddress
+  )
+{
+  return 0;
+}
+
+// VirtualMemoryMapVirtualPages
+BOOLEAN
+VirtualMemoryMapVirtualPages (
+  IN VOID                  *PageTable,
+  IN EFI_VIRTUAL_ADDRESS   VirtualAddress,
+  IN UINT64                NumberOfPages,
+  IN EFI_PHYSICAL_ADDRESS  PhysicalAddress
+  )
+{
+  ASSERT (PageTable == (VOID *)&mHostPageTable[0]);
+
+  ++gHostMapVirtualPagesCalls;
+  gHostMapVirtualPagesPages += NumberOfPages;
+
+  return TRUE;
+}
+
+// VirtualMemoryFlashCaches
+VOID
+VirtualMemoryFlashCaches (
+  VOID
+  )
+{
+}
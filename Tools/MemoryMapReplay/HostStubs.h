@@ -0,0 +1,71 @@
+/** @file
+  Host environment used to run FirmwareFixesLib memory map code off-target.
+
+  Copyright (C) 2017, CupertinoNet.  All rights reserved.<BR>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+**/
+
+#ifndef HOST_STUBS_H_
+#define HOST_STUBS_H_
+
+///
+/// Abort the process on the first failed ASSERT ().
+///
+extern BOOLEAN gHostAbortOnAssert;
+
+///
+/// The number of failed ASSERT ()s since the last reset.
+///
+extern UINTN   gHostAssertCount;
+
+///
+/// The number of VirtualMemoryMapVirtualPages() calls and the total number
+/// of pages requested through them since the last reset.
+///
+extern UINT64  gHostMapVirtualPagesCalls;
+extern UINT64  gHostMapVirtualPagesPages;
+
+/**
+  Assigns a PCD from a "Name=Value" string.
+
+  @param[in] Assignment  The assignment to parse.
+
+  @retval TRUE   The PCD has been assigned.
+  @retval FALSE  The PCD is unknown or the value is malformed.
+
+**/
+BOOLEAN
+HostSetPcd (
+  IN CONST CHAR8  *Assignment
+  );
+
+/**
+  Prints all stubbed PCDs with their current values.
+
+**/
+VOID
+HostPrintPcds (
+  VOID
+  );
+
+/**
+  Resets the host stub counters.
+
+**/
+VOID
+HostResetCounters (
+  VOID
+  );
+
+#endif // HOST_STUBS_H_
@@ -0,0 +1,75 @@
+/** @file
+  Binary capture format for firmware memory maps replayed by
+  MemoryMapReplay.
+
+  A capture file holds one or more captures back to back.  Each capture is a
+  MEMORY_MAP_CAPTURE_HEADER followed by MemoryMapSize bytes of memory
+  descriptors exactly as they were returned by GetMemoryMap(), including any
+  padding implied by DescriptorSize.  All fields are little-endian.
+
+  Copyright (C) 2017, CupertinoNet.  All rights reserved.<BR>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+**/
+
+#ifndef MEMORY_MAP_CAPTURE_H_
+#define MEMORY_MAP_CAPTURE_H_
+
+// MEMORY_MAP_CAPTURE_SIGNATURE
+#define MEMORY_MAP_CAPTURE_SIGNATURE  SIGNATURE_32 ('M', 'M', 'A', 'P')
+
+// MEMORY_MAP_CAPTURE_VERSION
+#define MEMORY_MAP_CAPTURE_VERSION  1
+
+#pragma pack (1)
+
+// MEMORY_MAP_CAPTURE_HEADER
+typedef PACKED struct {
+  ///
+  /// MEMORY_MAP_CAPTURE_SIGNATURE.
+  ///
+  UINT32 Signature;
+  ///
+  /// MEMORY_MAP_CAPTURE_VERSION.
+  ///
+  UINT32 Version;
+  ///
+  /// The size, in bytes, of this header.  The memory map follows directly.
+  ///
+  UINT32 HeaderSize;
+  ///
+  /// The descriptor version returned by GetMemoryMap().
+  ///
+  UINT32 DescriptorVersion;
+  ///
+  /// The descriptor size returned by GetMemoryMap().
+  ///
+  UINT64 DescriptorSize;
+  ///
+  /// The size, in bytes, of the captured memory map.
+  ///
+  UINT64 MemoryMapSize;
+  ///
+  /// The physical start of the descriptor holding the EFI System Table, or 0
+  /// if it has not been recorded.
+  ///
+  UINT64 SystemTableArea;
+  ///
+  /// A NULL-terminated, free-form identifier of the captured board.
+  ///
+  CHAR8  BoardId[32];
+} MEMORY_MAP_CAPTURE_HEADER;
+
+#pragma pack ()
+
+#endif // MEMORY_MAP_CAPTURE_H_
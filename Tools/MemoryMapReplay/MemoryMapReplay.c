@@ -0,0 +1,1063 @@
+/** @file
+  Replays captured firmware memory maps through the FirmwareFixesLib memory
+  map passes and reports the timing and a digest of the result per pass.
+
+  Usage: MemoryMapReplay [options] <capture file or directory>...
+
+    -n <count>        Number of timed iterations per pass (default 1000).
+    -p <pass,...>     Passes to run (default all).
+    -D <Pcd>=<value>  Assign a stubbed PCD.
+    -d                Dump the resulting memory map of every pass.
+    -a                Abort on the first failed ASSERT ().
+    -t <file>         Trace the getmemorymap pass into file, see
+                      Tools/MemoryMapTrace.  Combine with -n 1 to trace
+                      every capture once.
+    -c                Check the distribution and the partial frees of the
+                      booter allocation table before replaying.  Captures
+                      are optional with this option.
+
+  Every result line is tab-separated so that the output of two builds can be
+  diffed directly:
+
+    capture  pass  in  out  min-ns  mean-ns  digest  map-calls  asserts  slides
+
+  "slides" is the number of valid kernel slides of the resulting memory map
+  for the passes that compute them, "-" otherwise.
+
+  Copyright (C) 2017, CupertinoNet.  All rights reserved.<BR>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+**/
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include <Uefi.h>
+
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/PcdLib.h>
+
+#include <Protocol/XnuKernelSlide.h>
+
+#include "FirmwareFixesInternal.h"
+#include "HostStubs.h"
+#include "MemoryMapCapture.h"
+
+#define REPLAY_DEFAULT_ITERATIONS  1000
+
+///
+/// The longest probe sequence tolerated for a half-filled booter allocation
+/// table.  A hash that drops address bits clusters aligned allocations far
+/// beyond it.
+///
+#define REPLAY_MAXIMUM_PROBE_LENGTH  16
+
+// REPLAY_CONTEXT
+typedef struct {
+  ///
+  /// The working copy of the captured memory map.  Restored before every
+  /// iteration.
+  ///
+  EFI_MEMORY_DESCRIPTOR *MemoryMap;
+  UINTN                 MemoryMapSize;
+  UINTN                 DescriptorSize;
+  UINTN                 SystemTableArea;
+  ///
+  /// The memory map produced by the pass.
+  ///
+  EFI_MEMORY_DESCRIPTOR *Result;
+  UINTN                 ResultSize;
+  ///
+  /// The number of valid kernel slides in Result or MAX_UINTN if the pass
+  /// does not compute them.
+  ///
+  UINTN                 NumberOfValidSlides;
+  UINT8                 ValidSlides[XNU_KERNEL_SLIDE_MAXIMUM / 8];
+} REPLAY_CONTEXT;
+
+/**
+  Runs one memory map pass on Context->MemoryMap.
+
+  @param[in, out] Context  The replay context.
+
+  @retval TRUE   The pass has been run and Context->Result is valid.
+  @retval FALSE  The pass cannot be run on this capture.
+
+**/
+typedef
+BOOLEAN
+(*REPLAY_PASS_FUNCTION) (
+  IN OUT REPLAY_CONTEXT  *Context
+  );
+
+// REPLAY_ALLOCATION_PATTERN
+typedef struct {
+  CONST CHAR8          *Name;
+  EFI_PHYSICAL_ADDRESS Base;
+  UINT64               Stride;
+} REPLAY_ALLOCATION_PATTERN;
+
+// REPLAY_PASS
+typedef struct {
+  CONST CHAR8          *Name;
+  REPLAY_PASS_FUNCTION Function;
+  BOOLEAN              Enabled;
+} REPLAY_PASS;
+
+// ReplayShrink
+STATIC
+BOOLEAN
+ReplayShrink (
+  IN OUT REPLAY_CONTEXT  *Context
+  )
+{
+  ShrinkMemoryMap (
+    &Context->MemoryMapSize,
+    Context->MemoryMap,
+    Context->DescriptorSize
+    );
+
+  Context->Result     = Context->MemoryMap;
+  Context->ResultSize = Context->MemoryMapSize;
+
+  return TRUE;
+}
+
+// ReplayFix
+STATIC
+BOOLEAN
+ReplayFix (
+  IN OUT REPLAY_CONTEXT  *Context
+  )
+{
+  FixMemoryMap (
+    Context->MemoryMapSize,
+    Context->MemoryMap,
+    Context->DescriptorSize
+    );
+
+  Context->Result     = Context->MemoryMap;
+  Context->ResultSize = Context->MemoryMapSize;
+
+  return TRUE;
+}
+
+// ReplayProtect
+STATIC
+BOOLEAN
+ReplayProtect (
+  IN OUT REPLAY_CONTEXT  *Context
+  )
+{
+  if (Context->SystemTableArea == 0) {
+    return FALSE;
+  }
+
+  ProtectRutimeMemoryFromRelocation (
+    Context->MemoryMapSize,
+    Context->DescriptorSize,
+    Context->MemoryMap,
+    Context->SystemTableArea
+    );
+
+  Context->Result     = Context->MemoryMap;
+  Context->ResultSize = Context->MemoryMapSize;
+
+  return TRUE;
+}
+
+// ReplayPartial
+STATIC
+BOOLEAN
+ReplayPartial (
+  IN OUT REPLAY_CONTEXT  *Context
+  )
+{
+  Context->ResultSize = Context->MemoryMapSize;
+  Context->Result     = GetPartialVirtualAddressMap (
+                          &Context->ResultSize,
+                          Context->DescriptorSize,
+                          Context->MemoryMap
+                          );
+
+  if (Context->Result == NULL) {
+    Context->ResultSize = 0;
+  }
+
+  return TRUE;
+}
+
+// ReplayMap
+STATIC
+BOOLEAN
+ReplayMap (
+  IN OUT REPLAY_CONTEXT  *Context
+  )
+{
+  MapVirtualPages (
+    Context->MemoryMapSize,
+    Context->DescriptorSize,
+    Context->MemoryMap
+    );
+
+  Context->Result     = Context->MemoryMap;
+  Context->ResultSize = Context->MemoryMapSize;
+
+  return TRUE;
+}
+
+// ReplayGetMemoryMap
+/** Runs the fixups InternalGetMemoryMap() applies, as selected by the PCDs.
+
+**/
+STATIC
+BOOLEAN
+ReplayGetMemoryMap (
+  IN OUT REPLAY_CONTEXT  *Context
+  )
+{
+  if (PcdGetBool (PcdTraceMemoryMap)) {
+    MemoryMapTraceBegin (
+      Context->MemoryMapSize,
+      Context->MemoryMap,
+      Context->DescriptorSize
+      );
+  }
+
+  if (PcdGetBool (PcdShrinkMemoryMap)) {
+    ShrinkMemoryMap (
+      &Context->MemoryMapSize,
+      Context->MemoryMap,
+      Context->DescriptorSize
+      );
+
+    if (PcdGetBool (PcdTraceMemoryMap)) {
+      MemoryMapTraceStage (
+        MEMORY_MAP_TRACE_STAGE_SHRINK,
+        Context->MemoryMapSize,
+        Context->MemoryMap,
+        Context->DescriptorSize
+        );
+    }
+  }
+
+  if (PcdGetBool (PcdFixMemoryMap)) {
+    FixMemoryMap (
+      Context->MemoryMapSize,
+      Context->MemoryMap,
+      Context->DescriptorSize
+      );
+
+    if (PcdGetBool (PcdTraceMemoryMap)) {
+      MemoryMapTraceStage (
+        MEMORY_MAP_TRACE_STAGE_FIX,
+        Context->MemoryMapSize,
+        Context->MemoryMap,
+        Context->DescriptorSize
+        );
+    }
+  }
+
+  if (PcdGetBool (PcdReportKernelSlides)) {
+    Context->NumberOfValidSlides = GetKernelSlideBitmap (
+                                     Context->MemoryMapSize,
+                                     Context->MemoryMap,
+                                     Context->DescriptorSize,
+                                     PcdGet64 (PcdKernelSlideRequiredSize),
+                                     Context->ValidSlides
+                                     );
+  }
+
+  Context->Result     = Context->MemoryMap;
+  Context->ResultSize = Context->MemoryMapSize;
+
+  return TRUE;
+}
+
+// ReplaySlides
+STATIC
+BOOLEAN
+ReplaySlides (
+  IN OUT REPLAY_CONTEXT  *Context
+  )
+{
+  Context->NumberOfValidSlides = GetKernelSlideBitmap (
+                                   Context->MemoryMapSize,
+                                   Context->MemoryMap,
+                                   Context->DescriptorSize,
+                                   PcdGet64 (PcdKernelSlideRequiredSize),
+                                   Context->ValidSlides
+                                   );
+
+  Context->Result     = Context->MemoryMap;
+  Context->ResultSize = Context->MemoryMapSize;
+
+  return TRUE;
+}
+
+STATIC REPLAY_PASS mPasses[] = {
+  { "shrink",       ReplayShrink,       TRUE },
+  { "fix",          ReplayFix,          TRUE },
+  { "protect",      ReplayProtect,      TRUE },
+  { "partial",      ReplayPartial,      TRUE },
+  { "map",          ReplayMap,          TRUE },
+  { "slides",       ReplaySlides,       TRUE },
+  { "getmemorymap", ReplayGetMemoryMap, TRUE }
+};
+
+STATIC CONST REPLAY_ALLOCATION_PATTERN mAllocationPatterns[] = {
+  { "pool",      0x0000000010000000ULL, 0x10       },
+  { "pages",     0x0000000000100000ULL, SIZE_4KB   },
+  { "64k",       0x0000000080000000ULL, SIZE_64KB  },
+  { "2m",        0x0000000100000000ULL, SIZE_2MB   },
+  { "1g",        0x0000001000000000ULL, SIZE_1GB   }
+};
+
+STATIC UINTN   mIterations = REPLAY_DEFAULT_ITERATIONS;
+STATIC BOOLEAN mDumpMaps   = FALSE;
+
+STATIC CONST CHAR8             *mTracePath    = NULL;
+STATIC MEMORY_MAP_TRACE_HEADER *mTrace        = NULL;
+STATIC MEMORY_MAP_TRACE_ENTRY  *mTraceEntries = NULL;
+
+// ReplayGetTime
+STATIC
+UINT64
+ReplayGetTime (
+  VOID
+  )
+{
+  struct timespec Time;
+
+  clock_gettime (CLOCK_MONOTONIC, &Time);
+
+  return ((UINT64)Time.tv_sec * 1000000000ULL) + (UINT64)Time.tv_nsec;
+}
+
+// ReplayDigest
+/** Calculates an FNV-1a digest of the fields of a memory map, ignoring any
+    descriptor padding.
+
+**/
+STATIC
+UINT64
+ReplayDigest (
+  IN CONST EFI_MEMORY_DESCRIPTOR  *MemoryMap,
+  IN UINTN                        MemoryMapSize,
+  IN UINTN                        DescriptorSize
+  )
+{
+  UINT64      Digest;
+  UINT64      Fields[5];
+  CONST UINT8 *Bytes;
+  UINTN       Index;
+  UINTN       Index2;
+
+  Digest = 0xCBF29CE484222325ULL;
+
+  for (Index = 0; Index < (MemoryMapSize / DescriptorSize); ++Index) {
+    Fields[0] = MemoryMap->Type;
+    Fields[1] = MemoryMap->PhysicalStart;
+    Fields[2] = MemoryMap->VirtualStart;
+    Fields[3] = MemoryMap->NumberOfPages;
+    Fields[4] = MemoryMap->Attribute;
+
+    Bytes = (CONST UINT8 *)&Fields[0];
+
+    for (Index2 = 0; Index2 < sizeof (Fields); ++Index2) {
+      Digest ^= Bytes[Index2];
+      Digest *= 0x100000001B3ULL;
+    }
+
+    MemoryMap = NEXT_MEMORY_DESCRIPTOR (MemoryMap, DescriptorSize);
+  }
+
+  return Digest;
+}
+
+// ReplayDumpMap
+STATIC
+VOID
+ReplayDumpMap (
+  IN CONST EFI_MEMORY_DESCRIPTOR  *MemoryMap,
+  IN UINTN                        MemoryMapSize,
+  IN UINTN                        DescriptorSize
+  )
+{
+  UINTN Index;
+
+  for (Index = 0; Index < (MemoryMapSize / DescriptorSize); ++Index) {
+    printf (
+      "#   %2u %016llx %016llx %10llu %016llx\n",
+      (unsigned)MemoryMap->Type,
+      (unsigned long long)MemoryMap->PhysicalStart,
+      (unsigned long long)MemoryMap->VirtualStart,
+      (unsigned long long)MemoryMap->NumberOfPages,
+      (unsigned long long)MemoryMap->Attribute
+      );
+
+    MemoryMap = NEXT_MEMORY_DESCRIPTOR (MemoryMap, DescriptorSize);
+  }
+}
+
+// ReplayDumpSlides
+STATIC
+VOID
+ReplayDumpSlides (
+  IN CONST UINT8  *ValidSlides
+  )
+{
+  UINTN Index;
+
+  printf ("#   slides ");
+
+  for (Index = 0; Index < (XNU_KERNEL_SLIDE_MAXIMUM / 8); ++Index) {
+    printf ("%02x", ValidSlides[Index]);
+  }
+
+  printf ("\n");
+}
+
+// ReplayCapture
+STATIC
+VOID
+ReplayCapture (
+  IN CONST CHAR8                      *Name,
+  IN CONST MEMORY_MAP_CAPTURE_HEADER  *Header,
+  IN CONST EFI_MEMORY_DESCRIPTOR      *MemoryMap
+  )
+{
+  REPLAY_CONTEXT Context;
+  UINTN          PassIndex;
+  UINTN          Iteration;
+  UINT64         Start;
+  UINT64         Elapsed;
+  UINT64         Minimum;
+  UINT64         Total;
+  UINT64         MapCalls;
+  BOOLEAN        Result;
+
+  Context.MemoryMap = malloc ((size_t)Header->MemoryMapSize);
+
+  if (Context.MemoryMap == NULL) {
+    fprintf (stderr, "%s: out of memory\n", Name);
+    return;
+  }
+
+  for (PassIndex = 0; PassIndex < ARRAY_SIZE (mPasses); ++PassIndex) {
+    if (!mPasses[PassIndex].Enabled) {
+      continue;
+    }
+
+    Minimum  = MAX_UINT64;
+    Total    = 0;
+    MapCalls = 0;
+    Result   = TRUE;
+
+    HostResetCounters ();
+
+    for (Iteration = 0; (Iteration < mIterations) && Result; ++Iteration) {
+      memcpy (Context.MemoryMap, MemoryMap, (size_t)Header->MemoryMapSize);
+
+      Context.MemoryMapSize   = (UINTN)Header->MemoryMapSize;
+      Context.DescriptorSize  = (UINTN)Header->DescriptorSize;
+      Context.SystemTableArea = (UINTN)Header->SystemTableArea;
+      Context.Result          = NULL;
+      Context.ResultSize      = 0;
+
+      Context.NumberOfValidSlides = MAX_UINTN;
+
+      gHostMapVirtualPagesCalls = 0;
+
+      Start   = ReplayGetTime ();
+      Result  = mPasses[PassIndex].Function (&Context);
+      Elapsed = ReplayGetTime () - Start;
+
+      MapCalls = gHostMapVirtualPagesCalls;
+      Minimum  = MIN (Minimum, Elapsed);
+      Total   += Elapsed;
+
+      if (gHostAssertCount > 0) {
+        //
+        // The remaining iterations would only repeat the same failure.
+        //
+        ++Iteration;
+        break;
+      }
+    }
+
+    if (!Result) {
+      printf ("%s\t%s\tskipped\n", Name, mPasses[PassIndex].Name);
+      continue;
+    }
+
+    printf (
+      "%s\t%s\t%llu\t%llu\t%llu\t%llu\t%016llx\t%llu\t%llu\t",
+      Name,
+      mPasses[PassIndex].Name,
+      (unsigned long long)(Header->MemoryMapSize / Header->DescriptorSize),
+      (unsigned long long)(Context.ResultSize / Context.DescriptorSize),
+      (unsigned long long)Minimum,
+      (unsigned long long)(Total / Iteration),
+      (unsigned long long)(
+        (Context.Result != NULL)
+          ? ReplayDigest (Context.Result, Context.ResultSize, Context.DescriptorSize)
+          : 0
+        ),
+      (unsigned long long)MapCalls,
+      (unsigned long long)gHostAssertCount
+      );
+
+    if (Context.NumberOfValidSlides != MAX_UINTN) {
+      printf ("%llu\n", (unsigned long long)Context.NumberOfValidSlides);
+    } else {
+      printf ("-\n");
+    }
+
+    if (mDumpMaps && (Context.Result != NULL)) {
+      ReplayDumpMap (Context.Result, Context.ResultSize, Context.DescriptorSize);
+
+      if (Context.NumberOfValidSlides != MAX_UINTN) {
+        ReplayDumpSlides (Context.ValidSlides);
+      }
+    }
+  }
+
+  free (Context.MemoryMap);
+}
+
+// ReplayFile
+STATIC
+VOID
+ReplayFile (
+  IN CONST CHAR8  *Path
+  )
+{
+  FILE                      *File;
+  UINT8                     *Buffer;
+  EFI_MEMORY_DESCRIPTOR     *MemoryMap;
+  long                      FileSize;
+  UINTN                     Offset;
+  UINTN                     Index;
+  MEMORY_MAP_CAPTURE_HEADER Header;
+  CHAR8                     Name[4096];
+
+  File = fopen (Path, "rb");
+
+  if (File == NULL) {
+    perror (Path);
+    return;
+  }
+
+  fseek (File, 0, SEEK_END);
+  FileSize = ftell (File);
+  fseek (File, 0, SEEK_SET);
+
+  Buffer = NULL;
+
+  if (FileSize > 0) {
+    Buffer = malloc ((size_t)FileSize);
+  }
+
+  if ((Buffer == NULL)
+   || (fread (Buffer, 1, (size_t)FileSize, File) != (size_t)FileSize)) {
+    fprintf (stderr, "%s: cannot read capture\n", Path);
+    fclose (File);
+    free (Buffer);
+    return;
+  }
+
+  fclose (File);
+
+  Offset = 0;
+
+  for (Index = 0; (Offset + sizeof (Header)) <= (UINTN)FileSize; ++Index) {
+    memcpy (&Header, &Buffer[Offset], sizeof (Header));
+
+    if ((Header.Signature != MEMORY_MAP_CAPTURE_SIGNATURE)
+     || (Header.Version != MEMORY_MAP_CAPTURE_VERSION)
+     || (Header.HeaderSize < sizeof (Header))
+     || (Header.HeaderSize > ((UINTN)FileSize - Offset))
+     || (Header.DescriptorSize < sizeof (EFI_MEMORY_DESCRIPTOR))
+     || ((Header.DescriptorSize % sizeof (UINT64)) != 0)
+     || (Header.MemoryMapSize < Header.DescriptorSize)
+     || ((Header.MemoryMapSize % Header.DescriptorSize) != 0)
+     || (Header.MemoryMapSize > ((UINTN)FileSize - Offset - Header.HeaderSize))) {
+      fprintf (
+        stderr,
+        "%s: malformed capture at offset %llu\n",
+        Path,
+        (unsigned long long)Offset
+        );
+      break;
+    }
+
+    //
+    // Copy the map out of the file buffer so that it is aligned as the
+    // firmware would return it.
+    //
+    MemoryMap = malloc ((size_t)Header.MemoryMapSize);
+
+    if (MemoryMap == NULL) {
+      fprintf (stderr, "%s: out of memory\n", Path);
+      break;
+    }
+
+    memcpy (
+      MemoryMap,
+      &Buffer[Offset + Header.HeaderSize],
+      (size_t)Header.MemoryMapSize
+      );
+
+    snprintf (Name, sizeof (Name), "%s#%llu", Path, (unsigned long long)Index);
+
+    ReplayCapture (Name, &Header, MemoryMap);
+
+    free (MemoryMap);
+
+    Offset += (Header.HeaderSize + (UINTN)Header.MemoryMapSize);
+  }
+
+  free (Buffer);
+}
+
+// ReplayCheckAllocationPattern
+STATIC
+BOOLEAN
+ReplayCheckAllocationPattern (
+  IN CONST REPLAY_ALLOCATION_PATTERN  *Pattern
+  )
+{
+  UINTN  NumberOfRecords;
+  UINTN  NumberOfAllocations;
+  UINT32 UntrackedFrees;
+  UINTN  MaximumProbeLength;
+  UINTN  Index;
+
+  NumberOfRecords = PcdGet32 (PcdBooterAllocationRecords);
+
+  AllocationTrackerInitialize ();
+
+  for (Index = 0; Index < (NumberOfRecords / 2); ++Index) {
+    AllocationTrackerAdd (
+      (Pattern->Base + (Index * Pattern->Stride)),
+      Pattern->Stride,
+      EfiLoaderData,
+      (Pattern->Stride < SIZE_4KB),
+      NULL
+      );
+  }
+
+  AllocationTrackerGetStatistics (
+    &NumberOfAllocations,
+    &UntrackedFrees,
+    &MaximumProbeLength
+    );
+
+  AllocationTrackerFree ();
+
+  printf (
+    "# allocations\t%s\t%llu\tprobe %llu\n",
+    Pattern->Name,
+    (unsigned long long)NumberOfAllocations,
+    (unsigned long long)MaximumProbeLength
+    );
+
+  return ((NumberOfAllocations == (NumberOfRecords / 2))
+       && (MaximumProbeLength <= REPLAY_MAXIMUM_PROBE_LENGTH));
+}
+
+// ReplayCheckPartialFrees
+STATIC
+BOOLEAN
+ReplayCheckPartialFrees (
+  VOID
+  )
+{
+  UINTN   NumberOfAllocations[3];
+  UINT32  UntrackedFrees;
+  UINTN   MaximumProbeLength;
+  BOOLEAN Result;
+
+  AllocationTrackerInitialize ();
+
+  AllocationTrackerAdd (
+    0x200000,
+    EFI_PAGES_TO_SIZE (16),
+    EfiLoaderData,
+    FALSE,
+    NULL
+    );
+
+  //
+  // Freeing from the middle splits the allocation, the parts in front and
+  // behind must then be freeable on their own.
+  //
+  AllocationTrackerRemove (0x204000, EFI_PAGES_TO_SIZE (4));
+  AllocationTrackerGetStatistics (
+    &NumberOfAllocations[0],
+    &UntrackedFrees,
+    &MaximumProbeLength
+    );
+
+  AllocationTrackerRemove (0x20A000, EFI_PAGES_TO_SIZE (2));
+  AllocationTrackerRemove (0x208000, EFI_PAGES_TO_SIZE (2));
+  AllocationTrackerGetStatistics (
+    &NumberOfAllocations[1],
+    &UntrackedFrees,
+    &MaximumProbeLength
+    );
+
+  AllocationTrackerRemove (0x20C000, EFI_PAGES_TO_SIZE (4));
+  AllocationTrackerRemove (0x200000, EFI_PAGES_TO_SIZE (4));
+  AllocationTrackerGetStatistics (
+    &NumberOfAllocations[2],
+    &UntrackedFrees,
+    &MaximumProbeLength
+    );
+
+  AllocationTrackerFree ();
+
+  Result = ((NumberOfAllocations[0] == 2)
+         && (NumberOfAllocations[1] == 2)
+         && (NumberOfAllocations[2] == 0)
+         && (UntrackedFrees == 0));
+
+  printf (
+    "# allocations\tpartial\t%s\n",
+    (Result ? "ok" : "FAILED")
+    );
+
+  return Result;
+}
+
+// ReplayCheckAllocations
+STATIC
+BOOLEAN
+ReplayCheckAllocations (
+  VOID
+  )
+{
+  BOOLEAN Result;
+  UINTN   Index;
+
+  Result = TRUE;
+
+  for (Index = 0; Index < ARRAY_SIZE (mAllocationPatterns); ++Index) {
+    if (!ReplayCheckAllocationPattern (&mAllocationPatterns[Index])) {
+      fprintf (
+        stderr,
+        "allocation table: %s addresses cluster\n",
+        mAllocationPatterns[Index].Name
+        );
+
+      Result = FALSE;
+    }
+  }
+
+  if (!ReplayCheckPartialFrees ()) {
+    fprintf (stderr, "allocation table: partial frees are not tracked\n");
+    Result = FALSE;
+  }
+
+  return Result;
+}
+
+// ReplayCompareNames
+STATIC
+int
+ReplayCompareNames (
+  IN CONST VOID  *First,
+  IN CONST VOID  *Second
+  )
+{
+  return strcmp (*(CHAR8 * CONST *)First, *(CHAR8 * CONST *)Second);
+}
+
+// ReplayPath
+STATIC
+VOID
+ReplayPath (
+  IN CONST CHAR8  *Path
+  )
+{
+  struct stat   Stat;
+  DIR           *Directory;
+  struct dirent *Entry;
+  CHAR8         **Names;
+  UINTN         NumberOfNames;
+  UINTN         Index;
+  CHAR8         EntryPath[4096];
+
+  if (stat (Path, &Stat) != 0) {
+    perror (Path);
+    return;
+  }
+
+  if (!S_ISDIR (Stat.st_mode)) {
+    ReplayFile (Path);
+    return;
+  }
+
+  Directory = opendir (Path);
+
+  if (Directory == NULL) {
+    perror (Path);
+    return;
+  }
+
+  //
+  // Replay the corpus in a stable order so that runs can be diffed.
+  //
+  Names         = NULL;
+  NumberOfNames = 0;
+
+  while ((Entry = readdir (Directory)) != NULL) {
+    if (Entry->d_name[0] == '.') {
+      continue;
+    }
+
+    Names = realloc (Names, (NumberOfNames + 1) * sizeof (*Names));
+
+    if (Names == NULL) {
+      fprintf (stderr, "%s: out of memory\n", Path);
+      closedir (Directory);
+      return;
+    }
+
+    Names[NumberOfNames] = strdup (Entry->d_name);
+    ++NumberOfNames;
+  }
+
+  closedir (Directory);
+
+  qsort (Names, NumberOfNames, sizeof (*Names), ReplayCompareNames);
+
+  for (Index = 0; Index < NumberOfNames; ++Index) {
+    snprintf (EntryPath, sizeof (EntryPath), "%s/%s", Path, Names[Index]);
+    ReplayPath (EntryPath);
+    free (Names[Index]);
+  }
+
+  free (Names);
+}
+
+// ReplaySelectPasses
+STATIC
+BOOLEAN
+ReplaySelectPasses (
+  IN CONST CHAR8  *List
+  )
+{
+  CONST CHAR8 *Name;
+  UINTN       Length;
+  UINTN       Index;
+  BOOLEAN     Found;
+
+  for (Index = 0; Index < ARRAY_SIZE (mPasses); ++Index) {
+    mPasses[Index].Enabled = FALSE;
+  }
+
+  for (Name = List; *Name != '\0'; Name += Length) {
+    if (*Name == ',') {
+      ++Name;
+    }
+
+    Length = strcspn (Name, ",");
+    Found  = FALSE;
+
+    for (Index = 0; Index < ARRAY_SIZE (mPasses); ++Index) {
+      if ((strlen (mPasses[Index].Name) == Length)
+       && (strncmp (mPasses[Index].Name, Name, Length) == 0)) {
+        mPasses[Index].Enabled = TRUE;
+        Found                  = TRUE;
+      }
+    }
+
+    if (!Found) {
+      fprintf (stderr, "unknown pass '%.*s'\n", (int)Length, Name);
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+// ReplayStartTrace
+STATIC
+BOOLEAN
+ReplayStartTrace (
+  VOID
+  )
+{
+  HostSetPcd ("PcdTraceMemoryMap=TRUE");
+
+  mTrace = calloc (
+             1,
+             sizeof (*mTrace)
+               + (PcdGet32 (PcdMemoryMapTraceRecords)
+                   * sizeof (MEMORY_MAP_TRACE_RECORD))
+             );
+  mTraceEntries = calloc (
+                    (2 * PcdGet32 (PcdMemoryMapTraceDescriptors)),
+                    sizeof (*mTraceEntries)
+                    );
+
+  if ((mTrace == NULL) || (mTraceEntries == NULL)) {
+    fprintf (stderr, "out of memory\n");
+    return FALSE;
+  }
+
+  MemoryMapTraceInitialize (
+    mTrace,
+    PcdGet32 (PcdMemoryMapTraceRecords),
+    mTraceEntries,
+    (2 * PcdGet32 (PcdMemoryMapTraceDescriptors))
+    );
+
+  return TRUE;
+}
+
+// ReplayWriteTrace
+STATIC
+BOOLEAN
+ReplayWriteTrace (
+  VOID
+  )
+{
+  FILE    *File;
+  BOOLEAN Result;
+
+  File = fopen (mTracePath, "wb");
+
+  if (File == NULL) {
+    perror (mTracePath);
+    return FALSE;
+  }
+
+  Result = (fwrite (
+              mTrace,
+              sizeof (*mTrace)
+                + (mTrace->NumberOfRecords * sizeof (MEMORY_MAP_TRACE_RECORD)),
+              1,
+              File
+              ) == 1);
+
+  fclose (File);
+
+  free (mTraceEntries);
+  free (mTrace);
+
+  return Result;
+}
+
+// ReplayUsage
+STATIC
+VOID
+ReplayUsage (
+  IN CONST CHAR8  *Program
+  )
+{
+  UINTN Index;
+
+  fprintf (
+    stderr,
+    "Usage: %s [-n count] [-p pass,...] [-D Pcd=value] [-d] [-a] [-t file] [-c] <capture>...\n"
+    "Passes:",
+    Program
+    );
+
+  for (Index = 0; Index < ARRAY_SIZE (mPasses); ++Index) {
+    fprintf (stderr, " %s", mPasses[Index].Name);
+  }
+
+  fprintf (stderr, "\n");
+}
+
+int
+main (
+  int   argc,
+  char  *argv[]
+  )
+{
+  int     Index;
+  BOOLEAN CheckAllocations;
+
+  CheckAllocations = FALSE;
+
+  for (Index = 1; Index < argc; ++Index) {
+    if (argv[Index][0] != '-') {
+      break;
+    }
+
+    if ((strcmp (argv[Index], "-n") == 0) && ((Index + 1) < argc)) {
+      mIterations = (UINTN)strtoull (argv[++Index], NULL, 0);
+
+      if (mIterations == 0) {
+        mIterations = 1;
+      }
+    } else if ((strcmp (argv[Index], "-p") == 0) && ((Index + 1) < argc)) {
+      if (!ReplaySelectPasses (argv[++Index])) {
+        return EXIT_FAILURE;
+      }
+    } else if ((strcmp (argv[Index], "-D") == 0) && ((Index + 1) < argc)) {
+      if (!HostSetPcd (argv[++Index])) {
+        fprintf (stderr, "invalid PCD assignment '%s'\n", argv[Index]);
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp (argv[Index], "-d") == 0) {
+      mDumpMaps = TRUE;
+    } else if (strcmp (argv[Index], "-a") == 0) {
+      gHostAbortOnAssert = TRUE;
+    } else if ((strcmp (argv[Index], "-t") == 0) && ((Index + 1) < argc)) {
+      mTracePath = argv[++Index];
+    } else if (strcmp (argv[Index], "-c") == 0) {
+      CheckAllocations = TRUE;
+    } else {
+      ReplayUsage (argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if ((Index == argc) && !CheckAllocations) {
+    ReplayUsage (argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if ((mTracePath != NULL) && !ReplayStartTrace ()) {
+    return EXIT_FAILURE;
+  }
+
+  HostPrintPcds ();
+
+  if (CheckAllocations && !ReplayCheckAllocations ()) {
+    return EXIT_FAILURE;
+  }
+
+  printf ("# capture\tpass\tin\tout\tmin-ns\tmean-ns\tdigest\tmap-calls\tasserts\tslides\n");
+
+  for (; Index < argc; ++Index) {
+    ReplayPath (argv[Index]);
+  }
+
+  if ((mTracePath != NULL) && !ReplayWriteTrace ()) {
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
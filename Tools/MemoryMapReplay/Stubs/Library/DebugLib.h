@@ -0,0 +1,62 @@
+/** @file
+  Host replacement of DebugLib.  Assertions are counted and reported instead
+  of halting, so that a single malformed capture does not stop a corpus run.
+  DEBUG () output is discarded.
+
+  Copyright (C) 2017, CupertinoNet.  All rights reserved.<BR>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+**/
+
+#ifndef HOST_DEBUG_LIB_H_
+#define HOST_DEBUG_LIB_H_
+
+#define DEBUG_INIT     0x00000001
+#define DEBUG_WARN     0x00000002
+#define DEBUG_INFO     0x00000040
+#define DEBUG_VERBOSE  0x00400000
+#define DEBUG_ERROR    0x80000000
+
+// HostAssert
+VOID
+HostAssert (
+  IN CONST CHAR8  *FileName,
+  IN UINTN        LineNumber,
+  IN CONST CHAR8  *Description
+  );
+
+#define ASSERT(Expression)                                  \
+  do {                                                      \
+    if (!(Expression)) {                                    \
+      HostAssert (__FILE__, __LINE__, #Expression);         \
+    }                                                       \
+  } while (FALSE)
+
+#define ASSERT_EFI_ERROR(StatusParameter)                   \
+  do {                                                      \
+    if (EFI_ERROR (StatusParameter)) {                      \
+      HostAssert (__FILE__, __LINE__, #StatusParameter);    \
+    }                                                       \
+  } while (FALSE)
+
+#define DEBUG(Expression)
+
+#define DEBUG_CODE_BEGIN()  do {
+#define DEBUG_CODE_END()    } while (FALSE)
+
+#define DEBUG_CODE(Expression)  \
+  DEBUG_CODE_BEGIN ();          \
+  Expression                    \
+  DEBUG_CODE_END ()
+
+#endif // HOST_DEBUG_LIB_H_
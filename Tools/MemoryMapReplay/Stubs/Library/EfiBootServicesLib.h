@@ -0,0 +1,37 @@
+/** @file
+  Host replacement of EfiBootServicesLib.  Only the pool services are
+  provided, which are backed by the C library heap.
+
+  Copyright (C) 2017, CupertinoNet.  All rights reserved.<BR>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+**/
+
+#ifndef HOST_EFI_BOOT_SERVICES_LIB_H_
+#define HOST_EFI_BOOT_SERVICES_LIB_H_
+
+// EfiAllocatePool
+EFI_STATUS
+EfiAllocatePool (
+  IN  EFI_MEMORY_TYPE  PoolType,
+  IN  UINTN            Size,
+  OUT VOID             **Buffer
+  );
+
+// EfiFreePool
+EFI_STATUS
+EfiFreePool (
+  IN VOID  *Buffer
+  );
+
+#endif // HOST_EFI_BOOT_SERVICES_LIB_H_
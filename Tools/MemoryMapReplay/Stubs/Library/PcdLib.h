@@ -0,0 +1,48 @@
+/** @file
+  Host replacement of PcdLib.  Every PCD is backed by a global that can be
+  changed at runtime through HostSetPcd().
+
+  Copyright (C) 2017, CupertinoNet.  All rights reserved.<BR>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+**/
+
+#ifndef HOST_PCD_LIB_H_
+#define HOST_PCD_LIB_H_
+
+extern BOOLEAN _gPcd_FixedAtBuild_PcdPreserveSystemTable;
+extern BOOLEAN _gPcd_FixedAtBuild_PcdPartialVirtualAddressMap;
+extern BOOLEAN _gPcd_FixedAtBuild_PcdMapVirtualPages;
+extern BOOLEAN _gPcd_FixedAtBuild_PcdShrinkMemoryMap;
+extern BOOLEAN _gPcd_FixedAtBuild_PcdFixMemoryMap;
+extern BOOLEAN _gPcd_FixedAtBuild_PcdHandleGop;
+extern BOOLEAN _gPcd_FixedAtBuild_PcdDisableMemoryAllocationServicesBeforeExitBS;
+extern BOOLEAN _gPcd_FixedAtBuild_PcdSignalAppleOSLoadedEvent;
+extern BOOLEAN _gPcd_FixedAtBuild_PcdCoalesceVirtualAddressMap;
+extern BOOLEAN _gPcd_FixedAtBuild_PcdReportKernelSlides;
+extern UINT64  _gPcd_FixedAtBuild_PcdKernelSlideRequiredSize;
+extern BOOLEAN _gPcd_FixedAtBuild_PcdTraceMemoryMap;
+extern UINT32  _gPcd_FixedAtBuild_PcdMemoryMapTraceRecords;
+extern UINT32  _gPcd_FixedAtBuild_PcdMemoryMapTraceDescriptors;
+extern UINT32  _gPcd_FixedAtBuild_PcdBooterAllocationRecords;
+
+#define FeaturePcdGet(TokenName)  (_gPcd_FixedAtBuild_##TokenName)
+#define PcdGetBool(TokenName)     (_gPcd_FixedAtBuild_##TokenName)
+#define PcdGet8(TokenName)        (_gPcd_FixedAtBuild_##TokenName)
+#define PcdGet16(TokenName)       (_gPcd_FixedAtBuild_##TokenName)
+#define PcdGet32(TokenName)       (_gPcd_FixedAtBuild_##TokenName)
+#define PcdGet64(TokenName)       (_gPcd_FixedAtBuild_##TokenName)
+#define FixedPcdGet32(TokenName)  (_gPcd_FixedAtBuild_##TokenName)
+#define FixedPcdGet64(TokenName)  (_gPcd_FixedAtBuild_##TokenName)
+
+#endif // HOST_PCD_LIB_H_
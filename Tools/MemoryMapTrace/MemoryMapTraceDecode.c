@@ -0,0 +1,264 @@
+/** @file
+  Decodes a memory map trace recorded by FirmwareFixesLib into text.
+
+  Usage: MemoryMapTraceDecode [-s] <trace file>
+
+    -s  Only print the number of records per stage and kind.
+
+  The trace file is a dump of the gMemoryMapTraceGuid configuration table,
+  starting at its MEMORY_MAP_TRACE_HEADER.  Records are printed oldest
+  first, one tab-separated line each:
+
+    sequence  stage  kind  type  physical-start  pages  attribute
+      [old-type  old-attribute]
+
+  Copyright (C) 2017, CupertinoNet.  All rights reserved.<BR>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <Uefi.h>
+
+#include <Guid/MemoryMapTrace.h>
+
+#define TRACE_NUMBER_OF_KINDS  (MEMORY_MAP_TRACE_RECORD_OVERFLOW + 1)
+
+STATIC CONST CHAR8 *mStageNames[MEMORY_MAP_TRACE_STAGE_MAXIMUM] = {
+  "firmware",
+  "shrink",
+  "fix"
+};
+
+STATIC CONST CHAR8 *mKindNames[TRACE_NUMBER_OF_KINDS] = {
+  "call",
+  "added",
+  "removed",
+  "retyped",
+  "overflow"
+};
+
+STATIC CONST CHAR8 *mTypeNames[EfiMaxMemoryType] = {
+  "Reserved",
+  "LoaderCode",
+  "LoaderData",
+  "BootServicesCode",
+  "BootServicesData",
+  "RuntimeServicesCode",
+  "RuntimeServicesData",
+  "Conventional",
+  "Unusable",
+  "AcpiReclaim",
+  "AcpiNvs",
+  "MemoryMappedIO",
+  "MemoryMappedIOPortSpace",
+  "PalCode",
+  "Persistent"
+};
+
+// TraceTypeName
+STATIC
+CONST CHAR8 *
+TraceTypeName (
+  IN UINT32  Type
+  )
+{
+  if ((Type < EfiMaxMemoryType) && (mTypeNames[Type] != NULL)) {
+    return mTypeNames[Type];
+  }
+
+  return "Unknown";
+}
+
+// TraceReadFile
+STATIC
+MEMORY_MAP_TRACE_HEADER *
+TraceReadFile (
+  IN CONST CHAR8  *Path
+  )
+{
+  FILE                    *File;
+  MEMORY_MAP_TRACE_HEADER Header;
+  MEMORY_MAP_TRACE_HEADER *Trace;
+  size_t                  TraceSize;
+
+  File = fopen (Path, "rb");
+
+  if (File == NULL) {
+    perror (Path);
+    return NULL;
+  }
+
+  Trace = NULL;
+
+  if (fread (&Header, sizeof (Header), 1, File) != 1) {
+    fprintf (stderr, "%s: truncated header\n", Path);
+  } else if ((Header.Signature != MEMORY_MAP_TRACE_SIGNATURE)
+          || (Header.Version != MEMORY_MAP_TRACE_VERSION)
+          || (Header.HeaderSize != sizeof (Header))
+          || (Header.RecordSize != sizeof (MEMORY_MAP_TRACE_RECORD))
+          || (Header.NumberOfRecords == 0)) {
+    fprintf (stderr, "%s: unsupported trace\n", Path);
+  } else {
+    TraceSize = sizeof (Header)
+                  + ((size_t)Header.NumberOfRecords
+                      * sizeof (MEMORY_MAP_TRACE_RECORD));
+
+    Trace = malloc (TraceSize);
+
+    if (Trace == NULL) {
+      fprintf (stderr, "%s: out of memory\n", Path);
+    } else {
+      memcpy (Trace, &Header, sizeof (Header));
+
+      if (fread (
+            (Trace + 1),
+            sizeof (MEMORY_MAP_TRACE_RECORD),
+            Header.NumberOfRecords,
+            File
+            ) != Header.NumberOfRecords) {
+        fprintf (stderr, "%s: truncated records\n", Path);
+        free (Trace);
+        Trace = NULL;
+      }
+    }
+  }
+
+  fclose (File);
+
+  return Trace;
+}
+
+// TracePrintRecord
+STATIC
+VOID
+TracePrintRecord (
+  IN CONST MEMORY_MAP_TRACE_RECORD  *Record
+  )
+{
+  printf (
+    "%u\t%s\t%s",
+    (unsigned)Record->Sequence,
+    mStageNames[Record->Stage],
+    mKindNames[Record->Kind]
+    );
+
+  switch (Record->Kind) {
+    case MEMORY_MAP_TRACE_RECORD_CALL:
+    case MEMORY_MAP_TRACE_RECORD_OVERFLOW:
+      printf ("\t%llu descriptors\n", (unsigned long long)Record->NumberOfPages);
+      break;
+
+    default:
+      printf (
+        "\t%s\t%016llx\t%llu\t%016llx",
+        TraceTypeName (Record->Type),
+        (unsigned long long)Record->PhysicalStart,
+        (unsigned long long)Record->NumberOfPages,
+        (unsigned long long)Record->Attribute
+        );
+
+      if (Record->Kind == MEMORY_MAP_TRACE_RECORD_RETYPED) {
+        printf (
+          "\t%s\t%016llx",
+          TraceTypeName (Record->OldType),
+          (unsigned long long)Record->OldAttribute
+          );
+      }
+
+      printf ("\n");
+      break;
+  }
+}
+
+int
+main (
+  int   argc,
+  char  *argv[]
+  )
+{
+  MEMORY_MAP_TRACE_HEADER       *Trace;
+  CONST MEMORY_MAP_TRACE_RECORD *Records;
+  CONST MEMORY_MAP_TRACE_RECORD *Record;
+  BOOLEAN                       Summary;
+  UINT64                        First;
+  UINT64                        Index;
+  UINT64                        Counts[MEMORY_MAP_TRACE_STAGE_MAXIMUM][TRACE_NUMBER_OF_KINDS];
+  UINTN                         Stage;
+  UINTN                         Kind;
+
+  Summary = FALSE;
+
+  if ((argc == 3) && (strcmp (argv[1], "-s") == 0)) {
+    Summary = TRUE;
+  } else if (argc != 2) {
+    fprintf (stderr, "Usage: %s [-s] <trace file>\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  Trace = TraceReadFile (argv[argc - 1]);
+
+  if (Trace == NULL) {
+    return EXIT_FAILURE;
+  }
+
+  Records = (CONST MEMORY_MAP_TRACE_RECORD *)(Trace + 1);
+  First   = 0;
+
+  if (Trace->NumberOfWrittenRecords > Trace->NumberOfRecords) {
+    First = (Trace->NumberOfWrittenRecords - Trace->NumberOfRecords);
+
+    printf ("# %llu oldest records have been overwritten\n", (unsigned long long)First);
+  }
+
+  memset (Counts, 0, sizeof (Counts));
+
+  for (Index = First; Index < Trace->NumberOfWrittenRecords; ++Index) {
+    Record = &Records[Index % Trace->NumberOfRecords];
+
+    if ((Record->Stage >= MEMORY_MAP_TRACE_STAGE_MAXIMUM)
+     || (Record->Kind >= TRACE_NUMBER_OF_KINDS)) {
+      fprintf (stderr, "record %llu: malformed\n", (unsigned long long)Index);
+      continue;
+    }
+
+    ++Counts[Record->Stage][Record->Kind];
+
+    if (!Summary) {
+      TracePrintRecord (Record);
+    }
+  }
+
+  if (Summary) {
+    for (Stage = 0; Stage < MEMORY_MAP_TRACE_STAGE_MAXIMUM; ++Stage) {
+      printf ("%s", mStageNames[Stage]);
+
+      for (Kind = 0; Kind < TRACE_NUMBER_OF_KINDS; ++Kind) {
+        printf (
+          "\t%s=%llu",
+          mKindNames[Kind],
+          (unsigned long long)Counts[Stage][Kind]
+          );
+      }
+
+      printf ("\n");
+    }
+  }
+
+  free (Trace);
+
+  return EXIT_SUCCESS;
+}